@@ -0,0 +1,105 @@
+///
+/// @file AllocationCounter.cpp
+///
+/// @brief Replaces the global operator new and delete with counting ones.
+/// Every block carries its size in a small header in front of it, so that
+/// the bytes still allocated can be reported too.
+///
+#include "AllocationCounter.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+namespace
+{
+    std::atomic<uint64_t> allocations(0);
+    std::atomic<int64_t> liveBytes(0);
+    int failures = 0;
+
+    // Big enough for the size and to keep the usual 16 bytes alignment.
+    constexpr std::size_t headerSize = 16;
+
+    void *Allocate(std::size_t size, std::size_t alignment)
+    {
+        std::size_t header = alignment > headerSize ? alignment : headerSize;
+        std::size_t total = (header + size + alignment - 1) / alignment * alignment;
+        char *block = static_cast<char *>(std::aligned_alloc(alignment, total));
+        if (block == nullptr)
+            throw std::bad_alloc();
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        liveBytes.fetch_add(size, std::memory_order_relaxed);
+        char *p = block + header;
+        reinterpret_cast<std::size_t *>(p)[-1] = size;
+        reinterpret_cast<std::size_t *>(p)[-2] = header;
+        return p;
+    }
+
+    void Deallocate(void *p)
+    {
+        if (p == nullptr)
+            return;
+        std::size_t size = static_cast<std::size_t *>(p)[-1];
+        std::size_t header = static_cast<std::size_t *>(p)[-2];
+        liveBytes.fetch_sub(size, std::memory_order_relaxed);
+        std::free(static_cast<char *>(p) - header);
+    }
+}
+
+uint64_t AllocationCount()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+int64_t LiveBytes()
+{
+    return liveBytes.load(std::memory_order_relaxed);
+}
+
+void ExpectAllocations(benchmark::State &state, uint64_t start, double maxPerIteration)
+{
+    uint64_t made = AllocationCount() - start;
+    ReportAllocations(state, start);
+    if (made <= maxPerIteration * state.iterations() + 1)
+        return;
+    failures++;
+    std::string message = std::to_string(made) + " allocations in " + std::to_string(state.iterations())
+                        + " iterations, at most " + std::to_string(maxPerIteration) + " per iteration expected";
+    state.SkipWithError(message.c_str());
+}
+
+int AllocationFailures()
+{
+    return failures;
+}
+
+void *operator new(std::size_t size)
+{
+    return Allocate(size, alignof(std::max_align_t));
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    return Allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void *p) noexcept
+{
+    Deallocate(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    Deallocate(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    Deallocate(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept
+{
+    Deallocate(p);
+}
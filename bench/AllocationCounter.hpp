@@ -0,0 +1,44 @@
+///
+/// @file AllocationCounter.hpp
+///
+/// @brief Counts the heap allocations made by the benchmark binary, so that
+/// the benchmarks can report how many allocations an operation makes and
+/// how much memory a structure holds, and fail when a path which shall not
+/// allocate does.
+///
+#ifndef ALLOCATION_COUNTER_HPP
+#define ALLOCATION_COUNTER_HPP
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+
+// Number of calls to operator new since the start of the program.
+uint64_t AllocationCount();
+
+// Number of bytes allocated with operator new and not deleted yet.
+int64_t LiveBytes();
+
+///
+/// @brief Reports the allocations made since @p start as an average per
+/// iteration, in the "allocs" counter.
+///
+inline void ReportAllocations(benchmark::State &state, uint64_t start)
+{
+    state.counters["allocs"] = benchmark::Counter(AllocationCount() - start,
+                                                  benchmark::Counter::kAvgIterations);
+}
+
+///
+/// @brief Reports the allocations made since @p start like
+/// ReportAllocations, and fails the benchmark if there were more than
+/// @p maxPerIteration per iteration. One allocation per run is let
+/// through, for the structures kept across the iterations which grow now
+/// and then. smartpot_bench exits with 1 once a benchmark failed.
+///
+void ExpectAllocations(benchmark::State &state, uint64_t start, double maxPerIteration);
+
+// Number of benchmark runs which failed ExpectAllocations.
+int AllocationFailures();
+
+#endif
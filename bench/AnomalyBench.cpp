@@ -0,0 +1,122 @@
+///
+/// @file AnomalyBench.cpp
+///
+/// @brief Micro-benchmarks for the @b AnomalyDetector: a reading checked on
+/// its own, and readings of a whole fleet applied with their anomalies
+/// taken as the endpoint does.
+///
+#include "AnomalyDetector.hpp"
+#include "Fleet.hpp"
+#include "AllocationCounter.hpp"
+#include "BenchPots.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace pot;
+
+namespace
+{
+    const int64_t start = 4000000000;
+
+    ///
+    /// @brief Readings of a soil humidity sampled every minute: drying
+    /// slowly with some noise, with a spike one reading in a thousand and
+    /// a probe drifting away for good after two thirds of the trace.
+    ///
+    vector<double> MakeTrace(size_t count, uint64_t seed)
+    {
+        mt19937_64 random(seed);
+        normal_distribution<double> noise(0, 0.2);
+        vector<double> values;
+        double humidity = 40 + (double) (random() % 30);
+        for (size_t i = 0; i < count; ++i)
+        {
+            humidity -= 0.01;
+            if (humidity < 30)
+                humidity = 65;
+            double value = humidity + noise(random);
+            if (i > count * 2 / 3)
+                value += (double) (i - count * 2 / 3) * 0.05;
+            if (random() % 1000 == 0)
+                value += 20;
+            values.push_back(value);
+        }
+        return values;
+    }
+}
+
+// A reading checked by the detector alone.
+static void BM_AnomalyUpdate(benchmark::State &state)
+{
+    vector<double> trace = MakeTrace(10000, 1);
+    AnomalyDetector detector;
+    size_t i = 0;
+    int64_t time = start;
+    uint64_t anomalies = 0;
+    for (auto _ : state)
+    {
+        anomalies += detector.Update(trace[i], time, 20, 80) != AnomalyDetector::none;
+        time += 60;
+        if (++i == trace.size())
+            i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["anomalies_per_reading"] = (double) anomalies / state.iterations();
+}
+BENCHMARK(BM_AnomalyUpdate);
+
+///
+/// @brief A reading of every pot in turn through Fleet::SetValue, as MQTT
+/// applies them, with the anomalies taken every 1000 readings. Compare with
+/// BM_FleetSet for the cost of the detection.
+///
+static void BM_FleetIngestAnomalies(benchmark::State &state)
+{
+    int potCount = state.range(0);
+    Fleet fleet;
+    for (int i = 0; i < potCount; ++i)
+    {
+        // The soil humidity thresholds around the readings of the traces.
+        SmartPot pot = MakeBenchPot(i);
+        pot.Set("soilHumidity", Sensor("soilHumidity", 50, 20, 80));
+        fleet.Add(i, move(pot));
+    }
+    vector<double> trace = MakeTrace(4096, 2);
+
+    vector<Fleet::Anomaly> anomalies;
+    uint64_t published = 0;
+    int potId = 0;
+    size_t reading = 0;
+    size_t applied = 0;
+    int64_t now = start;
+    uint64_t allocations = AllocationCount();
+    for (auto _ : state)
+    {
+        // Every pot of the fleet reads a minute after the previous round,
+        // the pots do not all read the same value.
+        benchmark::DoNotOptimize(fleet.SetValue(potId, "soilHumidity",
+                                                trace[(reading + potId) % trace.size()]));
+        if (++potId == potCount)
+        {
+            potId = 0;
+            reading++;
+            now += 60;
+            fleet.ExpireStale(now);
+        }
+        if (++applied % 1000 == 0)
+        {
+            fleet.TakeAnomalies(anomalies);
+            published += anomalies.size();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["anomalies_per_reading"] = (double) published / state.iterations();
+    ReportAllocations(state, allocations);
+}
+BENCHMARK(BM_FleetIngestAnomalies)->Arg(100)->Arg(10000)->Arg(100000);
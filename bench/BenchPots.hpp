@@ -0,0 +1,46 @@
+///
+/// @file BenchPots.hpp
+///
+/// @brief The pots the benchmarks are run on.
+///
+#ifndef BENCH_POTS_HPP
+#define BENCH_POTS_HPP
+
+#include "SmartPot.hpp"
+
+#include <string>
+
+///
+/// @brief Builds pot number @p i with the sensors of the default pot (as
+/// the SmartPotEndpoint constructor does), their values spread over their
+/// ranges and the plant types taken in turn, plus @p extraSensors synthetic
+/// sensors spread over the three sensor groups so that we can see how the
+/// lookups scale.
+///
+inline pot::SmartPot MakeBenchPot(int i = 0, int extraSensors = 0)
+{
+    using namespace pot;
+    static const char *plantTypes[] = {"Desert", "Tropical", "Aquatic", "Alpine"};
+
+    SensorGroups sensors;
+    sensors[3]["soilHumidity"] = Sensor("soilHumidity", i % 10, 3, 6);
+    sensors[3]["soilType"] = Sensor("soilType", "Red", 3, 3);
+    sensors[3]["soilPh"] = Sensor("soilPh", 4 + i % 5, 5, 8);
+    sensors[2]["temperature"] = Sensor("temperature", 15 + i % 20, 18, 30);
+    sensors[2]["luminosity"] = Sensor("luminosity", i % 8, 4, 5);
+    sensors[2]["humidity"] = Sensor("humidity", 30 + i % 50, 40, 70);
+    sensors[1]["phosphorus"] = Sensor("phosphorus", 1, 2, 3);
+    sensors[1]["nitrogen"] = Sensor("nitrogen", 1, 2, 3);
+    sensors[1]["potassium"] = Sensor("potassium", 1, 2, 3);
+
+    for (int extra = 0; extra < extraSensors; ++extra)
+    {
+        std::string name = "extra" + std::to_string(extra);
+        sensors[1 + extra % 3][name] = Sensor(name, extra, 0, extraSensors);
+    }
+
+    Plant p("Cactus", "Green", 1.3, plantTypes[i % 4], "Red");
+    return SmartPot(p, sensors);
+}
+
+#endif
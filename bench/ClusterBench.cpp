@@ -0,0 +1,79 @@
+///
+/// @file ClusterBench.cpp
+///
+/// @brief Micro-benchmarks for the @b HashRing: finding the owner of a pot,
+/// which every forwarded request and MQTT message of a cluster does, and
+/// the share of the pots moving when an instance joins.
+///
+#include "Cluster.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace pot;
+
+namespace
+{
+    HashRing MakeRing(int nodes, int virtualNodes = HashRing::defaultVirtualNodes)
+    {
+        HashRing ring(virtualNodes);
+        for (int i = 0; i < nodes; ++i)
+            ring.Add("127.0.0.1:" + to_string(9080 + i));
+        return ring;
+    }
+}
+
+// The owner of every pot in turn, with state.range(0) instances.
+static void BM_HashRingOwner(benchmark::State &state)
+{
+    HashRing ring = MakeRing((int) state.range(0));
+    int potId = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(ring.OwnerIndex(potId));
+        potId++;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_HashRingOwner)->Arg(2)->Arg(8)->Arg(64);
+
+///
+/// @brief Adds an instance to a ring of state.range(0) and reports the
+/// share of 1M pots moving (ideally 1 / (instances + 1), all of them to the
+/// new instance) and the most any instance owns over the average.
+///
+static void BM_HashRingJoin(benchmark::State &state)
+{
+    const int potCount = 1000000;
+    int nodes = (int) state.range(0);
+    vector<int> before(potCount);
+    HashRing ring = MakeRing(nodes);
+    for (int potId = 0; potId < potCount; ++potId)
+        before[potId] = ring.OwnerIndex(potId);
+
+    double moved = 0;
+    double imbalance = 0;
+    for (auto _ : state)
+    {
+        HashRing joined = MakeRing(nodes + 1);
+        vector<int> owned(nodes + 1);
+        int movedCount = 0;
+        for (int potId = 0; potId < potCount; ++potId)
+        {
+            int owner = joined.OwnerIndex(potId);
+            owned[owner]++;
+            movedCount += owner != before[potId];
+        }
+        moved = (double) movedCount / potCount;
+        int most = 0;
+        for (int count : owned)
+            most = max(most, count);
+        imbalance = (double) most * (nodes + 1) / potCount;
+    }
+    state.counters["moved"] = moved;
+    state.counters["max_over_mean"] = imbalance;
+}
+BENCHMARK(BM_HashRingJoin)->Arg(3)->Arg(7)->Unit(benchmark::kMillisecond);
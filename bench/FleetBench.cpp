@@ -0,0 +1,355 @@
+///
+/// @file FleetBench.cpp
+///
+/// @brief Micro-benchmarks for the fleet-wide structures kept by @b Fleet.
+///
+#include "Fleet.hpp"
+#include "FleetQuery.hpp"
+#include "PotConfig.hpp"
+#include "PotListing.hpp"
+#include "Snapshot.hpp"
+#include "AllocationCounter.hpp"
+#include "BenchPots.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <map>
+#include <string>
+
+using namespace std;
+using namespace pot;
+
+namespace
+{
+    Fleet MakeFleet(int potCount)
+    {
+        Fleet fleet;
+        for (int i = 0; i < potCount; ++i)
+            fleet.Add(i, MakeBenchPot(i));
+        return fleet;
+    }
+
+    // The layout before the pot pool: every pot and every sensor in its
+    // own heap node.
+    map<int, SmartPot> MakeNodeFleet(int potCount)
+    {
+        map<int, SmartPot> pots;
+        for (int i = 0; i < potCount; ++i)
+            pots.emplace(i, MakeBenchPot(i));
+        return pots;
+    }
+
+    // The fleet-wide scan both layouts are compared with.
+    double ScanSoilHumidity(int potId, const SmartPot &pot, double sum)
+    {
+        const Sensor *soilHumidity = pot.FindSensor("soilHumidity");
+        return soilHumidity == nullptr ? sum : sum + soilHumidity->GetDoubleValue();
+    }
+
+    void PotCounts(benchmark::internal::Benchmark *b)
+    {
+        b->Arg(100)->Arg(10000)->Arg(100000);
+    }
+}
+
+// A reading applied through the fleet, which keeps the aggregates in sync.
+static void BM_FleetSet(benchmark::State &state)
+{
+    int potCount = state.range(0);
+    Fleet fleet = MakeFleet(potCount);
+    int potId = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(fleet.SetValue(potId, "soilHumidity", potId % 10));
+        potId = (potId + 7919) % potCount;
+    }
+}
+BENCHMARK(BM_FleetSet)->Apply(PotCounts);
+
+// What GET /fleet/aggregates reads for one sensor kind.
+static void BM_FleetAggregatesQuery(benchmark::State &state)
+{
+    Fleet fleet = MakeFleet(state.range(0));
+    for (auto _ : state)
+    {
+        const SensorAggregate &aggregate = fleet.Aggregates().ByPlantType().at("Desert").at("soilPh");
+        benchmark::DoNotOptimize(aggregate.GetMean());
+        benchmark::DoNotOptimize(aggregate.GetOutOfRange());
+        benchmark::DoNotOptimize(aggregate.GetMin());
+        benchmark::DoNotOptimize(aggregate.GetMax());
+        benchmark::DoNotOptimize(aggregate.GetPercentile(0.5));
+        benchmark::DoNotOptimize(aggregate.GetPercentile(0.99));
+    }
+}
+BENCHMARK(BM_FleetAggregatesQuery)->Apply(PotCounts);
+
+// Memory held per pot by the slab storage of Fleet (without the aggregates
+// and the indexes, which are the same for any storage).
+static void BM_PotPoolMemory(benchmark::State &state)
+{
+    int potCount = state.range(0);
+    int64_t bytes = 0;
+    for (auto _ : state)
+    {
+        int64_t before = LiveBytes();
+        PotPool pool;
+        for (int i = 0; i < potCount; ++i)
+            pool.Insert(i, MakeBenchPot(i));
+        bytes = LiveBytes() - before;
+    }
+    state.counters["bytesPerPot"] = (double)bytes / potCount;
+}
+BENCHMARK(BM_PotPoolMemory)->Arg(100000)->Unit(benchmark::kMillisecond)->Iterations(1);
+
+static void BM_NodeMapMemory(benchmark::State &state)
+{
+    int potCount = state.range(0);
+    int64_t bytes = 0;
+    for (auto _ : state)
+    {
+        int64_t before = LiveBytes();
+        map<int, SmartPot> pots = MakeNodeFleet(potCount);
+        bytes = LiveBytes() - before;
+    }
+    state.counters["bytesPerPot"] = (double)bytes / potCount;
+}
+BENCHMARK(BM_NodeMapMemory)->Arg(100000)->Unit(benchmark::kMillisecond)->Iterations(1);
+
+static void BM_FleetScan(benchmark::State &state)
+{
+    Fleet fleet = MakeFleet(state.range(0));
+    for (auto _ : state)
+    {
+        double sum = 0;
+        fleet.ForEach([&sum](int potId, const SmartPot &pot)
+        {
+            sum = ScanSoilHumidity(potId, pot, sum);
+        });
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FleetScan)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+static void BM_NodeMapScan(benchmark::State &state)
+{
+    map<int, SmartPot> pots = MakeNodeFleet(state.range(0));
+    for (auto _ : state)
+    {
+        double sum = 0;
+        for (auto &pot : pots)
+            sum = ScanSoilHumidity(pot.first, pot.second, sum);
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_NodeMapScan)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+// GET /snapshot followed by PUT /snapshot into an empty fleet, fed in the
+// same 64KB pieces as the endpoint does.
+static void BM_SnapshotRoundTrip(benchmark::State &state)
+{
+    int potCount = state.range(0);
+    Fleet fleet = MakeFleet(potCount);
+    size_t bytes = 0;
+    for (auto _ : state)
+    {
+        string snapshot;
+        Snapshot::WriteHeader(snapshot);
+        uint64_t written = 0;
+        fleet.ForEachFrom(0, potCount, [&snapshot, &written](int potId, const SmartPot &pot)
+        {
+            Snapshot::WritePot(snapshot, potId, pot);
+            written++;
+        });
+        Snapshot::WriteEnd(snapshot, written);
+        bytes = snapshot.size();
+
+        Fleet loaded;
+        SnapshotReader reader;
+        for (size_t offset = 0; offset < snapshot.size(); offset += 64 * 1024)
+        {
+            reader.Feed(snapshot.data() + offset, min<size_t>(64 * 1024, snapshot.size() - offset),
+                        [&loaded](int potId, SmartPot pot) { loaded.Put(potId, move(pot)); });
+        }
+        if (!reader.Done() || loaded.Size() != fleet.Size())
+            state.SkipWithError("snapshot round trip lost pots");
+    }
+    state.counters["bytesPerPot"] = (double)bytes / potCount;
+}
+BENCHMARK(BM_SnapshotRoundTrip)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+///
+/// @brief GET /pots over the whole fleet in one page, encoded in the same
+/// chunks as the endpoint does, with the coding given by state.range(1)
+/// (identity, gzip, deflate). Reports the size of the response and the time
+/// until its first chunk is ready.
+///
+static void PotListingBench(benchmark::State &state, const char *fields)
+{
+    int potCount = state.range(0);
+    Fleet fleet = MakeFleet(potCount);
+    ChunkCompressor::Encoding encoding = (ChunkCompressor::Encoding) state.range(1);
+    size_t bytes = 0;
+    double firstChunkUs = 0;
+    for (auto _ : state)
+    {
+        auto start = chrono::steady_clock::now();
+        PotListing listing(0, potCount, fields, encoding);
+        string chunk;
+        bytes = 0;
+        bool more = true;
+        bool first = true;
+        while (more)
+        {
+            more = listing.Next(fleet, 256, chunk);
+            if (first)
+            {
+                firstChunkUs += chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+                first = false;
+            }
+            bytes += chunk.size();
+            chunk.clear();
+        }
+    }
+    state.counters["bytes"] = (double)bytes;
+    state.counters["firstChunkUs"] = firstChunkUs / state.iterations();
+}
+
+static void BM_PotListing(benchmark::State &state)
+{
+    PotListingBench(state, "");
+}
+BENCHMARK(BM_PotListing)
+    ->Args({50000, ChunkCompressor::identity})
+    ->Args({50000, ChunkCompressor::gzip})
+    ->Args({50000, ChunkCompressor::deflate})
+    ->Unit(benchmark::kMillisecond);
+
+// The same listing restricted with ?fields=soilHumidity,temperature.
+static void BM_PotListingFields(benchmark::State &state)
+{
+    PotListingBench(state, "soilHumidity,temperature");
+}
+BENCHMARK(BM_PotListingFields)
+    ->Args({50000, ChunkCompressor::identity})
+    ->Args({50000, ChunkCompressor::gzip})
+    ->Unit(benchmark::kMillisecond);
+
+// Startup with a configuration of state.range(0) pots: loading the
+// configuration and declaring its pots, up to the fleet being ready.
+static void BM_LoadPotConfig(benchmark::State &state)
+{
+    int potCount = (int)state.range(0);
+    string text = R"({"plants": {"cactus": {"species": "Cactus", "color": "Green", "height": 1.3,
+                                            "type": "Desert", "suitableSoilType": "Red"}},
+                      "sensorSets": {"desert": {
+                          "2": {"temperature": {"value": 25, "min": 18, "max": 35}},
+                          "3": {"soilHumidity": {"value": 20, "min": 10, "max": 30},
+                                "soilType": {"value": "Red", "min": 0, "max": 0}}}},
+                      "pots": [)";
+    for (int i = 0; i < potCount; ++i)
+    {
+        text += i == 0 ? "" : ",";
+        text += R"({"id": )" + to_string(i) + R"(, "plant": "cactus", "sensorSet": "desert")";
+        // Every tenth pot has thresholds of its own.
+        text += i % 10 == 0 ? R"(, "thresholds": {"temperature": {"min": 15, "max": 30}}})" : "}";
+    }
+    text += "]}";
+
+    for (auto _ : state)
+    {
+        PotConfig config;
+        config.LoadJson(text);
+        Fleet fleet;
+        fleet.SetHydrator([&config](int potId) { return config.Build(potId); });
+        for (int potId : config.PotIds())
+            fleet.Declare(potId);
+        benchmark::DoNotOptimize(fleet.Size());
+    }
+    state.counters["bytes"] = (double)text.size();
+}
+BENCHMARK(BM_LoadPotConfig)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+// Building declared pots, as the first reads and the scheduler thread do.
+static void BM_HydratePots(benchmark::State &state)
+{
+    PotConfig config;
+    config.LoadJson(R"({"plants": {"cactus": {"species": "Cactus", "color": "Green", "height": 1.3,
+                                              "type": "Desert", "suitableSoilType": "Red"}},
+                        "sensorSets": {"desert": {
+                            "2": {"temperature": {"value": 25, "min": 18, "max": 35}},
+                            "3": {"soilHumidity": {"value": 20, "min": 10, "max": 30},
+                                  "soilType": {"value": "Red", "min": 0, "max": 0}}}},
+                        "pots": [{"id": 0, "plant": "cactus", "sensorSet": "desert"}]})");
+    size_t batch = (size_t)state.range(0);
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        Fleet fleet;
+        fleet.SetHydrator([&config](int) { return config.Build(0); });
+        for (size_t potId = 0; potId < batch; ++potId)
+            fleet.Declare((int)potId);
+        state.ResumeTiming();
+        fleet.HydrateSome(batch);
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK(BM_HydratePots)->Arg(4096)->Unit(benchmark::kMillisecond);
+
+// GET /fleet/query: "soilHumidity < min and plant.type == 'Desert' and
+// luminosity >= 4" compiled once and run over the columns of the fleet.
+static void BM_FleetQuery(benchmark::State &state)
+{
+    Fleet fleet = MakeFleet(state.range(0));
+    string error;
+    shared_ptr<const FleetQuery> query =
+        FleetQuery::Compile("soilHumidity < min and plant.type == 'Desert' and luminosity >= 4", error);
+    size_t matches = 0;
+    for (auto _ : state)
+    {
+        matches = query->Run(fleet.Columns(), [](int potId) { benchmark::DoNotOptimize(potId); });
+    }
+    state.counters["matches"] = (double)matches;
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FleetQuery)->Apply(PotCounts);
+
+// The same selection written by hand over the SmartPot objects, as the
+// endpoint code of SoilStatus does.
+static void BM_FleetQueryHandWritten(benchmark::State &state)
+{
+    Fleet fleet = MakeFleet(state.range(0));
+    size_t matches = 0;
+    for (auto _ : state)
+    {
+        matches = 0;
+        fleet.ForEach([&matches](int potId, const SmartPot &pot)
+        {
+            const Sensor *soilHumidity = pot.FindSensor("soilHumidity");
+            const Sensor *luminosity = pot.FindSensor("luminosity");
+            if (soilHumidity != nullptr && luminosity != nullptr
+                && soilHumidity->GetDoubleValue() < soilHumidity->GetMinValue()
+                && pot.GetPlant().GetType() == "Desert"
+                && luminosity->GetDoubleValue() >= 4)
+            {
+                matches++;
+                benchmark::DoNotOptimize(potId);
+            }
+        });
+    }
+    state.counters["matches"] = (double)matches;
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FleetQueryHandWritten)->Apply(PotCounts);
+
+// Compiling a query, what the cache saves.
+static void BM_FleetQueryCompile(benchmark::State &state)
+{
+    string error;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(FleetQuery::Compile(
+            "soilHumidity < min and plant.type == 'Desert' and luminosity >= 4", error));
+}
+BENCHMARK(BM_FleetQueryCompile);
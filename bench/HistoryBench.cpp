@@ -0,0 +1,173 @@
+///
+/// @file HistoryBench.cpp
+///
+/// @brief Micro-benchmarks for the @b SensorHistory: the bytes a sample of
+/// realistic soil and temperature traces takes, and how fast range queries
+/// and aggregations decode them.
+///
+#include "SensorHistory.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace pot;
+
+namespace
+{
+    const int64_t start = 1700000000;
+    const int64_t day = 86400;
+    const size_t tracePots = 1000;
+
+    ///
+    /// @brief A day of readings of a sensor sampling every minute, with a
+    /// second of jitter now and then: a temperature (trace 0) following the
+    /// day with some noise, to 0.1 degree, or a soil humidity (trace 1)
+    /// drying slowly and jumping up when irrigated, to 0.5 percent.
+    ///
+    vector<SensorHistory::Sample> MakeTrace(int trace, uint64_t seed)
+    {
+        mt19937_64 random(seed);
+        normal_distribution<double> noise(0, 0.05);
+        vector<SensorHistory::Sample> samples;
+        int64_t time = start + (int64_t) (random() % 60);
+        double humidity = 40 + (double) (random() % 30);
+        while (time < start + day)
+        {
+            double value;
+            if (trace == 0)
+            {
+                double hour = (double) ((time - start) % day) / 3600;
+                value = 21 + 4 * sin((hour - 9) * M_PI / 12) + noise(random);
+                value = round(value * 10) / 10;
+            }
+            else
+            {
+                humidity -= 0.01;
+                if (humidity < 30)
+                    humidity = 65;
+                value = round(humidity * 2) / 2;
+            }
+            samples.push_back({time, value});
+            time += 60;
+            if (random() % 10 == 0)
+                time += random() % 2 == 0 ? 1 : -1;
+        }
+        return samples;
+    }
+
+    // A day of readings of trace state.range(0) for every pot.
+    SensorHistory MakeHistory(int trace)
+    {
+        SensorHistory history(7 * day);
+        for (size_t potId = 0; potId < tracePots; ++potId)
+        {
+            for (const SensorHistory::Sample &sample : MakeTrace(trace, potId))
+                history.Append((int) potId, "sensor", sample.time, sample.value);
+        }
+        return history;
+    }
+}
+
+///
+/// @brief Appends a day of readings of trace state.range(0) for 1000 pots,
+/// and reports the bytes per sample (16 uncompressed).
+///
+static void BM_HistoryAppend(benchmark::State &state)
+{
+    vector<vector<SensorHistory::Sample>> traces;
+    for (size_t potId = 0; potId < tracePots; ++potId)
+        traces.push_back(MakeTrace((int) state.range(0), potId));
+
+    double bytesPerSample = 0;
+    size_t samples = 0;
+    for (auto _ : state)
+    {
+        SensorHistory history(7 * day);
+        for (size_t potId = 0; potId < traces.size(); ++potId)
+        {
+            for (const SensorHistory::Sample &sample : traces[potId])
+                history.Append((int) potId, "sensor", sample.time, sample.value);
+        }
+        bytesPerSample = (double) history.Bytes() / history.Samples();
+        samples = history.Samples();
+        benchmark::DoNotOptimize(history.Bytes());
+    }
+    state.SetItemsProcessed(state.iterations() * samples);
+    state.counters["bytes_per_sample"] = bytesPerSample;
+}
+BENCHMARK(BM_HistoryAppend)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+///
+/// @brief Reads back the whole day of one pot, the items are the samples
+/// decoded.
+///
+static void BM_HistoryRange(benchmark::State &state)
+{
+    SensorHistory history = MakeHistory((int) state.range(0));
+
+    vector<SensorHistory::Sample> samples;
+    int potId = 0;
+    size_t decoded = 0;
+    for (auto _ : state)
+    {
+        samples.clear();
+        history.Range(potId, "sensor", start, start + day, SIZE_MAX, samples);
+        decoded += samples.size();
+        potId = (potId + 1) % tracePots;
+    }
+    state.SetItemsProcessed(decoded);
+}
+BENCHMARK(BM_HistoryRange)->Arg(0)->Arg(1);
+
+// The same day of samples kept uncompressed.
+static void BM_HistoryRangeUncompressed(benchmark::State &state)
+{
+    vector<vector<SensorHistory::Sample>> traces;
+    for (size_t potId = 0; potId < tracePots; ++potId)
+        traces.push_back(MakeTrace((int) state.range(0), potId));
+
+    vector<SensorHistory::Sample> samples;
+    size_t potId = 0;
+    size_t decoded = 0;
+    for (auto _ : state)
+    {
+        samples.clear();
+        for (const SensorHistory::Sample &sample : traces[potId])
+        {
+            if (sample.time >= start && sample.time <= start + day)
+                samples.push_back(sample);
+        }
+        decoded += samples.size();
+        potId = (potId + 1) % tracePots;
+    }
+    state.SetItemsProcessed(decoded);
+}
+BENCHMARK(BM_HistoryRangeUncompressed)->Arg(0)->Arg(1);
+
+///
+/// @brief Aggregates the whole day of one pot in hourly buckets, the items
+/// are the samples decoded.
+///
+static void BM_HistoryAggregate(benchmark::State &state)
+{
+    SensorHistory history = MakeHistory((int) state.range(0));
+
+    vector<SensorHistory::Bucket> buckets;
+    int potId = 0;
+    size_t decoded = 0;
+    for (auto _ : state)
+    {
+        buckets.clear();
+        history.Aggregate(potId, "sensor", start, start + day, 3600, buckets);
+        for (const SensorHistory::Bucket &bucket : buckets)
+            decoded += bucket.count;
+        potId = (potId + 1) % tracePots;
+    }
+    state.SetItemsProcessed(decoded);
+}
+BENCHMARK(BM_HistoryAggregate)->Arg(0)->Arg(1);
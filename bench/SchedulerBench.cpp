@@ -0,0 +1,100 @@
+///
+/// @file SchedulerBench.cpp
+///
+/// @brief Micro-benchmarks for the @b TimingWheel holding the scheduled
+/// jobs, against an ordered multimap of expiry times.
+///
+#include "TimingWheel.hpp"
+#include "AllocationCounter.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace pot;
+
+namespace
+{
+    const uint64_t start = 1700000000;
+    const uint64_t day = 86400;
+
+    // Expiry times spread over the next day, like a fleet of daily jobs.
+    vector<uint64_t> MakeExpiries(size_t timerCount)
+    {
+        mt19937_64 random(42);
+        vector<uint64_t> expiries(timerCount);
+        for (uint64_t &expires : expiries)
+            expires = start + 1 + random() % day;
+        return expiries;
+    }
+}
+
+///
+/// @brief Inserts and cancels one timer in a wheel holding state.range(0)
+/// timers.
+///
+static void BM_TimingWheelInsertCancel(benchmark::State &state)
+{
+    vector<uint64_t> expiries = MakeExpiries(state.range(0));
+    TimingWheel wheel(start);
+    for (size_t i = 0; i < expiries.size(); ++i)
+        wheel.Insert(expiries[i], i);
+
+    size_t i = 0;
+    uint64_t allocs = AllocationCount();
+    for (auto _ : state)
+    {
+        TimingWheel::Handle handle = wheel.Insert(expiries[i++ % expiries.size()], 0);
+        benchmark::DoNotOptimize(wheel.Cancel(handle));
+    }
+    ReportAllocations(state, allocs);
+}
+BENCHMARK(BM_TimingWheelInsertCancel)->Arg(1000)->Arg(1000000);
+
+static void BM_MultimapInsertCancel(benchmark::State &state)
+{
+    vector<uint64_t> expiries = MakeExpiries(state.range(0));
+    multimap<uint64_t, uint64_t> timers;
+    for (size_t i = 0; i < expiries.size(); ++i)
+        timers.emplace(expiries[i], i);
+
+    size_t i = 0;
+    uint64_t allocs = AllocationCount();
+    for (auto _ : state)
+    {
+        auto it = timers.emplace(expiries[i++ % expiries.size()], 0);
+        timers.erase(it);
+    }
+    ReportAllocations(state, allocs);
+}
+BENCHMARK(BM_MultimapInsertCancel)->Arg(1000)->Arg(1000000);
+
+///
+/// @brief Advances a wheel holding state.range(0) timers by a whole day,
+/// one second at a time, expiring all of them.
+///
+static void BM_TimingWheelDay(benchmark::State &state)
+{
+    vector<uint64_t> expiries = MakeExpiries(state.range(0));
+    vector<uint64_t> expired;
+    expired.reserve(expiries.size());
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        TimingWheel wheel(start);
+        for (size_t i = 0; i < expiries.size(); ++i)
+            wheel.Insert(expiries[i], i);
+        expired.clear();
+        state.ResumeTiming();
+
+        for (uint64_t now = start + 1; now <= start + day; ++now)
+            wheel.Advance(now, expired);
+        benchmark::DoNotOptimize(expired.data());
+    }
+    state.SetItemsProcessed(state.iterations() * expiries.size());
+}
+BENCHMARK(BM_TimingWheelDay)->Arg(1000000)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,155 @@
+///
+/// @file TierBench.cpp
+///
+/// @brief A fleet of pots of the default configuration kept under a memory
+/// budget, the other pots in its cold store, read by a skewed (Zipf)
+/// access pattern: the share of the reads finding their pot in memory,
+/// the time to read a cold pot back, and the memory of the process.
+///
+#include "Fleet.hpp"
+#include "PotConfig.hpp"
+#include "AllocationCounter.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace pot;
+
+namespace
+{
+    const int64_t startTime = 1700000000;
+    // The readings applied between two ticks of the server, which evict
+    // the pots over the budget.
+    const int readingsPerTick = 2000;
+    const int readings = 1000000;
+    // The skew of YCSB: the top 1% of the pots get about 60% of the reads.
+    const double zipfExponent = 0.99;
+
+    ///
+    /// @brief The rank, from 0, of a Zipf draw over @p count items for the
+    /// uniform draw @p u, inverting the continuous approximation of the
+    /// distribution.
+    ///
+    size_t ZipfRank(double u, double count)
+    {
+        double a = 1 - zipfExponent;
+        double rank = pow(1 + u * (pow(count, a) - 1), 1 / a) - 1;
+        return (size_t) min(max(rank, 0.0), count - 1);
+    }
+
+    // The pot of a rank, the popular pots spread over the slabs.
+    int PotOfRank(size_t rank, int potCount)
+    {
+        return (int) ((rank * 2654435761ULL) % (uint64_t) potCount);
+    }
+
+    // A field of /proc/self/status in megabytes, 0 if there is none.
+    double StatusMegabytes(const char *field)
+    {
+        ifstream status("/proc/self/status");
+        string line;
+        size_t length = strlen(field);
+        while (getline(status, line))
+        {
+            if (line.compare(0, length, field) == 0 && line.size() > length && line[length] == ':')
+                return atof(line.c_str() + length + 1) / 1024;
+        }
+        return 0;
+    }
+
+    double Percentile(vector<double> &values, double fraction)
+    {
+        if (values.empty())
+            return 0;
+        size_t index = min(values.size() - 1, (size_t)(fraction * values.size()));
+        nth_element(values.begin(), values.begin() + index, values.end());
+        return values[index];
+    }
+}
+
+// A reading of a pot drawn from a Zipf distribution, as the MQTT ingest
+// applies it, with state.range(1) percent of the pots fitting the budget.
+static void BM_TieredFleet(benchmark::State &state)
+{
+    int potCount = (int)state.range(0);
+    shared_ptr<PotConfig> config = make_shared<PotConfig>();
+    config->LoadJson(PotConfig::defaults);
+    size_t potBytes = PotPool::Footprint(config->Build(0));
+    size_t budget = potBytes * (size_t)potCount * (size_t)state.range(1) / 100;
+
+    int64_t now = startTime;
+    Fleet fleet(now);
+    fleet.SetStaleTtl(600);
+    fleet.SetHydrator([config](int) { return config->Build(0); });
+    for (int potId = 0; potId < potCount; ++potId)
+        fleet.Declare(potId);
+    if (fleet.EnableTiering("smartpot_bench.cold", budget))
+    {
+        state.SkipWithError(fleet.TieringError().c_str());
+        return;
+    }
+    // Built as the server does in the background, a tick at a time.
+    while (fleet.HydrateSome(4096) > 0)
+        fleet.Trim();
+    fleet.Trim();
+
+    const char *sensors[] = {"temperature", "humidity", "luminosity", "soilHumidity"};
+    mt19937_64 random(1);
+    uniform_real_distribution<double> uniform(0, 1);
+    auto read = [&](vector<double> *faultTimes)
+    {
+        for (int i = 0; i < readings; ++i)
+        {
+            int potId = PotOfRank(ZipfRank(uniform(random), potCount), potCount);
+            bool cold = fleet.IsCold(potId);
+            auto start = chrono::steady_clock::now();
+            if (fleet.Get(potId) != nullptr)
+                fleet.SetValue(potId, sensors[i % 4], 20 + i % 10);
+            if (cold && faultTimes != nullptr)
+                faultTimes->push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+            if (i % readingsPerTick == readingsPerTick - 1)
+            {
+                fleet.ExpireStale(++now);
+                fleet.Trim();
+            }
+        }
+    };
+    // The pots in memory follow the reads first.
+    read(nullptr);
+
+    Fleet::TierStats before = fleet.Tiering();
+    vector<double> faultTimes;
+    for (auto _ : state)
+        read(&faultTimes);
+    const Fleet::TierStats &after = fleet.Tiering();
+    uint64_t hits = after.hits - before.hits;
+    uint64_t faults = after.faults - before.faults;
+
+    state.SetItemsProcessed(state.iterations() * readings);
+    state.counters["hitRate"] = (double)hits / (hits + faults);
+    state.counters["faultP50Us"] = Percentile(faultTimes, 0.5);
+    state.counters["faultP99Us"] = Percentile(faultTimes, 0.99);
+    state.counters["faultMeanUs"] = faults > 0 ? (double)(after.faultNanoseconds - before.faultNanoseconds) / faults / 1000 : 0;
+    state.counters["hotPots"] = (double)fleet.HotPots();
+    state.counters["hotMB"] = (double)fleet.HotBytes() / (1024 * 1024);
+    state.counters["heapMB"] = (double)LiveBytes() / (1024 * 1024);
+    state.counters["rssAnonMB"] = StatusMegabytes("RssAnon");
+    state.counters["rssFileMB"] = StatusMegabytes("RssFile");
+    state.counters["storeMB"] = (double)fleet.Store().Size() / (1024 * 1024);
+}
+BENCHMARK(BM_TieredFleet)
+    ->Args({1000000, 5})
+    ->Args({1000000, 20})
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
@@ -0,0 +1,120 @@
+///
+/// @file TraceBench.cpp
+///
+/// @brief Micro-benchmarks for the @b Trace spans: what a span costs while
+/// no trace is captured and while one is, alone and around the stages of
+/// an MQTT message.
+///
+#include "Fleet.hpp"
+#include "MqttIngest.hpp"
+#include "Trace.hpp"
+#include "BenchPots.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+using namespace std;
+using namespace pot;
+
+namespace
+{
+    const char *payload = "{\"sensorType\": 7, \"value\": 4.25, \"nutrientType\": null}";
+
+    ///
+    /// @brief A message applied as in SmartPotEndpoint::mosquittoOnMessage,
+    /// with its spans if @p traced.
+    ///
+    template<bool traced>
+    void ApplyMessage(MqttIngest &ingest, Fleet &fleet, mutex &lock, int potId,
+                      MqttIngest::Reading &reading, string &reply)
+    {
+        if constexpr (traced)
+        {
+            Trace::Span span("mqtt.message");
+            Trace::Span parse("mqtt.parse");
+            ingest.Parse(payload, strlen(payload), reading, reply);
+            parse.End();
+            Trace::Span wait("mqtt.lockWait");
+            lock_guard<mutex> guard(lock);
+            wait.End();
+            Trace::Span apply("mqtt.apply");
+            fleet.Get(potId);
+            ingest.Apply(potId, reading);
+        }
+        else
+        {
+            ingest.Parse(payload, strlen(payload), reading, reply);
+            lock_guard<mutex> guard(lock);
+            fleet.Get(potId);
+            ingest.Apply(potId, reading);
+        }
+    }
+
+    ///
+    /// @brief Applies messages to 1000 pots, without spans (as built without
+    /// SMARTPOT_TRACE) for state.range(0) = 0, with spans and no capture for
+    /// 1, while capturing for 2.
+    ///
+    void RunMessages(benchmark::State &state)
+    {
+        Fleet fleet;
+        for (int i = 0; i < 1000; ++i)
+            fleet.Add(i, MakeBenchPot(i));
+        MqttIngest ingest(fleet, make_shared<const map<int, string>>(map<int, string>{{7, "soilHumidity"}}));
+        mutex lock;
+        MqttIngest::Reading reading;
+        string reply;
+        Trace::Capture capture;
+        if (state.range(0) == 2)
+            Trace::Start(capture);
+        int potId = 0;
+        for (auto _ : state)
+        {
+            if (state.range(0) == 0)
+                ApplyMessage<false>(ingest, fleet, lock, potId, reading, reply);
+            else
+                ApplyMessage<true>(ingest, fleet, lock, potId, reading, reply);
+            potId = (potId + 7) % 1000;
+        }
+        if (state.range(0) == 2)
+            Trace::Stop(capture);
+    }
+}
+
+// A span alone while no trace is captured.
+static void BM_TraceSpanOff(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        Trace::Span span("bench");
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_TraceSpanOff);
+
+// A span alone while a trace is captured.
+static void BM_TraceSpanOn(benchmark::State &state)
+{
+    Trace::Capture capture;
+    Trace::Start(capture);
+    for (auto _ : state)
+    {
+        Trace::Span span("bench");
+        benchmark::ClobberMemory();
+    }
+    Trace::Stop(capture);
+    state.counters["events"] = (double) capture.events.size();
+}
+BENCHMARK(BM_TraceSpanOn);
+
+// An MQTT message with its four spans, see RunMessages.
+static void BM_TraceMqttMessage(benchmark::State &state)
+{
+    RunMessages(state);
+}
+BENCHMARK(BM_TraceMqttMessage)->Arg(0)->Arg(1)->Arg(2);
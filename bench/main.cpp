@@ -0,0 +1,412 @@
+///
+/// @file main.cpp
+///
+/// @brief Micro-benchmarks for the @b SmartPot core operations, the JSON
+/// payloads we receive over HTTP and MQTT and the status rendering.
+///
+/// Run with `--benchmark_format=json` (or the `run_smartpot_bench` target)
+/// to get machine-readable results which can be compared between builds.
+///
+#include "MqttIngest.hpp"
+#include "RateLimiter.hpp"
+#include "SmartPot.hpp"
+#include "AllocationCounter.hpp"
+#include "BenchPots.hpp"
+
+// Our JSON Parser.
+#include <rapidjson/document.h>
+
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace pot;
+
+namespace
+{
+    // Same mapping as SmartPotEndpoint::sensorNameMap.
+    map <int, string> sensorNameMap = {
+            {1, "ground"},
+            {2, "temperature"},
+            {3, "luminosity"},
+            {4, "humidity"},
+            {5, "fertiliser"},
+            {6, "soilPh"},
+            {7, "soilHumidity"},
+            {8, "soilType"}
+    };
+
+    const char *settingUpdatePayload =
+        "{\"sensorType\": 7, \"min\": 2.5, \"max\": 6.5, \"nutrientType\": null}";
+    const char *nutrientUpdatePayload =
+        "{\"sensorType\": 1, \"min\": 1.5, \"max\": 3.5, \"nutrientType\": \"nitrogen\"}";
+    const char *mqttValuePayload =
+        "{\"sensorType\": 7, \"value\": 4.25, \"nutrientType\": null}";
+    const char *mqttStringPayload =
+        "{\"sensorType\": 8, \"value\": \"Red\", \"nutrientType\": null}";
+
+    // Sensor counts on top of the default nine sensors.
+    void SensorCounts(benchmark::internal::Benchmark *b)
+    {
+        b->Arg(0)->Arg(64)->Arg(512);
+    }
+
+    // Number of pots for the fleet-wide status rendering.
+    void PotCounts(benchmark::internal::Benchmark *b)
+    {
+        b->Arg(1)->Arg(100)->Arg(10000);
+    }
+}
+
+// Lookups.
+
+static void BM_Find(benchmark::State &state)
+{
+    SmartPot pot = MakeBenchPot(0, state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(pot.Find("soilHumidity"));
+}
+BENCHMARK(BM_Find)->Apply(SensorCounts);
+
+static void BM_FindMissing(benchmark::State &state)
+{
+    SmartPot pot = MakeBenchPot(0, state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(pot.Find("mortiSiRanitiInGhiveci"));
+}
+BENCHMARK(BM_FindMissing)->Apply(SensorCounts);
+
+static void BM_GetSensor(benchmark::State &state)
+{
+    SmartPot pot = MakeBenchPot(0, state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(pot.GetSensor("soilHumidity"));
+}
+BENCHMARK(BM_GetSensor)->Apply(SensorCounts);
+
+static void BM_GetSensorValue(benchmark::State &state)
+{
+    SmartPot pot = MakeBenchPot(0, state.range(0));
+    Sensor value;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(pot.Get("soilHumidity", value));
+}
+BENCHMARK(BM_GetSensorValue)->Apply(SensorCounts);
+
+// What GET /settings/:settingName does with the pot.
+static void BM_GetStringValue(benchmark::State &state)
+{
+    SmartPot pot = MakeBenchPot(0, state.range(0));
+    string value;
+    pot.Get("soilHumidity", value);
+    uint64_t allocations = AllocationCount();
+    for (auto _ : state)
+        benchmark::DoNotOptimize(pot.Get("soilHumidity", value));
+    ExpectAllocations(state, allocations, 0);
+}
+BENCHMARK(BM_GetStringValue)->Apply(SensorCounts);
+
+static void BM_Set(benchmark::State &state)
+{
+    SmartPot pot = MakeBenchPot(0, state.range(0));
+    Sensor value("soilHumidity", 4, 3, 6);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(pot.Set("soilHumidity", value));
+}
+BENCHMARK(BM_Set)->Apply(SensorCounts);
+
+// Moves, which shall not copy the strings (all longer than the small
+// string buffer).
+
+static void BM_MovePlant(benchmark::State &state)
+{
+    Plant plant("Saguaro cactus of the desert", "Green with white spines",
+                1.3, "Desert succulent plants", "Red sandy desert soil");
+    Plant other;
+    uint64_t allocations = AllocationCount();
+    for (auto _ : state)
+    {
+        other = move(plant);
+        plant = move(other);
+        benchmark::DoNotOptimize(plant);
+    }
+    ExpectAllocations(state, allocations, 0);
+}
+BENCHMARK(BM_MovePlant);
+
+static void BM_MoveSensor(benchmark::State &state)
+{
+    Sensor sensor("soilHumidityOfTheRootZone", "Humid and warm loamy soil", 3, 6);
+    Sensor other;
+    uint64_t allocations = AllocationCount();
+    for (auto _ : state)
+    {
+        Sensor moved(move(sensor));
+        other = move(moved);
+        sensor = move(other);
+        benchmark::DoNotOptimize(sensor);
+    }
+    ExpectAllocations(state, allocations, 0);
+}
+BENCHMARK(BM_MoveSensor);
+
+// Actuators and status methods.
+
+static void BM_Shovel(benchmark::State &state)
+{
+    SmartPot pot = MakeBenchPot(0, state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(pot.Shovel());
+}
+BENCHMARK(BM_Shovel)->Apply(SensorCounts);
+
+static void BM_IrrigateSoil(benchmark::State &state)
+{
+    SmartPot pot = MakeBenchPot(0, state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(pot.IrrigateSoil());
+}
+BENCHMARK(BM_IrrigateSoil)->Apply(SensorCounts);
+
+static void BM_NutrientsInjector(benchmark::State &state)
+{
+    SmartPot pot = MakeBenchPot(0, state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(pot.NutrientsInjector());
+}
+BENCHMARK(BM_NutrientsInjector)->Apply(SensorCounts);
+
+static void BM_SolarLamp(benchmark::State &state)
+{
+    SmartPot pot = MakeBenchPot(0, state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(pot.SolarLamp());
+}
+BENCHMARK(BM_SolarLamp)->Apply(SensorCounts);
+
+static void BM_DisplayPlantData(benchmark::State &state)
+{
+    SmartPot pot = MakeBenchPot(0, state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(pot.DisplayPlantData());
+}
+BENCHMARK(BM_DisplayPlantData)->Apply(SensorCounts);
+
+static void BM_DisplayEnvironmentData(benchmark::State &state)
+{
+    SmartPot pot = MakeBenchPot(0, state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(pot.DisplayEnvironmentData());
+}
+BENCHMARK(BM_DisplayEnvironmentData)->Apply(SensorCounts);
+
+static void BM_SoilCompatibility(benchmark::State &state)
+{
+    SmartPot pot = MakeBenchPot(0, state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(pot.SoilCompatibility());
+}
+BENCHMARK(BM_SoilCompatibility)->Apply(SensorCounts);
+
+static void BM_SoilStatus(benchmark::State &state)
+{
+    SmartPot pot = MakeBenchPot(0, state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(pot.SoilStatus());
+}
+BENCHMARK(BM_SoilStatus)->Apply(SensorCounts);
+
+static void BM_InadequateEnvironment(benchmark::State &state)
+{
+    SmartPot pot = MakeBenchPot(0, state.range(0));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(pot.InadequateEnvironment());
+}
+BENCHMARK(BM_InadequateEnvironment)->Apply(SensorCounts);
+
+// JSON payloads, parsed and applied the same way as in SmartPotEndpoint.
+
+static void BM_ParseSettingUpdate(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        rapidjson::Document document;
+        document.Parse(settingUpdatePayload);
+        benchmark::DoNotOptimize(document["min"].GetDouble());
+    }
+    state.SetBytesProcessed(state.iterations() * strlen(settingUpdatePayload));
+}
+BENCHMARK(BM_ParseSettingUpdate);
+
+static void BM_ParseMqttPayload(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        rapidjson::Document document;
+        document.Parse(mqttValuePayload);
+        benchmark::DoNotOptimize(document["value"].GetDouble());
+    }
+    state.SetBytesProcessed(state.iterations() * strlen(mqttValuePayload));
+}
+BENCHMARK(BM_ParseMqttPayload);
+
+///
+/// @brief The body of SmartPotEndpoint::putSettingUpdate without the HTTP
+/// layer around it.
+///
+static void ApplySettingUpdate(Fleet &fleet, const char *payload)
+{
+    rapidjson::Document document;
+    if (document.Parse(payload).HasParseError() || document.IsObject() == false)
+        return;
+
+    double sensorTypeID = document["sensorType"].GetDouble();
+    double sensorMin = document["min"].GetDouble();
+    double sensorMax = document["max"].GetDouble();
+
+    if (document["nutrientType"].IsNull())
+        fleet.SetThresholds(0, sensorNameMap[sensorTypeID], sensorMin, sensorMax);
+    else
+        fleet.SetThresholds(0, document["nutrientType"].GetString(), sensorMin, sensorMax);
+}
+
+static void ApplySettingUpdates(benchmark::State &state, const char *payload)
+{
+    Fleet fleet;
+    fleet.Add(0, MakeBenchPot(0, state.range(0)));
+    uint64_t allocations = AllocationCount();
+    for (auto _ : state)
+        ApplySettingUpdate(fleet, payload);
+    ReportAllocations(state, allocations);
+}
+
+static void BM_ApplySettingUpdate(benchmark::State &state)
+{
+    ApplySettingUpdates(state, settingUpdatePayload);
+}
+BENCHMARK(BM_ApplySettingUpdate)->Apply(SensorCounts);
+
+static void BM_ApplyNutrientUpdate(benchmark::State &state)
+{
+    ApplySettingUpdates(state, nutrientUpdatePayload);
+}
+BENCHMARK(BM_ApplyNutrientUpdate)->Apply(SensorCounts);
+
+///
+/// @brief Applies @p payload to a fleet holding one pot the same way
+/// SmartPotEndpoint::mosquittoOnMessage does, and reports the allocations
+/// made per message.
+///
+static void ApplyMqttPayloads(benchmark::State &state, const char *payload)
+{
+    Fleet fleet;
+    fleet.Add(0, MakeBenchPot(0, state.range(0)));
+    MqttIngest ingest(fleet, make_shared<const map<int, string>>(sensorNameMap));
+    size_t length = strlen(payload);
+    string reply;
+    // The reply and the reading grow to their size on the first message.
+    ingest.Apply(0, payload, length, reply);
+    uint64_t allocations = AllocationCount();
+    for (auto _ : state)
+        benchmark::DoNotOptimize(ingest.Apply(0, payload, length, reply));
+    // The history of the sensor takes a new block now and then.
+    ExpectAllocations(state, allocations, 0.05);
+}
+
+static void BM_ApplyMqttValue(benchmark::State &state)
+{
+    ApplyMqttPayloads(state, mqttValuePayload);
+}
+BENCHMARK(BM_ApplyMqttValue)->Apply(SensorCounts);
+
+static void BM_ApplyMqttString(benchmark::State &state)
+{
+    ApplyMqttPayloads(state, mqttStringPayload);
+}
+BENCHMARK(BM_ApplyMqttString)->Apply(SensorCounts);
+
+///
+/// @brief Cost of a message of a pot flooding its topic, which the rate
+/// limiter drops before parsing.
+///
+static void BM_DropFloodingPot(benchmark::State &state)
+{
+    RateLimiter limiter(10, 50, 20000, 20000);
+    int64_t now = 0;
+    limiter.Admit(0, now++);
+    uint64_t allocations = AllocationCount();
+    for (auto _ : state)
+        benchmark::DoNotOptimize(limiter.Admit(0, now++));
+    ExpectAllocations(state, allocations, 0);
+}
+BENCHMARK(BM_DropFloodingPot);
+
+///
+/// @brief Cost of a message under overload: parsed, then only kept as the
+/// latest reading of its sensor.
+///
+static void BM_CoalesceMqttValue(benchmark::State &state)
+{
+    Fleet fleet;
+    fleet.Add(0, MakeBenchPot());
+    MqttIngest ingest(fleet, make_shared<const map<int, string>>(sensorNameMap));
+    size_t length = strlen(mqttValuePayload);
+    MqttIngest::Reading reading;
+    string reply;
+    ingest.Parse(mqttValuePayload, length, reading, reply);
+    ingest.Coalesce(0, reading);
+    uint64_t allocations = AllocationCount();
+    for (auto _ : state)
+    {
+        ingest.Parse(mqttValuePayload, length, reading, reply);
+        ingest.Coalesce(0, reading);
+    }
+    ExpectAllocations(state, allocations, 0);
+}
+BENCHMARK(BM_CoalesceMqttValue);
+
+// Status rendering, the body of SmartPotEndpoint::getStatus for many pots.
+
+static void BM_RenderStatus(benchmark::State &state)
+{
+    vector<SmartPot> pots(state.range(0), MakeBenchPot());
+    uint64_t allocations = AllocationCount();
+    size_t bytes = 0;
+    for (auto _ : state)
+    {
+        string status = "";
+        for (auto &pot : pots)
+        {
+            status += pot.DisplayPlantData()
+                    + string("\n")
+                    + pot.DisplayEnvironmentData();
+        }
+        bytes += status.size();
+        benchmark::DoNotOptimize(status);
+    }
+    ReportAllocations(state, allocations);
+    state.SetBytesProcessed(bytes);
+    state.counters["pots"] = state.range(0);
+}
+BENCHMARK(BM_RenderStatus)->Apply(PotCounts)->Unit(benchmark::kMicrosecond);
+
+// BENCHMARK_MAIN, failing when a benchmark failed ExpectAllocations.
+int main(int argc, char **argv)
+{
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    if (AllocationFailures() > 0)
+    {
+        fprintf(stderr, "%d benchmark runs allocated more than expected\n", AllocationFailures());
+        return 1;
+    }
+    return 0;
+}
@@ -40,11 +40,40 @@ int main(int argc, char *argv[])
     int thr = 2;
     omp_set_num_threads(thr);
 
+    // JSON file or directory of the pots to serve.
+    string configPath;
+
+    // File recording the MQTT messages received, for tools/replay.
+    string capturePath;
+
+    // JSON file of the instances serving the fleet with this one.
+    string clusterPath;
+
+    // File the pots not used lately are evicted to, and the megabytes of
+    // pots kept in memory.
+    string coldStorePath;
+    size_t memoryBudgetMb = 1024;
+
     if (argc >= 2) {
         port = static_cast<uint16_t>(std::stol(argv[1]));
 
-        if (argc == 3)
+        if (argc >= 3)
             thr = std::stoi(argv[2]);
+
+        if (argc >= 4)
+            configPath = argv[3];
+
+        if (argc >= 5)
+            capturePath = argv[4];
+
+        if (argc >= 6)
+            clusterPath = argv[5];
+
+        if (argc >= 7)
+            coldStorePath = argv[6];
+
+        if (argc >= 8)
+            memoryBudgetMb = std::stoul(argv[7]);
     }
 
     Address addr(Ipv4::any(), port);
@@ -53,24 +82,42 @@ int main(int argc, char *argv[])
     cout << "Using " << thr << " threads" << endl;
 
     // Instance of the class that defines what the server can do.
-    SmartPotEndpoint server(addr);
+    SmartPotEndpoint server(addr, configPath, clusterPath);
+    if (!capturePath.empty() && server.startCapture(capturePath))
+    {
+        std::cerr << "Could not create the capture " << capturePath << std::endl;
+        return 1;
+    }
+    if (!coldStorePath.empty() && server.startTiering(coldStorePath, memoryBudgetMb * 1024 * 1024))
+    {
+        std::cerr << "Could not create the cold store " << coldStorePath << std::endl;
+        return 1;
+    }
 
     // Initialize and start the server
     server.init();
     server.start();
 
 
-    // Code that waits for the shutdown sinal for the server
+    // Code that waits for the shutdown sinal for the server, SIGHUP only
+    // reloads the pots configuration.
     int signal = 0;
 
-    int status = sigwait(&signals, &signal);
-    if (status == 0)
+    while (true)
     {
+        int status = sigwait(&signals, &signal);
+        if (status != 0)
+        {
+            std::cerr << "sigwait returns " << status << std::endl;
+            break;
+        }
         std::cout << "received signal " << signal << std::endl;
-    }
-    else
-    {
-        std::cerr << "sigwait returns " << status << std::endl;
+        if (signal != SIGHUP)
+            break;
+
+        // The reload prints how it went once done.
+        if (!server.reloadInBackground())
+            std::cout << "A reload is already running" << std::endl;
     }
 
     server.stop();
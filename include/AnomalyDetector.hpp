@@ -0,0 +1,170 @@
+///
+/// @file AnomalyDetector.hpp
+///
+/// @brief Notices the readings of a sensor which are unusual for it even
+/// though they are between its thresholds, such as the drift or the spikes
+/// of a failing probe.
+///
+/// The detector keeps an exponentially weighted mean and variance of the
+/// readings and flags a reading whose z-score against them is too high,
+/// and a reading which moved from the previous one faster than the sensor
+/// may change. Its state is a few numbers and a reading costs a few
+/// multiplications and a square root.
+///
+/// The variance follows the readings ten times slower than the mean: a
+/// drift moves the mean away from where the readings used to be before the
+/// variance grows to match, so it is flagged. A spike barely changes the
+/// variance, the readings after it are not hidden. Until the readings are
+/// more than the averaging periods, the mean and variance are the plain
+/// ones of the readings so far.
+///
+#ifndef ANOMALY_DETECTOR_HPP
+#define ANOMALY_DETECTOR_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+using namespace std;
+
+namespace pot
+{
+class AnomalyDetector
+{
+public:
+    // What is unusual about the latest reading, or'ed together.
+    enum Kind : uint8_t
+    {
+        none = 0,
+        // Too many standard deviations from the mean.
+        deviation = 1,
+        // Changed faster than the rate limit.
+        rate = 2
+    };
+
+    // Weight of a reading in the mean, which follows about the last
+    // 1 / alpha readings, and in the variance.
+    static constexpr double alpha = 0.02;
+    static constexpr double varianceAlpha = 0.002;
+    // Standard deviations from the mean a usual reading stays within.
+    static constexpr double zLimit = 4;
+    // Readings before the deviations are checked.
+    static constexpr uint32_t warmup = 30;
+    // Readings counted, after which the weights are alpha and varianceAlpha.
+    static constexpr uint32_t maxCount = 500;
+    // The standard deviation is taken as at least this part of the band
+    // between the thresholds, so a steady sensor is not flagged for
+    // moving by its resolution.
+    static constexpr double minDeviationOfBand = 0.01;
+    // Without a rate limit of its own a sensor may cross its whole band in
+    // that many seconds.
+    static constexpr double bandSeconds = 60;
+
+private:
+    double mean = 0;
+    double variance = 0;
+    double last = 0;
+    double zScore = 0;
+    double rateOfChange = 0;
+    int64_t lastTime = 0;
+    // Per second, 0 for the band over bandSeconds.
+    double maxRate = 0;
+    uint32_t count = 0;
+    uint8_t kinds = none;
+
+public:
+    ///
+    /// @brief Checks the reading @p value taken at @p time (in seconds)
+    /// against the previous ones, then adds it to them. @p minValue and
+    /// @p maxValue are the thresholds of the sensor.
+    ///
+    /// @returns The kinds of anomaly of the reading.
+    ///
+    uint8_t Update(double value, int64_t time, double minValue, double maxValue)
+    {
+        double band = maxValue - minValue;
+        kinds = none;
+        if(count > 0)
+        {
+            // Readings of the same second are a second apart.
+            int64_t seconds = max<int64_t>(time - lastTime, 1);
+            rateOfChange = fabs(value - last) / (double) seconds;
+            double limit = maxRate > 0 ? maxRate : band / bandSeconds;
+            if(limit > 0 && rateOfChange > limit)
+                kinds |= rate;
+
+            double difference = value - mean;
+            double deviation = max(sqrt(variance), max(band * minDeviationOfBand, 1e-9));
+            zScore = difference / deviation;
+            if(count >= warmup && fabs(zScore) > zLimit)
+                kinds |= AnomalyDetector::deviation;
+
+            double weight = 1 / (double) (count + 1);
+            mean += max(alpha, weight) * difference;
+            variance += max(varianceAlpha, weight) * (difference * difference - variance);
+        }
+        else
+        {
+            mean = value;
+            variance = 0;
+            zScore = 0;
+            rateOfChange = 0;
+        }
+        last = value;
+        lastTime = time;
+        if(count < maxCount)
+            count++;
+        return kinds;
+    }
+
+    // The rate limit in units per second, 0 for the default one.
+    void SetMaxRate(double newValue)
+    {
+        maxRate = newValue;
+    }
+    double GetMaxRate() const
+    {
+        return maxRate;
+    }
+
+    // The kinds of anomaly of the latest reading.
+    uint8_t Kinds() const
+    {
+        return kinds;
+    }
+
+    double Mean() const
+    {
+        return mean;
+    }
+
+    double ZScore() const
+    {
+        return zScore;
+    }
+
+    // Of the latest reading, in units per second.
+    double RateOfChange() const
+    {
+        return rateOfChange;
+    }
+
+    // "deviation", "rate", "deviation,rate" or "" for none.
+    static const char* Name(uint8_t kinds)
+    {
+        switch(kinds)
+        {
+        case deviation:
+            return "deviation";
+        case rate:
+            return "rate";
+        case deviation | rate:
+            return "deviation,rate";
+        default:
+            return "";
+        }
+    }
+};
+}
+
+#endif
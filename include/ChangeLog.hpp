@@ -0,0 +1,158 @@
+///
+/// @file ChangeLog.hpp
+///
+/// @brief The latest sensor writes of a pot, in a small ring, so that the
+/// sensors changed since a version a client already has are found by
+/// walking back the ring over those changes only.
+///
+/// The versions are taken from one counter of the process, so a version is
+/// never given twice, even to a pot replaced by another one with the same
+/// id. A client whose version is older than the ring (or than the last
+/// restart of the log, or newer than the log, after a restart of the
+/// process) gets everything.
+///
+#ifndef CHANGE_LOG_HPP
+#define CHANGE_LOG_HPP
+
+#include "Sensor.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+using namespace std;
+
+namespace pot
+{
+class ChangeLog
+{
+public:
+    // Writes remembered per pot, a few more than the sensors of a pot.
+    static constexpr size_t capacity = 16;
+
+    // A sensor of a pot with its name, as stored in the sensor maps.
+    using Entry = pair<const string, Sensor>;
+
+private:
+    struct Change
+    {
+        uint64_t version;
+        const Entry *entry;
+    };
+
+    inline static atomic<uint64_t> counter{0};
+
+    // The sensors live in the maps of the pot owning the log, the changes
+    // are only read while their version is newer than start.
+    array<Change, capacity> changes;
+    size_t written = 0;
+    // The latest version, and the version from which on every change is
+    // in the ring.
+    uint64_t version = 0;
+    uint64_t start = 0;
+
+public:
+    static uint64_t Next()
+    {
+        return counter.fetch_add(1, memory_order_relaxed) + 1;
+    }
+
+    ChangeLog()
+    {
+
+    }
+
+    // A copy does not have the sensors of the ring, it only answers with
+    // everything to the versions older than the copy.
+    ChangeLog(const ChangeLog& other)
+        : version(other.version),
+          start(other.version)
+    {
+
+    }
+
+    ChangeLog& operator=(const ChangeLog& other)
+    {
+        version = start = other.version;
+        return *this;
+    }
+
+    ///
+    /// @brief Records a write of the sensor of @p entry.
+    ///
+    /// @returns The version of the write.
+    ///
+    uint64_t Record(const Entry *entry)
+    {
+        version = Next();
+        // Repeated writes of a sensor keep one change.
+        if(written > 0)
+        {
+            Change& latest = changes[(written - 1) % capacity];
+            if(latest.entry == entry && latest.version > start)
+            {
+                latest.version = version;
+                return version;
+            }
+        }
+        Change& change = changes[written % capacity];
+        // The change overwritten is the oldest one the ring knew.
+        if(written >= capacity && change.version > start)
+            start = change.version;
+        change = {version, entry};
+        written++;
+        return version;
+    }
+
+    ///
+    /// @brief Takes everything as changed (a new or replaced pot): the
+    /// clients get everything, whatever their version.
+    ///
+    /// @returns The new version.
+    ///
+    uint64_t Restart()
+    {
+        version = start = Next();
+        return version;
+    }
+
+    // A change which is not about a sensor (the plant of the pot).
+    uint64_t Bump()
+    {
+        version = Next();
+        return version;
+    }
+
+    ///
+    /// @brief Calls @p visit(entry, version) for the sensors written after
+    /// @p since, the latest first, a sensor maybe more than once.
+    ///
+    /// @returns false, without visiting anything, if the ring does not go
+    /// back to @p since: everything shall be taken as changed then.
+    ///
+    template<typename Visit>
+    bool Since(uint64_t since, Visit visit) const
+    {
+        if(since < start || since > version)
+            return false;
+        size_t count = written < capacity ? written : capacity;
+        for(size_t i = 1; i <= count; ++i)
+        {
+            const Change& change = changes[(written - i) % capacity];
+            if(change.version <= since || change.version <= start)
+                break;
+            visit(*change.entry, change.version);
+        }
+        return true;
+    }
+
+    uint64_t Version() const
+    {
+        return version;
+    }
+};
+}
+
+#endif
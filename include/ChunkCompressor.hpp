@@ -0,0 +1,154 @@
+///
+/// @file ChunkCompressor.hpp
+///
+/// @brief Compresses a response body piece by piece with zlib, in the
+/// content coding negotiated through the Accept-Encoding header, so that a
+/// streamed response can be compressed without being buffered in full.
+///
+#ifndef CHUNK_COMPRESSOR_HPP
+#define CHUNK_COMPRESSOR_HPP
+
+#include <zlib.h>
+
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+namespace pot
+{
+class ChunkCompressor
+{
+public:
+    enum Encoding
+    {
+        identity,
+        gzip,
+        deflate
+    };
+
+private:
+    Encoding encoding;
+    z_stream stream{};
+
+    void Run(string_view in, string& out, int flush)
+    {
+        stream.next_in = (Bytef *) in.data();
+        stream.avail_in = (uInt) in.size();
+        do
+        {
+            // deflateBound is for a whole input, the loop covers the rest.
+            size_t offset = out.size();
+            size_t room = deflateBound(&stream, stream.avail_in) + 64;
+            out.resize(offset + room);
+            stream.next_out = (Bytef *) &out[offset];
+            stream.avail_out = (uInt) room;
+            ::deflate(&stream, flush);
+            out.resize(offset + room - stream.avail_out);
+        }
+        while(stream.avail_out == 0);
+    }
+
+public:
+    ///
+    /// @param _encoding The content coding of the output.
+    /// @param level The zlib compression level, the lower levels give the
+    /// first bytes sooner.
+    ///
+    explicit ChunkCompressor(Encoding _encoding, int level = Z_DEFAULT_COMPRESSION)
+        : encoding(_encoding)
+    {
+        if(encoding == identity)
+            return;
+        // 15 bits of window, +16 for the gzip header instead of zlib's.
+        int windowBits = encoding == gzip ? 15 + 16 : 15;
+        deflateInit2(&stream, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY);
+    }
+
+    ~ChunkCompressor()
+    {
+        if(encoding != identity)
+            deflateEnd(&stream);
+    }
+
+    ChunkCompressor(const ChunkCompressor&) = delete;
+    ChunkCompressor& operator=(const ChunkCompressor&) = delete;
+
+    ///
+    /// @brief Appends @p in, compressed, to @p out. The output is flushed so
+    /// that the client can decode everything sent so far.
+    ///
+    void Compress(string_view in, string& out)
+    {
+        if(encoding == identity)
+            out.append(in.data(), in.size());
+        else
+            Run(in, out, Z_SYNC_FLUSH);
+    }
+
+    // Appends the end of the compressed stream to @p out.
+    void Finish(string& out)
+    {
+        if(encoding != identity)
+            Run(string_view(), out, Z_FINISH);
+    }
+
+    Encoding GetEncoding() const
+    {
+        return encoding;
+    }
+
+    // The Content-Encoding header value, empty for identity.
+    static const char* Name(Encoding encoding)
+    {
+        return encoding == gzip ? "gzip" : encoding == deflate ? "deflate" : "";
+    }
+
+    ///
+    /// @brief Picks the coding of a response from the value of an
+    /// Accept-Encoding header: gzip, then deflate, when the client accepts
+    /// them (a q value of 0 refuses a coding). "*" accepts the codings
+    /// the header does not name.
+    ///
+    static Encoding Negotiate(string_view acceptEncoding)
+    {
+        // 1 if named and accepted, -1 if named and refused, 0 otherwise.
+        int gzipNamed = 0;
+        int deflateNamed = 0;
+        bool acceptsOthers = false;
+        while(!acceptEncoding.empty())
+        {
+            size_t comma = acceptEncoding.find(',');
+            string_view item = acceptEncoding.substr(0, comma);
+            acceptEncoding = comma == string_view::npos ? string_view() : acceptEncoding.substr(comma + 1);
+
+            size_t semicolon = item.find(';');
+            string_view coding = item.substr(0, semicolon);
+            while(!coding.empty() && coding.front() == ' ')
+                coding.remove_prefix(1);
+            while(!coding.empty() && coding.back() == ' ')
+                coding.remove_suffix(1);
+
+            bool refused = false;
+            if(semicolon != string_view::npos)
+            {
+                size_t q = item.find("q=", semicolon);
+                if(q != string_view::npos)
+                    refused = atof(string(item.substr(q + 2)).c_str()) <= 0;
+            }
+            if(coding == "gzip")
+                gzipNamed = refused ? -1 : 1;
+            else if(coding == "deflate")
+                deflateNamed = refused ? -1 : 1;
+            else if(coding == "*")
+                acceptsOthers = !refused;
+        }
+        bool acceptsGzip = gzipNamed > 0 || (gzipNamed == 0 && acceptsOthers);
+        bool acceptsDeflate = deflateNamed > 0 || (deflateNamed == 0 && acceptsOthers);
+        return acceptsGzip ? gzip : acceptsDeflate ? deflate : identity;
+    }
+};
+}
+
+#endif
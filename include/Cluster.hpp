@@ -0,0 +1,238 @@
+///
+/// @file Cluster.hpp
+///
+/// @brief The instances serving the fleet together, as declared in a JSON
+/// cluster file, and which of them owns every pot (see HashRing.hpp). An
+/// instance only keeps the pots it owns, forwards the HTTP requests of the
+/// other pots to their owner and ignores their MQTT messages, which their
+/// owner receives from the same broker.
+///
+/// A cluster file is an object such as:
+///
+///     "self":         "127.0.0.1:9081", this instance, as the others reach it
+///     "nodes":        ["127.0.0.1:9080", "127.0.0.1:9081", ...]
+///     "virtualNodes": 128, optional, the points of every instance
+///     "broker":       "localhost:1883", optional, the MQTT broker
+///
+/// Every instance shall be given the same nodes and virtual nodes. An
+/// instance missing from its own nodes owns no pot, which is how it
+/// leaves the cluster. Without a cluster file the instance owns every pot.
+///
+#ifndef CLUSTER_HPP
+#define CLUSTER_HPP
+
+#include "HashRing.hpp"
+
+// Our JSON Parser.
+#include <rapidjson/document.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+namespace pot
+{
+class Cluster
+{
+public:
+    static constexpr const char *defaultBrokerHost = "mqtt_server";
+    static constexpr int defaultBrokerPort = 1883;
+    static constexpr int maxVirtualNodes = 4096;
+    // The snapshot routes of an instance are also served on its port plus
+    // this, far enough for the instances of a host on consecutive ports.
+    static constexpr int snapshotPortOffset = 1000;
+
+private:
+    string self;
+    HashRing ring;
+    // The index of self in the nodes of the ring, -1 if it is not one.
+    int selfIndex = -1;
+    string brokerHost = defaultBrokerHost;
+    int brokerPort = defaultBrokerPort;
+    string error;
+
+    int Fail(const string& what)
+    {
+        error = what;
+        return 1;
+    }
+
+    ///
+    /// @brief Splits "host:port" into @p host and @p port.
+    ///
+    /// @returns false if it is not one.
+    ///
+    static bool SplitAddress(string_view address, string& host, int& port)
+    {
+        size_t colon = address.rfind(':');
+        if(colon == string_view::npos || colon == 0 || colon + 1 == address.size())
+            return false;
+        string portText(address.substr(colon + 1));
+        char *end;
+        long value = strtol(portText.c_str(), &end, 10);
+        if(*end != '\0' || value <= 0 || value > 65535)
+            return false;
+        host.assign(address.substr(0, colon));
+        port = (int) value;
+        return true;
+    }
+
+public:
+    ///
+    /// @brief Loads the cluster file at @p path.
+    ///
+    /// @returns 0 on success, 1 on failure (see @b Error).
+    ///
+    int Load(const string& path)
+    {
+        ifstream in(path, ios::binary);
+        if(!in)
+            return Fail("cannot read " + path);
+        stringstream text;
+        text << in.rdbuf();
+        if(LoadJson(text.str()))
+            return Fail(path + ": " + error);
+        return 0;
+    }
+
+    ///
+    /// @brief Loads a cluster given as JSON text.
+    ///
+    /// @returns 0 on success, 1 on failure (see @b Error).
+    ///
+    int LoadJson(string_view text)
+    {
+        rapidjson::Document document;
+        if(document.Parse(text.data(), text.size()).HasParseError() || !document.IsObject())
+            return Fail("invalid JSON near offset " + to_string(document.GetErrorOffset()));
+
+        string host;
+        int port;
+        auto selfMember = document.FindMember("self");
+        if(selfMember == document.MemberEnd() || !selfMember->value.IsString()
+           || !SplitAddress(selfMember->value.GetString(), host, port))
+            return Fail("self shall be the \"host:port\" of this instance");
+
+        int virtualNodes = HashRing::defaultVirtualNodes;
+        auto virtualMember = document.FindMember("virtualNodes");
+        if(virtualMember != document.MemberEnd())
+        {
+            if(!virtualMember->value.IsInt() || virtualMember->value.GetInt() < 1
+               || virtualMember->value.GetInt() > maxVirtualNodes)
+                return Fail("virtualNodes shall be between 1 and " + to_string(maxVirtualNodes));
+            virtualNodes = virtualMember->value.GetInt();
+        }
+
+        HashRing nodes(virtualNodes);
+        auto nodesMember = document.FindMember("nodes");
+        if(nodesMember == document.MemberEnd() || !nodesMember->value.IsArray())
+            return Fail("nodes shall be an array");
+        for(auto& node : nodesMember->value.GetArray())
+        {
+            if(!node.IsString() || !SplitAddress(node.GetString(), host, port))
+                return Fail("a node shall be the \"host:port\" of an instance");
+            if(port + snapshotPortOffset > 65535)
+                return Fail(string("node ") + node.GetString() + " leaves no port for its snapshot routes");
+            if(nodes.Add(node.GetString()))
+                return Fail(string("node ") + node.GetString() + " is listed twice");
+        }
+
+        string broker = defaultBrokerHost;
+        int brokerPortValue = defaultBrokerPort;
+        auto brokerMember = document.FindMember("broker");
+        if(brokerMember != document.MemberEnd())
+        {
+            if(!brokerMember->value.IsString() || brokerMember->value.GetStringLength() == 0)
+                return Fail("broker shall be a \"host\" or a \"host:port\"");
+            string_view address(brokerMember->value.GetString(), brokerMember->value.GetStringLength());
+            if(!SplitAddress(address, broker, brokerPortValue))
+            {
+                if(address.find(':') != string_view::npos)
+                    return Fail("broker shall be a \"host\" or a \"host:port\"");
+                broker.assign(address);
+                brokerPortValue = defaultBrokerPort;
+            }
+        }
+
+        self = selfMember->value.GetString();
+        ring = move(nodes);
+        selfIndex = ring.Find(self);
+        brokerHost = move(broker);
+        brokerPort = brokerPortValue;
+        return 0;
+    }
+
+    // Why the last load failed.
+    const string& Error() const
+    {
+        return error;
+    }
+
+    // False without a cluster file, the instance then owns every pot.
+    bool IsClustered() const
+    {
+        return !self.empty();
+    }
+
+    bool Owns(int potId) const
+    {
+        if(!IsClustered())
+            return true;
+        return selfIndex >= 0 && ring.OwnerIndex(potId) == selfIndex;
+    }
+
+    ///
+    /// @returns The "host:port" of the instance owning pot @p potId, this
+    /// one if it is not clustered, or an empty string if the cluster has
+    /// no nodes.
+    ///
+    const string& Owner(int potId) const
+    {
+        static const string none;
+        if(!IsClustered())
+            return self;
+        int index = ring.OwnerIndex(potId);
+        return index < 0 ? none : ring.Nodes()[(size_t) index];
+    }
+
+    ///
+    /// @brief The address of the snapshot routes of @p node, "host:port"
+    /// with the port @b snapshotPortOffset after its own.
+    ///
+    static string SnapshotAddress(const string& node)
+    {
+        string host;
+        int port;
+        if(!SplitAddress(node, host, port))
+            return node;
+        return host + ":" + to_string(port + snapshotPortOffset);
+    }
+
+    // This instance, empty if it is not clustered.
+    const string& Self() const
+    {
+        return self;
+    }
+
+    const HashRing& Ring() const
+    {
+        return ring;
+    }
+
+    const string& BrokerHost() const
+    {
+        return brokerHost;
+    }
+
+    int BrokerPort() const
+    {
+        return brokerPort;
+    }
+};
+}
+
+#endif
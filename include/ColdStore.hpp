@@ -0,0 +1,369 @@
+///
+/// @file ColdStore.hpp
+///
+/// @brief File holding the pots a @b Fleet evicted from memory (its cold
+/// pots), read back through a mapping of the file when one is needed again.
+///
+/// The record of a pot is its snapshot record (see Snapshot.hpp) followed
+/// by what a snapshot leaves out because it only makes sense in this
+/// process: a 32 bit count and, for every sensor in the order of the
+/// snapshot record, the time of its last reading, the time it goes stale
+/// (0 if it is stale or its staleness is not tracked), its stale flag and
+/// the bytes of its @b AnomalyDetector. Then a 32 bit count and the time
+/// and luminosity of every light integral of its @b DerivedSensors.
+///
+/// Records start at a multiple of 64 bytes. The place of a record read back
+/// is merged with the free places next to it, and a new record takes the
+/// smallest free place it fits in, the rest of which stays free, so the
+/// file does not grow while the records change size. The records are
+/// written with pwrite and read
+/// through the mapping, so the pages only count in the memory of the
+/// process while they are read and the kernel drops them when it needs the
+/// memory. The file is removed once opened, it only lives as long as the
+/// process.
+///
+#ifndef COLD_STORE_HPP
+#define COLD_STORE_HPP
+
+#include "AnomalyDetector.hpp"
+#include "Snapshot.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <map>
+#include <set>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace pot
+{
+class ColdStore
+{
+public:
+    static constexpr size_t granularity = 64;
+    // The address space mapped once for the file, which can't grow past it.
+    static constexpr uint64_t maxSize = (uint64_t) 1 << 40;
+
+    // Where a record is in the file.
+    struct Location
+    {
+        uint64_t offset = 0;
+        uint32_t size = 0;
+    };
+
+    // What a sensor keeps besides its snapshot.
+    struct SensorState
+    {
+        int64_t lastSeen = 0;
+        // The tick of the fleet the sensor goes stale at, 0 if none.
+        int64_t staleAt = 0;
+        bool stale = false;
+        AnomalyDetector detector;
+    };
+
+    static constexpr size_t stateSize = 8 + 8 + 1 + sizeof(AnomalyDetector);
+
+private:
+    // The detectors are only read back by this process, as they are.
+    static_assert(is_trivially_copyable<AnomalyDetector>::value, "AnomalyDetector is stored as bytes");
+
+    int fd = -1;
+    const char *base = nullptr;
+    // The end of the last record, where the next new one goes.
+    uint64_t end = 0;
+    size_t liveBytes = 0;
+    size_t records = 0;
+    // The places freed, their size in granules by offset (adjacent ones
+    // are merged) and the same places by size.
+    map<uint64_t, uint32_t> freeByOffset;
+    set<pair<uint32_t, uint64_t>> freeBySize;
+    string error;
+
+    int Fail(const string& what)
+    {
+        error = what;
+        return 1;
+    }
+
+    static uint32_t Granules(size_t size)
+    {
+        return (uint32_t) ((size + granularity - 1) / granularity);
+    }
+
+    static uint64_t ReadU64(const char *p)
+    {
+        uint64_t value = 0;
+        for(int i = 0; i < 8; ++i)
+            value |= (uint64_t) (uint8_t) p[i] << (8 * i);
+        return value;
+    }
+
+    static uint32_t ReadU32(const char *p)
+    {
+        uint32_t value = 0;
+        for(int i = 0; i < 4; ++i)
+            value |= (uint32_t) (uint8_t) p[i] << (8 * i);
+        return value;
+    }
+
+    // Where the states of @p record start, after its snapshot record and
+    // their count.
+    static size_t StatesOffset(string_view record)
+    {
+        return 4 + (size_t) ReadU32(record.data()) + 4;
+    }
+
+    void AddFree(uint64_t offset, uint32_t granules)
+    {
+        freeByOffset.emplace(offset, granules);
+        freeBySize.emplace(granules, offset);
+    }
+
+    void RemoveFree(map<uint64_t, uint32_t>::iterator place)
+    {
+        freeBySize.erase({place->second, place->first});
+        freeByOffset.erase(place);
+    }
+
+    bool WriteAt(uint64_t offset, const char *data, size_t size)
+    {
+        while(size > 0)
+        {
+            ssize_t written = pwrite(fd, data, size, (off_t) offset);
+            if(written < 0 && errno == EINTR)
+                continue;
+            if(written <= 0)
+                return false;
+            data += written;
+            size -= (size_t) written;
+            offset += (uint64_t) written;
+        }
+        return true;
+    }
+
+public:
+    static void WriteState(string& out, const SensorState& state)
+    {
+        Snapshot::WriteU64(out, (uint64_t) state.lastSeen);
+        Snapshot::WriteU64(out, (uint64_t) state.staleAt);
+        Snapshot::WriteU8(out, state.stale ? 1 : 0);
+        out.append((const char*) &state.detector, sizeof(AnomalyDetector));
+    }
+
+    static void WriteIntegrals(string& out, const vector<DerivedSensors::Integral>& integrals)
+    {
+        Snapshot::WriteU32(out, (uint32_t) integrals.size());
+        for(const DerivedSensors::Integral& integral : integrals)
+        {
+            Snapshot::WriteU64(out, (uint64_t) integral.time);
+            Snapshot::WriteF64(out, integral.value);
+        }
+    }
+
+    // The light integrals of @p record, after its sensor states.
+    static vector<DerivedSensors::Integral> ReadIntegrals(string_view record)
+    {
+        const char *p = record.data() + StatesOffset(record) + StateCount(record) * stateSize;
+        vector<DerivedSensors::Integral> integrals(ReadU32(p));
+        p += 4;
+        for(DerivedSensors::Integral& integral : integrals)
+        {
+            integral.time = (int64_t) ReadU64(p);
+            uint64_t bits = ReadU64(p + 8);
+            memcpy(&integral.value, &bits, sizeof(bits));
+            p += 16;
+        }
+        return integrals;
+    }
+
+    // The number of sensor states of @p record.
+    static size_t StateCount(string_view record)
+    {
+        return ReadU32(record.data() + StatesOffset(record) - 4);
+    }
+
+    // The state of the sensor @p index of @p record.
+    static SensorState ReadState(string_view record, size_t index)
+    {
+        const char *p = record.data() + StatesOffset(record) + index * stateSize;
+        SensorState state;
+        state.lastSeen = (int64_t) ReadU64(p);
+        state.staleAt = (int64_t) ReadU64(p + 8);
+        state.stale = p[16] != 0;
+        memcpy(&state.detector, p + 17, sizeof(AnomalyDetector));
+        return state;
+    }
+
+    ~ColdStore()
+    {
+        Close();
+    }
+
+    ///
+    /// @brief Creates the store at @p path, replacing the file.
+    ///
+    /// @returns 0 on success, 1 on failure (see @b Error).
+    ///
+    int Open(const string& path)
+    {
+        Close();
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if(fd < 0)
+            return Fail("cannot create " + path + ": " + strerror(errno));
+        unlink(path.c_str());
+        void *mapping = mmap(nullptr, maxSize, PROT_READ, MAP_SHARED | MAP_NORESERVE, fd, 0);
+        if(mapping == MAP_FAILED)
+        {
+            int code = errno;
+            close(fd);
+            fd = -1;
+            return Fail("cannot map " + path + ": " + strerror(code));
+        }
+        base = (const char*) mapping;
+        return 0;
+    }
+
+    void Close()
+    {
+        if(fd < 0)
+            return;
+        munmap((void*) base, maxSize);
+        close(fd);
+        fd = -1;
+        base = nullptr;
+        end = 0;
+        liveBytes = 0;
+        records = 0;
+        freeByOffset.clear();
+        freeBySize.clear();
+    }
+
+    bool IsOpen() const
+    {
+        return fd >= 0;
+    }
+
+    ///
+    /// @brief Writes @p record and gives its place in @p location.
+    ///
+    /// @returns 0 on success, 1 if it could not be written (see @b Error).
+    ///
+    int Put(string_view record, Location& location)
+    {
+        uint32_t granules = Granules(record.size());
+        uint64_t offset = end;
+        auto fit = freeBySize.lower_bound({granules, 0});
+        bool reused = fit != freeBySize.end();
+        if(reused)
+            offset = fit->second;
+        else if(end + (uint64_t) granules * granularity > maxSize)
+            return Fail("the cold store is full");
+        if(!WriteAt(offset, record.data(), record.size()))
+            return Fail(string("cannot write the cold store: ") + strerror(errno));
+        if(reused)
+        {
+            // The rest of the place stays free, the places around it are not.
+            uint32_t placeGranules = fit->first;
+            RemoveFree(freeByOffset.find(offset));
+            if(placeGranules > granules)
+                AddFree(offset + (uint64_t) granules * granularity, placeGranules - granules);
+        }
+        else
+        {
+            end += (uint64_t) granules * granularity;
+        }
+        location.offset = offset;
+        location.size = (uint32_t) record.size();
+        liveBytes += record.size();
+        records++;
+        return 0;
+    }
+
+    ///
+    /// @returns The record at @p location, valid until it is freed.
+    ///
+    string_view Read(const Location& location) const
+    {
+        return string_view(base + location.offset, location.size);
+    }
+
+    ///
+    /// @brief Replaces the state of the sensor @p index of the record at
+    /// @p location.
+    ///
+    /// @returns 0 on success, 1 if it could not be written.
+    ///
+    int WriteState(const Location& location, size_t index, const SensorState& state)
+    {
+        string bytes;
+        WriteState(bytes, state);
+        uint64_t offset = location.offset + StatesOffset(Read(location)) + index * stateSize;
+        return WriteAt(offset, bytes.data(), bytes.size()) ? 0 : 1;
+    }
+
+    // Gives the place of the record at @p location to the next ones.
+    void Free(const Location& location)
+    {
+        uint64_t offset = location.offset;
+        uint32_t granules = Granules(location.size);
+        auto next = freeByOffset.find(offset + (uint64_t) granules * granularity);
+        if(next != freeByOffset.end())
+        {
+            granules += next->second;
+            RemoveFree(next);
+        }
+        auto previous = freeByOffset.lower_bound(offset);
+        if(previous != freeByOffset.begin())
+        {
+            --previous;
+            if(previous->first + (uint64_t) previous->second * granularity == offset)
+            {
+                offset = previous->first;
+                granules += previous->second;
+                RemoveFree(previous);
+            }
+        }
+        // A place at the end is given back to the end.
+        if(offset + (uint64_t) granules * granularity == end)
+            end = offset;
+        else
+            AddFree(offset, granules);
+        liveBytes -= location.size;
+        records--;
+    }
+
+    const string& Error() const
+    {
+        return error;
+    }
+
+    // The size of the file, the records and the free places before the
+    // last one.
+    uint64_t Size() const
+    {
+        return end;
+    }
+
+    size_t LiveBytes() const
+    {
+        return liveBytes;
+    }
+
+    size_t Records() const
+    {
+        return records;
+    }
+};
+}
+
+#endif
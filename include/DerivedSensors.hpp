@@ -0,0 +1,454 @@
+///
+/// @file DerivedSensors.hpp
+///
+/// @brief Sensors computed from other sensors of a pot: the vapour pressure
+/// deficit and dew point (from temperature and humidity), the balance of
+/// the nutrients (from nitrogen, phosphorus and potassium) and the daily
+/// light integral (from luminosity).
+///
+/// A derived sensor is an ordinary sensor of the pot, with a value and
+/// thresholds, which is written when one of its inputs is. The
+/// @b DerivedGraph of a sensor set is built once, from the configuration:
+/// it gives for every input the derived sensors to compute again, in an
+/// order where the inputs of a derived sensor (which may be derived too)
+/// come first. The @b DerivedSensors of a pot holds the graph and the
+/// sensors of the pot it reads and writes, so a write only computes the
+/// sensors downstream of it and nothing is computed on reads.
+///
+#ifndef DERIVED_SENSORS_HPP
+#define DERIVED_SENSORS_HPP
+
+#include "Sensor.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace pot
+{
+class DerivedGraph
+{
+public:
+    enum Function : uint8_t
+    {
+        // A sensor read by the derived ones, not computed.
+        input,
+        // Vapour pressure deficit in kPa, from temperature and humidity.
+        vaporPressureDeficit,
+        // Dew point in degrees, from temperature and humidity.
+        dewPoint,
+        // The lowest of nitrogen, phosphorus and potassium over the highest,
+        // 1 when balanced.
+        npkBalance,
+        // Light received since midnight (UTC) in mol/m2, from luminosity.
+        dailyLightIntegral
+    };
+
+    static constexpr uint32_t noNode = UINT32_MAX;
+
+    struct Node
+    {
+        string name;
+        Function function;
+        vector<uint32_t> inputs;
+        // The derived nodes to compute again when this one is written, in
+        // order.
+        vector<uint32_t> cascade;
+    };
+
+private:
+    vector<Node> nodes;
+    map<string, uint32_t, less<>> ids;
+    // The nodes with a cascade.
+    vector<uint32_t> sources;
+    // Every derived node, inputs first.
+    vector<uint32_t> order;
+
+    uint32_t Intern(string_view name)
+    {
+        auto it = ids.find(name);
+        if(it != ids.end())
+            return it->second;
+        uint32_t id = (uint32_t) nodes.size();
+        nodes.push_back({string(name), input, {}, {}});
+        ids.emplace(string(name), id);
+        return id;
+    }
+
+    // Depth first, 1 while visiting and 2 once done.
+    bool Visit(uint32_t id, vector<uint8_t>& marks, string& error)
+    {
+        if(marks[id] == 2)
+            return true;
+        if(marks[id] == 1)
+        {
+            error = "derived sensor " + nodes[id].name + " depends on itself";
+            return false;
+        }
+        marks[id] = 1;
+        for(uint32_t inputId : nodes[id].inputs)
+        {
+            if(!Visit(inputId, marks, error))
+                return false;
+        }
+        marks[id] = 2;
+        if(nodes[id].function != input)
+            order.push_back(id);
+        return true;
+    }
+
+public:
+    ///
+    /// @returns The function called @p name, or input if there is none.
+    ///
+    static Function Parse(string_view name)
+    {
+        if(name == "vaporPressureDeficit")
+            return vaporPressureDeficit;
+        if(name == "dewPoint")
+            return dewPoint;
+        if(name == "npkBalance")
+            return npkBalance;
+        if(name == "dailyLightIntegral")
+            return dailyLightIntegral;
+        return input;
+    }
+
+    // The sensors a function reads when the configuration does not say.
+    static vector<string> DefaultInputs(Function function)
+    {
+        switch(function)
+        {
+        case vaporPressureDeficit:
+        case dewPoint:
+            return {"temperature", "humidity"};
+        case npkBalance:
+            return {"nitrogen", "phosphorus", "potassium"};
+        case dailyLightIntegral:
+            return {"luminosity"};
+        default:
+            return {};
+        }
+    }
+
+    ///
+    /// @brief Declares the derived sensor @p name, computed by @p function
+    /// from @p inputs.
+    ///
+    /// @returns 0 on success, 1 if the inputs do not suit the function or
+    /// the sensor is declared twice.
+    ///
+    int Add(string_view name, Function function, const vector<string>& inputs, string& error)
+    {
+        if(inputs.size() != DefaultInputs(function).size())
+        {
+            error = "derived sensor " + string(name) + " shall have "
+                    + to_string(DefaultInputs(function).size()) + " inputs";
+            return 1;
+        }
+        uint32_t id = Intern(name);
+        if(nodes[id].function != input)
+        {
+            error = "derived sensor " + string(name) + " is declared twice";
+            return 1;
+        }
+        nodes[id].function = function;
+        for(const string& inputName : inputs)
+        {
+            uint32_t inputId = Intern(inputName);
+            nodes[id].inputs.push_back(inputId);
+        }
+        return 0;
+    }
+
+    ///
+    /// @brief Orders the derived sensors and finds the cascade of every
+    /// node, once they are all added.
+    ///
+    /// @returns 0 on success, 1 if a derived sensor depends on itself.
+    ///
+    int Build(string& error)
+    {
+        order.clear();
+        sources.clear();
+        vector<uint8_t> marks(nodes.size(), 0);
+        for(uint32_t id = 0; id < nodes.size(); ++id)
+        {
+            if(!Visit(id, marks, error))
+                return 1;
+        }
+        // A derived node is in the cascade of a node if one of its inputs
+        // is the node or in its cascade, the order keeps the inputs first.
+        for(uint32_t id = 0; id < nodes.size(); ++id)
+        {
+            vector<bool> reached(nodes.size(), false);
+            reached[id] = true;
+            nodes[id].cascade.clear();
+            for(uint32_t derived : order)
+            {
+                for(uint32_t inputId : nodes[derived].inputs)
+                {
+                    if(reached[inputId])
+                    {
+                        reached[derived] = true;
+                        nodes[id].cascade.push_back(derived);
+                        break;
+                    }
+                }
+            }
+            if(!nodes[id].cascade.empty())
+                sources.push_back(id);
+        }
+        return 0;
+    }
+
+    uint32_t Find(string_view name) const
+    {
+        auto it = ids.find(name);
+        return it == ids.end() ? noNode : it->second;
+    }
+
+    const vector<Node>& Nodes() const
+    {
+        return nodes;
+    }
+
+    const vector<uint32_t>& Sources() const
+    {
+        return sources;
+    }
+
+    const vector<uint32_t>& Order() const
+    {
+        return order;
+    }
+};
+
+class DerivedSensors
+{
+public:
+    // A sensor of a pot with its name, as stored in the sensor maps.
+    using Entry = pair<const string, Sensor>;
+
+    // The luminosity integrated so far by a light integral.
+    struct Integral
+    {
+        int64_t time;
+        double value;
+    };
+
+    // Lux to photosynthetic photon flux (umol/m2/s) under sunlight.
+    static constexpr double luxToPhotonFlux = 0.0185;
+    // A luminosity is not taken as lasting longer than that many seconds
+    // without a new reading.
+    static constexpr int64_t maxLightGap = 3600;
+    // The temperatures (in C) given to the vapour pressure formulas, which
+    // stay finite within (Tetens and Magnus divide by T + 237.3 and
+    // T + 243.12).
+    static constexpr double minTemperature = -100;
+    static constexpr double maxTemperature = 100;
+
+private:
+    shared_ptr<const DerivedGraph> graph;
+    // The sensors of the pot by node, found again after a copy.
+    vector<Entry*> entries;
+    // By node, for the light integrals.
+    vector<Integral> integrals;
+
+    // NaN if the pot does not have the sensor, which makes the derived
+    // sensors depending on it keep their value.
+    double Value(uint32_t id) const
+    {
+        Entry *entry = entries[id];
+        return entry == nullptr ? NAN : entry->second.GetDoubleValue();
+    }
+
+    // A NaN stays NaN.
+    static double Temperature(double value)
+    {
+        return isnan(value) ? value : min(max(value, minTemperature), maxTemperature);
+    }
+
+    double Compute(uint32_t id)
+    {
+        const DerivedGraph::Node& node = graph->Nodes()[id];
+        switch(node.function)
+        {
+        case DerivedGraph::vaporPressureDeficit:
+        {
+            double temperature = Temperature(Value(node.inputs[0]));
+            double humidity = min(max(Value(node.inputs[1]), 0.0), 100.0);
+            // Tetens, in kPa.
+            double saturation = 0.6108 * exp(17.27 * temperature / (temperature + 237.3));
+            return saturation * (1 - humidity / 100);
+        }
+        case DerivedGraph::dewPoint:
+        {
+            double temperature = Temperature(Value(node.inputs[0]));
+            double humidity = min(max(Value(node.inputs[1]), 0.1), 100.0);
+            // Magnus.
+            double gamma = log(humidity / 100) + 17.62 * temperature / (243.12 + temperature);
+            return 243.12 * gamma / (17.62 - gamma);
+        }
+        case DerivedGraph::npkBalance:
+        {
+            double nitrogen = Value(node.inputs[0]);
+            double phosphorus = Value(node.inputs[1]);
+            double potassium = Value(node.inputs[2]);
+            double highest = max(nitrogen, max(phosphorus, potassium));
+            if(!(highest > 0))
+                return 0;
+            return max(min(nitrogen, min(phosphorus, potassium)), 0.0) / highest;
+        }
+        case DerivedGraph::dailyLightIntegral:
+        {
+            double current = entries[id]->second.GetDoubleValue();
+            if(entries[node.inputs[0]] == nullptr)
+                return current;
+            const Sensor& luminosity = entries[node.inputs[0]]->second;
+            Integral& integral = integrals[id];
+            int64_t now = luminosity.GetLastSeen();
+            // Readings without a time (outside a fleet) are not integrated.
+            if(now == 0 || now <= integral.time)
+                return current;
+            if(integral.time != 0)
+            {
+                // The previous luminosity lasted until now, or until
+                // midnight which restarts the integral.
+                int64_t midnight = now - now % 86400;
+                int64_t from = max(integral.time, midnight);
+                if(integral.time < midnight)
+                    current = 0;
+                int64_t seconds = min(now - from, maxLightGap);
+                current += integral.value * luxToPhotonFlux * (double) seconds / 1e6;
+            }
+            integral = {now, luminosity.GetDoubleValue()};
+            return current;
+        }
+        default:
+            return Value(id);
+        }
+    }
+
+    // Computes the derived sensor @p derived and writes it with @p apply
+    // when it comes out finite.
+    template<typename Apply>
+    void Write(uint32_t derived, Apply& apply)
+    {
+        if(entries[derived] == nullptr)
+            return;
+        double value = Compute(derived);
+        if(isfinite(value))
+            apply(*entries[derived], value);
+    }
+
+public:
+    DerivedSensors()
+    {
+
+    }
+
+    explicit DerivedSensors(shared_ptr<const DerivedGraph> _graph)
+        : graph(move(_graph))
+    {
+        if(graph)
+            integrals.resize(graph->Nodes().size(), {0, 0});
+    }
+
+    // A copy belongs to another pot, it finds its sensors again.
+    DerivedSensors(const DerivedSensors& other)
+        : graph(other.graph),
+          integrals(other.integrals)
+    {
+
+    }
+
+    DerivedSensors& operator=(const DerivedSensors& other)
+    {
+        graph = other.graph;
+        integrals = other.integrals;
+        entries.clear();
+        return *this;
+    }
+
+    const shared_ptr<const DerivedGraph>& Graph() const
+    {
+        return graph;
+    }
+
+    // What the light integrals integrated so far, by node.
+    const vector<Integral>& Integrals() const
+    {
+        return integrals;
+    }
+
+    // Takes over @p _integrals from a copy of the pot put aside, if they
+    // are of the same graph.
+    void SetIntegrals(vector<Integral> _integrals)
+    {
+        if(_integrals.size() == integrals.size())
+            integrals = move(_integrals);
+    }
+
+    // Whether the sensors of the pot were found, see Bind.
+    bool Bound() const
+    {
+        return graph == nullptr || !entries.empty();
+    }
+
+    ///
+    /// @brief Finds the sensors of the nodes with @p find(name), which
+    /// returns the entry of the pot or nullptr.
+    ///
+    template<typename Find>
+    void Bind(Find find)
+    {
+        if(graph == nullptr)
+            return;
+        entries.resize(graph->Nodes().size());
+        for(size_t id = 0; id < entries.size(); ++id)
+            entries[id] = find(graph->Nodes()[id].name);
+    }
+
+    ///
+    /// @brief Computes the derived sensors downstream of @p written and
+    /// calls @p apply(entry, value) for each one, in order, but for those
+    /// which do not come out finite (an input is missing, NaN or out of
+    /// range), which keep their value. The sensors shall be bound.
+    ///
+    template<typename Apply>
+    void Propagate(const Sensor& written, Apply apply)
+    {
+        if(graph == nullptr)
+            return;
+        for(uint32_t id : graph->Sources())
+        {
+            if(entries[id] == nullptr || &entries[id]->second != &written)
+                continue;
+            for(uint32_t derived : graph->Nodes()[id].cascade)
+                Write(derived, apply);
+            return;
+        }
+    }
+
+    // Computes every derived sensor, as Propagate.
+    template<typename Apply>
+    void ComputeAll(Apply apply)
+    {
+        if(graph == nullptr)
+            return;
+        for(uint32_t derived : graph->Order())
+            Write(derived, apply);
+    }
+};
+}
+
+#endif
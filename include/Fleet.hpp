@@ -0,0 +1,1126 @@
+///
+/// @file Fleet.hpp
+///
+/// @brief Class which holds all the @b SmartPot objects served by this
+/// process, indexed by their pot id, and keeps the fleet-wide data in
+/// sync with every change applied to them.
+///
+/// The fleet also notices the sensors which stopped reporting: every sensor
+/// has a timer in a @b TimingWheel which marks it stale once no reading came
+/// for the time-to-live. A reading only stamps the sensor, the timer checks
+/// the stamp when it fires and re-arms itself if a reading came meanwhile,
+/// so the readings never touch the wheel and nothing scans the fleet.
+///
+/// Pots can also be declared before they exist: a declared pot only costs
+/// its id until it is first read, when the hydrator of the fleet builds it.
+/// The fleet looks the same whether its pots were built or not yet.
+///
+/// The numeric readings are also kept compressed in a @b SensorHistory for
+/// a day, stamped with the clock of the fleet.
+///
+/// Every numeric reading goes through the @b AnomalyDetector of its sensor,
+/// the fleet queues an @b Anomaly each time the verdict of a detector
+/// changes, for the caller to publish (see TakeAnomalies).
+///
+/// With a @b ColdStore (see EnableTiering), the pots not used lately are
+/// evicted to it once the pots in memory take more than a budget, and read
+/// back when they are used again. A cold pot keeps its slot, so its row of
+/// the columns, its aggregates and its soil index entry stay as they were,
+/// and its stale sensors are still counted: only its sensors and plant
+/// leave the memory. Its timers are replaced by one timer for the pot,
+/// which marks its sensors stale in the store.
+///
+#ifndef FLEET_HPP
+#define FLEET_HPP
+
+#include "SmartPot.hpp"
+#include "ColdStore.hpp"
+#include "PotPool.hpp"
+#include "FleetAggregates.hpp"
+#include "FleetColumns.hpp"
+#include "SensorHistory.hpp"
+#include "SoilIndex.hpp"
+#include "TimingWheel.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace pot
+{
+class Fleet
+{
+    PotPool pots;
+    FleetAggregates aggregates;
+    SoilIndex soilIndex;
+    FleetColumns columns;
+
+    // The payload of a timer is the address of its sensor, the sensors do
+    // not move while their pot is in the fleet.
+    TimingWheel staleWheel;
+    // Current time in seconds since the epoch, moved by ExpireStale.
+    int64_t clock;
+    // 0 when the staleness is not tracked.
+    int64_t staleTtl = 0;
+    size_t staleCount = 0;
+    vector<uint64_t> expired;
+
+    // Declared pots not built yet, and what builds them.
+    set<int> pending;
+    function<SmartPot(int)> hydrator;
+
+    // Seconds of readings kept in the history.
+    static constexpr int64_t historyRetention = 24 * 3600;
+    SensorHistory history{historyRetention};
+
+    // The timers of the cold pots carry their id shifted left and this bit,
+    // which the sensor addresses never have.
+    static constexpr uint64_t coldTimer = 1;
+
+    struct ColdPot
+    {
+        ColdStore::Location location;
+        // Fires when the first of its sensors goes stale.
+        TimingWheel::Handle staleTimer = TimingWheel::noTimer;
+        shared_ptr<const DerivedGraph> derived;
+    };
+
+    ColdStore store;
+    unordered_map<int, ColdPot> cold;
+    // The bytes of the pots in memory above which Trim evicts some.
+    size_t memoryBudget = 0;
+    // The pots never evicted, whose address is kept.
+    set<int> pinned;
+    string coldRecord;
+
+public:
+    // How the pots in memory are used, see EnableTiering.
+    struct TierStats
+    {
+        // Get finding its pot in memory, and pots read back from the store.
+        uint64_t hits = 0;
+        uint64_t faults = 0;
+        uint64_t evictions = 0;
+        // The time spent reading the pots back.
+        uint64_t faultNanoseconds = 0;
+        uint64_t maxFaultNanoseconds = 0;
+    };
+    // A sensor whose readings became unusual, or usual again.
+    struct Anomaly
+    {
+        int potId;
+        string sensor;
+        // AnomalyDetector::Kind or'ed together, none once usual again.
+        uint8_t kinds;
+        double value;
+        // The mean the reading was compared to.
+        double mean;
+        double zScore;
+        // In units per second.
+        double rate;
+    };
+
+    // Anomalies queued at most, the next ones are dropped until taken.
+    static constexpr size_t maxAnomalies = 4096;
+
+private:
+    vector<Anomaly> anomalies;
+    uint64_t droppedAnomalies = 0;
+    TierStats tierStats;
+
+    static int64_t WallClock()
+    {
+        return chrono::duration_cast<chrono::seconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // A sensor just watched gets a whole time-to-live to report.
+    void Watch(Sensor& sensor)
+    {
+        if(staleTtl <= 0)
+            return;
+        sensor.SetStaleTimer(staleWheel.Insert(clock + staleTtl, (uint64_t) &sensor));
+    }
+
+    void Unwatch(Sensor& sensor)
+    {
+        staleWheel.Cancel(sensor.GetStaleTimer());
+        sensor.SetStaleTimer(TimingWheel::noTimer);
+        if(sensor.IsStale())
+        {
+            sensor.SetStale(false);
+            staleCount--;
+        }
+    }
+
+    template<typename Visit>
+    static void ForEachSensor(SmartPot& pot, Visit visit)
+    {
+        for(auto it = pot.GetSensors().begin(); it != pot.GetSensors().end(); ++it)
+        {
+            for(auto it2 = (it->second).begin(); it2 != (it->second).end(); ++it2)
+                visit(it2->second);
+        }
+    }
+
+    void WatchSensors(SmartPot& pot)
+    {
+        // Sensors copied from another pot bring its timers along.
+        ForEachSensor(pot, [this](Sensor& sensor)
+        {
+            sensor.SetStale(false);
+            sensor.SetStaleTimer(TimingWheel::noTimer);
+            Watch(sensor);
+        });
+    }
+
+    void UnwatchSensors(SmartPot& pot)
+    {
+        ForEachSensor(pot, [this](Sensor& sensor) { Unwatch(sensor); });
+    }
+
+    // Records a reading of @p sensor.
+    void Seen(Sensor& sensor)
+    {
+        sensor.SetLastSeen(clock);
+        if(sensor.IsStale())
+        {
+            sensor.SetStale(false);
+            staleCount--;
+            Watch(sensor);
+        }
+    }
+
+    // Runs the detector of @p sensor on its latest reading.
+    void Check(int potId, string_view name, Sensor& sensor)
+    {
+        AnomalyDetector& detector = sensor.GetDetector();
+        uint8_t before = detector.Kinds();
+        double mean = detector.Mean();
+        uint8_t kinds = detector.Update(sensor.GetDoubleValue(), clock,
+                                        sensor.GetMinValue(), sensor.GetMaxValue());
+        if(kinds == before)
+            return;
+        if(anomalies.size() >= maxAnomalies)
+        {
+            droppedAnomalies++;
+            return;
+        }
+        anomalies.push_back({potId, string(name), kinds, sensor.GetDoubleValue(),
+                             mean, detector.ZScore(), detector.RateOfChange()});
+    }
+
+    // Puts the pot in the soil index, or takes it out if it has no plant
+    // or no soilType sensor.
+    void IndexSoil(int potId, const SmartPot& pot)
+    {
+        const Sensor* soilType = pot.FindSensor("soilType");
+        if(!pot.HasPlant() || soilType == nullptr)
+            soilIndex.Remove(potId);
+        else
+            soilIndex.Update(potId, pot.GetPlant().GetSoil(), soilType->GetStringValue());
+    }
+
+    void AddToAggregates(const SmartPot& pot)
+    {
+        const string& plantType = pot.GetPlant().GetType();
+        for(auto it = pot.GetSensors().begin(); it != pot.GetSensors().end(); ++it)
+        {
+            for(auto it2 = (it->second).begin(); it2 != (it->second).end(); ++it2)
+                aggregates.Add(plantType, it2->first, it2->second);
+        }
+    }
+
+    void RemoveFromAggregates(const SmartPot& pot)
+    {
+        const string& plantType = pot.GetPlant().GetType();
+        for(auto it = pot.GetSensors().begin(); it != pot.GetSensors().end(); ++it)
+        {
+            for(auto it2 = (it->second).begin(); it2 != (it->second).end(); ++it2)
+                aggregates.Remove(plantType, it2->first, it2->second);
+        }
+    }
+
+    // Like Get, with the row of the pot in @p row.
+    SmartPot* Locate(int potId, uint32_t& row)
+    {
+        SmartPot* pot = pots.Get(potId, row);
+        if(pot != nullptr || (cold.empty() && pending.empty()))
+            return pot;
+        if(Get(potId) == nullptr)
+            return nullptr;
+        return pots.Get(potId, row);
+    }
+
+    static uint64_t ColdPayload(int potId)
+    {
+        return ((uint64_t) (uint32_t) potId << 1) | coldTimer;
+    }
+
+    ///
+    /// @brief Decodes the cold pot @p entry into @p pot, with the last
+    /// readings, staleness and detectors of its sensors but no timers.
+    ///
+    /// @returns 0 on success, 1 if its record is corrupt.
+    ///
+    int LoadCold(const ColdPot& entry, SmartPot& pot)
+    {
+        string_view record = store.Read(entry.location);
+        int potId;
+        if(SnapshotReader::DecodePot(record, potId, pot))
+            return 1;
+        size_t count = 0;
+        ForEachSensor(pot, [&count](Sensor&) { count++; });
+        if(count != ColdStore::StateCount(record))
+            return 1;
+        size_t index = 0;
+        ForEachSensor(pot, [&record, &index](Sensor& sensor)
+        {
+            ColdStore::SensorState state = ColdStore::ReadState(record, index++);
+            sensor.SetLastSeen(state.lastSeen);
+            sensor.SetStale(state.stale);
+            sensor.GetDetector() = state.detector;
+        });
+        return 0;
+    }
+
+    ///
+    /// @brief Reads the cold pot @p potId back into its slot, with timers
+    /// for its sensors which are not stale yet.
+    ///
+    /// @returns The pot or nullptr if @p potId is not a cold pot.
+    ///
+    SmartPot* FaultIn(int potId)
+    {
+        auto it = cold.find(potId);
+        if(it == cold.end())
+            return nullptr;
+        auto start = chrono::steady_clock::now();
+        SmartPot loaded;
+        if(LoadCold(it->second, loaded))
+            return nullptr;
+        ColdPot entry = move(it->second);
+        cold.erase(it);
+        staleWheel.Cancel(entry.staleTimer);
+
+        SmartPot* pot = pots.Thaw(potId, move(loaded));
+        string_view record = store.Read(entry.location);
+        if(entry.derived != nullptr)
+        {
+            pot->SetDerived(entry.derived);
+            pot->SetIntegrals(ColdStore::ReadIntegrals(record));
+        }
+        pot->Restart();
+        size_t index = 0;
+        ForEachSensor(*pot, [this, &record, &index](Sensor& sensor)
+        {
+            ColdStore::SensorState state = ColdStore::ReadState(record, index++);
+            sensor.SetStaleTimer(TimingWheel::noTimer);
+            if(!state.stale && state.staleAt > 0)
+                sensor.SetStaleTimer(staleWheel.Insert((uint64_t) state.staleAt, (uint64_t) &sensor));
+        });
+        store.Free(entry.location);
+
+        uint64_t elapsed = (uint64_t) chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - start).count();
+        tierStats.faults++;
+        tierStats.faultNanoseconds += elapsed;
+        tierStats.maxFaultNanoseconds = max(tierStats.maxFaultNanoseconds, elapsed);
+        return pot;
+    }
+
+    ///
+    /// @brief Marks stale the sensors of the cold pot @p potId whose time
+    /// came, and waits for the next one.
+    ///
+    /// @returns The number of sensors which just became stale.
+    ///
+    size_t ExpireCold(int potId)
+    {
+        auto it = cold.find(potId);
+        if(it == cold.end())
+            return 0;
+        ColdPot& entry = it->second;
+        entry.staleTimer = TimingWheel::noTimer;
+        string_view record = store.Read(entry.location);
+        size_t count = ColdStore::StateCount(record);
+        size_t newlyStale = 0;
+        int64_t next = 0;
+        for(size_t i = 0; i < count; ++i)
+        {
+            ColdStore::SensorState state = ColdStore::ReadState(record, i);
+            if(state.stale || state.staleAt == 0)
+                continue;
+            if(state.staleAt > clock)
+            {
+                if(next == 0 || state.staleAt < next)
+                    next = state.staleAt;
+                continue;
+            }
+            state.stale = true;
+            state.staleAt = 0;
+            store.WriteState(entry.location, i, state);
+            staleCount++;
+            newlyStale++;
+        }
+        if(next > 0)
+            entry.staleTimer = staleWheel.Insert((uint64_t) next, ColdPayload(potId));
+        return newlyStale;
+    }
+
+    // Applies a new time-to-live to the cold pots, as Watch and Unwatch do
+    // to the others.
+    void WatchCold()
+    {
+        for(auto& it : cold)
+        {
+            ColdPot& entry = it.second;
+            staleWheel.Cancel(entry.staleTimer);
+            entry.staleTimer = TimingWheel::noTimer;
+            string_view record = store.Read(entry.location);
+            size_t count = ColdStore::StateCount(record);
+            for(size_t i = 0; i < count; ++i)
+            {
+                ColdStore::SensorState state = ColdStore::ReadState(record, i);
+                if(state.stale)
+                    staleCount--;
+                state.stale = false;
+                state.staleAt = staleTtl > 0 ? clock + staleTtl : 0;
+                store.WriteState(entry.location, i, state);
+            }
+            if(staleTtl > 0 && count > 0)
+                entry.staleTimer = staleWheel.Insert((uint64_t) (clock + staleTtl), ColdPayload(it.first));
+        }
+    }
+
+    // Calls @p visit(potId, pot), with the pot read back if it is cold.
+    template<typename Visit>
+    void VisitPot(int potId, SmartPot& pot, Visit& visit)
+    {
+        if(!cold.empty())
+        {
+            auto it = cold.find(potId);
+            if(it != cold.end())
+            {
+                SmartPot loaded;
+                if(LoadCold(it->second, loaded) == 0)
+                    visit(potId, loaded);
+                return;
+            }
+        }
+        visit(potId, pot);
+    }
+
+    ///
+    /// @brief Applies @p change to the sensor @p name of pot @p potId,
+    /// keeping the fleet data in sync with it. The derived sensors reading
+    /// it are computed again if @p propagate.
+    ///
+    /// @returns 0 on success, 1 if the pot or the sensor does not exist.
+    ///
+    template<typename Change>
+    int Update(int potId, string_view name, Change change, bool propagate = true)
+    {
+        uint32_t row;
+        SmartPot* pot = Locate(potId, row);
+        if(pot == nullptr)
+            return 1;
+        SensorMap::value_type* entry = pot->FindEntry(name);
+        if(entry == nullptr)
+            return 1;
+        Sensor* sensor = &entry->second;
+        const string& plantType = pot->GetPlant().GetType();
+        aggregates.Remove(plantType, name, *sensor);
+        change(*sensor);
+        pot->Changed(*entry);
+        aggregates.Add(plantType, name, *sensor);
+        columns.SetSensor(row, name, *sensor);
+        if(name == "soilType")
+            IndexSoil(potId, *pot);
+        if(propagate)
+        {
+            pot->Propagate(*sensor, [&](SensorMap::value_type& derived, double value)
+            {
+                aggregates.Remove(plantType, derived.first, derived.second);
+                derived.second.SetValue(value);
+                Seen(derived.second);
+                Check(potId, derived.first, derived.second);
+                pot->Changed(derived);
+                aggregates.Add(plantType, derived.first, derived.second);
+                columns.SetSensor(row, derived.first, derived.second);
+                history.Append(potId, derived.first, clock, value);
+            });
+        }
+        return 0;
+    }
+
+public:
+    Fleet()
+        : Fleet(WallClock())
+    {
+
+    }
+
+    // A fleet whose clock starts at @p now (seconds since the epoch)
+    // rather than at the current time, to replay past readings.
+    explicit Fleet(int64_t now)
+        : staleWheel((uint64_t) now),
+          clock(now)
+    {
+
+    }
+
+    ///
+    /// @brief Adds a new pot to the fleet.
+    ///
+    /// @returns 0 on success, 1 if a pot with the same id already exists.
+    ///
+    int Add(int potId, SmartPot pot)
+    {
+        if(pending.find(potId) != pending.end())
+            return 1;
+        SmartPot* added = pots.Insert(potId, move(pot));
+        if(added == nullptr)
+            return 1;
+        added->Restart();
+        uint32_t row;
+        pots.Get(potId, row);
+        columns.SetPot(row, potId, *added);
+        AddToAggregates(*added);
+        IndexSoil(potId, *added);
+        WatchSensors(*added);
+        return 0;
+    }
+
+    ///
+    /// @brief Adds pot @p potId, or replaces its plant and sensors if it
+    /// already exists (the pot keeps its storage, so pointers to it stay
+    /// valid).
+    ///
+    void Put(int potId, SmartPot pot)
+    {
+        // A declared pot is replaced before it is ever built, a cold one
+        // comes back first to leave the fleet data.
+        pending.erase(potId);
+        if(!cold.empty())
+            FaultIn(potId);
+        uint32_t row;
+        SmartPot* existing = pots.Get(potId, row);
+        if(existing == nullptr)
+        {
+            Add(potId, move(pot));
+            return;
+        }
+        RemoveFromAggregates(*existing);
+        UnwatchSensors(*existing);
+        *existing = move(pot);
+        existing->Restart();
+        pots.Measure(potId);
+        columns.ClearRow(row);
+        columns.SetPot(row, potId, *existing);
+        AddToAggregates(*existing);
+        IndexSoil(potId, *existing);
+        WatchSensors(*existing);
+    }
+
+    ///
+    /// @brief Like @b Put for pot @p potId handed over by its previous
+    /// owner, but the sensors read here after the reading of theirs in
+    /// @p pot are kept: the owner changes before the pot is sent, so the
+    /// readings of the meantime come here and are newer than the copy.
+    ///
+    void Merge(int potId, SmartPot pot)
+    {
+        if(!cold.empty())
+            FaultIn(potId);
+        SmartPot* existing = pots.Get(potId);
+        if(existing != nullptr)
+        {
+            bool kept = false;
+            for(auto& group : existing->GetSensors())
+            {
+                auto theirs = pot.GetSensors().find(group.first);
+                if(theirs == pot.GetSensors().end())
+                    continue;
+                for(auto& entry : group.second)
+                {
+                    auto sensor = theirs->second.find(entry.first);
+                    if(sensor != theirs->second.end()
+                       && entry.second.GetLastSeen() > sensor->second.GetLastSeen())
+                    {
+                        sensor->second = entry.second;
+                        kept = true;
+                    }
+                }
+            }
+            // The derived sensors follow the sensors kept.
+            if(kept && pot.GetDerived())
+                pot.SetDerived(pot.GetDerived());
+        }
+        Put(potId, move(pot));
+    }
+
+    ///
+    /// @brief Removes a pot from the fleet and from the fleet data, its
+    /// storage is reused by the next pot added.
+    ///
+    /// @returns 0 on success, 1 if the pot does not exist.
+    ///
+    int Remove(int potId)
+    {
+        if(pending.erase(potId) != 0)
+            return 0;
+        if(!cold.empty())
+            FaultIn(potId);
+        uint32_t row;
+        SmartPot* pot = pots.Get(potId, row);
+        if(pot == nullptr)
+            return 1;
+        columns.ClearRow(row);
+        RemoveFromAggregates(*pot);
+        soilIndex.Remove(potId);
+        UnwatchSensors(*pot);
+        history.RemovePot(potId);
+        return pots.Erase(potId);
+    }
+
+    ///
+    /// @returns The pot with the given id or nullptr if there is none. The
+    /// pot shall only be read through this pointer, changes go through
+    /// @b Set, @b SetValue, @b SetThresholds and @b SetPlant so that the
+    /// fleet data stays in sync.
+    ///
+    SmartPot* Get(int potId)
+    {
+        SmartPot* pot = pots.Get(potId);
+        if(pot != nullptr)
+        {
+            tierStats.hits++;
+            return pot;
+        }
+        if(!cold.empty())
+            pot = FaultIn(potId);
+        if(pot == nullptr && !pending.empty())
+            pot = Hydrate(potId);
+        return pot;
+    }
+
+    ///
+    /// @brief Sets the function building the declared pots.
+    ///
+    void SetHydrator(function<SmartPot(int)> _hydrator)
+    {
+        hydrator = move(_hydrator);
+    }
+
+    ///
+    /// @brief Declares pot @p potId, which is built by the hydrator when it
+    /// is first read.
+    ///
+    /// @returns 0 on success, 1 if a pot with the same id already exists.
+    ///
+    int Declare(int potId)
+    {
+        if(pots.Contains(potId))
+            return 1;
+        return pending.insert(potId).second ? 0 : 1;
+    }
+
+    ///
+    /// @brief Builds the declared pot @p potId now.
+    ///
+    /// @returns The pot or nullptr if @p potId is not a declared pot.
+    ///
+    SmartPot* Hydrate(int potId)
+    {
+        auto it = pending.find(potId);
+        if(it == pending.end() || !hydrator)
+            return nullptr;
+        pending.erase(it);
+        Add(potId, hydrator(potId));
+        return pots.Get(potId);
+    }
+
+    ///
+    /// @brief Builds at most @p count declared pots, the lowest ids first,
+    /// so that the fleet can be filled in the background.
+    ///
+    /// @returns The number of declared pots left.
+    ///
+    size_t HydrateSome(size_t count)
+    {
+        while(count-- > 0 && !pending.empty())
+            Hydrate(*pending.begin());
+        return pending.size();
+    }
+
+    // True if pot @p potId is declared and not built yet.
+    bool IsDeclared(int potId) const
+    {
+        return pending.find(potId) != pending.end();
+    }
+
+    // Number of declared pots not built yet.
+    size_t Pending() const
+    {
+        return pending.size();
+    }
+
+    ///
+    /// @brief Calls @p visit(potId, pot) for at most @p limit pots in pot id
+    /// order, starting from @p potId. Like @b Get, the pots shall only be
+    /// read.
+    ///
+    /// @returns The id to continue from or -1 after the last pot.
+    ///
+    /// The cold pots are visited as read from the store, they stay cold.
+    ///
+    template<typename Visit>
+    int ForEachFrom(int potId, size_t limit, Visit visit)
+    {
+        // The first limit pots from potId are among the first limit built
+        // and the first limit declared ones.
+        auto it = pending.lower_bound(potId);
+        for(size_t i = 0; i < limit && it != pending.end(); ++i)
+            Hydrate(*it++);
+        int next = pots.ForEachFrom(potId, limit, [this, &visit](int id, SmartPot& pot)
+        {
+            VisitPot(id, pot, visit);
+        });
+        it = pending.lower_bound(potId);
+        if(it != pending.end() && (next < 0 || *it < next))
+            next = *it;
+        return next;
+    }
+
+    ///
+    /// @brief Calls @p visit(potId, pot) for every pot, in storage order.
+    /// Like @b Get, the pots shall only be read.
+    ///
+    template<typename Visit>
+    void ForEach(Visit visit)
+    {
+        HydrateSome(pending.size());
+        pots.ForEach([this, &visit](int id, SmartPot& pot) { VisitPot(id, pot, visit); });
+    }
+
+    ///
+    /// @brief Replaces the sensor @p name of pot @p potId with @p value,
+    /// which counts as a reading.
+    ///
+    /// @returns 0 on success, 1 if the pot or the sensor does not exist.
+    ///
+    int Set(int potId, string_view name, const Sensor& value)
+    {
+        int result = Update(potId, name, [this, potId, name, &value](Sensor& sensor)
+        {
+            // The staleness and the detector of the sensor are ours, not
+            // part of the value.
+            bool stale = sensor.IsStale();
+            uint64_t staleTimer = sensor.GetStaleTimer();
+            AnomalyDetector detector = sensor.GetDetector();
+            sensor = value;
+            sensor.SetStale(stale);
+            sensor.SetStaleTimer(staleTimer);
+            sensor.GetDetector() = detector;
+            Seen(sensor);
+            if(sensor.IsNumeric())
+                Check(potId, name, sensor);
+        });
+        if(result == 0 && value.IsNumeric())
+            history.Append(potId, name, clock, value.GetDoubleValue());
+        return result;
+    }
+
+    ///
+    /// @brief Applies a reading to the sensor @p name of pot @p potId, and
+    /// checks it for anomalies.
+    ///
+    /// @returns 0 on success, 1 if the pot or the sensor does not exist.
+    ///
+    int SetValue(int potId, string_view name, double value)
+    {
+        int result = Update(potId, name, [this, potId, name, value](Sensor& sensor)
+        {
+            sensor.SetValue(value);
+            Seen(sensor);
+            Check(potId, name, sensor);
+        });
+        if(result == 0)
+            history.Append(potId, name, clock, value);
+        return result;
+    }
+    int SetValue(int potId, string_view name, string_view value)
+    {
+        return Update(potId, name, [this, value](Sensor& sensor)
+        {
+            sensor.SetValue(value);
+            Seen(sensor);
+        });
+    }
+
+    ///
+    /// @brief Changes the min and max values of the sensor @p name of pot
+    /// @p potId.
+    ///
+    /// @returns 0 on success, 1 if the pot or the sensor does not exist.
+    ///
+    int SetThresholds(int potId, string_view name, double minValue, double maxValue)
+    {
+        return Update(potId, name, [minValue, maxValue](Sensor& sensor)
+        {
+            sensor.SetMinValue(minValue);
+            sensor.SetMaxValue(maxValue);
+        }, false);
+    }
+
+    ///
+    /// @brief Changes the plant of pot @p potId, which moves all of its
+    /// sensors to the aggregates of the new plant type and re-checks its
+    /// soil compatibility.
+    ///
+    /// @returns 0 on success, 1 if the pot does not exist.
+    ///
+    int SetPlant(int potId, Plant plant)
+    {
+        uint32_t row;
+        SmartPot* pot = Locate(potId, row);
+        if(pot == nullptr)
+            return 1;
+        string oldType = pot->GetPlant().GetType();
+        pot->SetPlant(move(plant));
+        columns.SetPlant(row, pot->GetPlant());
+        IndexSoil(potId, *pot);
+        const string& newType = pot->GetPlant().GetType();
+        if(oldType == newType)
+            return 0;
+        for(auto it = pot->GetSensors().begin(); it != pot->GetSensors().end(); ++it)
+        {
+            for(auto it2 = (it->second).begin(); it2 != (it->second).end(); ++it2)
+            {
+                aggregates.Remove(oldType, it2->first, it2->second);
+                aggregates.Add(newType, it2->first, it2->second);
+            }
+        }
+        return 0;
+    }
+
+    ///
+    /// @brief Gives pot @p potId the plant, the thresholds, the rate limits
+    /// and the derived sensors of @p configured, for the sensors both pots have. The
+    /// readings of the pot are kept.
+    ///
+    /// @returns 0 on success, 1 if the pot does not exist.
+    ///
+    int Reconfigure(int potId, const SmartPot& configured)
+    {
+        // A cold pot is changed in memory and goes back to the store.
+        bool wasCold = IsCold(potId);
+        if(Get(potId) == nullptr)
+            return 1;
+        uint32_t row;
+        SmartPot* pot = Locate(potId, row);
+        // The derived sensors are computed again with the new graph.
+        if(pot->GetDerived() != configured.GetDerived())
+        {
+            RemoveFromAggregates(*pot);
+            pot->SetDerived(configured.GetDerived());
+            columns.ClearRow(row);
+            columns.SetPot(row, potId, *pot);
+            AddToAggregates(*pot);
+        }
+        SetPlant(potId, configured.GetPlant());
+        for(auto it = configured.GetSensors().begin(); it != configured.GetSensors().end(); ++it)
+        {
+            for(auto it2 = (it->second).begin(); it2 != (it->second).end(); ++it2)
+            {
+                const Sensor& sensor = it2->second;
+                Update(potId, it2->first, [&sensor](Sensor& current)
+                {
+                    current.SetMinValue(sensor.GetMinValue());
+                    current.SetMaxValue(sensor.GetMaxValue());
+                    current.GetDetector().SetMaxRate(sensor.GetDetector().GetMaxRate());
+                }, false);
+            }
+        }
+        if(wasCold)
+            Evict(potId);
+        return 0;
+    }
+
+    ///
+    /// @brief Sets the time-to-live of the readings in seconds, 0 stops
+    /// tracking the staleness. A shorter time-to-live applies to a sensor
+    /// once its current timer fires.
+    ///
+    void SetStaleTtl(int64_t ttl)
+    {
+        int64_t previous = staleTtl;
+        staleTtl = ttl > 0 ? ttl : 0;
+        if(staleTtl == 0 && previous > 0)
+            pots.ForEach([this](int, SmartPot& pot) { UnwatchSensors(pot); });
+        else if(staleTtl > 0 && previous == 0)
+            pots.ForEach([this](int, SmartPot& pot) { WatchSensors(pot); });
+        if((staleTtl == 0) != (previous == 0))
+            WatchCold();
+    }
+
+    int64_t GetStaleTtl() const
+    {
+        return staleTtl;
+    }
+
+    ///
+    /// @brief Moves the clock of the fleet to @p now (seconds since the
+    /// epoch) and marks stale the sensors whose last reading is older than
+    /// the time-to-live. Meant to be called every second, it only costs as
+    /// much as the timers which fire.
+    ///
+    /// @returns The number of sensors which just became stale.
+    ///
+    size_t ExpireStale(int64_t now)
+    {
+        if(now <= clock)
+            return 0;
+        clock = now;
+        expired.clear();
+        staleWheel.Advance((uint64_t) now, expired);
+
+        size_t newlyStale = 0;
+        for(uint64_t payload : expired)
+        {
+            if(payload & coldTimer)
+            {
+                newlyStale += ExpireCold((int) (payload >> 1));
+                continue;
+            }
+            Sensor* sensor = (Sensor*) payload;
+            int64_t deadline = sensor->GetLastSeen() + staleTtl;
+            if(deadline > now)
+            {
+                sensor->SetStaleTimer(staleWheel.Insert(deadline, payload));
+                continue;
+            }
+            sensor->SetStaleTimer(TimingWheel::noTimer);
+            sensor->SetStale(true);
+            staleCount++;
+            newlyStale++;
+        }
+        return newlyStale;
+    }
+
+    // Number of sensors of the fleet which are stale.
+    size_t StaleCount() const
+    {
+        return staleCount;
+    }
+
+    size_t Size() const
+    {
+        return pots.Size() + pending.size();
+    }
+
+    const FleetAggregates& Aggregates() const
+    {
+        return aggregates;
+    }
+
+    const SoilIndex& Soils() const
+    {
+        return soilIndex;
+    }
+
+    ///
+    /// @brief The sensors and plants of the built pots, column by column.
+    /// Declared pots are only there once built, see @b HydrateSome.
+    ///
+    const FleetColumns& Columns() const
+    {
+        return columns;
+    }
+
+    ///
+    /// @brief Moves the anomalies queued since the last call to @p out,
+    /// which is cleared first.
+    ///
+    void TakeAnomalies(vector<Anomaly>& out)
+    {
+        out.clear();
+        out.swap(anomalies);
+    }
+
+    // Anomalies dropped because the queue was full.
+    uint64_t DroppedAnomalies() const
+    {
+        return droppedAnomalies;
+    }
+
+    // The past numeric readings of the pots.
+    const SensorHistory& History() const
+    {
+        return history;
+    }
+
+    ///
+    /// @brief Lets the fleet evict the pots not used lately to a cold store
+    /// created at @p path, once the pots in memory take more than
+    /// @p budget bytes (see @b Trim). The pots are read back when used.
+    /// The slabs taken from then on share their arena, so the memory of an
+    /// evicted pot goes to the next pot read back wherever its slot is.
+    ///
+    /// @returns 0 on success, 1 if the store could not be created (see
+    /// @b TieringError).
+    ///
+    int EnableTiering(const string& path, size_t budget)
+    {
+        if(!cold.empty() || store.Open(path))
+            return 1;
+        memoryBudget = budget;
+        pots.ShareArena();
+        return 0;
+    }
+
+    const string& TieringError() const
+    {
+        return store.Error();
+    }
+
+    void SetMemoryBudget(size_t budget)
+    {
+        memoryBudget = budget;
+    }
+
+    size_t GetMemoryBudget() const
+    {
+        return memoryBudget;
+    }
+
+    // Keeps pot @p potId in memory, so a pointer to it stays valid.
+    void Pin(int potId)
+    {
+        pinned.insert(potId);
+    }
+
+    ///
+    /// @brief Moves pot @p potId to the cold store. The pointers to the pot
+    /// and its sensors are no longer valid.
+    ///
+    /// @returns 0 on success, 1 if there is no store, the pot is not in
+    /// memory or pinned, or its record could not be written.
+    ///
+    int Evict(int potId)
+    {
+        if(!store.IsOpen() || pinned.find(potId) != pinned.end())
+            return 1;
+        SmartPot* pot = pots.Get(potId);
+        if(pot == nullptr)
+            return 1;
+
+        coldRecord.clear();
+        Snapshot::WritePot(coldRecord, potId, *pot);
+        size_t countAt = coldRecord.size();
+        Snapshot::WriteU32(coldRecord, 0);
+        uint32_t count = 0;
+        int64_t firstStale = 0;
+        ForEachSensor(*pot, [this, &count, &firstStale](Sensor& sensor)
+        {
+            ColdStore::SensorState state;
+            state.lastSeen = sensor.GetLastSeen();
+            state.stale = sensor.IsStale();
+            state.detector = sensor.GetDetector();
+            // When its timer would find no reading since the last one.
+            if(!state.stale && staleTtl > 0)
+            {
+                state.staleAt = max((int64_t) staleWheel.Expires(sensor.GetStaleTimer()),
+                                    state.lastSeen + staleTtl);
+                if(firstStale == 0 || state.staleAt < firstStale)
+                    firstStale = state.staleAt;
+            }
+            ColdStore::WriteState(coldRecord, state);
+            count++;
+        });
+        for(int i = 0; i < 4; ++i)
+            coldRecord[countAt + i] = (char) (count >> (8 * i));
+        ColdStore::WriteIntegrals(coldRecord, pot->GetDerivedSensors().Integrals());
+
+        ColdPot entry;
+        if(store.Put(coldRecord, entry.location))
+            return 1;
+        // The stale sensors stay counted while cold.
+        ForEachSensor(*pot, [this](Sensor& sensor) { staleWheel.Cancel(sensor.GetStaleTimer()); });
+        entry.derived = pot->GetDerived();
+        if(firstStale > 0)
+            entry.staleTimer = staleWheel.Insert((uint64_t) firstStale, ColdPayload(potId));
+        pots.Freeze(potId);
+        cold.emplace(potId, move(entry));
+        tierStats.evictions++;
+        return 0;
+    }
+
+    ///
+    /// @brief Evicts the pots not used lately until the pots in memory take
+    /// at most the budget. Meant to be called every second: the pots read
+    /// back in between take memory above the budget until then, and the
+    /// pointers to the pots are only valid until then.
+    ///
+    /// @returns The number of pots evicted.
+    ///
+    size_t Trim()
+    {
+        size_t evicted = 0;
+        if(!store.IsOpen())
+            return 0;
+        while(pots.HotBytes() > memoryBudget)
+        {
+            int potId = pots.Sweep([this](int id) { return pinned.find(id) != pinned.end(); });
+            if(potId < 0 || Evict(potId))
+                break;
+            evicted++;
+        }
+        return evicted;
+    }
+
+    // True if pot @p potId is in the cold store.
+    bool IsCold(int potId) const
+    {
+        return !cold.empty() && cold.find(potId) != cold.end();
+    }
+
+    size_t ColdPots() const
+    {
+        return cold.size();
+    }
+
+    size_t HotPots() const
+    {
+        return pots.Size() - cold.size();
+    }
+
+    // The memory of the pots in memory, as PotPool::Footprint counts it.
+    size_t HotBytes() const
+    {
+        return pots.HotBytes();
+    }
+
+    const TierStats& Tiering() const
+    {
+        return tierStats;
+    }
+
+    const ColdStore& Store() const
+    {
+        return store;
+    }
+};
+}
+
+#endif
@@ -0,0 +1,304 @@
+///
+/// @file FleetAggregates.hpp
+///
+/// @brief Running aggregates (count, sum, min, max, out-of-range count and
+/// approximate percentiles) of the sensor values across the whole fleet,
+/// per sensor kind and per plant type.
+///
+#ifndef FLEET_AGGREGATES_HPP
+#define FLEET_AGGREGATES_HPP
+
+#include "Sensor.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace pot
+{
+///
+/// @brief Mergeable quantile sketch with a relative accuracy guarantee
+/// (the DDSketch idea): values are counted in logarithmically sized
+/// buckets, so adding or removing a value is O(1) and two sketches are
+/// merged by adding their bucket counts.
+///
+class QuantileSketch
+{
+    // Dense bucket counts for the indexes [offset, offset + size).
+    class Store
+    {
+        vector<int64_t> counts;
+        int offset = 0;
+    public:
+        void Add(int index, int64_t delta)
+        {
+            if(counts.empty())
+            {
+                counts.assign(1, 0);
+                offset = index;
+            }
+            else if(index < offset)
+            {
+                counts.insert(counts.begin(), offset - index, 0);
+                offset = index;
+            }
+            else if(index >= offset + (int)counts.size())
+            {
+                counts.resize(index - offset + 1, 0);
+            }
+            counts[index - offset] += delta;
+        }
+        void Merge(const Store& other)
+        {
+            for(size_t i = 0; i < other.counts.size(); ++i)
+                if(other.counts[i] != 0)
+                    Add(other.offset + (int)i, other.counts[i]);
+        }
+        int Offset() const
+        {
+            return offset;
+        }
+        const vector<int64_t>& Counts() const
+        {
+            return counts;
+        }
+    };
+
+    // Values closer to zero than this all land in the zero bucket.
+    static constexpr double minIndexable = 1e-9;
+    // The bucket indexes are kept within this distance of zero, which
+    // bounds the size of the stores whatever the accuracy.
+    static constexpr int maxIndex = 1 << 16;
+
+    double gamma;
+    double logGamma;
+    Store positive;
+    Store negative;
+    int64_t zeroCount = 0;
+    int64_t count = 0;
+
+    int Index(double absValue) const
+    {
+        double index = ceil(log(absValue) / logGamma);
+        return (int)max(-(double)maxIndex, min((double)maxIndex, index));
+    }
+    double Value(int index) const
+    {
+        return 2 * pow(gamma, index) / (gamma + 1);
+    }
+    void Update(double value, int64_t delta)
+    {
+        // Not counted, see SensorAggregate::Add.
+        if(!isfinite(value))
+            return;
+        if(value > minIndexable)
+            positive.Add(Index(value), delta);
+        else if(value < -minIndexable)
+            negative.Add(Index(-value), delta);
+        else
+            zeroCount += delta;
+        count += delta;
+    }
+
+public:
+    ///
+    /// @param relativeAccuracy Every returned quantile is within this
+    /// relative distance of an actual value.
+    ///
+    QuantileSketch(double relativeAccuracy = 0.01)
+    {
+        gamma = (1 + relativeAccuracy) / (1 - relativeAccuracy);
+        logGamma = log(gamma);
+    }
+
+    void Add(double value)
+    {
+        Update(value, 1);
+    }
+    void Remove(double value)
+    {
+        Update(value, -1);
+    }
+    void Merge(const QuantileSketch& other)
+    {
+        positive.Merge(other.positive);
+        negative.Merge(other.negative);
+        zeroCount += other.zeroCount;
+        count += other.count;
+    }
+    int64_t Count() const
+    {
+        return count;
+    }
+
+    ///
+    /// @brief Approximate value at quantile @p q (between 0 and 1).
+    /// Costs one pass over the buckets, whose number only depends on the
+    /// range of the values and never on how many were added.
+    ///
+    double Quantile(double q) const
+    {
+        if(count <= 0)
+            return 0;
+        int64_t rank = (int64_t)(q * (count - 1));
+        int64_t seen = 0;
+
+        // The most negative values have the biggest indexes.
+        const vector<int64_t>& neg = negative.Counts();
+        for(size_t i = neg.size(); i-- > 0; )
+        {
+            seen += neg[i];
+            if(seen > rank)
+                return -Value(negative.Offset() + (int)i);
+        }
+        seen += zeroCount;
+        if(seen > rank)
+            return 0;
+        const vector<int64_t>& pos = positive.Counts();
+        for(size_t i = 0; i < pos.size(); ++i)
+        {
+            seen += pos[i];
+            if(seen > rank)
+                return Value(positive.Offset() + (int)i);
+        }
+        return 0;
+    }
+};
+
+///
+/// @brief Aggregate of the current numeric value of one sensor kind over a
+/// set of pots. Every pot contributes its latest reading, so a new reading
+/// removes the previous one before being added.
+///
+class SensorAggregate
+{
+    int64_t count = 0;
+    double sum = 0;
+    int64_t outOfRange = 0;
+    QuantileSketch sketch;
+
+    static bool IsOutOfRange(const Sensor& sensor)
+    {
+        return sensor.GetDoubleValue() < sensor.GetMinValue()
+            || sensor.GetDoubleValue() > sensor.GetMaxValue();
+    }
+
+public:
+    // The infinite and NaN values are left out, they would stay in the sum
+    // once removed.
+    void Add(const Sensor& sensor)
+    {
+        if(!sensor.IsNumeric() || !isfinite(sensor.GetDoubleValue()))
+            return;
+        count++;
+        sum += sensor.GetDoubleValue();
+        outOfRange += IsOutOfRange(sensor);
+        sketch.Add(sensor.GetDoubleValue());
+    }
+    void Remove(const Sensor& sensor)
+    {
+        if(!sensor.IsNumeric() || !isfinite(sensor.GetDoubleValue()))
+            return;
+        count--;
+        sum -= sensor.GetDoubleValue();
+        outOfRange -= IsOutOfRange(sensor);
+        sketch.Remove(sensor.GetDoubleValue());
+    }
+    void Merge(const SensorAggregate& other)
+    {
+        count += other.count;
+        sum += other.sum;
+        outOfRange += other.outOfRange;
+        sketch.Merge(other.sketch);
+    }
+
+    int64_t GetCount() const
+    {
+        return count;
+    }
+    double GetSum() const
+    {
+        return sum;
+    }
+    double GetMean() const
+    {
+        return count > 0 ? sum / count : 0;
+    }
+    int64_t GetOutOfRange() const
+    {
+        return outOfRange;
+    }
+    // Min and max come from the sketch, so they are as accurate as the
+    // percentiles (1% relative error).
+    double GetMin() const
+    {
+        return sketch.Quantile(0);
+    }
+    double GetMax() const
+    {
+        return sketch.Quantile(1);
+    }
+    double GetPercentile(double q) const
+    {
+        return sketch.Quantile(q);
+    }
+};
+
+///
+/// @brief The aggregates of the whole fleet, per sensor kind (the sensor
+/// name) and per plant type and sensor kind.
+///
+class FleetAggregates
+{
+public:
+    using SensorAggregates = map<string, SensorAggregate, less<>>;
+
+private:
+    SensorAggregates bySensor;
+    map<string, SensorAggregates, less<>> byPlantType;
+
+    // Looks the key up without building a string, which is only needed
+    // the first time a key is seen.
+    template<typename Map>
+    static typename Map::mapped_type& Entry(Map& m, string_view key)
+    {
+        auto it = m.find(key);
+        if(it == m.end())
+            it = m.emplace(string(key), typename Map::mapped_type()).first;
+        return it->second;
+    }
+
+public:
+    void Add(string_view plantType, string_view name, const Sensor& sensor)
+    {
+        if(!sensor.IsNumeric())
+            return;
+        Entry(bySensor, name).Add(sensor);
+        Entry(Entry(byPlantType, plantType), name).Add(sensor);
+    }
+    void Remove(string_view plantType, string_view name, const Sensor& sensor)
+    {
+        if(!sensor.IsNumeric())
+            return;
+        Entry(bySensor, name).Remove(sensor);
+        Entry(Entry(byPlantType, plantType), name).Remove(sensor);
+    }
+
+    const SensorAggregates& BySensor() const
+    {
+        return bySensor;
+    }
+    const map<string, SensorAggregates, less<>>& ByPlantType() const
+    {
+        return byPlantType;
+    }
+};
+}
+
+#endif
@@ -0,0 +1,212 @@
+///
+/// @file FleetColumns.hpp
+///
+/// @brief The sensors and plants of a @b Fleet stored column by column: one
+/// array per sensor name for the values, another for the min thresholds and
+/// so on, indexed by the row of the pot in its @b PotPool. A question about
+/// one or two sensors of every pot then reads a few contiguous arrays
+/// instead of visiting the sensor maps of every pot.
+///
+/// The strings (plant types, soil types...) are stored as codes of one
+/// dictionary, so comparing them is comparing integers.
+///
+#ifndef FLEET_COLUMNS_HPP
+#define FLEET_COLUMNS_HPP
+
+#include "SmartPot.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+namespace pot
+{
+class FleetColumns
+{
+public:
+    // The code of no string, for the rows without one.
+    static constexpr uint32_t noCode = 0;
+    // The code of a string no row holds, it matches nothing.
+    static constexpr uint32_t unknownCode = UINT32_MAX;
+
+    struct SensorColumn
+    {
+        // NaN for the string sensors.
+        vector<double> value;
+        vector<double> minValue;
+        vector<double> maxValue;
+        // Codes of the string values, only allocated once the sensor has
+        // been given a string.
+        vector<uint32_t> text;
+        // 1 for the rows whose pot has this sensor.
+        vector<uint8_t> present;
+    };
+
+    struct PlantColumns
+    {
+        vector<uint32_t> type;
+        vector<uint32_t> species;
+        vector<uint32_t> soil;
+    };
+
+private:
+    size_t rows = 0;
+    // The pot id of every row, -1 for the empty rows.
+    vector<int> potIds;
+    PlantColumns plants;
+    // The columns do not move when others are added.
+    map<string, unique_ptr<SensorColumn>, less<>> sensors;
+
+    unordered_map<string, uint32_t> codes;
+    vector<string> strings{string()};
+
+    void Grow(SensorColumn& column)
+    {
+        column.value.resize(rows, NAN);
+        column.minValue.resize(rows, 0);
+        column.maxValue.resize(rows, 0);
+        if(!column.text.empty())
+            column.text.resize(rows, noCode);
+        column.present.resize(rows, 0);
+    }
+
+    void Reserve(uint32_t row)
+    {
+        if(row < rows)
+            return;
+        rows = row + 1;
+        potIds.resize(rows, -1);
+        plants.type.resize(rows, noCode);
+        plants.species.resize(rows, noCode);
+        plants.soil.resize(rows, noCode);
+        for(auto& column : sensors)
+            Grow(*column.second);
+    }
+
+    SensorColumn& Column(string_view name)
+    {
+        auto it = sensors.find(name);
+        if(it == sensors.end())
+        {
+            it = sensors.emplace(string(name), unique_ptr<SensorColumn>(new SensorColumn())).first;
+            Grow(*it->second);
+        }
+        return *it->second;
+    }
+
+    uint32_t Intern(const string& value)
+    {
+        if(value.empty())
+            return noCode;
+        auto it = codes.find(value);
+        if(it != codes.end())
+            return it->second;
+        uint32_t code = (uint32_t) strings.size();
+        strings.push_back(value);
+        codes.emplace(value, code);
+        return code;
+    }
+
+public:
+    ///
+    /// @brief Stores pot @p potId at row @p row, which must be empty.
+    ///
+    void SetPot(uint32_t row, int potId, const SmartPot& pot)
+    {
+        Reserve(row);
+        potIds[row] = potId;
+        SetPlant(row, pot.GetPlant());
+        for(auto it = pot.GetSensors().begin(); it != pot.GetSensors().end(); ++it)
+        {
+            for(auto it2 = (it->second).begin(); it2 != (it->second).end(); ++it2)
+                SetSensor(row, it2->first, it2->second);
+        }
+    }
+
+    // Empties row @p row.
+    void ClearRow(uint32_t row)
+    {
+        if(row >= rows)
+            return;
+        potIds[row] = -1;
+        plants.type[row] = plants.species[row] = plants.soil[row] = noCode;
+        for(auto& column : sensors)
+            column.second->present[row] = 0;
+    }
+
+    void SetPlant(uint32_t row, const Plant& plant)
+    {
+        Reserve(row);
+        plants.type[row] = Intern(plant.GetType());
+        plants.species[row] = Intern(plant.GetName());
+        plants.soil[row] = Intern(plant.GetSoil());
+    }
+
+    void SetSensor(uint32_t row, string_view name, const Sensor& sensor)
+    {
+        Reserve(row);
+        SensorColumn& column = Column(name);
+        column.present[row] = 1;
+        column.minValue[row] = sensor.GetMinValue();
+        column.maxValue[row] = sensor.GetMaxValue();
+        if(sensor.IsNumeric())
+        {
+            column.value[row] = sensor.GetDoubleValue();
+            if(!column.text.empty())
+                column.text[row] = noCode;
+        }
+        else
+        {
+            column.value[row] = NAN;
+            if(column.text.empty())
+                column.text.resize(rows, noCode);
+            column.text[row] = Intern(sensor.GetStringValue());
+        }
+    }
+
+    ///
+    /// @returns The column of the sensor @p name or nullptr if no pot ever
+    /// had it.
+    ///
+    const SensorColumn* Find(string_view name) const
+    {
+        auto it = sensors.find(name);
+        return it == sensors.end() ? nullptr : it->second.get();
+    }
+
+    ///
+    /// @returns The code of @p value or unknownCode if no row ever held it.
+    ///
+    uint32_t Code(string_view value) const
+    {
+        if(value.empty())
+            return noCode;
+        auto it = codes.find(string(value));
+        return it == codes.end() ? unknownCode : it->second;
+    }
+
+    const PlantColumns& Plants() const
+    {
+        return plants;
+    }
+
+    const vector<int>& PotIds() const
+    {
+        return potIds;
+    }
+
+    size_t Rows() const
+    {
+        return rows;
+    }
+};
+}
+
+#endif
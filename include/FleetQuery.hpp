@@ -0,0 +1,625 @@
+///
+/// @file FleetQuery.hpp
+///
+/// @brief Filters over the pots of a fleet written as expressions such as
+///
+///     soilHumidity < min and plant.type == 'Desert' and luminosity > 4
+///
+/// compiled once to a short postfix program which is run over the columns
+/// of a @b FleetColumns a block of rows at a time: every comparison is a
+/// tight loop over two arrays writing a mask, and the masks are combined
+/// by the and, or and not instructions.
+///
+/// The operands are numbers, 'strings' (or "strings"), the pot id (id), the
+/// plant (plant.type, plant.species, plant.soil) and the sensors: a sensor
+/// name stands for its value, name.min and name.max for its thresholds,
+/// and a bare min or max compared with a sensor for the threshold of that
+/// sensor. The comparisons are < <= > >= == != and strings only support ==
+/// and !=. A comparison involving a sensor a pot does not have is false for
+/// that pot.
+///
+#ifndef FLEET_QUERY_HPP
+#define FLEET_QUERY_HPP
+
+#include "FleetColumns.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+namespace pot
+{
+class FleetQuery
+{
+public:
+    // Rows evaluated per pass of the program.
+    static constexpr size_t blockRows = 1024;
+
+private:
+    enum OperandKind : uint8_t
+    {
+        numberOperand,
+        textOperand,
+        potIdOperand,
+        sensorValue,
+        sensorMin,
+        sensorMax,
+        sensorText,
+        plantType,
+        plantSpecies,
+        plantSoil
+    };
+
+    struct Operand
+    {
+        OperandKind kind;
+        string name;
+        double number = 0;
+    };
+
+    enum Op : uint8_t
+    {
+        compareNumbers,
+        compareCodes,
+        andMasks,
+        orMasks,
+        notMask
+    };
+
+    enum Cmp : uint8_t
+    {
+        lt,
+        le,
+        gt,
+        ge,
+        eq,
+        ne
+    };
+
+    struct Instruction
+    {
+        Op op;
+        Cmp cmp;
+        uint16_t left;
+        uint16_t right;
+    };
+
+    // An operand resolved against the columns: arrays indexed by row, or
+    // arrays of blockRows equal values for the constants.
+    struct Bound
+    {
+        const double *numbers = nullptr;
+        const uint32_t *codes = nullptr;
+        const uint8_t *present = nullptr;
+        bool perRow = false;
+        bool presentPerRow = false;
+        vector<double> ownNumbers;
+        vector<uint32_t> ownCodes;
+    };
+
+    vector<Operand> operands;
+    vector<Instruction> program;
+    size_t depth = 0;
+
+    // The parser state, only used while compiling.
+    struct Token
+    {
+        enum Kind : uint8_t
+        {
+            endToken,
+            identifierToken,
+            numberToken,
+            textToken,
+            comparisonToken,
+            andToken,
+            orToken,
+            notToken,
+            openToken,
+            closeToken
+        } kind = endToken;
+        string_view text;
+        double number = 0;
+        Cmp cmp = eq;
+    };
+
+    string_view source;
+    size_t position = 0;
+    Token token;
+    size_t stackSize = 0;
+    string error;
+
+    static bool IsWord(string_view word, const char *keyword)
+    {
+        if(word.size() != strlen(keyword))
+            return false;
+        for(size_t i = 0; i < word.size(); ++i)
+        {
+            if(tolower((unsigned char) word[i]) != keyword[i])
+                return false;
+        }
+        return true;
+    }
+
+    bool Next()
+    {
+        while(position < source.size() && isspace((unsigned char) source[position]))
+            position++;
+        token = Token();
+        if(position >= source.size())
+            return true;
+
+        size_t start = position;
+        char c = source[position];
+        auto two = [this](const char *op) { return source.compare(position, 2, op) == 0; };
+        if(isalpha((unsigned char) c) || c == '_')
+        {
+            while(position < source.size()
+                  && (isalnum((unsigned char) source[position]) || source[position] == '_' || source[position] == '.'))
+                position++;
+            token.text = source.substr(start, position - start);
+            token.kind = IsWord(token.text, "and") ? Token::andToken
+                       : IsWord(token.text, "or") ? Token::orToken
+                       : IsWord(token.text, "not") ? Token::notToken
+                       : Token::identifierToken;
+        }
+        else if(isdigit((unsigned char) c) || c == '-' || c == '.')
+        {
+            string number(source.substr(start, 64));
+            char *end;
+            token.number = strtod(number.c_str(), &end);
+            if(end == number.c_str())
+                return Fail("invalid number at " + to_string(start));
+            position += end - number.c_str();
+            token.kind = Token::numberToken;
+        }
+        else if(c == '\'' || c == '"')
+        {
+            size_t close = source.find(c, start + 1);
+            if(close == string_view::npos)
+                return Fail("unterminated string at " + to_string(start));
+            token.text = source.substr(start + 1, close - start - 1);
+            token.kind = Token::textToken;
+            position = close + 1;
+        }
+        else if(two("&&") || two("||"))
+        {
+            token.kind = c == '&' ? Token::andToken : Token::orToken;
+            position += 2;
+        }
+        else if(two("<=") || two(">=") || two("==") || two("!=") || two("<>"))
+        {
+            token.kind = Token::comparisonToken;
+            token.cmp = two("<=") ? le : two(">=") ? ge : two("==") ? eq : ne;
+            position += 2;
+        }
+        else if(c == '<' || c == '>' || c == '=')
+        {
+            token.kind = Token::comparisonToken;
+            token.cmp = c == '<' ? lt : c == '>' ? gt : eq;
+            position++;
+        }
+        else if(c == '!')
+        {
+            token.kind = Token::notToken;
+            position++;
+        }
+        else if(c == '(' || c == ')')
+        {
+            token.kind = c == '(' ? Token::openToken : Token::closeToken;
+            position++;
+        }
+        else
+        {
+            return Fail(string("unexpected '") + c + "' at " + to_string(start));
+        }
+        return true;
+    }
+
+    bool Fail(const string& what)
+    {
+        if(error.empty())
+            error = what;
+        return false;
+    }
+
+    void Emit(Op op, Cmp cmp = eq, uint16_t left = 0, uint16_t right = 0)
+    {
+        program.push_back({op, cmp, left, right});
+        if(op == compareNumbers || op == compareCodes)
+            depth = max(depth, ++stackSize);
+        else if(op != notMask)
+            stackSize--;
+    }
+
+    // Reads an operand, bare sensor names are sensorValue for now.
+    bool ParseOperand(Operand& operand)
+    {
+        if(token.kind == Token::numberToken)
+        {
+            operand.kind = numberOperand;
+            operand.number = token.number;
+        }
+        else if(token.kind == Token::textToken)
+        {
+            operand.kind = textOperand;
+            operand.name = string(token.text);
+        }
+        else if(token.kind == Token::identifierToken)
+        {
+            string_view name = token.text;
+            size_t dot = name.rfind('.');
+            string_view field = dot == string_view::npos ? string_view() : name.substr(dot + 1);
+            if(name == "id")
+            {
+                operand.kind = potIdOperand;
+            }
+            else if(name.substr(0, 6) == "plant.")
+            {
+                if(field == "type")
+                    operand.kind = plantType;
+                else if(field == "species")
+                    operand.kind = plantSpecies;
+                else if(field == "soil" || field == "suitableSoilType")
+                    operand.kind = plantSoil;
+                else
+                    return Fail("unknown plant field " + string(field));
+            }
+            else if(field == "min" || field == "max" || field == "value")
+            {
+                operand.kind = field == "min" ? sensorMin : field == "max" ? sensorMax : sensorValue;
+                operand.name = string(name.substr(0, dot));
+            }
+            else
+            {
+                operand.kind = sensorValue;
+                operand.name = string(name);
+            }
+        }
+        else
+        {
+            return Fail("operand expected at " + to_string(position));
+        }
+        return Next();
+    }
+
+    static bool IsText(const Operand& operand)
+    {
+        return operand.kind == textOperand || operand.kind == plantType
+            || operand.kind == plantSpecies || operand.kind == plantSoil;
+    }
+
+    static bool IsBareSensor(const Operand& operand)
+    {
+        return operand.kind == sensorValue && operand.name.find('.') == string::npos;
+    }
+
+    uint16_t AddOperand(Operand operand)
+    {
+        operands.push_back(move(operand));
+        return (uint16_t) (operands.size() - 1);
+    }
+
+    bool ParseComparison()
+    {
+        Operand left;
+        Operand right;
+        if(!ParseOperand(left))
+            return false;
+        if(token.kind != Token::comparisonToken)
+            return Fail("comparison expected at " + to_string(position));
+        Cmp cmp = token.cmp;
+        if(!Next() || !ParseOperand(right))
+            return false;
+
+        // A bare min or max is the threshold of the sensor it is compared to.
+        for(Operand *bound : {&left, &right})
+        {
+            Operand& other = bound == &left ? right : left;
+            if(bound->kind == sensorValue && (bound->name == "min" || bound->name == "max") && IsBareSensor(other))
+            {
+                bound->kind = bound->name == "min" ? sensorMin : sensorMax;
+                bound->name = other.name;
+            }
+        }
+
+        // A sensor compared to a string is compared by its string value.
+        bool text = IsText(left) || IsText(right);
+        if(text)
+        {
+            for(Operand *operand : {&left, &right})
+            {
+                if(operand->kind == sensorValue)
+                    operand->kind = sensorText;
+                else if(!IsText(*operand))
+                    return Fail("a string can only be compared to a string");
+            }
+            if(cmp != eq && cmp != ne)
+                return Fail("strings can only be compared with == and !=");
+        }
+        if(operands.size() + 2 > UINT16_MAX)
+            return Fail("expression too long");
+        uint16_t leftIndex = AddOperand(move(left));
+        uint16_t rightIndex = AddOperand(move(right));
+        Emit(text ? compareCodes : compareNumbers, cmp, leftIndex, rightIndex);
+        return true;
+    }
+
+    bool ParseFactor()
+    {
+        if(token.kind == Token::notToken)
+        {
+            if(!Next() || !ParseFactor())
+                return false;
+            Emit(notMask);
+            return true;
+        }
+        if(token.kind == Token::openToken)
+        {
+            if(!Next() || !ParseOr())
+                return false;
+            if(token.kind != Token::closeToken)
+                return Fail("')' expected at " + to_string(position));
+            return Next();
+        }
+        return ParseComparison();
+    }
+
+    bool ParseAnd()
+    {
+        if(!ParseFactor())
+            return false;
+        while(token.kind == Token::andToken)
+        {
+            if(!Next() || !ParseFactor())
+                return false;
+            Emit(andMasks);
+        }
+        return true;
+    }
+
+    bool ParseOr()
+    {
+        if(!ParseAnd())
+            return false;
+        while(token.kind == Token::orToken)
+        {
+            if(!Next() || !ParseAnd())
+                return false;
+            Emit(orMasks);
+        }
+        return true;
+    }
+
+    Bound Bind(const Operand& operand, const FleetColumns& columns) const
+    {
+        static const vector<uint8_t> allRows(blockRows, 1);
+        static const vector<uint8_t> noRows(blockRows, 0);
+
+        Bound bound;
+        bound.present = allRows.data();
+        const FleetColumns::SensorColumn *column = nullptr;
+        switch(operand.kind)
+        {
+        case numberOperand:
+            bound.ownNumbers.assign(blockRows, operand.number);
+            break;
+        case textOperand:
+            bound.ownCodes.assign(blockRows, columns.Code(operand.name));
+            break;
+        case potIdOperand:
+            bound.ownNumbers.assign(columns.PotIds().begin(), columns.PotIds().end());
+            bound.perRow = true;
+            break;
+        case plantType:
+        case plantSpecies:
+        case plantSoil:
+            bound.codes = (operand.kind == plantType ? columns.Plants().type
+                         : operand.kind == plantSpecies ? columns.Plants().species
+                         : columns.Plants().soil).data();
+            bound.perRow = true;
+            break;
+        default:
+            column = columns.Find(operand.name);
+            if(column == nullptr)
+            {
+                // No pot has the sensor, the comparison is always false.
+                bound.present = noRows.data();
+                bound.ownNumbers.assign(blockRows, NAN);
+                bound.ownCodes.assign(blockRows, FleetColumns::noCode);
+                break;
+            }
+            bound.present = column->present.data();
+            bound.presentPerRow = true;
+            bound.perRow = true;
+            if(operand.kind == sensorText)
+            {
+                if(column->text.empty())
+                    bound.ownCodes.assign(columns.Rows(), FleetColumns::noCode);
+                else
+                    bound.codes = column->text.data();
+            }
+            else
+            {
+                bound.numbers = (operand.kind == sensorMin ? column->minValue
+                               : operand.kind == sensorMax ? column->maxValue
+                               : column->value).data();
+            }
+            break;
+        }
+        if(!bound.ownNumbers.empty())
+            bound.numbers = bound.ownNumbers.data();
+        if(!bound.ownCodes.empty())
+            bound.codes = bound.ownCodes.data();
+        return bound;
+    }
+
+    template<typename T, typename Compare>
+    static void CompareBlock(const T *a, const T *b, const uint8_t *presentA, const uint8_t *presentB,
+                             uint8_t *out, size_t count, Compare compare)
+    {
+        for(size_t i = 0; i < count; ++i)
+            out[i] = (uint8_t) (compare(a[i], b[i]) & presentA[i] & presentB[i]);
+    }
+
+    template<typename T>
+    static void Compare(Cmp cmp, const T *a, const T *b, const uint8_t *presentA, const uint8_t *presentB,
+                        uint8_t *out, size_t count)
+    {
+        switch(cmp)
+        {
+        case lt: CompareBlock(a, b, presentA, presentB, out, count, [](T x, T y) { return x < y; }); break;
+        case le: CompareBlock(a, b, presentA, presentB, out, count, [](T x, T y) { return x <= y; }); break;
+        case gt: CompareBlock(a, b, presentA, presentB, out, count, [](T x, T y) { return x > y; }); break;
+        case ge: CompareBlock(a, b, presentA, presentB, out, count, [](T x, T y) { return x >= y; }); break;
+        case eq: CompareBlock(a, b, presentA, presentB, out, count, [](T x, T y) { return x == y; }); break;
+        case ne: CompareBlock(a, b, presentA, presentB, out, count, [](T x, T y) { return x != y; }); break;
+        }
+    }
+
+public:
+    ///
+    /// @brief Compiles @p text.
+    ///
+    /// @returns The query, or nullptr with the reason in @p error.
+    ///
+    static shared_ptr<const FleetQuery> Compile(string_view text, string& error)
+    {
+        shared_ptr<FleetQuery> query(new FleetQuery());
+        query->source = text;
+        bool parsed = query->Next() && query->ParseOr();
+        if(parsed && query->token.kind != Token::endToken)
+            parsed = query->Fail("unexpected text at " + to_string(query->position));
+        if(!parsed)
+        {
+            error = query->error;
+            return nullptr;
+        }
+        query->source = string_view();
+        return query;
+    }
+
+    ///
+    /// @brief Runs the query over @p columns, calling @p visit(potId) for
+    /// every matching pot in row order.
+    ///
+    /// @returns The number of matching pots.
+    ///
+    template<typename Visit>
+    size_t Run(const FleetColumns& columns, Visit visit) const
+    {
+        vector<Bound> bound;
+        bound.reserve(operands.size());
+        for(const Operand& operand : operands)
+            bound.push_back(Bind(operand, columns));
+
+        const vector<int>& potIds = columns.PotIds();
+        vector<uint8_t> stack(max<size_t>(depth, 1) * blockRows);
+        size_t matches = 0;
+        for(size_t begin = 0; begin < columns.Rows(); begin += blockRows)
+        {
+            size_t count = min(blockRows, columns.Rows() - begin);
+            uint8_t *top = stack.data();
+            for(const Instruction& instruction : program)
+            {
+                switch(instruction.op)
+                {
+                case compareNumbers:
+                case compareCodes:
+                {
+                    const Bound& a = bound[instruction.left];
+                    const Bound& b = bound[instruction.right];
+                    size_t offsetA = a.perRow ? begin : 0;
+                    size_t offsetB = b.perRow ? begin : 0;
+                    const uint8_t *presentA = a.present + (a.presentPerRow ? begin : 0);
+                    const uint8_t *presentB = b.present + (b.presentPerRow ? begin : 0);
+                    if(instruction.op == compareNumbers)
+                        Compare(instruction.cmp, a.numbers + offsetA, b.numbers + offsetB, presentA, presentB, top, count);
+                    else
+                        Compare(instruction.cmp, a.codes + offsetA, b.codes + offsetB, presentA, presentB, top, count);
+                    top += blockRows;
+                    break;
+                }
+                case andMasks:
+                case orMasks:
+                {
+                    top -= blockRows;
+                    uint8_t *left = top - blockRows;
+                    if(instruction.op == andMasks)
+                        for(size_t i = 0; i < count; ++i)
+                            left[i] &= top[i];
+                    else
+                        for(size_t i = 0; i < count; ++i)
+                            left[i] |= top[i];
+                    break;
+                }
+                case notMask:
+                {
+                    uint8_t *mask = top - blockRows;
+                    for(size_t i = 0; i < count; ++i)
+                        mask[i] ^= 1;
+                    break;
+                }
+                }
+            }
+            const uint8_t *result = stack.data();
+            for(size_t i = 0; i < count; ++i)
+            {
+                if(result[i] && potIds[begin + i] >= 0)
+                {
+                    matches++;
+                    visit(potIds[begin + i]);
+                }
+            }
+        }
+        return matches;
+    }
+};
+
+///
+/// @brief The compiled queries by text, so a query sent again is not
+/// compiled again. Thread safe.
+///
+class QueryCache
+{
+    static constexpr size_t capacity = 256;
+
+    mutex lock;
+    unordered_map<string, shared_ptr<const FleetQuery>> queries;
+
+public:
+    ///
+    /// @returns The compiled @p text, or nullptr with the reason in @p error.
+    ///
+    shared_ptr<const FleetQuery> Get(const string& text, string& error)
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            auto it = queries.find(text);
+            if(it != queries.end())
+                return it->second;
+        }
+        shared_ptr<const FleetQuery> query = FleetQuery::Compile(text, error);
+        if(query == nullptr)
+            return nullptr;
+        lock_guard<mutex> guard(lock);
+        // Made up queries can't make the cache grow without bound.
+        if(queries.size() >= capacity)
+            queries.clear();
+        queries.emplace(text, query);
+        return query;
+    }
+};
+}
+
+#endif
@@ -0,0 +1,337 @@
+///
+/// @file GorillaBlock.hpp
+///
+/// @brief A block of (timestamp, value) samples of one sensor, compressed as
+/// in Facebook's Gorilla: the timestamps as the difference between two
+/// consecutive deltas, which is 0 for regular readings, and the values as
+/// the XOR with the previous value, which only has a few meaningful bits
+/// for slowly changing values. A sample of a regular, slowly changing
+/// series takes a couple of bytes instead of 16.
+///
+/// The samples are appended to a bit stream and read back a batch at a
+/// time by a @b Reader, so a range query decodes into small arrays and
+/// aggregates them in tight loops.
+///
+#ifndef GORILLA_BLOCK_HPP
+#define GORILLA_BLOCK_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+namespace pot
+{
+class GorillaBlock
+{
+    // The bits, most significant first.
+    vector<uint64_t> words;
+    size_t bitCount = 0;
+
+    int64_t firstTime = 0;
+    int64_t lastTime = 0;
+    uint32_t count = 0;
+
+    // Encoder state.
+    int64_t previousDelta = 0;
+    uint64_t previousValue = 0;
+    int previousLeading = -1;
+    int previousTrailing = 0;
+
+    static uint64_t Bits(double value)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    static double Value(uint64_t bits)
+    {
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // Appends the @p width low bits of @p value.
+    void Write(uint64_t value, int width)
+    {
+        if(width == 0)
+            return;
+        if(width < 64)
+            value &= ((uint64_t) 1 << width) - 1;
+        size_t offset = bitCount & 63;
+        if(offset == 0)
+            words.push_back(0);
+        int room = 64 - (int) offset;
+        if(width <= room)
+        {
+            words.back() |= value << (room - width);
+        }
+        else
+        {
+            words.back() |= value >> (width - room);
+            words.push_back(value << (64 - (width - room)));
+        }
+        bitCount += width;
+    }
+
+    void WriteTime(int64_t time)
+    {
+        int64_t delta = time - lastTime;
+        int64_t deltaOfDelta = delta - previousDelta;
+        previousDelta = delta;
+        lastTime = time;
+        if(deltaOfDelta == 0)
+            Write(0, 1);
+        else if(deltaOfDelta >= -64 && deltaOfDelta <= 63)
+        {
+            Write(0b10, 2);
+            Write((uint64_t) deltaOfDelta, 7);
+        }
+        else if(deltaOfDelta >= -256 && deltaOfDelta <= 255)
+        {
+            Write(0b110, 3);
+            Write((uint64_t) deltaOfDelta, 9);
+        }
+        else if(deltaOfDelta >= -2048 && deltaOfDelta <= 2047)
+        {
+            Write(0b1110, 4);
+            Write((uint64_t) deltaOfDelta, 12);
+        }
+        else
+        {
+            Write(0b1111, 4);
+            Write((uint64_t) deltaOfDelta, 64);
+        }
+    }
+
+    void WriteValue(uint64_t bits)
+    {
+        uint64_t xored = bits ^ previousValue;
+        previousValue = bits;
+        if(xored == 0)
+        {
+            Write(0, 1);
+            return;
+        }
+        int leading = __builtin_clzll(xored);
+        int trailing = __builtin_ctzll(xored);
+        // The leading count is stored on 5 bits.
+        if(leading > 31)
+            leading = 31;
+        if(previousLeading >= 0 && leading >= previousLeading && trailing >= previousTrailing)
+        {
+            // The meaningful bits fit in the window of the previous value.
+            Write(0b10, 2);
+            Write(xored >> previousTrailing, 64 - previousLeading - previousTrailing);
+            return;
+        }
+        int length = 64 - leading - trailing;
+        Write(0b11, 2);
+        Write((uint64_t) leading, 5);
+        // A length of 64 is stored as 0.
+        Write((uint64_t) (length & 63), 6);
+        Write(xored >> trailing, length);
+        previousLeading = leading;
+        previousTrailing = trailing;
+    }
+
+public:
+    // Samples per block, blocks are sealed when full.
+    static constexpr uint32_t capacity = 1024;
+
+    ///
+    /// @brief Reads the samples of a block in order, in batches.
+    ///
+    class Reader
+    {
+        const GorillaBlock *block;
+        size_t bit = 0;
+        uint32_t samplesRead = 0;
+        int64_t time = 0;
+        int64_t delta = 0;
+        uint64_t value = 0;
+        int leading = 0;
+        int trailing = 0;
+
+        static int64_t Signed(uint64_t value, int width)
+        {
+            // Sign extends a width bits value.
+            return (int64_t) (value << (64 - width)) >> (64 - width);
+        }
+
+    public:
+        explicit Reader(const GorillaBlock& _block)
+            : block(&_block),
+              time(_block.firstTime)
+        {
+
+        }
+
+        ///
+        /// @brief Decodes the next samples, at most @p capacity of them,
+        /// into @p times and @p values.
+        ///
+        /// @returns The number of samples decoded, 0 at the end.
+        ///
+        size_t Next(int64_t *times, double *values, size_t capacity)
+        {
+            // The state is kept in locals while decoding, the stores to
+            // the output arrays would otherwise reload it every sample.
+            const uint64_t *words = block->words.data();
+            size_t wordCount = block->words.size();
+            size_t position = bit;
+            int64_t currentTime = time;
+            int64_t currentDelta = delta;
+            uint64_t currentValue = value;
+            int currentLeading = leading;
+            int currentTrailing = trailing;
+
+            // The next 64 bits, without reading them.
+            auto peek = [&]()
+            {
+                size_t index = position >> 6;
+                int offset = (int) (position & 63);
+                uint64_t result = words[index] << offset;
+                if(offset != 0 && index + 1 < wordCount)
+                    result |= words[index + 1] >> (64 - offset);
+                return result;
+            };
+            auto read = [&](int width) -> uint64_t
+            {
+                if(width == 0)
+                    return 0;
+                uint64_t result = peek() >> (64 - width);
+                position += width;
+                return result;
+            };
+
+            uint32_t count = block->count;
+            uint32_t index = samplesRead;
+            size_t decoded = 0;
+            for(; decoded < capacity && index < count; ++decoded, ++index)
+            {
+                if(index == 0)
+                {
+                    currentValue = read(64);
+                }
+                else if(peek() >> 62 == 0)
+                {
+                    // The usual sample: regular time and same value.
+                    position += 2;
+                    currentTime += currentDelta;
+                }
+                else
+                {
+                    // Up to four 1s, ended by a 0 below four, then the
+                    // delta of delta.
+                    int ones = __builtin_clzll(~peek() | 1);
+                    if(ones >= 4)
+                    {
+                        position += 4;
+                        currentDelta += (int64_t) read(64);
+                    }
+                    else
+                    {
+                        position += ones + 1;
+                        if(ones == 1)
+                            currentDelta += Signed(read(7), 7);
+                        else if(ones == 2)
+                            currentDelta += Signed(read(9), 9);
+                        else if(ones == 3)
+                            currentDelta += Signed(read(12), 12);
+                    }
+                    currentTime += currentDelta;
+
+                    // 0 for the same value, 10 for the previous window and
+                    // 11 for a new one.
+                    uint64_t control = peek() >> 62;
+                    if(control < 0b10)
+                    {
+                        position += 1;
+                    }
+                    else
+                    {
+                        position += 2;
+                        if(control == 0b11)
+                        {
+                            currentLeading = (int) read(5);
+                            int length = (int) read(6);
+                            if(length == 0)
+                                length = 64;
+                            currentTrailing = 64 - currentLeading - length;
+                        }
+                        currentValue ^= read(64 - currentLeading - currentTrailing) << currentTrailing;
+                    }
+                }
+                times[decoded] = currentTime;
+                values[decoded] = Value(currentValue);
+            }
+
+            samplesRead = index;
+            bit = position;
+            time = currentTime;
+            delta = currentDelta;
+            value = currentValue;
+            leading = currentLeading;
+            trailing = currentTrailing;
+            return decoded;
+        }
+    };
+
+    ///
+    /// @brief Appends a sample, @p time shall not be before the last one
+    /// (an earlier time is recorded as the last one).
+    ///
+    void Append(int64_t time, double value)
+    {
+        if(count == 0)
+        {
+            firstTime = lastTime = time;
+            previousValue = Bits(value);
+            Write(previousValue, 64);
+        }
+        else
+        {
+            WriteTime(time < lastTime ? lastTime : time);
+            WriteValue(Bits(value));
+        }
+        count++;
+    }
+
+    // Gives back the memory reserved for appending, once full.
+    void Seal()
+    {
+        words.shrink_to_fit();
+    }
+
+    bool Full() const
+    {
+        return count >= capacity;
+    }
+
+    uint32_t Count() const
+    {
+        return count;
+    }
+
+    int64_t FirstTime() const
+    {
+        return firstTime;
+    }
+
+    int64_t LastTime() const
+    {
+        return lastTime;
+    }
+
+    // Bytes used by the samples.
+    size_t Bytes() const
+    {
+        return words.capacity() * sizeof(uint64_t);
+    }
+};
+}
+
+#endif
@@ -0,0 +1,180 @@
+///
+/// @file HashRing.hpp
+///
+/// @brief Consistent hashing of the pot ids over the instances of a
+/// cluster. Every instance is hashed to many points of a 64 bit ring (its
+/// virtual nodes), and a pot belongs to the instance of the first point
+/// following the hash of its id. An instance joining or leaving only moves
+/// the pots between its points and the previous ones, about one pot in
+/// the number of instances, and the virtual nodes spread them evenly over
+/// the others.
+///
+#ifndef HASH_RING_HPP
+#define HASH_RING_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace pot
+{
+class HashRing
+{
+public:
+    // Points per instance, the share of the pots of an instance is off
+    // the average by about 1 / sqrt(virtual nodes): 6% with 256.
+    static constexpr int defaultVirtualNodes = 256;
+
+private:
+    struct Point
+    {
+        uint64_t hash;
+        uint32_t node;
+
+        bool operator<(const Point& other) const
+        {
+            return hash < other.hash || (hash == other.hash && node < other.node);
+        }
+    };
+
+    int virtualNodes;
+    vector<string> nodes;
+    // The points sorted by hash, the hashes apart so that the search
+    // reads fewer cache lines.
+    vector<uint64_t> hashes;
+    vector<uint32_t> owners;
+
+    // The finalizer of SplitMix64, consecutive ids land far apart.
+    static uint64_t Mix(uint64_t value)
+    {
+        value ^= value >> 30;
+        value *= 0xbf58476d1ce4e5b9ULL;
+        value ^= value >> 27;
+        value *= 0x94d049bb133111ebULL;
+        value ^= value >> 31;
+        return value;
+    }
+
+    static uint64_t Hash(string_view text, uint32_t replica)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        for(char c : text)
+        {
+            hash ^= (uint8_t) c;
+            hash *= 1099511628211ULL;
+        }
+        return Mix(hash ^ Mix(replica + 1));
+    }
+
+    void Build()
+    {
+        vector<Point> points;
+        points.reserve(nodes.size() * (size_t) virtualNodes);
+        for(uint32_t node = 0; node < nodes.size(); ++node)
+        {
+            for(int replica = 0; replica < virtualNodes; ++replica)
+                points.push_back({Hash(nodes[node], (uint32_t) replica), node});
+        }
+        sort(points.begin(), points.end());
+        hashes.clear();
+        owners.clear();
+        for(const Point& point : points)
+        {
+            hashes.push_back(point.hash);
+            owners.push_back(point.node);
+        }
+    }
+
+public:
+    explicit HashRing(int _virtualNodes = defaultVirtualNodes)
+        : virtualNodes(_virtualNodes > 0 ? _virtualNodes : 1)
+    {
+
+    }
+
+    ///
+    /// @brief Adds the instance @p node ("host:port").
+    ///
+    /// @returns 0 on success, 1 if it is already on the ring.
+    ///
+    int Add(const string& node)
+    {
+        if(Find(node) >= 0)
+            return 1;
+        nodes.push_back(node);
+        Build();
+        return 0;
+    }
+
+    ///
+    /// @brief Removes the instance @p node, its pots go to the next points.
+    ///
+    /// @returns 0 on success, 1 if it is not on the ring.
+    ///
+    int Remove(const string& node)
+    {
+        int index = Find(node);
+        if(index < 0)
+            return 1;
+        nodes.erase(nodes.begin() + index);
+        Build();
+        return 0;
+    }
+
+    // The index of @p node in Nodes, or -1.
+    int Find(string_view node) const
+    {
+        for(size_t i = 0; i < nodes.size(); ++i)
+        {
+            if(nodes[i] == node)
+                return (int) i;
+        }
+        return -1;
+    }
+
+    ///
+    /// @returns The index in Nodes of the instance owning pot @p potId, or
+    /// -1 if the ring is empty.
+    ///
+    int OwnerIndex(int potId) const
+    {
+        if(hashes.empty())
+            return -1;
+        uint64_t hash = Mix((uint64_t) (uint32_t) potId);
+        // A lower bound without branches, the hashes being random a
+        // branch of the search is mispredicted half of the time.
+        const uint64_t *first = hashes.data();
+        size_t size = hashes.size();
+        while(size > 1)
+        {
+            size_t half = size / 2;
+            first += (size_t) (first[half - 1] < hash) * half;
+            size -= half;
+        }
+        size_t index = (size_t) (first - hashes.data()) + (*first < hash ? 1 : 0);
+        return (int) owners[index == hashes.size() ? 0 : index];
+    }
+
+    // The instance owning pot @p potId, the ring shall not be empty.
+    const string& Owner(int potId) const
+    {
+        return nodes[(size_t) OwnerIndex(potId)];
+    }
+
+    const vector<string>& Nodes() const
+    {
+        return nodes;
+    }
+
+    int VirtualNodes() const
+    {
+        return virtualNodes;
+    }
+};
+}
+
+#endif
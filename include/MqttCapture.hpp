@@ -0,0 +1,282 @@
+///
+/// @file MqttCapture.hpp
+///
+/// @brief Binary file of the MQTT messages received by the server, with
+/// their topic and arrival time, written by @b MqttCapture and read back
+/// by @b MqttCaptureReader to replay the traffic (see tools/replay.cpp).
+///
+/// A capture is the 4 bytes magic "FPMQ", a 32 bit little endian version
+/// and one record per message:
+///
+///     varint  nanoseconds since the previous message (since the epoch
+///             for the first one)
+///     varint  topic id, the topics being numbered in order of first use;
+///             a new topic is followed by its varint length and its bytes
+///     varint  payload length, then the payload bytes
+///
+/// A varint holds 7 bits per byte, the lowest first, the high bit set on
+/// every byte but the last. A reading on a known topic takes about ten
+/// bytes more than its payload.
+///
+#ifndef MQTT_CAPTURE_HPP
+#define MQTT_CAPTURE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+namespace pot
+{
+class MqttCapture
+{
+public:
+    static constexpr uint32_t version = 1;
+    static constexpr size_t headerSize = 8;
+    // Bigger topics and payloads are rejected when read, so garbage can't
+    // make us allocate.
+    static constexpr uint64_t maxFieldSize = 16 * 1024 * 1024;
+
+private:
+    // The messages are written once that many bytes are buffered.
+    static constexpr size_t bufferSize = 64 * 1024;
+
+    ofstream out;
+    string buffer;
+    map<string, uint64_t, less<>> topics;
+    int64_t previousTime = 0;
+    uint64_t messages = 0;
+
+    void WriteBuffer()
+    {
+        out.write(buffer.data(), (streamsize) buffer.size());
+        buffer.clear();
+    }
+
+public:
+    static void WriteVarint(string& out, uint64_t value)
+    {
+        while(value >= 0x80)
+        {
+            out.push_back((char) (value | 0x80));
+            value >>= 7;
+        }
+        out.push_back((char) value);
+    }
+
+    ~MqttCapture()
+    {
+        Close();
+    }
+
+    ///
+    /// @brief Starts a new capture at @p path, replacing the file.
+    ///
+    /// @returns 0 on success, 1 if the file could not be created.
+    ///
+    int Open(const string& path)
+    {
+        Close();
+        out.open(path, ios::binary | ios::trunc);
+        if(!out)
+            return 1;
+        topics.clear();
+        previousTime = 0;
+        messages = 0;
+        buffer.append("FPMQ", 4);
+        for(int i = 0; i < 4; ++i)
+            buffer.push_back((char) (version >> (8 * i)));
+        return 0;
+    }
+
+    bool IsOpen() const
+    {
+        return out.is_open();
+    }
+
+    ///
+    /// @brief Records a message received on @p topic at @p timeNs,
+    /// nanoseconds since the epoch. The messages are written to the file
+    /// in batches, Flush writes the buffered ones.
+    ///
+    void Write(string_view topic, const char *payload, size_t length, int64_t timeNs)
+    {
+        if(!out.is_open())
+            return;
+        // A clock going back is recorded as no time passing.
+        WriteVarint(buffer, timeNs > previousTime ? (uint64_t) (timeNs - previousTime) : 0);
+        if(timeNs > previousTime)
+            previousTime = timeNs;
+        auto it = topics.find(topic);
+        if(it != topics.end())
+        {
+            WriteVarint(buffer, it->second);
+        }
+        else
+        {
+            uint64_t id = topics.size();
+            topics.emplace(string(topic), id);
+            WriteVarint(buffer, id);
+            WriteVarint(buffer, topic.size());
+            buffer.append(topic.data(), topic.size());
+        }
+        WriteVarint(buffer, length);
+        buffer.append(payload, length);
+        messages++;
+        if(buffer.size() >= bufferSize)
+            WriteBuffer();
+    }
+
+    void Flush()
+    {
+        if(!out.is_open())
+            return;
+        WriteBuffer();
+        out.flush();
+    }
+
+    void Close()
+    {
+        if(!out.is_open())
+            return;
+        Flush();
+        out.close();
+    }
+
+    uint64_t Messages() const
+    {
+        return messages;
+    }
+};
+
+///
+/// @brief Reads a capture held in memory, one message at a time.
+///
+class MqttCaptureReader
+{
+public:
+    struct Message
+    {
+        // Nanoseconds since the epoch.
+        int64_t time;
+        // Valid until the reader is rewound or loaded again.
+        const string *topic;
+        string_view payload;
+    };
+
+private:
+    string data;
+    size_t position = 0;
+    deque<string> topics;
+    int64_t time = 0;
+    string error;
+
+    int Fail(const string& message)
+    {
+        error = message + " at byte " + to_string(position);
+        return 1;
+    }
+
+    bool ReadVarint(uint64_t& value)
+    {
+        value = 0;
+        for(int shift = 0; shift < 64 && position < data.size(); shift += 7)
+        {
+            uint8_t byte = (uint8_t) data[position++];
+            value |= (uint64_t) (byte & 0x7f) << shift;
+            if((byte & 0x80) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    bool ReadBytes(string_view& bytes)
+    {
+        uint64_t length;
+        if(!ReadVarint(length) || length > MqttCapture::maxFieldSize || length > data.size() - position)
+            return false;
+        bytes = string_view(data.data() + position, (size_t) length);
+        position += (size_t) length;
+        return true;
+    }
+
+public:
+    ///
+    /// @brief Loads the capture at @p path.
+    ///
+    /// @returns 0 on success, 1 if it can't be read or is not a capture
+    /// (see @b Error).
+    ///
+    int Load(const string& path)
+    {
+        ifstream in(path, ios::binary);
+        if(!in)
+            return Fail("can't open " + path);
+        data.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        position = 0;
+        topics.clear();
+        time = 0;
+        if(data.size() < MqttCapture::headerSize || memcmp(data.data(), "FPMQ", 4) != 0)
+            return Fail(path + " is not a MQTT capture");
+        uint32_t fileVersion = 0;
+        for(int i = 0; i < 4; ++i)
+            fileVersion |= (uint32_t) (uint8_t) data[4 + i] << (8 * i);
+        if(fileVersion != MqttCapture::version)
+            return Fail(path + " has the unknown version " + to_string(fileVersion));
+        position = MqttCapture::headerSize;
+        return 0;
+    }
+
+    ///
+    /// @brief Reads the next message into @p message.
+    ///
+    /// @returns 1 if there is one, 0 at the end of the capture, -1 if the
+    /// capture is corrupt or truncated (see @b Error).
+    ///
+    int Next(Message& message)
+    {
+        if(position == data.size())
+            return 0;
+        uint64_t delta, topicId;
+        if(!ReadVarint(delta) || !ReadVarint(topicId))
+            return -Fail("truncated message");
+        if(topicId == topics.size())
+        {
+            string_view topic;
+            if(!ReadBytes(topic))
+                return -Fail("truncated topic");
+            topics.emplace_back(topic);
+        }
+        else if(topicId > topics.size())
+        {
+            return -Fail("unknown topic " + to_string(topicId));
+        }
+        if(!ReadBytes(message.payload))
+            return -Fail("truncated payload");
+        time += (int64_t) delta;
+        message.time = time;
+        message.topic = &topics[topicId];
+        return 1;
+    }
+
+    // Back to the first message.
+    void Rewind()
+    {
+        position = MqttCapture::headerSize;
+        topics.clear();
+        time = 0;
+    }
+
+    const string& Error() const
+    {
+        return error;
+    }
+};
+}
+
+#endif
@@ -0,0 +1,331 @@
+///
+/// @file MqttIngest.hpp
+///
+/// @brief Class which applies the sensor readings received over MQTT to
+/// the pots of a @b Fleet. It does not depend on the MQTT library, so the
+/// same code path can be driven by the broker or by a benchmark.
+///
+#ifndef MQTT_INGEST_HPP
+#define MQTT_INGEST_HPP
+
+#include "Fleet.hpp"
+#include "RateLimiter.hpp"
+#include "Trace.hpp"
+
+// Our JSON Parser.
+#include <rapidjson/document.h>
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace pot
+{
+class MqttIngest
+{
+public:
+    // A parsed payload.
+    struct Reading
+    {
+        string name;
+        bool hasValue = false;
+        bool isString = false;
+        double value = 0;
+        string stringValue;
+    };
+
+    // What Receive did with a message.
+    enum Outcome : uint8_t
+    {
+        // Its topic is not a pot.
+        ignored,
+        // Its pot floods, see RateLimiter.
+        dropped,
+        // Not a valid payload.
+        invalid,
+        // Kept for the next Flush, under overload.
+        coalesced,
+        // Its pot does not exist.
+        unknownPot,
+        applied
+    };
+
+private:
+    using SensorNames = shared_ptr<const map<int, string>>;
+
+    Fleet& fleet;
+    // Maps the "sensorType" field of the payloads to sensor names. A new
+    // map is published in publishedNames and the version is bumped, the
+    // parsing thread only loads the map when the version changed.
+    SensorNames publishedNames;
+    atomic<uint64_t> namesVersion{0};
+    SensorNames sensorNames;
+    uint64_t seenVersion = 0;
+    // Reused by Apply, so that parsing does not allocate.
+    Reading scratch;
+
+    // The latest reading of every sensor, by (pot id, sensor name), while
+    // the ingest is overloaded.
+    mutex pendingLock;
+    map<pair<int, string>, Reading> pending;
+    uint64_t superseded = 0;
+
+public:
+    MqttIngest(Fleet& _fleet, SensorNames _sensorNames)
+        : fleet(_fleet),
+          publishedNames(_sensorNames),
+          sensorNames(move(_sensorNames))
+    {
+
+    }
+
+    ///
+    /// @brief Replaces the sensor names, the messages parsed from now on
+    /// use them. Can be called from any thread, the parsing does not wait
+    /// for it and the messages being parsed keep the names they started
+    /// with.
+    ///
+    void SetSensorNames(SensorNames names)
+    {
+        atomic_store(&publishedNames, move(names));
+        namesVersion.fetch_add(1, memory_order_release);
+    }
+
+    ///
+    /// @brief Returns the id of the pot a MQTT topic belongs to: "test" is
+    /// the default pot and "pots/<potId>" the pot with that id.
+    ///
+    /// @returns The pot id or -1 if the topic does not belong to a pot.
+    ///
+    static int PotIdFromTopic(const char *topic, int defaultPotId)
+    {
+        if(strcmp(topic, "test") == 0)
+            return defaultPotId;
+        if(strncmp(topic, "pots/", 5) != 0 || topic[5] == '\0')
+            return -1;
+
+        char *end = nullptr;
+        long potId = strtol(topic + 5, &end, 10);
+        if(*end != '\0' || potId < 0 || potId > INT_MAX)
+            return -1;
+        return (int) potId;
+    }
+
+    ///
+    /// @brief Parses one payload such as
+    /// {"sensorType": 7, "value": 4.5, "nutrientType": null} into
+    /// @p reading and writes the message to reply with in @p reply. It
+    /// does not touch the fleet, so it needs no lock, and it does not
+    /// allocate once @p reading and @p reply have grown to their usual size.
+    /// Payloads are parsed by one thread at a time.
+    ///
+    /// @returns 0 on success, 1 if the payload is not a valid JSON object.
+    ///
+    int Parse(const char *payload, size_t length, Reading& reading, string& reply)
+    {
+        using namespace rapidjson;
+
+        // The values and the parser stack live in these buffers, RapidJSON
+        // only falls back to the heap for unusually big payloads.
+        char valueBuffer[1024];
+        char parseBuffer[1024];
+        MemoryPoolAllocator<> valueAllocator(valueBuffer, sizeof(valueBuffer));
+        MemoryPoolAllocator<> parseAllocator(parseBuffer, sizeof(parseBuffer));
+        GenericDocument<UTF8<>, MemoryPoolAllocator<>, MemoryPoolAllocator<>>
+            document(&valueAllocator, 256, &parseAllocator);
+
+        if(document.Parse(payload, length).HasParseError() || document.IsObject() == false)
+            return 1;
+        if(!document.HasMember("sensorType") || !document["sensorType"].IsNumber())
+            return 1;
+
+        uint64_t version = namesVersion.load(memory_order_acquire);
+        if(version != seenVersion)
+        {
+            sensorNames = atomic_load(&publishedNames);
+            seenVersion = version;
+        }
+        int sensorTypeID = (int) document["sensorType"].GetDouble();
+        auto sensorName = sensorNames->find(sensorTypeID);
+        string_view typeName = sensorName == sensorNames->end() ? string_view() : string_view(sensorName->second);
+
+        bool hasNutrient = document.HasMember("nutrientType") && document["nutrientType"].IsString();
+        string_view nutrientType = hasNutrient
+            ? string_view(document["nutrientType"].GetString(), document["nutrientType"].GetStringLength())
+            : string_view();
+        string_view name = hasNutrient ? nutrientType : typeName;
+        reading.name.assign(name.data(), name.size());
+        reading.hasValue = false;
+
+        reply.clear();
+        reply.append("Senzorul ").append(typeName).append(" ").append(nutrientType);
+
+        if(!document.HasMember("value"))
+            return 0;
+        const Value& value = document["value"];
+        if(value.IsNumber())
+        {
+            reading.hasValue = true;
+            reading.isString = false;
+            reading.value = value.GetDouble();
+
+            reply.append(" ").append(hasNutrient ? nutrientType : "NULL");
+            reply.append(" ").append(to_string(value.GetDouble()));
+        }
+        else if(value.IsString())
+        {
+            string_view stringValue(value.GetString(), value.GetStringLength());
+            reading.hasValue = true;
+            reading.isString = true;
+            reading.stringValue.assign(stringValue.data(), stringValue.size());
+
+            reply.append(" ").append(hasNutrient ? nutrientType : "NULL");
+            reply.append(" ").append(stringValue);
+        }
+        return 0;
+    }
+
+    ///
+    /// @brief Applies @p reading to pot @p potId.
+    ///
+    void Apply(int potId, const Reading& reading)
+    {
+        if(!reading.hasValue)
+            return;
+        if(reading.isString)
+            fleet.SetValue(potId, reading.name, string_view(reading.stringValue));
+        else
+            fleet.SetValue(potId, reading.name, reading.value);
+    }
+
+    ///
+    /// @brief Parses one payload and applies it to pot @p potId, see Parse.
+    ///
+    /// @returns 0 if there is a reply to publish, 1 if the payload is not a
+    /// valid JSON object.
+    ///
+    int Apply(int potId, const char *payload, size_t length, string& reply)
+    {
+        if(Parse(payload, length, scratch, reply))
+            return 1;
+        Apply(potId, scratch);
+        return 0;
+    }
+
+    ///
+    /// @brief Keeps @p reading as the latest one of its sensor, replacing
+    /// the one kept before, until the next Flush. Used instead of Apply
+    /// under overload, it only takes the lock of the pending readings.
+    ///
+    void Coalesce(int potId, const Reading& reading)
+    {
+        if(!reading.hasValue)
+            return;
+        lock_guard<mutex> guard(pendingLock);
+        auto inserted = pending.emplace(make_pair(potId, reading.name), reading);
+        if(!inserted.second)
+        {
+            inserted.first->second = reading;
+            superseded++;
+        }
+    }
+
+    ///
+    /// @brief Applies the readings kept by Coalesce. The caller shall hold
+    /// the lock of the fleet.
+    ///
+    /// @returns The number of readings applied.
+    ///
+    size_t Flush()
+    {
+        map<pair<int, string>, Reading> readings;
+        {
+            lock_guard<mutex> guard(pendingLock);
+            if(pending.empty())
+                return 0;
+            readings.swap(pending);
+        }
+        for(auto it = readings.begin(); it != readings.end(); ++it)
+            Apply(it->first.first, it->second);
+        return readings.size();
+    }
+
+    ///
+    /// @brief Handles a message received on @p topic at @p nowNs
+    /// (nanoseconds): the MQTT endpoint and the replay tool go through it.
+    /// The message is dropped if its pot floods, kept until the next Flush
+    /// if @p limiter says so, or else applied with @p lock held after the
+    /// readings kept before. The anomalies of the fleet are then moved to
+    /// @p anomalies.
+    ///
+    /// @returns What became of the message, @p reply is to be published
+    /// when it was applied.
+    ///
+    Outcome Receive(const char *topic, const char *payload, size_t length, int64_t nowNs,
+                    int defaultPotId, RateLimiter& limiter, mutex& lock,
+                    Reading& reading, string& reply, vector<Fleet::Anomaly>& anomalies)
+    {
+        int potId = PotIdFromTopic(topic, defaultPotId);
+        if(potId < 0)
+            return ignored;
+
+        // Flooding devices are dropped before anything is parsed.
+        RateLimiter::Verdict verdict = limiter.Admit(potId, nowNs);
+        if(verdict == RateLimiter::drop)
+            return dropped;
+
+        TRACE_SPAN(parse, "mqtt.parse");
+        if(Parse(payload, length, reading, reply))
+            return invalid;
+        TRACE_END(parse);
+
+        // Under overload only the latest reading of every sensor is kept,
+        // without taking the lock nor replying.
+        if(verdict == RateLimiter::coalesce)
+        {
+            Coalesce(potId, reading);
+            return coalesced;
+        }
+
+        TRACE_SPAN(wait, "mqtt.lockWait");
+        lock_guard<mutex> guard(lock);
+        TRACE_END(wait);
+        if(fleet.Get(potId) == nullptr)
+            return unknownPot;
+
+        // The readings kept under overload are older than this one.
+        TRACE_SPAN(apply, "mqtt.apply");
+        Flush();
+        Apply(potId, reading);
+        fleet.TakeAnomalies(anomalies);
+        return applied;
+    }
+
+    // Number of readings waiting for the next Flush.
+    size_t Pending()
+    {
+        lock_guard<mutex> guard(pendingLock);
+        return pending.size();
+    }
+
+    // Number of readings replaced by a newer one before being applied.
+    uint64_t Superseded()
+    {
+        lock_guard<mutex> guard(pendingLock);
+        return superseded;
+    }
+};
+}
+
+#endif
@@ -0,0 +1,488 @@
+///
+/// @file PeerClient.hpp
+///
+/// @brief HTTP/1.1 client the instances of a cluster talk to each other
+/// with: the requests for a pot owned by another instance are forwarded
+/// to it, and the pots an instance stops owning are sent to their new
+/// owner as a PUT /snapshot.
+///
+/// The connections are kept open once a response is read, a few per
+/// instance, so a forwarded request usually costs a write and a read on
+/// the loopback rather than a new TCP handshake. A kept connection the
+/// other instance closed meanwhile is replaced once, before anything of
+/// the response was read.
+///
+/// @b Send blocks the calling thread, @b SendAsync queues the request to
+/// the threads of the client and calls back from one of them, so the HTTP
+/// threads do not wait for another instance (which may be waiting for
+/// them).
+///
+#ifndef PEER_CLIENT_HPP
+#define PEER_CLIENT_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace pot
+{
+class PeerClient
+{
+public:
+    // Set on every request, an instance serves a forwarded request itself
+    // rather than forwarding it again, so instances which disagree on the
+    // owner of a pot during a rebalance do not bounce it forever.
+    static constexpr const char *forwardedHeader = "X-SmartPot-Forwarded";
+    // Connections kept open per instance.
+    static constexpr size_t maxIdlePerPeer = 8;
+    // Bigger responses are rejected.
+    static constexpr size_t maxResponseSize = 256 * 1024 * 1024;
+    // Requests waiting for a thread at most, SendAsync fails beyond.
+    static constexpr size_t maxQueued = 4096;
+    // Bodies copied after the headers rather than written on their own.
+    static constexpr size_t smallBody = 16 * 1024;
+
+    struct Response
+    {
+        int code = 0;
+        string contentType;
+        string body;
+    };
+
+    // Called with 0 and the response, or 1 and why it failed.
+    using Callback = function<void(int failed, Response& response, const string& error)>;
+
+private:
+    struct Job
+    {
+        string peer;
+        string method;
+        string resource;
+        string contentType;
+        string body;
+        Callback done;
+    };
+
+    int timeoutSeconds;
+    mutex idleLock;
+    unordered_map<string, vector<int>> idle;
+
+    mutex queueLock;
+    condition_variable queueChanged;
+    deque<Job> queue;
+    bool stopping = false;
+    vector<thread> workers;
+
+    static int Connect(const string& peer, int timeoutSeconds, string& error)
+    {
+        size_t colon = peer.rfind(':');
+        if(colon == string::npos)
+        {
+            error = peer + " is not a host:port";
+            return -1;
+        }
+        string host = peer.substr(0, colon);
+        string port = peer.substr(colon + 1);
+
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *addresses = nullptr;
+        int status = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+        if(status != 0)
+        {
+            error = "cannot resolve " + host + ": " + gai_strerror(status);
+            return -1;
+        }
+
+        int socket = -1;
+        for(addrinfo *address = addresses; address != nullptr; address = address->ai_next)
+        {
+            socket = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if(socket < 0)
+                continue;
+            timeval timeout{timeoutSeconds, 0};
+            setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            if(connect(socket, address->ai_addr, address->ai_addrlen) == 0)
+                break;
+            close(socket);
+            socket = -1;
+        }
+        freeaddrinfo(addresses);
+        if(socket < 0)
+        {
+            error = "cannot connect to " + peer + ": " + strerror(errno);
+            return -1;
+        }
+        // The requests are small and answered at once.
+        int noDelay = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        return socket;
+    }
+
+    // A kept connection to @p peer, -1 if there is none.
+    int TakeIdle(const string& peer)
+    {
+        lock_guard<mutex> guard(idleLock);
+        auto it = idle.find(peer);
+        if(it == idle.end() || it->second.empty())
+            return -1;
+        int socket = it->second.back();
+        it->second.pop_back();
+        return socket;
+    }
+
+    void GiveBack(const string& peer, int socket)
+    {
+        {
+            lock_guard<mutex> guard(idleLock);
+            vector<int>& sockets = idle[peer];
+            if(sockets.size() < maxIdlePerPeer)
+            {
+                sockets.push_back(socket);
+                return;
+            }
+        }
+        close(socket);
+    }
+
+    static bool WriteAll(int socket, const char *data, size_t size)
+    {
+        while(size > 0)
+        {
+            ssize_t written = ::send(socket, data, size, MSG_NOSIGNAL);
+            if(written < 0 && errno == EINTR)
+                continue;
+            if(written <= 0)
+                return false;
+            data += written;
+            size -= (size_t) written;
+        }
+        return true;
+    }
+
+    // Reads from @p socket until @p buffer holds more than @p size bytes.
+    static bool ReadMore(int socket, string& buffer, size_t size)
+    {
+        char chunk[16 * 1024];
+        while(buffer.size() <= size)
+        {
+            ssize_t received = recv(socket, chunk, sizeof(chunk), 0);
+            if(received < 0 && errno == EINTR)
+                continue;
+            if(received <= 0)
+                return false;
+            buffer.append(chunk, (size_t) received);
+        }
+        return true;
+    }
+
+    static bool EqualsIgnoreCase(string_view a, string_view b)
+    {
+        if(a.size() != b.size())
+            return false;
+        for(size_t i = 0; i < a.size(); ++i)
+        {
+            if(tolower((unsigned char) a[i]) != tolower((unsigned char) b[i]))
+                return false;
+        }
+        return true;
+    }
+
+    static string_view Trim(string_view text)
+    {
+        while(!text.empty() && (text.front() == ' ' || text.front() == '\t'))
+            text.remove_prefix(1);
+        while(!text.empty() && (text.back() == ' ' || text.back() == '\t' || text.back() == '\r'))
+            text.remove_suffix(1);
+        return text;
+    }
+
+    ///
+    /// @brief Reads the response to a request from @p socket.
+    ///
+    /// @returns 0 on success, 1 on failure with @p received telling if
+    /// anything was read. @p keepAlive tells if the connection can be
+    /// reused.
+    ///
+    static int ReadResponse(int socket, Response& response, bool& keepAlive, bool& received, string& error)
+    {
+        string buffer;
+        received = false;
+        size_t headerEnd;
+        while((headerEnd = buffer.find("\r\n\r\n")) == string::npos)
+        {
+            if(buffer.size() > 64 * 1024 || !ReadMore(socket, buffer, buffer.size()))
+            {
+                error = buffer.empty() ? "connection closed" : "truncated response headers";
+                return 1;
+            }
+            received = true;
+        }
+
+        string_view headers(buffer.data(), headerEnd);
+        size_t lineEnd = headers.find("\r\n");
+        string_view statusLine = headers.substr(0, lineEnd);
+        size_t space = statusLine.find(' ');
+        if(statusLine.substr(0, 5) != "HTTP/" || space == string_view::npos)
+        {
+            error = "invalid status line";
+            return 1;
+        }
+        response.code = atoi(string(statusLine.substr(space + 1, 3)).c_str());
+        keepAlive = statusLine.substr(0, space) != "HTTP/1.0";
+
+        bool chunked = false;
+        bool hasLength = false;
+        size_t length = 0;
+        response.contentType.clear();
+        while(lineEnd != string_view::npos)
+        {
+            size_t start = lineEnd + 2;
+            lineEnd = headers.find("\r\n", start);
+            string_view line = headers.substr(start, lineEnd == string_view::npos ? string_view::npos : lineEnd - start);
+            size_t colon = line.find(':');
+            if(colon == string_view::npos)
+                continue;
+            string_view name = Trim(line.substr(0, colon));
+            string_view value = Trim(line.substr(colon + 1));
+            if(EqualsIgnoreCase(name, "Content-Length"))
+            {
+                hasLength = true;
+                length = strtoull(string(value).c_str(), nullptr, 10);
+            }
+            else if(EqualsIgnoreCase(name, "Transfer-Encoding"))
+            {
+                chunked = EqualsIgnoreCase(value, "chunked");
+            }
+            else if(EqualsIgnoreCase(name, "Connection"))
+            {
+                keepAlive = !EqualsIgnoreCase(value, "close");
+            }
+            else if(EqualsIgnoreCase(name, "Content-Type"))
+            {
+                response.contentType.assign(value);
+            }
+        }
+
+        size_t position = headerEnd + 4;
+        response.body.clear();
+        if(chunked)
+        {
+            while(true)
+            {
+                size_t sizeEnd;
+                while((sizeEnd = buffer.find("\r\n", position)) == string::npos)
+                {
+                    if(!ReadMore(socket, buffer, buffer.size()))
+                    {
+                        error = "truncated chunk";
+                        return 1;
+                    }
+                }
+                size_t size = strtoull(buffer.c_str() + position, nullptr, 16);
+                if(size > maxResponseSize - response.body.size())
+                {
+                    error = "response too big";
+                    return 1;
+                }
+                position = sizeEnd + 2;
+                // The chunk and its CRLF, or the CRLF ending the trailers.
+                if(buffer.size() < position + size + 2 && !ReadMore(socket, buffer, position + size + 1))
+                {
+                    error = "truncated chunk";
+                    return 1;
+                }
+                if(size == 0)
+                    break;
+                response.body.append(buffer, position, size);
+                position += size + 2;
+            }
+        }
+        else if(hasLength)
+        {
+            if(length > maxResponseSize)
+            {
+                error = "response too big";
+                return 1;
+            }
+            if(buffer.size() < position + length && !ReadMore(socket, buffer, position + length - 1))
+            {
+                error = "truncated body";
+                return 1;
+            }
+            response.body.assign(buffer, position, length);
+        }
+        else
+        {
+            // The body ends with the connection.
+            response.body.assign(buffer, position, string::npos);
+            char chunk[16 * 1024];
+            ssize_t read;
+            while((read = recv(socket, chunk, sizeof(chunk), 0)) > 0 && response.body.size() < maxResponseSize)
+                response.body.append(chunk, (size_t) read);
+            keepAlive = false;
+        }
+        return 0;
+    }
+
+    void Work()
+    {
+        while(true)
+        {
+            Job job;
+            {
+                unique_lock<mutex> guard(queueLock);
+                queueChanged.wait(guard, [this] { return stopping || !queue.empty(); });
+                if(queue.empty())
+                    return;
+                job = move(queue.front());
+                queue.pop_front();
+            }
+            Response response;
+            string error;
+            int failed = Send(job.peer, job.method, job.resource, job.contentType, job.body, response, error);
+            job.done(failed, response, error);
+        }
+    }
+
+public:
+    ///
+    /// @param threads The threads running the requests of SendAsync.
+    /// @param _timeoutSeconds How long a connection, a write or a read of
+    /// a response may take.
+    ///
+    explicit PeerClient(size_t threads = 4, int _timeoutSeconds = 10)
+        : timeoutSeconds(_timeoutSeconds)
+    {
+        for(size_t i = 0; i < threads; ++i)
+            workers.emplace_back(&PeerClient::Work, this);
+    }
+
+    // The queued requests are sent before the threads stop.
+    ~PeerClient()
+    {
+        {
+            lock_guard<mutex> guard(queueLock);
+            stopping = true;
+        }
+        queueChanged.notify_all();
+        for(thread& worker : workers)
+            worker.join();
+        for(auto& entry : idle)
+        {
+            for(int socket : entry.second)
+                close(socket);
+        }
+    }
+
+    PeerClient(const PeerClient&) = delete;
+    PeerClient& operator=(const PeerClient&) = delete;
+
+    ///
+    /// @brief Sends a request to the instance @p peer ("host:port") and
+    /// waits for its response. @p resource is the path and query.
+    ///
+    /// @returns 0 on success (whatever the status code of the response), 1
+    /// if the instance could not be reached or did not answer (see
+    /// @p error).
+    ///
+    int Send(const string& peer, string_view method, string_view resource, string_view contentType,
+             string_view body, Response& response, string& error)
+    {
+        string head;
+        head.reserve(128 + resource.size());
+        head.append(method).append(" ").append(resource).append(" HTTP/1.1\r\n");
+        head.append("Host: ").append(peer).append("\r\n");
+        head.append(forwardedHeader).append(": 1\r\n");
+        if(!contentType.empty())
+            head.append("Content-Type: ").append(contentType).append("\r\n");
+        head.append("Content-Length: ").append(to_string(body.size())).append("\r\n\r\n");
+        // A small body goes out in the same segment as the headers.
+        if(body.size() <= smallBody)
+        {
+            head.append(body);
+            body = string_view();
+        }
+
+        // A kept connection may have been closed by the other end, the
+        // request is then sent again once on a new one.
+        for(int attempt = 0; attempt < 2; ++attempt)
+        {
+            int socket = attempt == 0 ? TakeIdle(peer) : -1;
+            bool reused = socket >= 0;
+            if(!reused)
+            {
+                socket = Connect(peer, timeoutSeconds, error);
+                if(socket < 0)
+                    return 1;
+            }
+
+            bool keepAlive = false;
+            bool received = false;
+            if(!WriteAll(socket, head.data(), head.size()) || !WriteAll(socket, body.data(), body.size()))
+            {
+                error = "cannot write to " + peer + ": " + strerror(errno);
+            }
+            else if(ReadResponse(socket, response, keepAlive, received, error) == 0)
+            {
+                if(keepAlive)
+                    GiveBack(peer, socket);
+                else
+                    close(socket);
+                return 0;
+            }
+            close(socket);
+            if(!reused || received)
+                break;
+        }
+        error = peer + ": " + error;
+        return 1;
+    }
+
+    ///
+    /// @brief Queues a request to be sent by a thread of the client, see
+    /// @b Send, which calls @p done once it is answered or failed.
+    ///
+    /// @returns 0 on success, 1 if too many requests are queued, in which
+    /// case @p done is not called.
+    ///
+    int SendAsync(string peer, string method, string resource, string contentType, string body,
+                  Callback done)
+    {
+        {
+            lock_guard<mutex> guard(queueLock);
+            if(queue.size() >= maxQueued || stopping)
+                return 1;
+            queue.push_back({move(peer), move(method), move(resource), move(contentType), move(body), move(done)});
+        }
+        queueChanged.notify_one();
+        return 0;
+    }
+};
+}
+
+#endif
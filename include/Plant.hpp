@@ -1,10 +1,10 @@
-
 #ifndef PLANT_HPP
 #define PLANT_HPP
 
 #include <map>
 #include <vector>
 #include <string>
+#include <utility>
 
 using namespace std;
 
@@ -14,48 +14,50 @@ class Plant
 {
     string name;
     string color;
-    double height;
+    double height = 0;
     string plantType;
     string suitableSoilType;
 public:
     Plant(string _name, string _color, double _height, string _plantType, string _suitableSoilType)
-    {
-        name = _name;
-        color = _color;
-        height = _height;
-        plantType = _plantType;
-        suitableSoilType = _suitableSoilType;
-    }
-    Plant()
+        : name(move(_name)),
+          color(move(_color)),
+          height(_height),
+          plantType(move(_plantType)),
+          suitableSoilType(move(_suitableSoilType))
     {
 
     }
-    ~Plant()
+    Plant()
     {
 
     }
-    string GetName()
+    const string& GetName() const
     {
         return name;
     }
-    string GetColor()
+    const string& GetColor() const
     {
         return color;
     }
-    double GetHeight()
+    double GetHeight() const
     {
         return height;
     }
-    string GetType()
+    const string& GetType() const
     {
         return plantType;
     }
-    string GetSoil()
+    const string& GetSoil() const
     {
         return suitableSoilType;
     }
+    // A default constructed plant means there is no plant in the pot.
+    bool IsEmpty() const
+    {
+        return name.empty();
+    }
 
-    bool operator==(Plant& p1)
+    bool operator==(const Plant& p1) const
     {
         return p1.GetName() == this->GetName();
     }
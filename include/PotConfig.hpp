@@ -0,0 +1,621 @@
+///
+/// @file PotConfig.hpp
+///
+/// @brief The pots served at startup, as declared in JSON configuration
+/// files. Loading only keeps a compact entry per pot (its plant, the name
+/// of its sensor set and its threshold overrides), the @b SmartPot of a pot
+/// is built when the fleet first needs it.
+///
+/// A configuration file is an object with four optional members:
+///
+///     "sensorTypes": {"<sensorType>": "<sensor>", ...}
+///     "plants":     {"<name>": {"species", "color", "height", "type",
+///                                "suitableSoilType"}, ...}
+///     "sensorSets": {"<name>": {"<groupId>": {"<sensor>": {"value",
+///                                "min", "max", "maxRate", "derive",
+///                                "inputs"}, ...}, ...}, ...}
+///     "pots":       [{"id", "plant": "<name>" or a plant object,
+///                     "sensorSet": "<name>",
+///                     "thresholds": {"<sensor>": {"min", "max"}, ...}}, ...]
+///
+/// A sensor with a "derive" function (see DerivedSensors.hpp) is computed
+/// from the "inputs" sensors of its set, the usual ones of the function by
+/// default, whenever one of them is written.
+///
+/// The "maxRate" of a sensor is the fastest change of its readings, in
+/// units per second, which is not an anomaly (see AnomalyDetector.hpp).
+///
+/// The sensor types name the sensors of the "sensorType" numbers of the
+/// MQTT payloads and settings requests. A directory is loaded file after
+/// file, in name order, and the sensor types, plants, sensor sets and pots
+/// of a file replace those of the same name (or id) declared before, so a
+/// file can be overridden by a later one.
+///
+#ifndef POT_CONFIG_HPP
+#define POT_CONFIG_HPP
+
+#include "SmartPot.hpp"
+
+// Our JSON Parser.
+#include <rapidjson/document.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+namespace pot
+{
+class PotConfig
+{
+    struct SensorSpec
+    {
+        int group;
+        string name;
+        bool isString;
+        double value;
+        string stringValue;
+        double minValue;
+        double maxValue;
+        DerivedGraph::Function function;
+        vector<string> inputs;
+        // 0 for the default rate limit.
+        double maxRate;
+    };
+
+    struct Threshold
+    {
+        string name;
+        double minValue;
+        double maxValue;
+    };
+
+    // A pot only refers to its plant and sensor set, by index.
+    struct PotEntry
+    {
+        uint32_t plant;
+        uint32_t sensorSet;
+        vector<Threshold> thresholds;
+    };
+
+    // Plants and sensor sets by index, the names are interned when first
+    // referred to and may be defined by a later file.
+    vector<Plant> plants;
+    vector<bool> plantDefined;
+    unordered_map<string, uint32_t> plantNames;
+    vector<vector<SensorSpec>> sensorSets;
+    vector<bool> sensorSetDefined;
+    unordered_map<string, uint32_t> sensorSetNames;
+    // The derived sensors of every sensor set, nullptr if it has none.
+    vector<shared_ptr<const DerivedGraph>> derivedGraphs;
+
+    unordered_map<int, PotEntry> pots;
+    map<int, string> sensorTypes;
+    string error;
+
+    static uint32_t Intern(unordered_map<string, uint32_t>& names, string_view name, size_t& count)
+    {
+        auto it = names.emplace(string(name), (uint32_t) count).first;
+        if(it->second == count)
+            count++;
+        return it->second;
+    }
+
+    uint32_t PlantIndex(string_view name)
+    {
+        size_t count = plants.size();
+        uint32_t index = Intern(plantNames, name, count);
+        plants.resize(count);
+        plantDefined.resize(count, false);
+        return index;
+    }
+
+    uint32_t SensorSetIndex(string_view name)
+    {
+        size_t count = sensorSets.size();
+        uint32_t index = Intern(sensorSetNames, name, count);
+        sensorSets.resize(count);
+        sensorSetDefined.resize(count, false);
+        return index;
+    }
+
+    int Fail(const string& what)
+    {
+        error = what;
+        return 1;
+    }
+
+    static bool GetNumber(const rapidjson::Value& object, const char *key, double& out)
+    {
+        auto member = object.FindMember(key);
+        if(member == object.MemberEnd())
+            return true;
+        if(!member->value.IsNumber())
+            return false;
+        out = member->value.GetDouble();
+        return true;
+    }
+
+    int ParsePlant(const rapidjson::Value& value, Plant& plant)
+    {
+        if(!value.IsObject())
+            return Fail("a plant shall be an object");
+        const char *keys[] = {"species", "color", "type", "suitableSoilType"};
+        string fields[4];
+        for(int i = 0; i < 4; ++i)
+        {
+            auto member = value.FindMember(keys[i]);
+            if(member == value.MemberEnd() || !member->value.IsString())
+                return Fail(string("plant field ") + keys[i] + " shall be a string");
+            fields[i] = member->value.GetString();
+        }
+        double height = 0;
+        if(!GetNumber(value, "height", height))
+            return Fail("plant field height shall be a number");
+        plant = Plant(move(fields[0]), move(fields[1]), height, move(fields[2]), move(fields[3]));
+        return 0;
+    }
+
+    int ParseSensorSet(const rapidjson::Value& value, vector<SensorSpec>& sensors)
+    {
+        if(!value.IsObject())
+            return Fail("a sensor set shall be an object of sensor groups");
+        sensors.clear();
+        for(auto& group : value.GetObject())
+        {
+            char *end;
+            long groupId = strtol(group.name.GetString(), &end, 10);
+            if(*end != '\0' || end == group.name.GetString() || !group.value.IsObject())
+                return Fail(string("sensor group ") + group.name.GetString()
+                            + " shall have a numeric id and be an object");
+            for(auto& sensor : group.value.GetObject())
+            {
+                if(!sensor.value.IsObject())
+                    return Fail(string("sensor ") + sensor.name.GetString() + " shall be an object");
+                SensorSpec spec{(int) groupId, sensor.name.GetString(), false, 0, string(), 0, 0,
+                                DerivedGraph::input, {}, 0};
+                auto initial = sensor.value.FindMember("value");
+                if(initial != sensor.value.MemberEnd())
+                {
+                    if(initial->value.IsString())
+                    {
+                        spec.isString = true;
+                        spec.stringValue = initial->value.GetString();
+                    }
+                    else if(initial->value.IsNumber())
+                    {
+                        spec.value = initial->value.GetDouble();
+                    }
+                    else
+                    {
+                        return Fail("value of sensor " + spec.name + " shall be a number or a string");
+                    }
+                }
+                if(!GetNumber(sensor.value, "min", spec.minValue) || !GetNumber(sensor.value, "max", spec.maxValue))
+                    return Fail("thresholds of sensor " + spec.name + " shall be numbers");
+                if(!GetNumber(sensor.value, "maxRate", spec.maxRate) || spec.maxRate < 0)
+                    return Fail("maxRate of sensor " + spec.name + " shall be a positive number");
+                if(ParseDerive(sensor.value, spec))
+                    return 1;
+                sensors.push_back(move(spec));
+            }
+        }
+        return 0;
+    }
+
+    int ParseDerive(const rapidjson::Value& value, SensorSpec& spec)
+    {
+        auto derive = value.FindMember("derive");
+        if(derive == value.MemberEnd())
+            return 0;
+        if(!derive->value.IsString())
+            return Fail("derive of sensor " + spec.name + " shall be a string");
+        spec.function = DerivedGraph::Parse(derive->value.GetString());
+        if(spec.function == DerivedGraph::input)
+            return Fail("sensor " + spec.name + " derives from the unknown function "
+                        + derive->value.GetString());
+        if(spec.isString)
+            return Fail("derived sensor " + spec.name + " shall be numeric");
+        spec.inputs = DerivedGraph::DefaultInputs(spec.function);
+        auto inputs = value.FindMember("inputs");
+        if(inputs != value.MemberEnd())
+        {
+            if(!inputs->value.IsArray())
+                return Fail("inputs of sensor " + spec.name + " shall be an array of sensor names");
+            spec.inputs.clear();
+            for(auto& input : inputs->value.GetArray())
+            {
+                if(!input.IsString())
+                    return Fail("inputs of sensor " + spec.name + " shall be an array of sensor names");
+                spec.inputs.push_back(input.GetString());
+            }
+        }
+        return 0;
+    }
+
+    ///
+    /// @brief Builds the graph of the derived sensors of a sensor set.
+    ///
+    /// @returns 0 on success, 1 if a derived sensor reads a sensor the set
+    /// does not have or depends on itself.
+    ///
+    int BuildDerived(const string& name, const vector<SensorSpec>& sensors, shared_ptr<const DerivedGraph>& out)
+    {
+        out.reset();
+        auto graph = make_shared<DerivedGraph>();
+        bool any = false;
+        for(const SensorSpec& spec : sensors)
+        {
+            if(spec.function == DerivedGraph::input)
+                continue;
+            any = true;
+            string reason;
+            if(graph->Add(spec.name, spec.function, spec.inputs, reason))
+                return Fail("sensor set " + name + ": " + reason);
+        }
+        if(!any)
+            return 0;
+        for(const DerivedGraph::Node& node : graph->Nodes())
+        {
+            auto found = find_if(sensors.begin(), sensors.end(),
+                                 [&node](const SensorSpec& spec) { return spec.name == node.name; });
+            if(found == sensors.end())
+                return Fail("sensor set " + name + " derives a sensor from " + node.name
+                            + ", which it does not have");
+        }
+        string reason;
+        if(graph->Build(reason))
+            return Fail("sensor set " + name + ": " + reason);
+        out = move(graph);
+        return 0;
+    }
+
+    int ParsePot(const rapidjson::Value& value)
+    {
+        if(!value.IsObject())
+            return Fail("a pot shall be an object");
+        auto id = value.FindMember("id");
+        if(id == value.MemberEnd() || !id->value.IsInt() || id->value.GetInt() < 0)
+            return Fail("pot id shall be a non-negative integer");
+        int potId = id->value.GetInt();
+
+        PotEntry entry;
+        auto plant = value.FindMember("plant");
+        if(plant == value.MemberEnd())
+            return Fail("pot " + to_string(potId) + " has no plant");
+        if(plant->value.IsString())
+        {
+            entry.plant = PlantIndex(plant->value.GetString());
+        }
+        else
+        {
+            // An inline plant is a plant of its own, named after the pot.
+            entry.plant = PlantIndex("#pot" + to_string(potId));
+            if(ParsePlant(plant->value, plants[entry.plant]))
+                return Fail("pot " + to_string(potId) + ": " + error);
+            plantDefined[entry.plant] = true;
+        }
+
+        auto sensorSet = value.FindMember("sensorSet");
+        if(sensorSet == value.MemberEnd() || !sensorSet->value.IsString())
+            return Fail("pot " + to_string(potId) + " shall name its sensorSet");
+        entry.sensorSet = SensorSetIndex(sensorSet->value.GetString());
+
+        auto thresholds = value.FindMember("thresholds");
+        if(thresholds != value.MemberEnd())
+        {
+            if(!thresholds->value.IsObject())
+                return Fail("thresholds of pot " + to_string(potId) + " shall be an object");
+            for(auto& sensor : thresholds->value.GetObject())
+            {
+                Threshold threshold{sensor.name.GetString(), 0, 0};
+                if(!sensor.value.IsObject()
+                   || !sensor.value.HasMember("min") || !sensor.value.HasMember("max")
+                   || !GetNumber(sensor.value, "min", threshold.minValue)
+                   || !GetNumber(sensor.value, "max", threshold.maxValue))
+                    return Fail("threshold " + threshold.name + " of pot " + to_string(potId)
+                                + " shall have a numeric min and max");
+                entry.thresholds.push_back(move(threshold));
+            }
+        }
+        pots[potId] = move(entry);
+        return 0;
+    }
+
+    ///
+    /// @brief Checks that everything the pots refer to was defined.
+    ///
+    int Resolve()
+    {
+        for(auto& entry : plantNames)
+        {
+            if(!plantDefined[entry.second])
+                return Fail("plant " + entry.first + " is not defined");
+        }
+        derivedGraphs.assign(sensorSets.size(), nullptr);
+        for(auto& entry : sensorSetNames)
+        {
+            if(!sensorSetDefined[entry.second])
+                return Fail("sensor set " + entry.first + " is not defined");
+            if(BuildDerived(entry.first, sensorSets[entry.second], derivedGraphs[entry.second]))
+                return 1;
+        }
+        for(auto& entry : pots)
+        {
+            const vector<SensorSpec>& sensors = sensorSets[entry.second.sensorSet];
+            for(const Threshold& threshold : entry.second.thresholds)
+            {
+                auto found = find_if(sensors.begin(), sensors.end(),
+                                     [&threshold](const SensorSpec& spec) { return spec.name == threshold.name; });
+                if(found == sensors.end())
+                    return Fail("pot " + to_string(entry.first) + " sets the thresholds of "
+                                + threshold.name + ", which its sensor set does not have");
+            }
+        }
+        return 0;
+    }
+
+    int Merge(string_view text)
+    {
+        rapidjson::Document document;
+        if(document.Parse(text.data(), text.size()).HasParseError() || !document.IsObject())
+            return Fail("invalid JSON near offset " + to_string(document.GetErrorOffset()));
+
+        auto typesMember = document.FindMember("sensorTypes");
+        if(typesMember != document.MemberEnd())
+        {
+            if(!typesMember->value.IsObject())
+                return Fail("sensorTypes shall be an object");
+            for(auto& type : typesMember->value.GetObject())
+            {
+                char *end;
+                long sensorType = strtol(type.name.GetString(), &end, 10);
+                if(*end != '\0' || end == type.name.GetString() || !type.value.IsString())
+                    return Fail(string("sensor type ") + type.name.GetString()
+                                + " shall be a number naming a sensor");
+                sensorTypes[(int) sensorType] = type.value.GetString();
+            }
+        }
+
+        auto plantsMember = document.FindMember("plants");
+        if(plantsMember != document.MemberEnd())
+        {
+            if(!plantsMember->value.IsObject())
+                return Fail("plants shall be an object");
+            for(auto& plant : plantsMember->value.GetObject())
+            {
+                uint32_t index = PlantIndex(plant.name.GetString());
+                if(ParsePlant(plant.value, plants[index]))
+                    return Fail(string("plant ") + plant.name.GetString() + ": " + error);
+                plantDefined[index] = true;
+            }
+        }
+
+        auto setsMember = document.FindMember("sensorSets");
+        if(setsMember != document.MemberEnd())
+        {
+            if(!setsMember->value.IsObject())
+                return Fail("sensorSets shall be an object");
+            for(auto& sensorSet : setsMember->value.GetObject())
+            {
+                uint32_t index = SensorSetIndex(sensorSet.name.GetString());
+                if(ParseSensorSet(sensorSet.value, sensorSets[index]))
+                    return Fail(string("sensor set ") + sensorSet.name.GetString() + ": " + error);
+                sensorSetDefined[index] = true;
+            }
+        }
+
+        auto potsMember = document.FindMember("pots");
+        if(potsMember != document.MemberEnd())
+        {
+            if(!potsMember->value.IsArray())
+                return Fail("pots shall be an array");
+            pots.reserve(pots.size() + potsMember->value.Size());
+            for(auto& pot : potsMember->value.GetArray())
+            {
+                if(ParsePot(pot))
+                    return 1;
+            }
+        }
+        return 0;
+    }
+
+public:
+    // The sensor types, the plant, the sensor set and pot 0 every server
+    // starts with, loaded before the configuration given at startup which
+    // can refer to them or replace them.
+    inline static const char *defaults = R"({
+        "sensorTypes": {
+            "1": "ground", "2": "temperature", "3": "luminosity", "4": "humidity",
+            "5": "fertiliser", "6": "soilPh", "7": "soilHumidity", "8": "soilType"
+        },
+        "plants": {
+            "cactus": {"species": "Cactus", "color": "Green", "height": 1.3,
+                       "type": "Desert", "suitableSoilType": "Red"}
+        },
+        "sensorSets": {
+            "desert": {
+                "1": {"nitrogen":     {"value": 20,    "min": 10,    "max": 50},
+                      "phosphorus":   {"value": 15,    "min": 5,     "max": 30},
+                      "potassium":    {"value": 40,    "min": 20,    "max": 60}},
+                "2": {"temperature":  {"value": 25,    "min": 18,    "max": 35},
+                      "luminosity":   {"value": 20000, "min": 10000, "max": 50000},
+                      "humidity":     {"value": 30,    "min": 10,    "max": 50}},
+                "3": {"soilHumidity": {"value": 20,    "min": 10,    "max": 30},
+                      "soilType":     {"value": "Red", "min": 0,     "max": 0},
+                      "soilPh":       {"value": 6.5,   "min": 6,     "max": 7.5}},
+                "4": {"vaporPressureDeficit": {"derive": "vaporPressureDeficit", "min": 1,   "max": 3.5},
+                      "dewPoint":             {"derive": "dewPoint",             "min": -10, "max": 20},
+                      "npkBalance":           {"derive": "npkBalance",           "min": 0.3, "max": 1},
+                      "dailyLightIntegral":   {"derive": "dailyLightIntegral",   "min": 10,  "max": 40}}
+            }
+        },
+        "pots": [
+            {"id": 0, "plant": "cactus", "sensorSet": "desert"}
+        ]
+    })";
+
+    ///
+    /// @brief Loads a JSON configuration file, or every .json file of a
+    /// directory in name order, on top of what is already loaded.
+    ///
+    /// @returns 0 on success, 1 on failure (see @b Error).
+    ///
+    int Load(const string& path)
+    {
+        namespace fs = std::filesystem;
+        error_code code;
+        vector<fs::path> files;
+        if(fs::is_directory(path, code))
+        {
+            for(auto& entry : fs::directory_iterator(path, code))
+            {
+                if(entry.is_regular_file() && entry.path().extension() == ".json")
+                    files.push_back(entry.path());
+            }
+            sort(files.begin(), files.end());
+        }
+        else
+        {
+            files.push_back(path);
+        }
+
+        for(const fs::path& file : files)
+        {
+            ifstream in(file, ios::binary);
+            if(!in)
+                return Fail("cannot read " + file.string());
+            stringstream text;
+            text << in.rdbuf();
+            if(Merge(text.str()))
+                return Fail(file.string() + ": " + error);
+        }
+        return Resolve();
+    }
+
+    ///
+    /// @brief Loads a configuration given as JSON text, on top of what is
+    /// already loaded.
+    ///
+    /// @returns 0 on success, 1 on failure (see @b Error).
+    ///
+    int LoadJson(string_view text)
+    {
+        if(Merge(text))
+            return 1;
+        return Resolve();
+    }
+
+    // Why the last load failed.
+    const string& Error() const
+    {
+        return error;
+    }
+
+    size_t Size() const
+    {
+        return pots.size();
+    }
+
+    // The sensor names by "sensorType" number.
+    const map<int, string>& SensorTypes() const
+    {
+        return sensorTypes;
+    }
+
+    bool Has(int potId) const
+    {
+        return pots.find(potId) != pots.end();
+    }
+
+    // The ids of the configured pots, in increasing order.
+    vector<int> PotIds() const
+    {
+        vector<int> ids;
+        ids.reserve(pots.size());
+        for(auto& entry : pots)
+            ids.push_back(entry.first);
+        sort(ids.begin(), ids.end());
+        return ids;
+    }
+
+    ///
+    /// @brief Builds pot @p potId as configured: its plant and its sensor
+    /// set, with the thresholds overridden by the pot and the derived
+    /// sensors computed.
+    ///
+    /// @returns The pot, or an empty pot if @p potId is not configured.
+    ///
+    SmartPot Build(int potId) const
+    {
+        auto it = pots.find(potId);
+        if(it == pots.end())
+            return SmartPot();
+        const PotEntry& entry = it->second;
+
+        SensorGroups sensors;
+        for(const SensorSpec& spec : sensorSets[entry.sensorSet])
+        {
+            SensorMap& group = sensors[spec.group];
+            if(spec.isString)
+            {
+                group.emplace(spec.name, Sensor(spec.name, spec.stringValue, spec.minValue, spec.maxValue));
+            }
+            else
+            {
+                auto added = group.emplace(spec.name, Sensor(spec.name, spec.value, spec.minValue, spec.maxValue));
+                added.first->second.GetDetector().SetMaxRate(spec.maxRate);
+            }
+        }
+        for(const Threshold& threshold : entry.thresholds)
+        {
+            for(auto& group : sensors)
+            {
+                auto sensor = group.second.find(threshold.name);
+                if(sensor == group.second.end())
+                    continue;
+                sensor->second.SetMinValue(threshold.minValue);
+                sensor->second.SetMaxValue(threshold.maxValue);
+            }
+        }
+        SmartPot pot(plants[entry.plant], move(sensors));
+        if(derivedGraphs[entry.sensorSet])
+            pot.SetDerived(derivedGraphs[entry.sensorSet]);
+        return pot;
+    }
+
+    ///
+    /// @brief Gives @p pot, received from another instance, what a
+    /// snapshot does not carry (see Snapshot.hpp): the derived sensors and
+    /// the anomaly rates of the sensor set of pot @p potId. Its plant and
+    /// thresholds are kept.
+    ///
+    void Rebind(int potId, SmartPot& pot) const
+    {
+        auto it = pots.find(potId);
+        if(it == pots.end())
+            return;
+        const PotEntry& entry = it->second;
+
+        for(const SensorSpec& spec : sensorSets[entry.sensorSet])
+        {
+            Sensor* sensor = pot.FindSensor(spec.name);
+            if(sensor != nullptr && !spec.isString)
+                sensor->GetDetector().SetMaxRate(spec.maxRate);
+        }
+        if(derivedGraphs[entry.sensorSet])
+            pot.SetDerived(derivedGraphs[entry.sensorSet]);
+    }
+};
+}
+
+#endif
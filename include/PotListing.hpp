@@ -0,0 +1,193 @@
+///
+/// @file PotListing.hpp
+///
+/// @brief Encodes a page of the pots of a @b Fleet as JSON, a few pots at a
+/// time, so that a listing of the whole fleet can be streamed (and
+/// compressed on the way) instead of being built in one string.
+///
+/// The page is {"pots": [...], "nextCursor": <id or null>}. The cursor is
+/// the id of the first pot not listed and the pots are listed in id order,
+/// so the next page starts where this one stopped even if pots were added
+/// or removed in between.
+///
+#ifndef POT_LISTING_HPP
+#define POT_LISTING_HPP
+
+#include "ChunkCompressor.hpp"
+#include "Fleet.hpp"
+
+// Our JSON Parser.
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace pot
+{
+class PotListing
+{
+    int next;
+    size_t remaining;
+    // Requested sensors, unless all of them are.
+    vector<string> fields;
+    bool allSensors = true;
+    bool withPlant = true;
+    bool started = false;
+    bool finished = false;
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer;
+    ChunkCompressor compressor;
+
+    void WriteSensor(const string& name, const Sensor& sensor)
+    {
+        writer.Key(name.c_str(), (rapidjson::SizeType) name.size());
+        writer.StartObject();
+        writer.Key("value");
+        if(sensor.IsNumeric())
+            writer.Double(sensor.GetDoubleValue());
+        else
+            writer.String(sensor.GetStringValue().c_str(), (rapidjson::SizeType) sensor.GetStringValue().size());
+        writer.Key("min");      writer.Double(sensor.GetMinValue());
+        writer.Key("max");      writer.Double(sensor.GetMaxValue());
+        writer.Key("stale");    writer.Bool(sensor.IsStale());
+        writer.EndObject();
+    }
+
+    void WritePot(int potId, const SmartPot& pot)
+    {
+        writer.StartObject();
+        writer.Key("id");
+        writer.Int(potId);
+        if(withPlant && pot.HasPlant())
+        {
+            const Plant& plant = pot.GetPlant();
+            writer.Key("plant");
+            writer.StartObject();
+            writer.Key("species");          writer.String(plant.GetName().c_str());
+            writer.Key("color");            writer.String(plant.GetColor().c_str());
+            writer.Key("height");           writer.Double(plant.GetHeight());
+            writer.Key("type");             writer.String(plant.GetType().c_str());
+            writer.Key("suitableSoilType"); writer.String(plant.GetSoil().c_str());
+            writer.EndObject();
+        }
+        writer.Key("sensors");
+        writer.StartObject();
+        if(allSensors)
+        {
+            for(auto it = pot.GetSensors().begin(); it != pot.GetSensors().end(); ++it)
+            {
+                for(auto it2 = (it->second).begin(); it2 != (it->second).end(); ++it2)
+                    WriteSensor(it2->first, it2->second);
+            }
+        }
+        else
+        {
+            for(const string& name : fields)
+            {
+                const Sensor* sensor = pot.FindSensor(name);
+                if(sensor != nullptr)
+                    WriteSensor(name, *sensor);
+            }
+        }
+        writer.EndObject();
+        writer.EndObject();
+    }
+
+public:
+    ///
+    /// @param cursor The id to start from, 0 for the first page.
+    /// @param limit The most pots of the page.
+    /// @param _fields Comma separated sensor names, plus "plant" for the
+    /// plant, everything when empty.
+    /// @param encoding The content coding of the output.
+    ///
+    PotListing(int cursor, size_t limit, string_view _fields, ChunkCompressor::Encoding encoding)
+        : next(cursor < 0 ? 0 : cursor),
+          remaining(limit),
+          writer(buffer),
+          compressor(encoding, Z_BEST_SPEED)
+    {
+        while(!_fields.empty())
+        {
+            size_t comma = _fields.find(',');
+            string_view field = _fields.substr(0, comma);
+            _fields = comma == string_view::npos ? string_view() : _fields.substr(comma + 1);
+            if(!field.empty())
+                fields.emplace_back(field);
+        }
+        if(!fields.empty())
+        {
+            allSensors = false;
+            withPlant = false;
+            for(auto it = fields.begin(); it != fields.end(); )
+            {
+                if(*it == "plant")
+                {
+                    withPlant = true;
+                    it = fields.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+    }
+
+    ///
+    /// @brief Appends the encoding of the next @p chunkPots pots of the
+    /// page to @p out, and the end of the page after the last one. The
+    /// fleet is only read while this runs, so the caller can hold the lock
+    /// of the fleet for one chunk at a time.
+    ///
+    /// @returns False once the whole page has been written.
+    ///
+    bool Next(Fleet& fleet, size_t chunkPots, string& out)
+    {
+        if(finished)
+            return false;
+        buffer.Clear();
+        if(!started)
+        {
+            writer.StartObject();
+            writer.Key("pots");
+            writer.StartArray();
+            started = true;
+        }
+
+        size_t count = min(chunkPots, remaining);
+        if(count > 0)
+        {
+            next = fleet.ForEachFrom(next, count, [this](int potId, const SmartPot& pot)
+            {
+                WritePot(potId, pot);
+            });
+            remaining -= count;
+        }
+
+        if(remaining == 0 || next < 0)
+        {
+            writer.EndArray();
+            writer.Key("nextCursor");
+            if(next < 0)
+                writer.Null();
+            else
+                writer.Int(next);
+            writer.EndObject();
+            finished = true;
+        }
+
+        compressor.Compress(string_view(buffer.GetString(), buffer.GetSize()), out);
+        if(finished)
+            compressor.Finish(out);
+        return !finished;
+    }
+};
+}
+
+#endif
@@ -0,0 +1,422 @@
+///
+/// @file PotPool.hpp
+///
+/// @brief Slab storage for the pots of a @b Fleet. Pots live in fixed-size
+/// slabs of contiguous slots and the sensor map nodes of the pots of a slab
+/// are allocated from an arena owned by that slab, so a fleet-wide scan
+/// walks a few big blocks of memory instead of nodes spread over the heap.
+/// Slots, and the arena blocks of their sensors, are recycled when a pot is
+/// removed. Every slot has a row number, its rank among all the slots,
+/// which stays the same while a pot is stored, so data kept in arrays
+/// beside the pool can be indexed by it.
+///
+/// A pot can also be frozen: its sensors and plant are freed but its slot
+/// and row stay its own, until it is thawed with its state read back from
+/// elsewhere. The pool counts the memory of the pots which are not frozen,
+/// and picks the ones not used lately with a CLOCK sweep over the slots.
+///
+#ifndef POT_POOL_HPP
+#define POT_POOL_HPP
+
+#include "SmartPot.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace pot
+{
+class PotPool
+{
+public:
+    // Number of pots per slab.
+    static constexpr size_t slabSize = 1024;
+
+private:
+    struct Slot
+    {
+        // The id of the pot in this slot, -1 when the slot is free.
+        int potId = -1;
+        uint32_t row;
+        bool frozen = false;
+        // Set when the pot is read, cleared by the sweep passing over it.
+        bool referenced = false;
+        // What Footprint gave when the pot was stored.
+        uint32_t footprint = 0;
+        SmartPot pot;
+
+        Slot(pmr::memory_resource *resource, uint32_t _row)
+            : row(_row),
+              pot(resource)
+        {
+
+        }
+    };
+
+    ///
+    /// @brief Memory resource of a slab: blocks are carved one after the
+    /// other from big chunks and freed blocks are kept in one free list per
+    /// size, which is all the map nodes of the sensors need (they only come
+    /// in a couple of sizes). Unlike the standard pool resources it does not
+    /// round the sizes to powers of two.
+    ///
+    class SlabResource : public pmr::memory_resource
+    {
+        static constexpr size_t granularity = alignof(max_align_t);
+        static constexpr size_t chunkSize = 64 * 1024;
+        static constexpr size_t largestBlock = 1024;
+
+        struct FreeBlock
+        {
+            FreeBlock *next;
+        };
+
+        vector<unique_ptr<char[]>> chunks;
+        char *next = nullptr;
+        char *end = nullptr;
+        FreeBlock *freeLists[largestBlock / granularity + 1] = {};
+
+        void* do_allocate(size_t bytes, size_t alignment) override
+        {
+            size_t size = (bytes + granularity - 1) / granularity * granularity;
+            if(size > largestBlock || alignment > granularity)
+                return pmr::new_delete_resource()->allocate(bytes, alignment);
+            FreeBlock *&freeList = freeLists[size / granularity];
+            if(freeList != nullptr)
+            {
+                FreeBlock *block = freeList;
+                freeList = block->next;
+                return block;
+            }
+            if(next == nullptr || (size_t)(end - next) < size)
+            {
+                chunks.emplace_back(new char[chunkSize]);
+                next = chunks.back().get();
+                end = next + chunkSize;
+            }
+            void *block = next;
+            next += size;
+            return block;
+        }
+
+        void do_deallocate(void *p, size_t bytes, size_t alignment) override
+        {
+            size_t size = (bytes + granularity - 1) / granularity * granularity;
+            if(size > largestBlock || alignment > granularity)
+            {
+                pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+                return;
+            }
+            FreeBlock *&freeList = freeLists[size / granularity];
+            FreeBlock *block = static_cast<FreeBlock*>(p);
+            block->next = freeList;
+            freeList = block;
+        }
+
+        bool do_is_equal(const pmr::memory_resource &other) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+
+    struct Slab
+    {
+        // Declared first so that it outlives the sensors of the slots, null
+        // when the slab uses the arena shared by the pool.
+        unique_ptr<SlabResource> resource;
+        vector<Slot> slots;
+
+        Slab(uint32_t firstRow, SlabResource *shared)
+            : resource(shared == nullptr ? new SlabResource() : nullptr)
+        {
+            if(shared == nullptr)
+                shared = resource.get();
+            // Reserved once, so the slots never move.
+            slots.reserve(slabSize);
+            for(size_t i = 0; i < slabSize; ++i)
+                slots.emplace_back(shared, firstRow + (uint32_t) i);
+        }
+    };
+
+    // Declared before the slabs, which may allocate from it.
+    unique_ptr<SlabResource> sharedResource;
+    vector<unique_ptr<Slab>> slabs;
+    vector<Slot*> freeSlots;
+    map<int, Slot*> index;
+    // The bytes Footprint gives for the pots not frozen.
+    size_t hotBytes = 0;
+    size_t frozenCount = 0;
+    // The row the sweep looks at next.
+    size_t hand = 0;
+
+    void Measure(Slot& slot)
+    {
+        hotBytes -= slot.footprint;
+        slot.footprint = (uint32_t) Footprint(slot.pot);
+        hotBytes += slot.footprint;
+    }
+
+public:
+    ///
+    /// @brief The memory @p pot holds besides its slot, which freezing it
+    /// gives back: its sensor map nodes, taken to be their value and the
+    /// four words of a tree node, and the strings too long to be stored in
+    /// place.
+    ///
+    static size_t Footprint(const SmartPot& pot)
+    {
+        static const size_t inPlace = string().capacity();
+        auto heap = [](const string& text) { return text.capacity() > inPlace ? text.capacity() + 1 : 0; };
+        const size_t nodeOverhead = 4 * sizeof(void*);
+
+        const Plant& plant = pot.GetPlant();
+        size_t bytes = heap(plant.GetName()) + heap(plant.GetColor())
+                       + heap(plant.GetType()) + heap(plant.GetSoil());
+        for(auto it = pot.GetSensors().begin(); it != pot.GetSensors().end(); ++it)
+        {
+            bytes += nodeOverhead + sizeof(SensorGroups::value_type);
+            for(auto it2 = (it->second).begin(); it2 != (it->second).end(); ++it2)
+            {
+                bytes += nodeOverhead + sizeof(SensorMap::value_type) + heap(it2->first)
+                         + heap(it2->second.GetName()) + heap(it2->second.GetStringValue());
+            }
+        }
+        return bytes;
+    }
+
+    ///
+    /// @brief Moves @p pot into a free slot (taking a new slab when there
+    /// is none), its sensors are copied into the arena of the slab.
+    ///
+    /// @returns The stored pot or nullptr if the id is already taken.
+    ///
+    SmartPot* Insert(int potId, SmartPot pot)
+    {
+        if(index.find(potId) != index.end())
+            return nullptr;
+        if(freeSlots.empty())
+        {
+            slabs.emplace_back(new Slab((uint32_t) (slabs.size() * slabSize), sharedResource.get()));
+            Slab& slab = *slabs.back();
+            for(size_t i = slabSize; i-- > 0; )
+                freeSlots.push_back(&slab.slots[i]);
+        }
+        Slot* slot = freeSlots.back();
+        freeSlots.pop_back();
+        slot->potId = potId;
+        slot->pot = move(pot);
+        slot->referenced = false;
+        Measure(*slot);
+        index[potId] = slot;
+        return &slot->pot;
+    }
+
+    ///
+    /// @brief Removes pot @p potId, its slot is reused by the next insert.
+    ///
+    /// @returns 0 on success, 1 if there is no such pot.
+    ///
+    int Erase(int potId)
+    {
+        auto it = index.find(potId);
+        if(it == index.end())
+            return 1;
+        Slot* slot = it->second;
+        // Gives the sensor nodes back to the arena of the slab.
+        slot->pot = SmartPot();
+        slot->potId = -1;
+        if(slot->frozen)
+            frozenCount--;
+        slot->frozen = false;
+        hotBytes -= slot->footprint;
+        slot->footprint = 0;
+        freeSlots.push_back(slot);
+        index.erase(it);
+        return 0;
+    }
+
+    // The pot with the given id, nullptr if there is none or it is frozen.
+    SmartPot* Get(int potId)
+    {
+        auto it = index.find(potId);
+        if(it == index.end() || it->second->frozen)
+            return nullptr;
+        it->second->referenced = true;
+        return &it->second->pot;
+    }
+
+    ///
+    /// @returns The pot with the given id, and its row in @p row, or
+    /// nullptr if there is none or it is frozen.
+    ///
+    SmartPot* Get(int potId, uint32_t& row)
+    {
+        auto it = index.find(potId);
+        if(it == index.end() || it->second->frozen)
+            return nullptr;
+        it->second->referenced = true;
+        row = it->second->row;
+        return &it->second->pot;
+    }
+
+    ///
+    /// @brief Makes the slabs taken from now on allocate from one arena.
+    /// The blocks a slab arena frees are only reused by the pots of that
+    /// slab, so with pots frozen and thawed all over the pool every arena
+    /// would stay as big as when all its pots were in memory, while a
+    /// shared one only grows with the pots in memory at the same time.
+    ///
+    void ShareArena()
+    {
+        if(sharedResource == nullptr)
+            sharedResource.reset(new SlabResource());
+    }
+
+    // True if pot @p potId is stored, frozen or not.
+    bool Contains(int potId) const
+    {
+        return index.find(potId) != index.end();
+    }
+
+    ///
+    /// @brief Frees the sensors and plant of pot @p potId, which keeps its
+    /// slot and row.
+    ///
+    /// @returns 0 on success, 1 if there is no such pot or it is frozen.
+    ///
+    int Freeze(int potId)
+    {
+        auto it = index.find(potId);
+        if(it == index.end() || it->second->frozen)
+            return 1;
+        Slot* slot = it->second;
+        slot->pot = SmartPot();
+        slot->frozen = true;
+        hotBytes -= slot->footprint;
+        slot->footprint = 0;
+        frozenCount++;
+        return 0;
+    }
+
+    ///
+    /// @brief Moves @p pot into the slot of the frozen pot @p potId.
+    ///
+    /// @returns The stored pot or nullptr if @p potId is not frozen.
+    ///
+    SmartPot* Thaw(int potId, SmartPot pot)
+    {
+        auto it = index.find(potId);
+        if(it == index.end() || !it->second->frozen)
+            return nullptr;
+        Slot* slot = it->second;
+        slot->pot = move(pot);
+        slot->frozen = false;
+        slot->referenced = true;
+        Measure(*slot);
+        frozenCount--;
+        return &slot->pot;
+    }
+
+    // Counts pot @p potId again, once changed in place.
+    void Measure(int potId)
+    {
+        auto it = index.find(potId);
+        if(it != index.end() && !it->second->frozen)
+            Measure(*it->second);
+    }
+
+    ///
+    /// @brief Picks a pot to freeze: the hand goes over the slots, clearing
+    /// the referenced ones and stopping at the first which is not and for
+    /// which @p skip(potId) is false.
+    ///
+    /// @returns The id of the pot or -1 if there is none.
+    ///
+    template<typename Skip>
+    int Sweep(Skip skip)
+    {
+        size_t rows = Rows();
+        // Twice over, the first round may only clear the references.
+        for(size_t i = 0; i < 2 * rows; ++i)
+        {
+            if(hand >= rows)
+                hand = 0;
+            Slot& slot = slabs[hand / slabSize]->slots[hand % slabSize];
+            hand++;
+            if(slot.potId < 0 || slot.frozen)
+                continue;
+            if(slot.referenced)
+            {
+                slot.referenced = false;
+                continue;
+            }
+            if(!skip(slot.potId))
+                return slot.potId;
+        }
+        return -1;
+    }
+
+    size_t Size() const
+    {
+        return index.size();
+    }
+
+    size_t Frozen() const
+    {
+        return frozenCount;
+    }
+
+    size_t HotBytes() const
+    {
+        return hotBytes;
+    }
+
+    // Number of rows, every row is below it.
+    size_t Rows() const
+    {
+        return slabs.size() * slabSize;
+    }
+
+    ///
+    /// @brief Calls @p visit(potId, pot) for at most @p limit pots, in pot
+    /// id order, starting with the first id not lower than @p potId. The
+    /// frozen pots are visited empty.
+    ///
+    /// @returns The id to continue from or -1 after the last pot.
+    ///
+    template<typename Visit>
+    int ForEachFrom(int potId, size_t limit, Visit visit)
+    {
+        auto it = index.lower_bound(potId);
+        for(; it != index.end() && limit > 0; ++it, --limit)
+            visit(it->first, it->second->pot);
+        return it == index.end() ? -1 : it->first;
+    }
+
+    ///
+    /// @brief Calls @p visit(potId, pot) for every pot, slab after slab, in
+    /// memory order (so not in pot id order). The frozen pots are visited
+    /// empty.
+    ///
+    template<typename Visit>
+    void ForEach(Visit visit)
+    {
+        for(auto& slab : slabs)
+        {
+            for(Slot& slot : slab->slots)
+            {
+                if(slot.potId >= 0)
+                    visit(slot.potId, slot.pot);
+            }
+        }
+    }
+};
+}
+
+#endif
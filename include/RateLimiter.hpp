@@ -0,0 +1,145 @@
+///
+/// @file RateLimiter.hpp
+///
+/// @brief Token buckets deciding, before anything is parsed, what happens to
+/// an incoming MQTT message: a bucket per pot drops the messages of a device
+/// flooding its topic, and a global bucket detects when the whole fleet
+/// sends more than we can apply one message at a time.
+///
+#ifndef RATE_LIMITER_HPP
+#define RATE_LIMITER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <unordered_map>
+
+using namespace std;
+
+namespace pot
+{
+class RateLimiter
+{
+public:
+    enum Verdict : uint8_t
+    {
+        // Apply the message right away.
+        accept,
+        // Overload: only keep the latest value of the sensor.
+        coalesce,
+        // The pot is over its rate, ignore the message.
+        drop
+    };
+
+private:
+    // Idle buckets are pruned once there are that many, so made up pot
+    // ids in the topics can't make the map grow without bound.
+    static constexpr size_t maxBuckets = 1 << 20;
+
+    struct Bucket
+    {
+        double tokens;
+        int64_t last;
+    };
+
+    double potRate;
+    double potBurst;
+    double globalRate;
+    double globalBurst;
+    unordered_map<int, Bucket> pots;
+    Bucket global;
+
+    // Read by the other threads while the MQTT thread counts.
+    atomic<uint64_t> accepted{0};
+    atomic<uint64_t> coalesced{0};
+    atomic<uint64_t> dropped{0};
+
+    // Takes a token from @p bucket if it has one, after refilling it for
+    // the time elapsed since @p bucket.last.
+    static bool Take(Bucket& bucket, double rate, double burst, int64_t nowNs)
+    {
+        if(nowNs > bucket.last)
+        {
+            bucket.tokens = min(burst, bucket.tokens + (nowNs - bucket.last) * rate / 1e9);
+            bucket.last = nowNs;
+        }
+        if(bucket.tokens < 1)
+            return false;
+        bucket.tokens -= 1;
+        return true;
+    }
+
+    void Prune(int64_t nowNs)
+    {
+        for(auto it = pots.begin(); it != pots.end(); )
+        {
+            Bucket& bucket = it->second;
+            if(bucket.tokens + (nowNs - bucket.last) * potRate / 1e9 >= potBurst)
+                it = pots.erase(it);
+            else
+                ++it;
+        }
+    }
+
+public:
+    ///
+    /// @param _potRate Messages per second allowed to every pot.
+    /// @param _potBurst Messages a pot can send at once after being quiet.
+    /// @param _globalRate Messages per second applied one by one, beyond
+    /// that the messages are coalesced.
+    /// @param _globalBurst Burst of the global rate.
+    ///
+    RateLimiter(double _potRate, double _potBurst, double _globalRate, double _globalBurst)
+        : potRate(_potRate),
+          potBurst(_potBurst),
+          globalRate(_globalRate),
+          globalBurst(_globalBurst),
+          global{_globalBurst, 0}
+    {
+
+    }
+
+    ///
+    /// @brief Decides what to do with a message of pot @p potId received at
+    /// @p nowNs (nanoseconds of a monotonic clock). Not thread safe, meant
+    /// to be called by the MQTT thread only.
+    ///
+    Verdict Admit(int potId, int64_t nowNs)
+    {
+        auto it = pots.find(potId);
+        if(it == pots.end())
+        {
+            if(pots.size() >= maxBuckets)
+                Prune(nowNs);
+            it = pots.emplace(potId, Bucket{potBurst, nowNs}).first;
+        }
+        if(!Take(it->second, potRate, potBurst, nowNs))
+        {
+            dropped.fetch_add(1, memory_order_relaxed);
+            return drop;
+        }
+        if(!Take(global, globalRate, globalBurst, nowNs))
+        {
+            coalesced.fetch_add(1, memory_order_relaxed);
+            return coalesce;
+        }
+        accepted.fetch_add(1, memory_order_relaxed);
+        return accept;
+    }
+
+    uint64_t Accepted() const
+    {
+        return accepted.load(memory_order_relaxed);
+    }
+    uint64_t Coalesced() const
+    {
+        return coalesced.load(memory_order_relaxed);
+    }
+    uint64_t Dropped() const
+    {
+        return dropped.load(memory_order_relaxed);
+    }
+};
+}
+
+#endif
@@ -0,0 +1,436 @@
+///
+/// @file Scheduler.hpp
+///
+/// @brief Scheduled actuator jobs ("irrigate pot 3 every day at 06:00"),
+/// kept in a @b TimingWheel and run by one thread which hands the due jobs
+/// over in batches.
+///
+/// The jobs are persisted in an append-only journal of text lines, one
+/// "add <id> <potId> <action> <first> <period> <count>" per new job and one
+/// "del <id>" per removed or finished job, which is replayed and compacted
+/// at startup. Occurrences missed while the server was down are skipped.
+///
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include "SmartPot.hpp"
+#include "TimingWheel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+namespace pot
+{
+class Scheduler
+{
+public:
+    // The actuators a job can trigger, named after their routes.
+    enum Action : uint8_t
+    {
+        irrigateSoil,
+        injectMinerals,
+        activateSolarLamp,
+        shovel,
+        actionCount
+    };
+
+    struct Job
+    {
+        uint64_t id = 0;
+        int potId = 0;
+        Action action = irrigateSoil;
+        // First run, in seconds since the epoch.
+        int64_t first = 0;
+        // Seconds between the runs, 0 for a job which runs once.
+        int64_t period = 0;
+        // Number of runs of a periodic job, 0 for no limit.
+        uint32_t count = 0;
+        uint32_t runs = 0;
+        int64_t next = 0;
+        string lastResult;
+        TimingWheel::Handle timer = TimingWheel::noTimer;
+    };
+
+    // A job which is due, as handed to the dispatch function.
+    struct Due
+    {
+        uint64_t jobId;
+        int potId;
+        Action action;
+    };
+
+    ///
+    /// @brief Runs a batch of due jobs, pushing one result per job.
+    /// Called by the scheduler thread without the scheduler lock held.
+    ///
+    using Dispatch = function<void(const vector<Due>&, vector<string>&)>;
+
+    ///
+    /// @brief Called by the scheduler thread every second with the time in
+    /// seconds since the epoch, before the due jobs are dispatched.
+    ///
+    using Tick = function<void(int64_t)>;
+
+    // Due jobs handed over per call of the dispatch function.
+    static constexpr size_t batchSize = 1024;
+
+private:
+    // The journal is compacted once it holds that many more lines than jobs.
+    static constexpr size_t compactSlack = 4096;
+
+    string journalPath;
+    Dispatch dispatch;
+    Tick tick;
+
+    mutex lock;
+    condition_variable wakeUp;
+    bool stopping = false;
+    thread worker;
+
+    unordered_map<uint64_t, Job> jobs;
+    TimingWheel wheel;
+    uint64_t nextId = 1;
+    ofstream journal;
+    size_t journalLines = 0;
+
+    static int64_t Now()
+    {
+        return chrono::duration_cast<chrono::seconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    static void WriteAdd(ostream& out, const Job& job)
+    {
+        out << "add " << job.id << ' ' << job.potId << ' ' << (int) job.action << ' '
+            << job.first << ' ' << job.period << ' ' << job.count << '\n';
+    }
+
+    ///
+    /// @brief Finds the first occurrence of @p job after @p now and the
+    /// number of occurrences before it.
+    ///
+    /// @returns False if the job has no occurrence left.
+    ///
+    static bool Resume(Job& job, int64_t now)
+    {
+        if(job.first > now)
+        {
+            job.next = job.first;
+            job.runs = 0;
+            return true;
+        }
+        if(job.period == 0)
+            return false;
+        int64_t skipped = (now - job.first) / job.period + 1;
+        if(job.count != 0 && skipped >= job.count)
+            return false;
+        job.runs = (uint32_t) skipped;
+        job.next = job.first + skipped * job.period;
+        return true;
+    }
+
+    void Load()
+    {
+        ifstream in(journalPath);
+        unordered_map<uint64_t, Job> loaded;
+        string line;
+        while(getline(in, line))
+        {
+            istringstream fields(line);
+            string kind;
+            Job job;
+            int action;
+            fields >> kind >> job.id;
+            if(kind == "add" && fields >> job.potId >> action >> job.first >> job.period >> job.count
+               && action >= 0 && action < actionCount)
+            {
+                job.action = (Action) action;
+                loaded[job.id] = job;
+            }
+            else if(kind == "del")
+            {
+                loaded.erase(job.id);
+            }
+            nextId = max(nextId, job.id + 1);
+        }
+
+        int64_t now = Now();
+        for(auto& entry : loaded)
+        {
+            Job& job = entry.second;
+            if(!Resume(job, now))
+                continue;
+            job.timer = wheel.Insert(job.next, job.id);
+            jobs.emplace(job.id, move(job));
+        }
+    }
+
+    ///
+    /// @brief Rewrites the journal with one line per live job.
+    ///
+    void Compact()
+    {
+        journal.close();
+        string tmpPath = journalPath + ".tmp";
+        {
+            ofstream out(tmpPath, ios::trunc);
+            for(auto& entry : jobs)
+                WriteAdd(out, entry.second);
+        }
+        rename(tmpPath.c_str(), journalPath.c_str());
+        journal.open(journalPath, ios::app);
+        journalLines = jobs.size();
+    }
+
+    void Journaled()
+    {
+        journal.flush();
+        if(++journalLines > 2 * jobs.size() + compactSlack)
+            Compact();
+    }
+
+    void Finish(unordered_map<uint64_t, Job>::iterator it)
+    {
+        journal << "del " << it->first << '\n';
+        jobs.erase(it);
+        Journaled();
+    }
+
+    void Loop()
+    {
+        vector<uint64_t> expired;
+        vector<Due> due;
+        vector<string> results;
+
+        unique_lock<mutex> guard(lock);
+        while(!stopping)
+        {
+            int64_t now = Now();
+            wakeUp.wait_until(guard, chrono::system_clock::time_point(chrono::seconds(now + 1)));
+            if(stopping)
+                break;
+
+            if(tick)
+            {
+                guard.unlock();
+                tick(Now());
+                guard.lock();
+            }
+
+            expired.clear();
+            wheel.Advance((uint64_t) Now(), expired);
+            for(size_t start = 0; start < expired.size(); start += batchSize)
+            {
+                due.clear();
+                size_t end = min(expired.size(), start + batchSize);
+                for(size_t i = start; i < end; ++i)
+                {
+                    auto it = jobs.find(expired[i]);
+                    if(it == jobs.end())
+                        continue;
+                    Job& job = it->second;
+                    due.push_back({job.id, job.potId, job.action});
+                    job.runs++;
+                    job.timer = TimingWheel::noTimer;
+                    if(job.period == 0 || (job.count != 0 && job.runs >= job.count))
+                    {
+                        Finish(it);
+                        continue;
+                    }
+                    job.next += job.period;
+                    job.timer = wheel.Insert(job.next, job.id);
+                }
+
+                // The actuators take the pot lock, never hold both.
+                results.clear();
+                guard.unlock();
+                dispatch(due, results);
+                guard.lock();
+
+                for(size_t i = 0; i < due.size() && i < results.size(); ++i)
+                {
+                    auto it = jobs.find(due[i].jobId);
+                    if(it != jobs.end())
+                        it->second.lastResult = move(results[i]);
+                }
+            }
+        }
+    }
+
+public:
+    ///
+    /// @param _journalPath The journal the jobs are loaded from and saved
+    /// to, created if missing.
+    /// @param _dispatch Runs the due jobs.
+    ///
+    Scheduler(string _journalPath, Dispatch _dispatch)
+        : journalPath(move(_journalPath)),
+          dispatch(move(_dispatch)),
+          wheel((uint64_t) Now())
+    {
+        Load();
+        Compact();
+    }
+
+    ~Scheduler()
+    {
+        Stop();
+    }
+
+    // Sets the function called every second, before Start.
+    void SetTick(Tick _tick)
+    {
+        lock_guard<mutex> guard(lock);
+        tick = move(_tick);
+    }
+
+    // Starts the scheduler thread.
+    void Start()
+    {
+        lock_guard<mutex> guard(lock);
+        if(worker.joinable())
+            return;
+        stopping = false;
+        worker = thread(&Scheduler::Loop, this);
+    }
+
+    // Stops the scheduler thread, the jobs are kept.
+    void Stop()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        if(worker.joinable())
+            worker.join();
+    }
+
+    ///
+    /// @brief Adds a job, the id, runs, next and timer fields of @p job
+    /// are set here. A job which runs once with its run in the past runs as
+    /// soon as possible.
+    ///
+    /// @returns The id of the job or 0 if the job is invalid.
+    ///
+    uint64_t Add(Job job)
+    {
+        if(job.potId < 0 || job.action >= actionCount || job.period < 0)
+            return 0;
+
+        lock_guard<mutex> guard(lock);
+        int64_t now = Now();
+        // A periodic job keeps its phase, "every day at 06:00" can be given
+        // with any past 06:00.
+        if(job.first <= now && job.period > 0)
+            job.first += ((now - job.first) / job.period + 1) * job.period;
+        job.first = max(job.first, now + 1);
+        job.id = nextId++;
+        Resume(job, now);
+        job.timer = wheel.Insert(job.next, job.id);
+        WriteAdd(journal, job);
+        uint64_t id = job.id;
+        jobs.emplace(id, move(job));
+        Journaled();
+        return id;
+    }
+
+    ///
+    /// @returns 0 on success, 1 if there is no such job.
+    ///
+    int Remove(uint64_t id)
+    {
+        lock_guard<mutex> guard(lock);
+        auto it = jobs.find(id);
+        if(it == jobs.end())
+            return 1;
+        wheel.Cancel(it->second.timer);
+        Finish(it);
+        return 0;
+    }
+
+    ///
+    /// @brief Copies at most @p limit jobs of pot @p potId (of every pot if
+    /// negative), in id order.
+    ///
+    vector<Job> List(int potId, size_t limit)
+    {
+        vector<Job> result;
+        {
+            lock_guard<mutex> guard(lock);
+            for(auto& entry : jobs)
+            {
+                if(potId < 0 || entry.second.potId == potId)
+                    result.push_back(entry.second);
+            }
+        }
+        sort(result.begin(), result.end(),
+             [](const Job& a, const Job& b) { return a.id < b.id; });
+        if(result.size() > limit)
+            result.resize(limit);
+        return result;
+    }
+
+    size_t Size()
+    {
+        lock_guard<mutex> guard(lock);
+        return jobs.size();
+    }
+
+    static const char* ActionName(Action action)
+    {
+        static const char *names[actionCount] = {
+            "irrigateSoil", "injectMinerals", "activateSolarLamp", "shovel"
+        };
+        return action < actionCount ? names[action] : "";
+    }
+
+    ///
+    /// @returns The action named @p name or actionCount if there is none.
+    ///
+    static Action ActionFromName(const string& name)
+    {
+        for(int action = 0; action < actionCount; ++action)
+        {
+            if(name == ActionName((Action) action))
+                return (Action) action;
+        }
+        return actionCount;
+    }
+
+    ///
+    /// @brief Runs @p action on @p pot, as its route would.
+    ///
+    static string Run(const SmartPot& pot, Action action)
+    {
+        switch(action)
+        {
+        case irrigateSoil:
+            return pot.IrrigateSoil();
+        case injectMinerals:
+            return pot.NutrientsInjector();
+        case activateSolarLamp:
+            return pot.SolarLamp();
+        case shovel:
+            return pot.Shovel();
+        default:
+            return "";
+        }
+    }
+};
+}
+
+#endif
@@ -1,10 +1,14 @@
-
 #ifndef SENSOR_HPP
 #define SENSOR_HPP
 
+#include "AnomalyDetector.hpp"
+
+#include <cstdint>
 #include <map>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <utility>
 
 using namespace std;
 
@@ -14,38 +18,45 @@ namespace pot
 class Sensor
 {
     string name;
-    double doubleValue;
+    double doubleValue = 0;
     string stringValue;
-    double minValue;
-    double maxValue;
+    double minValue = 0;
+    double maxValue = 0;
+    // Time of the last reading in seconds since the epoch, 0 if none.
+    int64_t lastSeen = 0;
+    // Set when no reading came for longer than the time-to-live of the
+    // fleet, the value is then out of date.
+    bool stale = false;
+    // Timer of the fleet watching this sensor (see Fleet::ExpireStale).
+    uint64_t staleTimer = 0;
+    // Watches the readings for drifts and spikes (see Fleet::SetValue).
+    AnomalyDetector detector;
 public:
     Sensor()
     {
 
     }
     Sensor(string _name, double _value, double _minValue, double _maxValue)
+        : name(move(_name)),
+          doubleValue(_value),
+          minValue(_minValue),
+          maxValue(_maxValue)
     {
-        name = _name;
-        doubleValue = _value;
-        minValue = _minValue;
-        maxValue = _maxValue;
+
     }
     Sensor(string _name, string _value, double _minValue, double _maxValue)
-    {
-        name = _name;
-        stringValue = _value;
-        minValue = _minValue;
-        maxValue = _maxValue;
-    }
-    ~Sensor()
+        : name(move(_name)),
+          stringValue(move(_value)),
+          minValue(_minValue),
+          maxValue(_maxValue)
     {
 
     }
     void SetName(string newName)
     {
-        name = newName;
+        name = move(newName);
     }
-    string GetName()
+    const string& GetName() const
     {
         return name;
     }
@@ -53,15 +64,16 @@ public:
     {
         doubleValue = newValue;
     }
-    double GetDoubleValue()
+    double GetDoubleValue() const
     {
         return doubleValue;
     }
-    void SetValue(string newValue)
+    // Reuses the storage of the previous value when it is big enough.
+    void SetValue(string_view newValue)
     {
-        stringValue = newValue;
+        stringValue.assign(newValue.data(), newValue.size());
     }
-    string GetStringValue()
+    const string& GetStringValue() const
     {
         return stringValue;
     }
@@ -69,7 +81,7 @@ public:
     {
         minValue = newValue;
     }
-    double GetMinValue()
+    double GetMinValue() const
     {
         return minValue;
     }
@@ -77,10 +89,47 @@ public:
     {
         maxValue = newValue;
     }
-    double GetMaxValue()
+    double GetMaxValue() const
     {
         return maxValue;
     }
+    void SetLastSeen(int64_t newValue)
+    {
+        lastSeen = newValue;
+    }
+    int64_t GetLastSeen() const
+    {
+        return lastSeen;
+    }
+    void SetStale(bool newValue)
+    {
+        stale = newValue;
+    }
+    bool IsStale() const
+    {
+        return stale;
+    }
+    void SetStaleTimer(uint64_t newValue)
+    {
+        staleTimer = newValue;
+    }
+    uint64_t GetStaleTimer() const
+    {
+        return staleTimer;
+    }
+    AnomalyDetector& GetDetector()
+    {
+        return detector;
+    }
+    const AnomalyDetector& GetDetector() const
+    {
+        return detector;
+    }
+    // String sensors (e.g. soilType) have no meaningful double value.
+    bool IsNumeric() const
+    {
+        return stringValue.empty();
+    }
 
 };
 }
@@ -0,0 +1,256 @@
+///
+/// @file SensorHistory.hpp
+///
+/// @brief The past readings of the numeric sensors of a fleet, one series of
+/// @b GorillaBlock per (pot, sensor), kept for a retention period.
+///
+/// Range queries and aggregations decode the blocks overlapping the range
+/// a batch of samples at a time, and skip the other blocks without
+/// decoding them.
+///
+#ifndef SENSOR_HISTORY_HPP
+#define SENSOR_HISTORY_HPP
+
+#include "GorillaBlock.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+namespace pot
+{
+class SensorHistory
+{
+public:
+    // Samples decoded per batch.
+    static constexpr size_t batchSize = 256;
+
+    struct Sample
+    {
+        int64_t time;
+        double value;
+    };
+
+    // Aggregate of the samples of a time bucket.
+    struct Bucket
+    {
+        int64_t start;
+        uint64_t count;
+        double min;
+        double max;
+        double sum;
+    };
+
+private:
+    // The blocks of a series, the last one is being appended to. A series
+    // only holds a few blocks, dropping the first one moves the others.
+    using Series = vector<GorillaBlock>;
+
+    // Series by (pot id, sensor name id).
+    unordered_map<uint64_t, Series> series;
+    map<string, uint32_t, less<>> sensorIds;
+    // Samples older than that many seconds are dropped, a block at a time.
+    int64_t retention;
+    size_t bytes = 0;
+    uint64_t samples = 0;
+
+    static uint64_t Key(int potId, uint32_t sensorId)
+    {
+        return ((uint64_t) (uint32_t) potId << 32) | sensorId;
+    }
+
+    // The id of sensor @p name, or UINT32_MAX if it never had a sample.
+    uint32_t FindSensorId(string_view name) const
+    {
+        auto it = sensorIds.find(name);
+        return it == sensorIds.end() ? UINT32_MAX : it->second;
+    }
+
+    const Series* Find(int potId, string_view name) const
+    {
+        uint32_t sensorId = FindSensorId(name);
+        if(sensorId == UINT32_MAX)
+            return nullptr;
+        auto it = series.find(Key(potId, sensorId));
+        return it == series.end() ? nullptr : &it->second;
+    }
+
+    void DropBlock(Series& blocks)
+    {
+        bytes -= blocks.front().Bytes();
+        samples -= blocks.front().Count();
+        blocks.erase(blocks.begin());
+    }
+
+    ///
+    /// @brief Calls @p visit(times, values, count) for batches holding the
+    /// samples of [from, to] (and maybe a few others around them).
+    ///
+    template<typename Visit>
+    static void Scan(const Series& blocks, int64_t from, int64_t to, Visit visit)
+    {
+        int64_t times[batchSize];
+        double values[batchSize];
+        for(const GorillaBlock& block : blocks)
+        {
+            if(block.LastTime() < from || block.FirstTime() > to)
+                continue;
+            GorillaBlock::Reader reader(block);
+            size_t count;
+            while((count = reader.Next(times, values, batchSize)) > 0)
+            {
+                visit(times, values, count);
+                if(times[count - 1] > to)
+                    return;
+            }
+        }
+    }
+
+public:
+    ///
+    /// @param _retention Seconds the samples are kept.
+    ///
+    explicit SensorHistory(int64_t _retention)
+        : retention(_retention)
+    {
+
+    }
+
+    ///
+    /// @brief Records a reading of the sensor @p name of pot @p potId at
+    /// @p time, in seconds since the epoch.
+    ///
+    void Append(int potId, string_view name, int64_t time, double value)
+    {
+        auto id = sensorIds.find(name);
+        if(id == sensorIds.end())
+            id = sensorIds.emplace(string(name), (uint32_t) sensorIds.size()).first;
+        Series& blocks = series[Key(potId, id->second)];
+        if(blocks.empty() || blocks.back().Full())
+        {
+            if(!blocks.empty())
+            {
+                size_t before = blocks.back().Bytes();
+                blocks.back().Seal();
+                bytes -= before - blocks.back().Bytes();
+            }
+            blocks.emplace_back();
+        }
+        GorillaBlock& block = blocks.back();
+        size_t before = block.Bytes();
+        block.Append(time, value);
+        bytes += block.Bytes() - before;
+        samples++;
+
+        // Whole blocks past the retention go, the one appended to stays.
+        while(blocks.size() > 1 && blocks.front().LastTime() < time - retention)
+            DropBlock(blocks);
+    }
+
+    // Forgets the history of pot @p potId.
+    void RemovePot(int potId)
+    {
+        for(auto& sensor : sensorIds)
+        {
+            auto it = series.find(Key(potId, sensor.second));
+            if(it == series.end())
+                continue;
+            for(const GorillaBlock& block : it->second)
+            {
+                bytes -= block.Bytes();
+                samples -= block.Count();
+            }
+            series.erase(it);
+        }
+    }
+
+    ///
+    /// @brief Appends the samples of the sensor @p name of pot @p potId
+    /// taken in [from, to] to @p out, at most @p limit of them.
+    ///
+    void Range(int potId, string_view name, int64_t from, int64_t to, size_t limit, vector<Sample>& out) const
+    {
+        const Series* blocks = Find(potId, name);
+        if(blocks == nullptr)
+            return;
+        size_t added = 0;
+        Scan(*blocks, from, to, [&](const int64_t *times, const double *values, size_t count)
+        {
+            for(size_t i = 0; i < count && added < limit; ++i)
+            {
+                if(times[i] >= from && times[i] <= to)
+                {
+                    out.push_back({times[i], values[i]});
+                    added++;
+                }
+            }
+        });
+    }
+
+    ///
+    /// @brief Aggregates the samples of the sensor @p name of pot @p potId
+    /// taken in [from, to] in buckets of @p step seconds, appended to
+    /// @p out in time order (the empty buckets are left out).
+    ///
+    void Aggregate(int potId, string_view name, int64_t from, int64_t to, int64_t step, vector<Bucket>& out) const
+    {
+        const Series* blocks = Find(potId, name);
+        if(blocks == nullptr || step <= 0)
+            return;
+        Scan(*blocks, from, to, [&](const int64_t *times, const double *values, size_t count)
+        {
+            size_t i = 0;
+            while(i < count)
+            {
+                if(times[i] < from || times[i] > to)
+                {
+                    i++;
+                    continue;
+                }
+                int64_t start = from + (times[i] - from) / step * step;
+                int64_t end = min(start + step - 1, to);
+                if(out.empty() || out.back().start != start)
+                    out.push_back({start, 0, INFINITY, -INFINITY, 0});
+                Bucket& bucket = out.back();
+                // The samples of the bucket in this batch, in one loop.
+                size_t last = i;
+                while(last < count && times[last] <= end)
+                    last++;
+                for(size_t j = i; j < last; ++j)
+                {
+                    bucket.min = min(bucket.min, values[j]);
+                    bucket.max = max(bucket.max, values[j]);
+                    bucket.sum += values[j];
+                }
+                bucket.count += last - i;
+                i = last;
+            }
+        });
+    }
+
+    // Bytes used by the compressed samples.
+    size_t Bytes() const
+    {
+        return bytes;
+    }
+
+    uint64_t Samples() const
+    {
+        return samples;
+    }
+
+    int64_t Retention() const
+    {
+        return retention;
+    }
+};
+}
+
+#endif
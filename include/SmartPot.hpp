@@ -7,22 +7,55 @@
 #ifndef SMART_POT_HPP
 #define SMART_POT_HPP
 
+#include "ChangeLog.hpp"
+#include "DerivedSensors.hpp"
 #include "Plant.hpp"
 #include "Sensor.hpp"
 
 #include <map>
+#include <memory_resource>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <utility>
 
 
 using namespace std;
 
 namespace pot
 {
+// The sensors of one group, by name. The transparent comparator lets us
+// look them up with a string_view without building a string. The maps take
+// a memory resource so that a pot pool can keep their nodes together.
+using SensorMap = pmr::map<string, Sensor, less<>>;
+// The sensor groups of a pot (1 is the ground sensor with the nutrients).
+using SensorGroups = pmr::map<int, SensorMap>;
+
 class SmartPot
 {
     Plant plant;
-    map<int, map<string, Sensor>> sensors;
+    SensorGroups sensors;
+
+    // The versions of the writes, see GET /status?since=.
+    ChangeLog changes;
+    uint64_t plantVersion = 0;
+
+    // The sensors computed from the others.
+    DerivedSensors derived;
+
+    // Finds the sensors of the derived sensors, after a copy or move (it
+    // is the only time the maps are searched for them).
+    void Bind()
+    {
+        derived.Bind([this](string_view name) { return FindEntry(name); });
+    }
+
+    // Returned by GetSensor when the sensor does not exist.
+    static const Sensor& NoSensor()
+    {
+        static const Sensor noSensor;
+        return noSensor;
+    }
 
 public:
     SmartPot()
@@ -30,193 +63,317 @@ public:
 
     }
 
-    SmartPot(Plant _plant, const map<int, map<string, Sensor>> &_sensors)
+    SmartPot(Plant _plant, SensorGroups _sensors)
+        : plant(move(_plant)),
+          sensors(move(_sensors))
     {
-        plant = _plant;
-        sensors = _sensors;
+
     }
 
-    bool Find(string nameToFind)
+    ///
+    /// @brief Creates an empty pot whose sensors will be allocated from
+    /// @p resource, even when another pot is assigned to it.
+    ///
+    explicit SmartPot(pmr::memory_resource *resource)
+        : sensors(resource)
     {
-        for(auto it = sensors.begin(); it != sensors.end(); ++it)
-        {
-            map<string, Sensor> m = it->second;
-            for(auto it2 = m.begin(); it2 != m.end(); ++it2)
-            {
-                if(it2->first == nameToFind)
-                    return true;
-            }
-        }
-        return false;
+
     }
-    Sensor GetSensor(string nameToFind)
+
+    ///
+    /// @returns The sensor called @p nameToFind with its name, or nullptr if
+    /// there is none.
+    ///
+    SensorMap::value_type* FindEntry(string_view nameToFind)
     {
         for(auto it = sensors.begin(); it != sensors.end(); ++it)
         {
-            map<string, Sensor> m = it->second;
-            for(auto it2 = m.begin(); it2 != m.end(); ++it2)
-            {
-                if(it2->first == nameToFind)
-                    return it2->second;
-            }
+            auto it2 = (it->second).find(nameToFind);
+            if(it2 != (it->second).end())
+                return &*it2;
         }
-        return Sensor();
+        return nullptr;
+    }
+
+    ///
+    /// @returns The sensor called @p nameToFind or nullptr if there is none.
+    ///
+    Sensor* FindSensor(string_view nameToFind)
+    {
+        SensorMap::value_type* entry = FindEntry(nameToFind);
+        return entry == nullptr ? nullptr : &entry->second;
+    }
+    const Sensor* FindSensor(string_view nameToFind) const
+    {
+        return const_cast<SmartPot*>(this)->FindSensor(nameToFind);
+    }
+
+    bool Find(string_view nameToFind) const
+    {
+        return FindSensor(nameToFind) != nullptr;
+    }
+    const Sensor& GetSensor(string_view nameToFind) const
+    {
+        const Sensor* sensor = FindSensor(nameToFind);
+        if(sensor == nullptr)
+            return NoSensor();
+        return *sensor;
     }
 
 
-    int Get(const string& name, Sensor& returnedValue)
+    int Get(string_view name, Sensor& returnedValue) const
     {
+        const Sensor* sensor = FindSensor(name);
         // If the setting does not exist.
-        if(!Find(name))
+        if(sensor == nullptr)
         {
             returnedValue = Sensor();
             return 1;
         }
-        else
-        {
-            returnedValue = GetSensor(name);
-        }
+        returnedValue = *sensor;
         return 0;
     }
 
-    int Get(const string& name, string& returnedValue)
+    int Get(string_view name, string& returnedValue) const
     {
+        const Sensor* sensor = FindSensor(name);
         // If the setting does not exist.
-        if(!Find(name))
+        if(sensor == nullptr)
         {
-            returnedValue = "";
+            returnedValue.clear();
             return 1;
         }
+        if(sensor->IsNumeric())
+        {
+            returnedValue = to_string(sensor->GetDoubleValue());
+        }
         else
         {
-            Sensor aux = GetSensor(name);
-            if(aux.GetStringValue().compare("") == 0)
-            {
-                returnedValue = to_string(aux.GetDoubleValue());
-            }
-            else
-            {
-                returnedValue = aux.GetStringValue();
-            }
+            returnedValue = sensor->GetStringValue();
         }
         return 0;
     }
 
-    int Set(const string& name, const Sensor& value)
+    int Set(string_view name, const Sensor& value)
     {
+        SensorMap::value_type* entry = FindEntry(name);
         // If the setting does not exist.
-        if(!Find(name))
+        if(entry == nullptr)
         {
             return 1;
         }
-        else
+        entry->second = value;
+        changes.Record(entry);
+        Propagate(entry->second, [this](SensorMap::value_type& derivedEntry, double derivedValue)
         {
-            for(auto it = sensors.begin(); it != sensors.end(); ++it)
-            {
-                for(auto it2 = (it->second).begin(); it2 != (it->second).end(); ++it2)
-                {
-                    if(it2->first == name)
-                    {
-                        it2->second = value;
-                        return 0;
-                    }
-                }
-
-            }
-        }
-
+            derivedEntry.second.SetValue(derivedValue);
+            changes.Record(&derivedEntry);
+        });
         return 0;
     }
 
-    int SetPlant(const Plant& _plant)
+    int SetPlant(Plant _plant)
     {
-        plant = _plant;
+        plant = move(_plant);
+        plantVersion = changes.Bump();
         return 0;
     }
 
-    string Shovel()
+    ///
+    /// @brief Records a write of the sensor of @p entry, one of ours, made
+    /// through @b FindEntry or @b GetSensors.
+    ///
+    /// @returns The version of the write.
+    ///
+    uint64_t Changed(const SensorMap::value_type& entry)
+    {
+        return changes.Record(&entry);
+    }
+
+    ///
+    /// @brief Computes the derived sensors of the pot with @p graph from
+    /// now on, and computes them all once.
+    ///
+    void SetDerived(shared_ptr<const DerivedGraph> graph)
+    {
+        derived = DerivedSensors(move(graph));
+        Bind();
+        derived.ComputeAll([this](SensorMap::value_type& derivedEntry, double derivedValue)
+        {
+            derivedEntry.second.SetValue(derivedValue);
+            changes.Record(&derivedEntry);
+        });
+    }
+
+    const shared_ptr<const DerivedGraph>& GetDerived() const
+    {
+        return derived.Graph();
+    }
+
+    const DerivedSensors& GetDerivedSensors() const
+    {
+        return derived;
+    }
+
+    // Restores the light integrals of the pot put aside, see ColdStore.
+    void SetIntegrals(vector<DerivedSensors::Integral> integrals)
+    {
+        derived.SetIntegrals(move(integrals));
+    }
+
+    ///
+    /// @brief Computes the derived sensors downstream of @p written, a
+    /// sensor of ours which was just written, and calls
+    /// @p apply(entry, value) for each one, which shall write the value.
+    ///
+    template<typename Apply>
+    void Propagate(const Sensor& written, Apply apply)
+    {
+        if(!derived.Bound())
+            Bind();
+        derived.Propagate(written, apply);
+    }
+
+    // Takes the whole pot as changed, once replaced or added to a fleet.
+    uint64_t Restart()
+    {
+        plantVersion = changes.Restart();
+        return plantVersion;
+    }
+
+    const ChangeLog& Changes() const
+    {
+        return changes;
+    }
+
+    // The version of the latest write to the pot.
+    uint64_t Version() const
+    {
+        return changes.Version();
+    }
+
+    uint64_t PlantVersion() const
+    {
+        return plantVersion;
+    }
+
+    const Plant& GetPlant() const
+    {
+        return plant;
+    }
+
+    bool HasPlant() const
+    {
+        return !plant.IsEmpty();
+    }
+
+    const SensorGroups& GetSensors() const
+    {
+        return sensors;
+    }
+    // Only the values of the sensors shall be changed through it.
+    SensorGroups& GetSensors()
+    {
+        return sensors;
+    }
+
+    string Shovel() const
     {
         return("0%Soil has been shovelled!");
     }
-    string IrrigateSoil()
+    string IrrigateSoil() const
     {
-        if(!Find("soilHumidity"))
+        const Sensor* soilHumidity = FindSensor("soilHumidity");
+        if(soilHumidity == nullptr)
             return "-1%No soilHumidity sensor found!";
-        Sensor soilHumidity = GetSensor("soilHumidity");
-        if(soilHumidity.GetDoubleValue() < soilHumidity.GetMinValue())
-        {
-            soilHumidity.SetValue(soilHumidity.GetMaxValue());
-            return ("0%Soil has been moistened, current soil humidity: " + to_string(soilHumidity.GetDoubleValue()));
-        }
+        // Out of date readings are not acted upon.
+        if(soilHumidity->IsStale())
+            return "-1%soilHumidity sensor is stale!";
+        // Irrigating brings the soil humidity up to its maximum.
+        if(soilHumidity->GetDoubleValue() < soilHumidity->GetMinValue())
+            return ("0%Soil has been moistened, current soil humidity: " + to_string(soilHumidity->GetMaxValue()));
         return "0%";
     }
-    string NutrientsInjector()
+    string NutrientsInjector() const
     {
         string returnMessage = "0%";
         string nutrientsInjected = "";
-        map <string, Sensor> groundSensor = sensors[1];
-        if(groundSensor.find("phosphorus") == groundSensor.end())
+        string staleNutrients = "";
+        auto ground = sensors.find(1);
+        if(ground == sensors.end())
             return "-1%No phosphorus found!";
-        if(groundSensor.find("nitrogen") == groundSensor.end())
+        const SensorMap& groundSensor = ground->second;
+        auto ph = groundSensor.find("phosphorus");
+        if(ph == groundSensor.end())
+            return "-1%No phosphorus found!";
+        auto n = groundSensor.find("nitrogen");
+        if(n == groundSensor.end())
             return "-1%No nitrogen found!";
-        if(groundSensor.find("potassium") == groundSensor.end())
+        auto p = groundSensor.find("potassium");
+        if(p == groundSensor.end())
             return "-1%No potassium found!";
-        Sensor ph = groundSensor["phosphorus"];
-        Sensor n = groundSensor["nitrogen"];
-        Sensor p = groundSensor["potassium"];
-        if(ph.GetDoubleValue() < ph.GetMinValue())
-        {
-            ph.SetValue(ph.GetMaxValue());
+        // Every nutrient under its minimum is injected up to its maximum,
+        // the nutrients with a stale reading are skipped.
+        if(ph->second.IsStale())
+            staleNutrients += "phosphorus, ";
+        else if(ph->second.GetDoubleValue() < ph->second.GetMinValue())
             nutrientsInjected += "phosphorus, ";
-        }
-        if(n.GetDoubleValue() < n.GetMinValue())
-        {
-            n.SetValue(n.GetMaxValue());
+        if(n->second.IsStale())
+            staleNutrients += "nitrogen, ";
+        else if(n->second.GetDoubleValue() < n->second.GetMinValue())
             nutrientsInjected += "nitrogen, ";
-        }
-        if(p.GetDoubleValue() < p.GetMinValue())
-        {
-            p.SetValue(p.GetMaxValue());
+        if(p->second.IsStale())
+            staleNutrients += "potassium, ";
+        else if(p->second.GetDoubleValue() < p->second.GetMinValue())
             nutrientsInjected += "potassium, ";
+        if(nutrientsInjected.compare("") != 0)
+        {
+            nutrientsInjected = nutrientsInjected.substr(0, nutrientsInjected.size() - 2);
+            returnMessage += "Nutrients injected: " + nutrientsInjected;
         }
-        if(nutrientsInjected.compare("") == 0)
+        if(staleNutrients.compare("") != 0)
         {
-            return returnMessage;
+            staleNutrients = staleNutrients.substr(0, staleNutrients.size() - 2);
+            if(nutrientsInjected.compare("") != 0)
+                returnMessage += "\n";
+            returnMessage += "Stale sensors skipped: " + staleNutrients;
         }
-        nutrientsInjected = nutrientsInjected.substr(0, nutrientsInjected.size() - 2);
-        returnMessage += "Nutrients injected: " + nutrientsInjected;
         return returnMessage;
     }
-    string SolarLamp()
+    string SolarLamp() const
     {
         string returnMessage = "0%";
-        if(!Find("luminosity"))
+        const Sensor* luminosity = FindSensor("luminosity");
+        if(luminosity == nullptr)
             return "-1%No luminosity sensor found!";
-        Sensor luminosity = GetSensor("luminosity");
-        if(luminosity.GetDoubleValue() < luminosity.GetMinValue())
+        if(luminosity->IsStale())
+            return "-1%luminosity sensor is stale!";
+        // The lamp brings the luminosity to the middle of its range.
+        double target = (luminosity->GetMinValue() + luminosity->GetMaxValue())/2;
+        if(luminosity->GetDoubleValue() < luminosity->GetMinValue())
         {
-            luminosity.SetValue((luminosity.GetMinValue() + luminosity.GetMaxValue())/2);
-            returnMessage += "Luminosity has been increased to: " + to_string(luminosity.GetDoubleValue());
+            returnMessage += "Luminosity has been increased to: " + to_string(target);
         }
-        else if(luminosity.GetDoubleValue() > luminosity.GetMaxValue())
+        else if(luminosity->GetDoubleValue() > luminosity->GetMaxValue())
         {
-            luminosity.SetValue((luminosity.GetMinValue() + luminosity.GetMaxValue())/2);
-            returnMessage += "Luminosity has been increased to: " + to_string(luminosity.GetDoubleValue());
+            returnMessage += "Luminosity has been increased to: " + to_string(target);
         }
         return returnMessage;
     }
 
-    string DisplayPlantData()
+    string DisplayPlantData() const
     {
-        Plant p;
-        if(plant == p)
+        if(!HasPlant())
             return "-1%No plant found!";
         string returnMessage = "0%";
-        returnMessage += "Plant species: " + plant.GetName() + "\nPlant color: " + plant.GetColor() + "\nPlant height: " + to_string(plant.GetHeight()) + "\nPlant type: " + plant.GetType();
+        returnMessage.append("Plant species: ").append(plant.GetName())
+                     .append("\nPlant color: ").append(plant.GetColor())
+                     .append("\nPlant height: ").append(to_string(plant.GetHeight()))
+                     .append("\nPlant type: ").append(plant.GetType());
 
         return returnMessage;
     }
-    string DisplayEnvironmentData()
+    string DisplayEnvironmentData() const
     {
         string returnMessage = "0%";
         /*if(settings.find("airHumidity") == settings.end())
@@ -241,38 +398,51 @@ public:
         {
             for (auto it2 = (it->second).begin(); it2 != (it->second).end(); ++it2)
             {
-                Sensor s = it2->second;
-                if(s.GetStringValue().compare("") != 0)
-                    returnMessage += "\n" + s.GetName() + ": " + s.GetStringValue();
+                const Sensor& s = it2->second;
+                returnMessage.append("\n").append(s.GetName()).append(": ");
+                if(!s.IsNumeric())
+                    returnMessage.append(s.GetStringValue());
                 else
-                    returnMessage += "\n" + s.GetName() + ": " + to_string(s.GetDoubleValue());
+                    returnMessage.append(to_string(s.GetDoubleValue()));
+                if(s.IsStale())
+                    returnMessage.append(" (stale)");
+                if(s.IsNumeric() && s.GetDetector().Kinds() != AnomalyDetector::none)
+                    returnMessage.append(" (anomaly: ").append(AnomalyDetector::Name(s.GetDetector().Kinds())).append(")");
             }
         }
         return returnMessage;
     }
-    string SoilCompatibility()
+    string SoilCompatibility() const
     {
-        Plant p;
-        if(plant == p)
+        if(!HasPlant())
             return "-1%No plant found!";
-        if(!Find("soilType"))
+        const Sensor* soilType = FindSensor("soilType");
+        if(soilType == nullptr)
             return "-1%No soilType sensor found!";
-        if(plant.GetSoil().compare(GetSensor("soilType").GetStringValue()) != 0)
+        if(plant.GetSoil() != soilType->GetStringValue())
             return "1%Soil Type not suitable for plant!";
         else
             return "0%";
     }
-    string SoilStatus()
+    string SoilStatus() const
     {
         bool alert = false;
         string alertMessages = "";
-        if(!Find("soilPh"))
+        const Sensor* soilPhSensor = FindSensor("soilPh");
+        if(soilPhSensor == nullptr)
             return "-1%No soilPh sensor found!";
-        if(!Find("soilHumidity"))
+        const Sensor* soilHumiditySensor = FindSensor("soilHumidity");
+        if(soilHumiditySensor == nullptr)
             return "-1%No soilHumidity sensor found!";
-        Sensor soilPh = GetSensor("soilPh");
-        Sensor soilHumidity = GetSensor("soilHumidity");
-        if(soilPh.GetDoubleValue() < soilPh.GetMinValue())
+        const Sensor& soilPh = *soilPhSensor;
+        const Sensor& soilHumidity = *soilHumiditySensor;
+        // The thresholds are not checked against stale readings.
+        if(soilPh.IsStale())
+        {
+            alert = true;
+            alertMessages += "Soil ph sensor is stale!";
+        }
+        else if(soilPh.GetDoubleValue() < soilPh.GetMinValue())
         {
             alert = true;
             alertMessages += "Soil ph under critical levels!";
@@ -282,7 +452,12 @@ public:
             alert = true;
             alertMessages += "Soil ph above critical levels!";
         }
-        if(soilHumidity.GetDoubleValue() < soilHumidity.GetMinValue())
+        if(soilHumidity.IsStale())
+        {
+            alert = true;
+            alertMessages += "Soil humidity sensor is stale!";
+        }
+        else if(soilHumidity.GetDoubleValue() < soilHumidity.GetMinValue())
         {
             alert = true;
             alertMessages += "Soil humidity under critical levels!";
@@ -297,17 +472,24 @@ public:
         else
             return "0%";
     }
-    string InadequateEnvironment()
+    string InadequateEnvironment() const
     {
         bool alert = false;
         string alertMessages = "";
-        if(!Find("temperature"))
+        const Sensor* temperatureSensor = FindSensor("temperature");
+        if(temperatureSensor == nullptr)
             return "-1%No temperature sensor found!";
-        if(!Find("humidity"))
+        const Sensor* humiditySensor = FindSensor("humidity");
+        if(humiditySensor == nullptr)
             return "-1%No humidity sensor found!";
-        Sensor temperature = GetSensor("temperature");
-        Sensor humidity = GetSensor("humidity");
-        if(temperature.GetDoubleValue() < temperature.GetMinValue())
+        const Sensor& temperature = *temperatureSensor;
+        const Sensor& humidity = *humiditySensor;
+        if(temperature.IsStale())
+        {
+            alert = true;
+            alertMessages += "Temperature sensor is stale!";
+        }
+        else if(temperature.GetDoubleValue() < temperature.GetMinValue())
         {
             alert = true;
             alertMessages += "Temperature under critical levels!";
@@ -317,7 +499,12 @@ public:
             alert = true;
             alertMessages += "Temperature above critical levels!";
         }
-        if(humidity.GetDoubleValue() < humidity.GetMinValue())
+        if(humidity.IsStale())
+        {
+            alert = true;
+            alertMessages += "Humidity sensor is stale!";
+        }
+        else if(humidity.GetDoubleValue() < humidity.GetMinValue())
         {
             alert = true;
             alertMessages += "Humidity under critical levels!";
@@ -7,9 +7,22 @@
 #ifndef SMART_POT_ENDPOINT_HPP
 #define SMART_POT_ENDPOINT_HPP
 
-#include "SmartPot.hpp"
+#include "Cluster.hpp"
+#include "Fleet.hpp"
+#include "FleetQuery.hpp"
+#include "MqttCapture.hpp"
+#include "MqttIngest.hpp"
+#include "PeerClient.hpp"
+#include "PotConfig.hpp"
+#include "PotListing.hpp"
+#include "RateLimiter.hpp"
+#include "Scheduler.hpp"
+#include "Snapshot.hpp"
+#include "Trace.hpp"
 
+#include <atomic>
 #include <iostream>
+#include <thread>
 #include <signal.h>
 // Our HTTP library.
 #include <pistache/net.h>
@@ -34,7 +47,14 @@ namespace pot
     class SmartPotEndpoint
     {
     public:
-        SmartPotEndpoint(Address address);
+        ///
+        /// @param configPath JSON file or directory of the pots to serve,
+        /// only the default pot is served when empty.
+        /// @param clusterPath JSON file of the instances serving the fleet
+        /// together (see Cluster.hpp), this one serves every pot when empty.
+        ///
+        SmartPotEndpoint(Address address, const string &_configPath = "",
+                         const string &_clusterPath = "");
         ~SmartPotEndpoint(void);
 
         // Server initialization.
@@ -46,10 +66,58 @@ namespace pot
         // Server stop.
         void stop(void);
 
+        // Reloads the pots configuration and the cluster file, 0 on success.
+        int reload(string &message);
+
+        // Starts reload on a thread of its own, false if one is running.
+        bool reloadInBackground(void);
+
+        // Records the MQTT messages received from now on into a capture
+        // file at path (see MqttCapture.hpp), 0 on success.
+        int startCapture(const string &path);
+
+        // Keeps at most budgetBytes of pots in memory, the others going to
+        // a cold store file at path (see Fleet::EnableTiering), 0 on success.
+        int startTiering(const string &path, size_t budgetBytes);
+
         
     private:
         void createHttpRoutes(void);
 
+        // Forwards a request for a pot of another instance to it, true if
+        // it did (the response is then sent once the owner answers).
+        bool forwardToOwner     (int potId,
+                                const Rest::Request &request,
+                                Http::ResponseWriter &response);
+
+        // forwardToOwner for the routes of the default pot.
+        bool forwardDefaultPot  (const Rest::Request &request,
+                                Http::ResponseWriter &response);
+
+        // Calls use with the default pot under potLock, true if the pot is
+        // not here (the request is then answered).
+        bool withDefaultPot     (const function<void(SmartPot &)> &use,
+                                Http::ResponseWriter &response);
+
+        // The work of reload, with reloadLock held.
+        int applyReload         (string &message);
+
+        // Sends the pots this instance does not own to their owner.
+        int handOff             (const Cluster &current,
+                                size_t &handedOff,
+                                string &error);
+
+        // Uploads a snapshot to another instance in parts, 0 on success.
+        int sendSnapshot        (const string &peer,
+                                const string &snapshot,
+                                string &error);
+
+        // Adds or replaces the pots staged by an upload, a chunk at a
+        // time, 0 on success.
+        int loadPots            (SnapshotUpload &upload,
+                                size_t &loaded,
+                                string &error);
+
         // GETs.
         void getSetting         (const Rest::Request &request,
                                 Http::ResponseWriter response);
@@ -57,6 +125,10 @@ namespace pot
         void getStatus          (const Rest::Request &request,
                                 Http::ResponseWriter response);
 
+        void getStatusSince     (const Rest::Request &request,
+                                uint64_t since,
+                                Http::ResponseWriter &response);
+
         void shovel             (const Rest::Request &request,
                                 Http::ResponseWriter response);
 
@@ -71,6 +143,24 @@ namespace pot
 
         void activateSolarLamp  (const Rest::Request &request,
                                 Http::ResponseWriter response);
+
+        void getFleetAggregates (const Rest::Request &request,
+                                Http::ResponseWriter response);
+
+        void getIncompatibleSoil(const Rest::Request &request,
+                                Http::ResponseWriter response);
+
+        void getFleetQuery     (const Rest::Request &request,
+                                Http::ResponseWriter response);
+
+        void getHistory        (const Rest::Request &request,
+                                Http::ResponseWriter response);
+
+        void getIngestStats    (const Rest::Request &request,
+                                Http::ResponseWriter response);
+
+        void getPots           (const Rest::Request &request,
+                                Http::ResponseWriter response);
         
         // PUTs.
         
@@ -83,6 +173,54 @@ namespace pot
         void putPlantType      (const Rest::Request &request,
                                 Http::ResponseWriter response);
 
+        // Snapshots.
+        void getSnapshot       (const Rest::Request &request,
+                                Http::ResponseWriter response);
+
+        void putSnapshot       (const Rest::Request &request,
+                                Http::ResponseWriter response);
+
+        void postSnapshotUpload(const Rest::Request &request,
+                                Http::ResponseWriter response);
+
+        void putSnapshotUpload (const Rest::Request &request,
+                                Http::ResponseWriter response);
+
+        void deleteSnapshotUpload(const Rest::Request &request,
+                                Http::ResponseWriter response);
+
+        // Schedules.
+        void getSchedules      (const Rest::Request &request,
+                                Http::ResponseWriter response);
+
+        void postSchedule      (const Rest::Request &request,
+                                Http::ResponseWriter response);
+
+        void deleteSchedule    (const Rest::Request &request,
+                                Http::ResponseWriter response);
+
+        // Administration.
+        void postReload        (const Rest::Request &request,
+                                Http::ResponseWriter response);
+
+        void getReload         (const Rest::Request &request,
+                                Http::ResponseWriter response);
+
+        void postTrace         (const Rest::Request &request,
+                                Http::ResponseWriter response);
+
+        void getTrace          (const Rest::Request &request,
+                                Http::ResponseWriter response);
+
+        // Stops the trace capture once its seconds are over.
+        void finishTrace       (void);
+
+        void getCluster        (const Rest::Request &request,
+                                Http::ResponseWriter response);
+
+        void getMemory         (const Rest::Request &request,
+                                Http::ResponseWriter response);
+
         // Mosquitto calbacks.
         static void mosquittoOnMessage  (struct mosquitto *mosq,
                                         void *obj,
@@ -92,26 +230,91 @@ namespace pot
                                         void *obj,
                                         int rc);
 
+        // Publishes each anomaly on "pots/<potId>/anomaly".
+        static void publishAnomalies    (struct mosquitto *mosq,
+                                        const vector<Fleet::Anomaly> &anomalies);
+
         // static void mosquittoOnSubscribe (struct mosquitto *mosq,
         //                                   void *userdata, 
         //                                   int mid, int qos_count, 
         //                                   const int *granted_qos);
 
-        static map <int, string> sensorNameMap;
-
         // Our Endpoint for the http server thread.
         std::shared_ptr<Http::Endpoint> httpEndpoint;
         // The router for our HTTP routes.
         Rest::Router router;
+        // The snapshot routes again, on the port of Cluster::SnapshotAddress
+        // with a larger request size limit, for the parts of the snapshots.
+        std::shared_ptr<Http::Endpoint> snapshotEndpoint;
+        Rest::Router snapshotRouter;
 
         // Our MQTT Subscriber.
         struct mosquitto *mosquittoSub;
 
-        // The actual smart pot.
-        static SmartPot *smartPot;
+        // All the pots served by this process.
+        static Fleet *fleet;
+
+        // Applies the MQTT payloads to the fleet.
+        static MqttIngest *ingest;
+
+        // The configured pots, built by the fleet when first read. Replaced
+        // as a whole by a reload, always read and written atomically.
+        static shared_ptr<const PotConfig> config;
+
+        // The instances serving the fleet with this one, and which one owns
+        // every pot. Replaced as a whole by a reload, like the configuration.
+        static shared_ptr<const Cluster> cluster;
+
+        // Talks to the other instances of the cluster.
+        static PeerClient *peers;
+
+        // Where the configuration and the cluster are loaded from, and held
+        // while reloading.
+        string configPath;
+        string clusterPath;
+        Lock reloadLock;
+
+        // The reload started by POST /admin/reload, and the outcome of the
+        // latest reload.
+        thread reloadThread;
+        atomic<bool> reloadRunning{false};
+        string reloadMessage;
+        int reloadFailed = 0;
+        Lock reloadStatusLock;
+
+        // The latest trace started by POST /admin/trace, captured until
+        // traceEnd.
+        Trace::Capture traceCapture;
+        uint64_t traceId = 0;
+        bool traceRunning = false;
+        chrono::steady_clock::time_point traceEnd;
+        Lock traceLock;
+
+        // The snapshots being uploaded in parts, by id, and the directory
+        // their pots are staged in.
+        map<uint64_t, SnapshotUpload> uploads;
+        string stagingDirectory;
+        uint64_t nextUploadId = 1;
+        Lock uploadLock;
+
+        // The compiled GET /fleet/query expressions.
+        static QueryCache queries;
+
+        // The MQTT messages received, when capturing. Only touched by the
+        // MQTT thread once it runs.
+        static MqttCapture capture;
+
+        // Sheds the MQTT messages before they are parsed.
+        static RateLimiter *limiter;
+
+        // The pot served by the routes and topic without a pot id.
+        static constexpr int defaultPotId = 0;
+
+        // Runs the scheduled actuator jobs.
+        Scheduler *scheduler;
 
         // Prohibits the threads to concurrently edit the same variable.
-        Lock potLock;
+        static Lock potLock;
     };
 
 }
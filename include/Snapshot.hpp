@@ -0,0 +1,543 @@
+///
+/// @file Snapshot.hpp
+///
+/// @brief Binary snapshot format of the pots of a @b Fleet, used to move
+/// pots between hosts without replaying every HTTP request.
+///
+/// A snapshot is the 4 bytes magic "FPSN", a 32 bit version and a sequence
+/// of records, each one prefixed by its 32 bit length and starting with its
+/// type: one record per pot and an end record holding the number of pots.
+/// Numbers are little endian, strings are a 32 bit length and the bytes.
+///
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include "SmartPot.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace std;
+
+namespace pot
+{
+class Snapshot
+{
+public:
+    static constexpr uint32_t version = 1;
+    static constexpr size_t headerSize = 8;
+    // Bigger records are rejected, so garbage can't make us allocate.
+    static constexpr uint32_t maxRecordSize = 16 * 1024 * 1024;
+
+    enum RecordType : uint8_t
+    {
+        potRecord = 1,
+        endRecord = 2
+    };
+
+    static bool IsMagic(const char *data)
+    {
+        return memcmp(data, "FPSN", 4) == 0;
+    }
+
+    static void WriteU8(string& out, uint8_t value)
+    {
+        out.push_back((char) value);
+    }
+    static void WriteU32(string& out, uint32_t value)
+    {
+        for(int i = 0; i < 4; ++i)
+            out.push_back((char) (value >> (8 * i)));
+    }
+    static void WriteU64(string& out, uint64_t value)
+    {
+        for(int i = 0; i < 8; ++i)
+            out.push_back((char) (value >> (8 * i)));
+    }
+    static void WriteF64(string& out, double value)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        WriteU64(out, bits);
+    }
+    static void WriteString(string& out, string_view value)
+    {
+        WriteU32(out, (uint32_t) value.size());
+        out.append(value.data(), value.size());
+    }
+
+    static void WriteHeader(string& out)
+    {
+        out.append("FPSN", 4);
+        WriteU32(out, version);
+    }
+
+    ///
+    /// @brief Appends the record of pot @p potId to @p out.
+    ///
+    static void WritePot(string& out, int potId, const SmartPot& pot)
+    {
+        // The length is patched once the record is written.
+        size_t start = out.size();
+        WriteU32(out, 0);
+        WriteU8(out, potRecord);
+        WriteU32(out, (uint32_t) potId);
+
+        const Plant& plant = pot.GetPlant();
+        WriteString(out, plant.GetName());
+        WriteString(out, plant.GetColor());
+        WriteF64(out, plant.GetHeight());
+        WriteString(out, plant.GetType());
+        WriteString(out, plant.GetSoil());
+
+        WriteU32(out, (uint32_t) pot.GetSensors().size());
+        for(auto it = pot.GetSensors().begin(); it != pot.GetSensors().end(); ++it)
+        {
+            WriteU32(out, (uint32_t) it->first);
+            WriteU32(out, (uint32_t) (it->second).size());
+            for(auto it2 = (it->second).begin(); it2 != (it->second).end(); ++it2)
+            {
+                const Sensor& sensor = it2->second;
+                WriteString(out, it2->first);
+                WriteString(out, sensor.GetName());
+                WriteF64(out, sensor.GetDoubleValue());
+                WriteString(out, sensor.GetStringValue());
+                WriteF64(out, sensor.GetMinValue());
+                WriteF64(out, sensor.GetMaxValue());
+            }
+        }
+
+        uint32_t length = (uint32_t) (out.size() - start - 4);
+        for(int i = 0; i < 4; ++i)
+            out[start + i] = (char) (length >> (8 * i));
+    }
+
+    static void WriteEnd(string& out, uint64_t potCount)
+    {
+        WriteU32(out, 9);
+        WriteU8(out, endRecord);
+        WriteU64(out, potCount);
+    }
+};
+
+///
+/// @brief Decodes a snapshot fed in pieces of any size. Only the record
+/// being decoded is buffered, so the memory used does not depend on the
+/// size of the snapshot.
+///
+class SnapshotReader
+{
+    // Reads the fields of one record, turning @b ok off on overflow.
+    struct Cursor
+    {
+        const char *p;
+        const char *end;
+        bool ok = true;
+
+        bool Need(size_t size)
+        {
+            if(ok && (size_t) (end - p) >= size)
+                return true;
+            ok = false;
+            return false;
+        }
+        uint8_t U8()
+        {
+            if(!Need(1))
+                return 0;
+            return (uint8_t) *p++;
+        }
+        uint32_t U32()
+        {
+            if(!Need(4))
+                return 0;
+            uint32_t value = 0;
+            for(int i = 0; i < 4; ++i)
+                value |= (uint32_t) (uint8_t) p[i] << (8 * i);
+            p += 4;
+            return value;
+        }
+        uint64_t U64()
+        {
+            if(!Need(8))
+                return 0;
+            uint64_t value = 0;
+            for(int i = 0; i < 8; ++i)
+                value |= (uint64_t) (uint8_t) p[i] << (8 * i);
+            p += 8;
+            return value;
+        }
+        double F64()
+        {
+            uint64_t bits = U64();
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+        string_view String()
+        {
+            uint32_t size = U32();
+            if(!Need(size))
+                return string_view();
+            string_view value(p, size);
+            p += size;
+            return value;
+        }
+    };
+
+    string pending;
+    bool headerRead = false;
+    bool ended = false;
+    uint64_t potCount = 0;
+    string error;
+
+    int Fail(const string& message)
+    {
+        error = message;
+        return 1;
+    }
+
+    // Decodes one pot record (without its length and type).
+    static bool ReadPot(Cursor& cursor, int& potId, SmartPot& pot)
+    {
+        potId = (int) cursor.U32();
+        string name(cursor.String());
+        string color(cursor.String());
+        double height = cursor.F64();
+        string type(cursor.String());
+        string soil(cursor.String());
+
+        SensorGroups sensors;
+        uint32_t groupCount = cursor.U32();
+        for(uint32_t i = 0; i < groupCount && cursor.ok; ++i)
+        {
+            SensorMap& group = sensors[(int) cursor.U32()];
+            uint32_t sensorCount = cursor.U32();
+            for(uint32_t j = 0; j < sensorCount && cursor.ok; ++j)
+            {
+                string_view key = cursor.String();
+                string_view sensorName = cursor.String();
+                double doubleValue = cursor.F64();
+                string_view stringValue = cursor.String();
+                double minValue = cursor.F64();
+                double maxValue = cursor.F64();
+                Sensor sensor(string(sensorName), doubleValue, minValue, maxValue);
+                sensor.SetValue(stringValue);
+                group.emplace(string(key), move(sensor));
+            }
+        }
+        if(!cursor.ok || potId < 0)
+            return false;
+        pot = SmartPot(Plant(move(name), move(color), height, move(type), move(soil)), move(sensors));
+        return true;
+    }
+
+public:
+    ///
+    /// @brief Decodes the pot record at the start of @p record, its length
+    /// included, as written by @b Snapshot::WritePot.
+    ///
+    /// @returns 0 on success, 1 if it is not a valid pot record.
+    ///
+    static int DecodePot(string_view record, int& potId, SmartPot& pot)
+    {
+        Cursor cursor{record.data(), record.data() + record.size()};
+        uint32_t length = cursor.U32();
+        if(!cursor.Need(length))
+            return 1;
+        cursor.end = cursor.p + length;
+        if(cursor.U8() != Snapshot::potRecord)
+            return 1;
+        return ReadPot(cursor, potId, pot) ? 0 : 1;
+    }
+
+    ///
+    /// @brief Decodes the complete records found in @p data (plus what was
+    /// left from the previous calls) and calls @p onPot(potId, pot) for
+    /// every pot.
+    ///
+    /// @returns 0 on success, 1 if the snapshot is invalid (see @b Error).
+    ///
+    template<typename OnPot>
+    int Feed(const char *data, size_t size, OnPot onPot)
+    {
+        if(!error.empty())
+            return 1;
+        pending.append(data, size);
+
+        size_t offset = 0;
+        if(!headerRead)
+        {
+            if(pending.size() < Snapshot::headerSize)
+                return 0;
+            if(!Snapshot::IsMagic(pending.data()))
+                return Fail("Not a snapshot.");
+            Cursor cursor{pending.data() + 4, pending.data() + 8};
+            uint32_t version = cursor.U32();
+            if(version != Snapshot::version)
+                return Fail("Unsupported snapshot version " + to_string(version) + ".");
+            headerRead = true;
+            offset = Snapshot::headerSize;
+        }
+
+        while(!ended && pending.size() - offset >= 4)
+        {
+            Cursor lengthCursor{pending.data() + offset, pending.data() + pending.size()};
+            uint32_t length = lengthCursor.U32();
+            if(length == 0 || length > Snapshot::maxRecordSize)
+                return Fail("Invalid record length.");
+            if(pending.size() - offset - 4 < length)
+                break;
+
+            Cursor cursor{pending.data() + offset + 4, pending.data() + offset + 4 + length};
+            uint8_t type = cursor.U8();
+            if(type == Snapshot::potRecord)
+            {
+                int potId;
+                SmartPot pot;
+                if(!ReadPot(cursor, potId, pot))
+                    return Fail("Invalid pot record.");
+                onPot(potId, move(pot));
+                potCount++;
+            }
+            else if(type == Snapshot::endRecord)
+            {
+                if(cursor.U64() != potCount)
+                    return Fail("Pot count mismatch, the snapshot is truncated.");
+                ended = true;
+            }
+            // Unknown record types come from newer writers and are skipped.
+            offset += 4 + length;
+        }
+
+        pending.erase(0, offset);
+        return 0;
+    }
+
+    // True once the end record was read.
+    bool Done() const
+    {
+        return ended;
+    }
+    const string& Error() const
+    {
+        return error;
+    }
+    uint64_t PotCount() const
+    {
+        return potCount;
+    }
+};
+
+///
+/// @brief A snapshot received in parts: the parts are decoded as they come
+/// and the pots staged in a file until the end record, so a snapshot which
+/// turns out invalid or truncated changes nothing, and only the records of
+/// the part being decoded are held in memory whatever the size of the
+/// snapshot. The file is a snapshot itself, removed once created.
+///
+class SnapshotUpload
+{
+    // Bytes read back from the file at a time by @b Load.
+    static constexpr size_t loadBlockBytes = 1024 * 1024;
+
+    SnapshotReader reader;
+    int fd = -1;
+    // The records of the part being decoded, then written to the file.
+    string pending;
+    uint64_t stagedBytes = 0;
+    uint64_t maxBytes;
+    bool merging;
+    size_t staged = 0;
+    bool tooLarge = false;
+    bool invalid = false;
+    // When the last part came, in seconds.
+    int64_t touched;
+    string error;
+
+    int Fail(const string& message)
+    {
+        error = message;
+        return 1;
+    }
+
+    int Flush()
+    {
+        const char *data = pending.data();
+        size_t size = pending.size();
+        while(size > 0)
+        {
+            ssize_t written = write(fd, data, size);
+            if(written < 0 && errno == EINTR)
+                continue;
+            if(written <= 0)
+                return Fail(string("Cannot stage the snapshot: ") + strerror(errno));
+            data += written;
+            size -= (size_t) written;
+        }
+        stagedBytes += pending.size();
+        pending.clear();
+        return 0;
+    }
+
+public:
+    ///
+    /// @param maxBytes The most bytes staged, a bigger snapshot is refused
+    /// (see @b TooLarge).
+    /// @param merging Whether the pots are handed over by their previous
+    /// owner, to be merged with those here (see Fleet::Merge) rather than
+    /// replace them.
+    ///
+    SnapshotUpload(int64_t now, uint64_t _maxBytes, bool _merging = false)
+        : maxBytes(_maxBytes),
+          merging(_merging),
+          touched(now)
+    {
+
+    }
+
+    SnapshotUpload(SnapshotUpload&& other)
+        : reader(move(other.reader)),
+          fd(other.fd),
+          pending(move(other.pending)),
+          stagedBytes(other.stagedBytes),
+          maxBytes(other.maxBytes),
+          merging(other.merging),
+          staged(other.staged),
+          tooLarge(other.tooLarge),
+          invalid(other.invalid),
+          touched(other.touched),
+          error(move(other.error))
+    {
+        other.fd = -1;
+    }
+
+    SnapshotUpload(const SnapshotUpload&) = delete;
+    SnapshotUpload& operator=(const SnapshotUpload&) = delete;
+
+    ~SnapshotUpload()
+    {
+        if(fd >= 0)
+            close(fd);
+    }
+
+    ///
+    /// @brief Creates the file the pots are staged in, in @p directory.
+    ///
+    /// @returns 0 on success, 1 on failure (see @b Error).
+    ///
+    int Open(const string& directory)
+    {
+        string path = directory + "/smartpot-upload-XXXXXX";
+        fd = mkstemp(&path[0]);
+        if(fd < 0)
+            return Fail("Cannot stage the snapshot in " + directory + ": " + strerror(errno));
+        unlink(path.c_str());
+        Snapshot::WriteHeader(pending);
+        return Flush();
+    }
+
+    ///
+    /// @brief Decodes the part @p data, which follows the previous ones,
+    /// and stages its pots.
+    ///
+    /// @returns 0 on success, 1 if the snapshot is invalid, too large or
+    /// could not be staged (see @b Error).
+    ///
+    int Feed(const char *data, size_t size, int64_t now)
+    {
+        touched = now;
+        if(!error.empty())
+            return 1;
+        if(reader.Feed(data, size, [this](int potId, const SmartPot& pot)
+           {
+               Snapshot::WritePot(pending, potId, pot);
+               staged++;
+           }))
+        {
+            invalid = true;
+            return Fail(reader.Error());
+        }
+        if(reader.Done())
+            Snapshot::WriteEnd(pending, staged);
+        if(stagedBytes + pending.size() > maxBytes)
+        {
+            tooLarge = true;
+            return Fail("The snapshot is larger than " + to_string(maxBytes) + " bytes.");
+        }
+        return Flush();
+    }
+
+    ///
+    /// @brief Reads the staged pots back, once @b Done, and calls
+    /// @p onPot(potId, pot) for each one.
+    ///
+    /// @returns 0 on success, 1 if the file could not be read.
+    ///
+    template<typename OnPot>
+    int Load(OnPot onPot)
+    {
+        SnapshotReader staging;
+        string block(loadBlockBytes, '\0');
+        for(uint64_t offset = 0; offset < stagedBytes; )
+        {
+            ssize_t size = pread(fd, &block[0], block.size(), (off_t) offset);
+            if(size < 0 && errno == EINTR)
+                continue;
+            if(size <= 0)
+                return Fail(string("Cannot read the staged snapshot: ") + strerror(errno));
+            if(staging.Feed(block.data(), (size_t) size, onPot))
+                return Fail(staging.Error());
+            offset += (uint64_t) size;
+        }
+        return staging.Done() ? 0 : Fail("The staged snapshot is truncated.");
+    }
+
+    // True once the end record was read, the pots can then be loaded.
+    bool Done() const
+    {
+        return reader.Done() && error.empty();
+    }
+    bool Merging() const
+    {
+        return merging;
+    }
+    // True if the snapshot failed for being over the most bytes staged.
+    bool TooLarge() const
+    {
+        return tooLarge;
+    }
+    // True if the snapshot failed for being invalid or truncated.
+    bool Invalid() const
+    {
+        return invalid;
+    }
+    // Bytes written to the file so far.
+    uint64_t StagedBytes() const
+    {
+        return stagedBytes;
+    }
+    const string& Error() const
+    {
+        return error;
+    }
+    size_t Staged() const
+    {
+        return staged;
+    }
+    int64_t Touched() const
+    {
+        return touched;
+    }
+};
+}
+
+#endif
@@ -0,0 +1,99 @@
+///
+/// @file SoilIndex.hpp
+///
+/// @brief Inverted index from (suitable soil type, actual soil type) to the
+/// pots in that situation, so that the pots whose soil does not suit their
+/// plant can be listed without looking at every pot.
+///
+#ifndef SOIL_INDEX_HPP
+#define SOIL_INDEX_HPP
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+using namespace std;
+
+namespace pot
+{
+class SoilIndex
+{
+public:
+    // (suitable soil type of the plant, soil type measured in the pot).
+    using SoilPair = pair<string, string>;
+
+private:
+    // Only the incompatible pairs are kept here, with no empty sets, so
+    // listing them costs as much as the answer.
+    map<SoilPair, set<int>> incompatible;
+    // The pair every indexed pot is currently in.
+    map<int, SoilPair> potSoils;
+    size_t incompatibleCount = 0;
+
+    void Unlink(int potId, const SoilPair& soils)
+    {
+        if(soils.first == soils.second)
+            return;
+        auto it = incompatible.find(soils);
+        it->second.erase(potId);
+        if(it->second.empty())
+            incompatible.erase(it);
+        incompatibleCount--;
+    }
+
+public:
+    ///
+    /// @brief Records that pot @p potId holds a plant which needs
+    /// @p suitableSoilType and has a soil of type @p soilType.
+    ///
+    void Update(int potId, const string& suitableSoilType, const string& soilType)
+    {
+        auto it = potSoils.find(potId);
+        if(it != potSoils.end())
+        {
+            // Most updates repeat the current soil type.
+            if(it->second.first == suitableSoilType && it->second.second == soilType)
+                return;
+            Unlink(potId, it->second);
+            it->second.first = suitableSoilType;
+            it->second.second = soilType;
+        }
+        else
+        {
+            it = potSoils.emplace(potId, SoilPair(suitableSoilType, soilType)).first;
+        }
+        const SoilPair& soils = it->second;
+        if(soils.first != soils.second)
+        {
+            incompatible[soils].insert(potId);
+            incompatibleCount++;
+        }
+    }
+
+    ///
+    /// @brief Forgets pot @p potId, e.g. when it has no plant or no
+    /// soilType sensor anymore.
+    ///
+    void Remove(int potId)
+    {
+        auto it = potSoils.find(potId);
+        if(it == potSoils.end())
+            return;
+        Unlink(potId, it->second);
+        potSoils.erase(it);
+    }
+
+    const map<SoilPair, set<int>>& Incompatible() const
+    {
+        return incompatible;
+    }
+
+    size_t IncompatibleCount() const
+    {
+        return incompatibleCount;
+    }
+};
+}
+
+#endif
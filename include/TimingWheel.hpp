@@ -0,0 +1,266 @@
+///
+/// @file TimingWheel.hpp
+///
+/// @brief Hierarchical timing wheel: millions of timers with O(1) insert and
+/// cancel, and an advance whose cost only depends on the expired timers and
+/// the elapsed ticks.
+///
+#ifndef TIMING_WHEEL_HPP
+#define TIMING_WHEEL_HPP
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+namespace pot
+{
+///
+/// @brief Four wheels of 256 slots. A timer sits in the lowest wheel whose
+/// range covers its distance to the current tick and moves down a wheel
+/// each time the wheel above turns one slot, so it is touched at most four
+/// times in its life. The timers are nodes of one pool linked into their
+/// slot by index, so inserting or cancelling never allocates once the pool
+/// has grown.
+///
+class TimingWheel
+{
+public:
+    // Identifies a timer, the generation makes stale handles harmless.
+    using Handle = uint64_t;
+    static constexpr Handle noTimer = 0;
+
+private:
+    static constexpr int levels = 4;
+    static constexpr int slotBits = 8;
+    static constexpr uint32_t slotCount = 1u << slotBits;
+    static constexpr uint32_t slotMask = slotCount - 1;
+    static constexpr uint32_t none = UINT32_MAX;
+
+    struct Node
+    {
+        uint32_t prev = none;
+        uint32_t next = none;
+        // Slot index in heads, none when the node is free.
+        uint32_t slot = none;
+        uint32_t generation = 1;
+        uint64_t expires = 0;
+        uint64_t payload = 0;
+    };
+
+    vector<Node> nodes;
+    uint32_t freeNodes = none;
+    vector<uint32_t> heads;
+    // Number of timers per wheel, to skip the ticks with nothing to do.
+    size_t wheelSizes[levels] = {};
+    uint64_t now;
+    size_t size = 0;
+
+    static Handle MakeHandle(uint32_t index, uint32_t generation)
+    {
+        return ((uint64_t) generation << 32) | index;
+    }
+
+    // Links a node into its slot, @p earliest is the first tick whose
+    // slot is still to be visited.
+    void Link(uint32_t index, uint64_t earliest)
+    {
+        Node& node = nodes[index];
+        uint64_t delta = node.expires > now ? node.expires - now : 0;
+        int level = 0;
+        while(level < levels - 1 && delta >= ((uint64_t) 1 << (slotBits * (level + 1))))
+            level++;
+        // Past the biggest wheel: parked in its last slot and re-linked when
+        // that slot cascades.
+        uint64_t at = node.expires;
+        if(delta >= ((uint64_t) 1 << (slotBits * levels)))
+            at = now + ((uint64_t) 1 << (slotBits * levels)) - 1;
+        // Already due timers go to the first slot still to be visited.
+        if(at < earliest)
+            at = earliest;
+        uint32_t slot = level * slotCount + ((at >> (slotBits * level)) & slotMask);
+
+        node.slot = slot;
+        wheelSizes[level]++;
+        node.prev = none;
+        node.next = heads[slot];
+        if(node.next != none)
+            nodes[node.next].prev = index;
+        heads[slot] = index;
+    }
+
+    void Unlink(uint32_t index)
+    {
+        Node& node = nodes[index];
+        if(node.prev != none)
+            nodes[node.prev].next = node.next;
+        else
+            heads[node.slot] = node.next;
+        if(node.next != none)
+            nodes[node.next].prev = node.prev;
+        node.prev = node.next = none;
+        wheelSizes[node.slot / slotCount]--;
+    }
+
+    void Free(uint32_t index)
+    {
+        Node& node = nodes[index];
+        node.slot = none;
+        node.generation++;
+        if(node.generation == 0)
+            node.generation = 1;
+        node.next = freeNodes;
+        freeNodes = index;
+        size--;
+    }
+
+    // Moves the timers of a slot of an upper wheel to the lower wheels.
+    void Cascade(int level)
+    {
+        uint32_t slot = level * slotCount + ((now >> (slotBits * level)) & slotMask);
+        uint32_t index = heads[slot];
+        heads[slot] = none;
+        while(index != none)
+        {
+            uint32_t next = nodes[index].next;
+            wheelSizes[level]--;
+            // The slot of the current tick is visited right after.
+            Link(index, now);
+            index = next;
+        }
+    }
+
+public:
+    ///
+    /// @param _now The current tick, the timers expire at later ticks.
+    ///
+    explicit TimingWheel(uint64_t _now)
+        : heads(levels * slotCount, none),
+          now(_now)
+    {
+
+    }
+
+    ///
+    /// @brief Adds a timer which expires at tick @p expires (the next tick
+    /// if it is not in the future) and carries @p payload.
+    ///
+    Handle Insert(uint64_t expires, uint64_t payload)
+    {
+        uint32_t index;
+        if(freeNodes != none)
+        {
+            index = freeNodes;
+            freeNodes = nodes[index].next;
+        }
+        else
+        {
+            index = (uint32_t) nodes.size();
+            nodes.emplace_back();
+        }
+        Node& node = nodes[index];
+        node.expires = expires;
+        node.payload = payload;
+        Link(index, now + 1);
+        size++;
+        return MakeHandle(index, node.generation);
+    }
+
+    // The tick timer @p handle expires at, 0 if it is not pending.
+    uint64_t Expires(Handle handle) const
+    {
+        uint32_t index = (uint32_t) handle;
+        uint32_t generation = (uint32_t) (handle >> 32);
+        if(index >= nodes.size() || nodes[index].generation != generation || nodes[index].slot == none)
+            return 0;
+        return nodes[index].expires;
+    }
+
+    ///
+    /// @returns True if the timer was pending and is now cancelled.
+    ///
+    bool Cancel(Handle handle)
+    {
+        uint32_t index = (uint32_t) handle;
+        uint32_t generation = (uint32_t) (handle >> 32);
+        if(index >= nodes.size() || nodes[index].generation != generation || nodes[index].slot == none)
+            return false;
+        Unlink(index);
+        Free(index);
+        return true;
+    }
+
+    ///
+    /// @brief Moves the wheel to tick @p to, appending the payloads of the
+    /// timers which expired on the way to @p expired.
+    ///
+    void Advance(uint64_t to, vector<uint64_t>& expired)
+    {
+        while(now < to)
+        {
+            // With the lower wheels empty nothing happens before the next
+            // slot of the first wheel holding timers comes down.
+            int busy = 0;
+            while(busy < levels && wheelSizes[busy] == 0)
+                busy++;
+            if(busy == levels)
+            {
+                now = to;
+                break;
+            }
+            if(busy > 0)
+            {
+                uint64_t span = (uint64_t) 1 << (slotBits * busy);
+                uint64_t last = (now | (span - 1));
+                if(last >= to)
+                {
+                    now = to;
+                    break;
+                }
+                now = last;
+            }
+
+            now++;
+            // When a wheel wraps, the next slot of the wheel above comes down.
+            for(int level = 1; level < levels; ++level)
+            {
+                if(((now >> (slotBits * (level - 1))) & slotMask) != 0)
+                    break;
+                Cascade(level);
+            }
+
+            uint32_t slot = now & slotMask;
+            uint32_t index = heads[slot];
+            heads[slot] = none;
+            while(index != none)
+            {
+                uint32_t next = nodes[index].next;
+                wheelSizes[0]--;
+                // Parked timers can come down early, they wait for their turn.
+                if(nodes[index].expires > now)
+                {
+                    Link(index, now + 1);
+                }
+                else
+                {
+                    expired.push_back(nodes[index].payload);
+                    Free(index);
+                }
+                index = next;
+            }
+        }
+    }
+
+    uint64_t Now() const
+    {
+        return now;
+    }
+
+    size_t Size() const
+    {
+        return size;
+    }
+};
+}
+
+#endif
@@ -0,0 +1,252 @@
+///
+/// @file Trace.hpp
+///
+/// @brief Spans timing the stages of the requests and MQTT messages (the
+/// parsing, the wait for the lock, the JSON building...), captured for a
+/// few seconds at a time and exported as Chrome trace events, which
+/// chrome://tracing and Perfetto show on a timeline.
+///
+/// Every thread writes its spans to a ring of its own, so recording a span
+/// takes no lock and touches no shared cache line: the capture reads the
+/// rings afterwards, and drops the events a thread overwrote meanwhile.
+/// The spans are timed with the time-stamp counter of the CPU (the steady
+/// clock elsewhere), converted to microseconds with the clock of the
+/// capture.
+///
+/// The spans are written with TRACE_SPAN(variable, "name"), which ends the
+/// span with the scope or at TRACE_END(variable). They are only compiled
+/// in with SMARTPOT_TRACE defined (see the top CMakeLists.txt), and while
+/// no capture runs a span only reads a flag.
+///
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+
+#ifdef SMARTPOT_TRACE
+#define TRACE_SPAN(span, name) pot::Trace::Span span(name)
+#define TRACE_END(span) span.End()
+#else
+#define TRACE_SPAN(span, name) do {} while(0)
+#define TRACE_END(span) do {} while(0)
+#endif
+
+namespace pot
+{
+class Trace
+{
+public:
+    // Spans kept per thread, the older ones are overwritten.
+    static constexpr size_t ringCapacity = 1 << 14;
+
+    struct Event
+    {
+        // A string literal.
+        const char *name;
+        // In ticks of Now.
+        uint64_t start;
+        uint64_t end;
+        // Numbered from 1 in the order the threads first record a span.
+        uint32_t thread;
+    };
+
+    // The events of a capture and the clock to convert their ticks.
+    struct Capture
+    {
+        uint64_t startTick;
+        uint64_t endTick;
+        int64_t startNanoseconds;
+        int64_t endNanoseconds;
+        vector<Event> events;
+
+        // Microseconds from the start of the capture to @p tick.
+        double Microseconds(uint64_t tick) const
+        {
+            if(endTick <= startTick)
+                return 0;
+            double nanosecondsPerTick = (double) (endNanoseconds - startNanoseconds)
+                                        / (double) (endTick - startTick);
+            return ((double) tick - (double) startTick) * nanosecondsPerTick / 1000;
+        }
+    };
+
+private:
+    // The fields are atomic for the capture to read them while the thread
+    // writes, they are only ever written by that thread.
+    struct Slot
+    {
+        atomic<const char*> name{nullptr};
+        atomic<uint64_t> start{0};
+        atomic<uint64_t> end{0};
+    };
+
+    struct Ring
+    {
+        uint32_t thread;
+        array<Slot, ringCapacity> slots;
+        // The index of the event being written plus one, then of the last
+        // one written plus one.
+        atomic<uint64_t> claimed{0};
+        atomic<uint64_t> written{0};
+    };
+
+    inline static atomic<bool> enabled{false};
+    // The rings live as long as the process, a thread may end while its
+    // ring is read.
+    inline static mutex ringsLock;
+    inline static vector<unique_ptr<Ring>> rings;
+
+    static Ring& LocalRing()
+    {
+        thread_local Ring *ring = nullptr;
+        if(ring == nullptr)
+        {
+            lock_guard<mutex> guard(ringsLock);
+            rings.push_back(make_unique<Ring>());
+            ring = rings.back().get();
+            ring->thread = (uint32_t) rings.size();
+        }
+        return *ring;
+    }
+
+    static int64_t SteadyNanoseconds()
+    {
+        return chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+public:
+    // Ticks of the time-stamp counter, or nanoseconds of the steady clock.
+    static uint64_t Now()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return (uint64_t) SteadyNanoseconds();
+#endif
+    }
+
+    static bool Enabled()
+    {
+        return enabled.load(memory_order_relaxed);
+    }
+
+    // Records a span of the calling thread.
+    static void Record(const char *name, uint64_t start, uint64_t end)
+    {
+        Ring& ring = LocalRing();
+        uint64_t index = ring.written.load(memory_order_relaxed);
+        // A capture reading the slot meanwhile sees it claimed.
+        ring.claimed.store(index + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        Slot& slot = ring.slots[index % ringCapacity];
+        slot.name.store(name, memory_order_relaxed);
+        slot.start.store(start, memory_order_relaxed);
+        slot.end.store(end, memory_order_relaxed);
+        ring.written.store(index + 1, memory_order_release);
+    }
+
+    ///
+    /// @brief Starts recording the spans into @p capture.
+    ///
+    /// @returns 0 on success, 1 if a capture is already running.
+    ///
+    static int Start(Capture& capture)
+    {
+        bool expected = false;
+        if(!enabled.compare_exchange_strong(expected, true))
+            return 1;
+        capture.events.clear();
+        capture.startNanoseconds = SteadyNanoseconds();
+        capture.startTick = Now();
+        return 0;
+    }
+
+    ///
+    /// @brief Stops recording and gathers the spans which started during
+    /// the capture, from every thread.
+    ///
+    static void Stop(Capture& capture)
+    {
+        capture.endTick = Now();
+        capture.endNanoseconds = SteadyNanoseconds();
+        enabled.store(false, memory_order_relaxed);
+
+        lock_guard<mutex> guard(ringsLock);
+        for(const unique_ptr<Ring>& ring : rings)
+        {
+            uint64_t written = ring->written.load(memory_order_acquire);
+            uint64_t first = written > ringCapacity ? written - ringCapacity : 0;
+            size_t size = capture.events.size();
+            for(uint64_t index = first; index < written; ++index)
+            {
+                const Slot& slot = ring->slots[index % ringCapacity];
+                capture.events.push_back({slot.name.load(memory_order_relaxed),
+                                          slot.start.load(memory_order_relaxed),
+                                          slot.end.load(memory_order_relaxed),
+                                          ring->thread});
+            }
+            // The slots claimed since were being overwritten while read.
+            atomic_thread_fence(memory_order_acquire);
+            uint64_t claimed = ring->claimed.load(memory_order_relaxed);
+            size_t kept = size;
+            for(uint64_t index = first; index < written; ++index)
+            {
+                const Event& event = capture.events[size + (index - first)];
+                if(index + ringCapacity >= claimed
+                   && event.start >= capture.startTick && event.start <= capture.endTick)
+                    capture.events[kept++] = event;
+            }
+            capture.events.resize(kept);
+        }
+    }
+
+    ///
+    /// @brief Times its scope, or until End, when a capture is running.
+    ///
+    class Span
+    {
+        const char *name;
+        // 0 when not recording.
+        uint64_t start;
+
+    public:
+        explicit Span(const char *_name)
+            : name(_name),
+              start(Enabled() ? Now() : 0)
+        {
+
+        }
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+        ~Span()
+        {
+            End();
+        }
+
+        void End()
+        {
+            if(start == 0)
+                return;
+            Record(name, start, Now());
+            start = 0;
+        }
+    };
+};
+}
+
+#endif
@@ -0,0 +1 @@
+#include "AnomalyDetector.hpp"
\ No newline at end of file
@@ -0,0 +1 @@
+#include "ChangeLog.hpp"
\ No newline at end of file
@@ -0,0 +1 @@
+#include "ChunkCompressor.hpp"
\ No newline at end of file
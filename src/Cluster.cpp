@@ -0,0 +1 @@
+#include "Cluster.hpp"
\ No newline at end of file
@@ -0,0 +1 @@
+#include "ColdStore.hpp"
\ No newline at end of file
@@ -0,0 +1 @@
+#include "DerivedSensors.hpp"
\ No newline at end of file
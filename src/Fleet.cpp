@@ -0,0 +1 @@
+#include "Fleet.hpp"
\ No newline at end of file
@@ -0,0 +1 @@
+#include "FleetAggregates.hpp"
\ No newline at end of file
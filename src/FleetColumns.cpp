@@ -0,0 +1 @@
+#include "FleetColumns.hpp"
\ No newline at end of file
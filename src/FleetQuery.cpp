@@ -0,0 +1 @@
+#include "FleetQuery.hpp"
\ No newline at end of file
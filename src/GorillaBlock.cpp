@@ -0,0 +1 @@
+#include "GorillaBlock.hpp"
\ No newline at end of file
@@ -0,0 +1 @@
+#include "HashRing.hpp"
\ No newline at end of file
@@ -0,0 +1 @@
+#include "MqttCapture.hpp"
\ No newline at end of file
@@ -0,0 +1 @@
+#include "MqttIngest.hpp"
\ No newline at end of file
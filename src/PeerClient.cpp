@@ -0,0 +1 @@
+#include "PeerClient.hpp"
\ No newline at end of file
@@ -0,0 +1 @@
+#include "PotConfig.hpp"
\ No newline at end of file
@@ -0,0 +1 @@
+#include "PotListing.hpp"
\ No newline at end of file
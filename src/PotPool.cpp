@@ -0,0 +1 @@
+#include "PotPool.hpp"
\ No newline at end of file
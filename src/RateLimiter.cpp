@@ -0,0 +1 @@
+#include "RateLimiter.hpp"
\ No newline at end of file
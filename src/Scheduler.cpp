@@ -0,0 +1 @@
+#include "Scheduler.hpp"
\ No newline at end of file
@@ -0,0 +1 @@
+#include "SensorHistory.hpp"
\ No newline at end of file
@@ -11,57 +11,263 @@
 #include <rapidjson/writer.h>
 #include <rapidjson/stringbuffer.h>
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <string>
+#include <thread>
 #include <omp.h>
+#include <unistd.h>
 using namespace rapidjson;
 
 namespace pot
 {
-    SmartPotEndpoint::SmartPotEndpoint(Address address)
-    {   
-        // Create a default SmartPot object.
-        map<int, map<string, Sensor>> sensorsAux;
-        map<string, Sensor> s;
-        map<string, Sensor> s_2;
-        map<string, Sensor> s_3;
-        Sensor s1("soilHumidity", 2, 3, 6);
-        Sensor s2("luminosity", 2,4,5);
-        Sensor s3("temperature", 3,3,3);
-        Sensor s4("soilType", "Red",3,3);
-        Sensor s5("humidity", 3,3,3);
-        Sensor s6("soilPh", 3,3,3);
-        s["soilHumidity"] = s1;
-        s["soilType"] = s4;
-        s["soilPh"] = s6;
-        s_2["temperature"] = s3;
-        s_2["luminosity"] = s2;
-        s_2["humidity"] = s5;
-        Sensor sPh("phosphorus", 1, 2, 3);
-        Sensor sN("nitrogen", 1, 2, 3);
-        Sensor sP("potassium", 1, 2, 3);
-        s_3["phosphorus"] = sPh;
-        s_3["nitrogen"] = sN;
-        s_3["potassium"] = sP;
-        sensorsAux[3] = s;
-        sensorsAux[2] = s_2;
-        sensorsAux[1] = s_3;
-        Plant p("Cactus", "Green", 1.3, "Desert", "Red");
-        smartPot = new SmartPot(p, sensorsAux);
-
-        // Create the HTTP Endpoint.
+    // Pots encoded per chunk of GET /snapshot, the lock is released between
+    // the chunks.
+    static const size_t snapshotChunkPots = 256;
+
+    // Bytes of a snapshot sent per PUT /snapshot/uploads/:uploadId. The
+    // snapshot routes are also served on the port given by
+    // Cluster::SnapshotAddress, whose request size limit fits a part and its
+    // headers, while the other routes keep the 4 KB of Pistache.
+    static const size_t snapshotPartBytes = 4 * 1024 * 1024;
+    static const size_t snapshotRequestBytes = snapshotPartBytes + 64 * 1024;
+
+    // Snapshots being uploaded at most, and the seconds after which an
+    // upload without a new part is dropped to make room for another.
+    static const size_t maxSnapshotUploads = 16;
+    static const int64_t snapshotUploadTimeoutSeconds = 60;
+
+    // Bytes of pots staged on disk per upload and by all the uploads
+    // together, a part over either is refused with 413.
+    static const uint64_t maxSnapshotUploadBytes = 4ull * 1024 * 1024 * 1024;
+    static const uint64_t maxSnapshotStagedBytes = 16ull * 1024 * 1024 * 1024;
+
+    // Pots of a GET /pots page without a ?limit=, and the most of a page.
+    static const size_t defaultPotsLimit = 1000;
+    static const size_t maxPotsLimit = 100000;
+
+    // Pots listed by GET /fleet/query without a ?limit=.
+    static const size_t defaultQueryLimit = 1000;
+
+    // Samples listed by GET /history without a ?limit=, and the most listed.
+    static const size_t defaultHistoryLimit = 10000;
+    static const size_t maxHistoryLimit = 1000000;
+
+    // Pots encoded (and compressed) per chunk of GET /pots.
+    static const size_t potsChunkPots = 256;
+
+    // Journal of the scheduled jobs, kept across restarts.
+    static const char *schedulesPath = "schedules.journal";
+
+    // Seconds without a reading after which a sensor is stale.
+    static const int64_t staleSensorTtl = 600;
+
+    // MQTT messages per second and burst allowed to one pot, a device
+    // reports a few sensors every few seconds.
+    static const double ingestPotRate = 10;
+    static const double ingestPotBurst = 50;
+
+    // MQTT messages per second applied one by one, the messages beyond it
+    // only keep the latest value of every sensor.
+    static const double ingestGlobalRate = 20000;
+    static const double ingestGlobalBurst = 20000;
+
+    // Jobs listed by GET /schedules without a ?limit=.
+    static const size_t defaultScheduleLimit = 1000;
+
+    // Seconds captured by POST /admin/trace without and at most with a
+    // ?seconds=. The request returns the id of the trace at once, the
+    // scheduler tick ends the capture and GET /admin/trace/:traceId
+    // returns it.
+    static const int defaultTraceSeconds = 1;
+    static const int maxTraceSeconds = 10;
+
+    // Pots declared by the configuration and built by the scheduler thread
+    // every second, so the whole fleet is built a while after startup
+    // without holding the lock for long.
+    static const size_t hydratePotsPerTick = 4096;
+
+    // Built pots given their new plant and thresholds per lock acquisition
+    // by a reload.
+    static const size_t reloadChunkPots = 1024;
+
+    // Threads forwarding the requests to the other instances of the
+    // cluster, and how long an instance may take to answer.
+    static const size_t forwardThreads = 4;
+    static const int peerTimeoutSeconds = 10;
+
+    // Bytes of pots sent to their new owner per PUT /snapshot when the
+    // cluster changes.
+    static const size_t handOffBatchBytes = 4 * 1024 * 1024;
+
+    ///
+    /// @brief Loads the default configuration, then the one at @p path if
+    /// not empty.
+    ///
+    /// @returns The configuration or nullptr if @p path could not be
+    /// loaded, with the reason in @p error.
+    ///
+    static shared_ptr<const PotConfig> loadConfig(const string &path, string &error)
+    {
+        shared_ptr<PotConfig> loaded = make_shared<PotConfig>();
+        loaded->LoadJson(PotConfig::defaults);
+        if (!path.empty() && loaded->Load(path))
+        {
+            error = loaded->Error();
+            return nullptr;
+        }
+        return loaded;
+    }
+
+    ///
+    /// @brief Loads the cluster file at @p path, or a cluster of this
+    /// instance alone if @p path is empty.
+    ///
+    /// @returns The cluster or nullptr if @p path could not be loaded, with
+    /// the reason in @p error.
+    ///
+    static shared_ptr<const Cluster> loadCluster(const string &path, string &error)
+    {
+        shared_ptr<Cluster> loaded = make_shared<Cluster>();
+        if (!path.empty() && loaded->Load(path))
+        {
+            error = loaded->Error();
+            return nullptr;
+        }
+        return loaded;
+    }
+
+    // The resident memory of the process in bytes, 0 if unknown.
+    static uint64_t residentBytes()
+    {
+        ifstream statm("/proc/self/statm");
+        uint64_t size = 0, resident = 0;
+        if (!(statm >> size >> resident))
+            return 0;
+        return resident * (uint64_t) sysconf(_SC_PAGESIZE);
+    }
+
+    // The sensor names of @p loaded, which they keep alive.
+    static shared_ptr<const map<int, string>> sensorNamesOf(const shared_ptr<const PotConfig> &loaded)
+    {
+        return shared_ptr<const map<int, string>>(loaded, &loaded->SensorTypes());
+    }
+
+    SmartPotEndpoint::SmartPotEndpoint(Address address, const string &_configPath,
+                                       const string &_clusterPath)
+        : configPath(_configPath),
+          clusterPath(_clusterPath)
+    {
+        // The pots of the configuration are only declared here and built
+        // when first read, so startup does not depend on the fleet size.
+        string error;
+        shared_ptr<const PotConfig> loaded = loadConfig(configPath, error);
+        if (loaded == nullptr)
+        {
+            std::cerr << "Could not load the pots configuration: " << error << endl;
+            loaded = loadConfig("", error);
+        }
+        atomic_store(&config, loaded);
+
+        shared_ptr<const Cluster> members = loadCluster(clusterPath, error);
+        if (members == nullptr)
+        {
+            std::cerr << "Could not load the cluster: " << error << endl;
+            members = loadCluster("", error);
+        }
+        atomic_store(&cluster, members);
+        peers = new PeerClient(forwardThreads, peerTimeoutSeconds);
+
+        fleet = new Fleet();
+        fleet->SetStaleTtl(staleSensorTtl);
+        // Pots are built with the configuration current when they are.
+        fleet->SetHydrator([](int potId) { return atomic_load(&config)->Build(potId); });
+        // Only the pots of this instance, the others are forwarded.
+        for (int potId : loaded->PotIds())
+        {
+            if (members->Owns(potId))
+                fleet->Declare(potId);
+        }
+        // Read by every route without a pot id, it is never evicted.
+        fleet->Pin(defaultPotId);
+        ingest = new MqttIngest(*fleet, sensorNamesOf(loaded));
+        limiter = new RateLimiter(ingestPotRate, ingestPotBurst,
+                                  ingestGlobalRate, ingestGlobalBurst);
+
+        // Create the HTTP Endpoint, and the one of the snapshot routes.
         httpEndpoint = std::make_shared<Http::Endpoint>(address);
+        uint16_t snapshotPort = static_cast<uint16_t>(address.port()) + Cluster::snapshotPortOffset;
+        snapshotEndpoint = std::make_shared<Http::Endpoint>(Address(address.host(), Port(snapshotPort)));
+        const char *tmpdir = getenv("TMPDIR");
+        stagingDirectory = tmpdir != nullptr && *tmpdir != '\0' ? tmpdir : "/tmp";
 
-        // Create the MQTT Subscriber.
+        // Create the MQTT Subscriber, the instances of a cluster share the
+        // broker so each one needs an id of its own.
         mosquitto_lib_init();
-        //                            HostName   CleanSession SessionID
-        mosquittoSub = mosquitto_new("SmartPot", true, NULL);
+        string clientId = members->IsClustered() ? "SmartPot-" + members->Self() : "SmartPot";
+        //                            HostName         CleanSession SessionID
+        mosquittoSub = mosquitto_new(clientId.c_str(), true, NULL);
+
+        // Runs the due jobs one batch per lock acquisition and publishes
+        // their results on "pots/<potId>/schedule".
+        scheduler = new Scheduler(schedulesPath,
+            [this](const vector<Scheduler::Due> &due, vector<string> &results)
+            {
+                {
+                    Guard guard(potLock);
+                    for (const Scheduler::Due &job : due)
+                    {
+                        SmartPot *pot = fleet->Get(job.potId);
+                        results.push_back(pot != nullptr ? Scheduler::Run(*pot, job.action)
+                                                         : "Pot " + to_string(job.potId) + " was not found");
+                    }
+                }
+                for (size_t i = 0; i < due.size(); ++i)
+                {
+                    string topic = "pots/" + to_string(due[i].potId) + "/schedule";
+                    mosquitto_publish(mosquittoSub, NULL, topic.c_str(), results[i].size(),
+                                      results[i].c_str(), 0, false);
+                }
+            });
+        // The scheduler thread also drives the sensor staleness, applies the
+        // readings coalesced under overload (publishing their anomalies),
+        // builds the declared pots, evicts the pots over the memory budget
+        // and ends the trace capture.
+        scheduler->SetTick([this](int64_t now)
+            {
+                TRACE_SPAN(span, "tick");
+                vector<Fleet::Anomaly> anomalies;
+                {
+                    Guard guard(potLock);
+                    ingest->Flush();
+                    fleet->ExpireStale(now);
+                    fleet->HydrateSome(hydratePotsPerTick);
+                    fleet->Trim();
+                    fleet->TakeAnomalies(anomalies);
+                }
+                publishAnomalies(mosquittoSub, anomalies);
+                finishTrace();
+            });
     }
 
     SmartPotEndpoint::~SmartPotEndpoint(void)
     {
-        // Stop the HTTP server.
+        // Stop the HTTP servers.
         httpEndpoint->shutdown();
+        snapshotEndpoint->shutdown();
+
+        // Stop the scheduler before the MQTT client it publishes with.
+        delete scheduler;
+
+        if (reloadThread.joinable())
+            reloadThread.join();
+
+        // Sends the requests still being forwarded.
+        delete peers;
 
         mosquitto_destroy(mosquittoSub);
         mosquitto_lib_cleanup();
@@ -75,6 +281,9 @@ namespace pot
         // Get the optimal settings for our HTTP endpoint.
         auto settings = Http::Endpoint::options();
         httpEndpoint->init(settings);
+        // The parts of the snapshots are larger than a request of the
+        // other routes may be.
+        snapshotEndpoint->init(Http::Endpoint::options().maxRequestSize(snapshotRequestBytes));
         // Create the http routes we'll use.
         createHttpRoutes();
 
@@ -89,6 +298,9 @@ namespace pot
     ///
     void SmartPotEndpoint::start(void)
     {
+        // The scheduled jobs run on their own thread.
+        scheduler->Start();
+
         // Start the parallel region for the HTTP and MQTT servers.
         #pragma omp parallel sections 
         {
@@ -98,13 +310,17 @@ namespace pot
                 // cout << "HTTP " << omp_get_thread_num() << endl;
                 httpEndpoint->setHandler(router.handler());
                 httpEndpoint->serveThreaded();
+                snapshotEndpoint->setHandler(snapshotRouter.handler());
+                snapshotEndpoint->serveThreaded();
             }
 
             // The MQTT server.
             #pragma omp section
             {
                 // cout << "MQTT " << omp_get_thread_num() << endl;
-                if (mosquitto_connect(mosquittoSub, "mqtt_server", 1883, 60))
+                shared_ptr<const Cluster> members = atomic_load(&cluster);
+                if (mosquitto_connect(mosquittoSub, members->BrokerHost().c_str(),
+                                      members->BrokerPort(), 60))
                 {
                     std::cout << "Could not connect to MQTT broker." << endl;
                 }
@@ -122,12 +338,45 @@ namespace pot
     ///
     void SmartPotEndpoint::stop(void)
     {
-        // Stop the HTTP server.
+        // Stop the HTTP servers.
         httpEndpoint->shutdown();
+        snapshotEndpoint->shutdown();
+
+        // Stop the scheduled jobs, they are kept in the journal.
+        scheduler->Stop();
+
+        // A reload may be handing pots over to the other instances.
+        if (reloadThread.joinable())
+            reloadThread.join();
 
         // Stop the MQTT server and disconnect from the broker.
         mosquitto_loop_stop(mosquittoSub, true);
         mosquitto_disconnect(mosquittoSub);
+
+        // The messages captured are all received now.
+        capture.Close();
+    }
+
+    ///
+    /// @brief Starts recording the MQTT messages to @p path, to be called
+    /// before start. tools/replay.cpp feeds them back to the ingest.
+    ///
+    /// @returns 0 on success, 1 if the file could not be created.
+    ///
+    int SmartPotEndpoint::startCapture(const string &path)
+    {
+        return capture.Open(path);
+    }
+
+    int SmartPotEndpoint::startTiering(const string &path, size_t budgetBytes)
+    {
+        Guard guard(potLock);
+        if (fleet->EnableTiering(path, budgetBytes))
+        {
+            std::cerr << fleet->TieringError() << endl;
+            return 1;
+        }
+        return 0;
     }
 
     ///
@@ -159,6 +408,24 @@ namespace pot
         Routes::Get(router, "/activateSolarLamp",
                     Routes::bind(&SmartPotEndpoint::activateSolarLamp, this));
 
+        Routes::Get(router, "/fleet/aggregates",
+                    Routes::bind(&SmartPotEndpoint::getFleetAggregates, this));
+
+        Routes::Get(router, "/fleet/incompatibleSoil",
+                    Routes::bind(&SmartPotEndpoint::getIncompatibleSoil, this));
+
+        Routes::Get(router, "/fleet/query",
+                    Routes::bind(&SmartPotEndpoint::getFleetQuery, this));
+
+        Routes::Get(router, "/history",
+                    Routes::bind(&SmartPotEndpoint::getHistory, this));
+
+        Routes::Get(router, "/pots",
+                    Routes::bind(&SmartPotEndpoint::getPots, this));
+
+        Routes::Get(router, "/ingest/stats",
+                    Routes::bind(&SmartPotEndpoint::getIngestStats, this));
+
 
         Routes::Put(router, "/settings/:settingName/:settingValue",
                     Routes::bind(&SmartPotEndpoint::putSetting, this));
@@ -168,6 +435,140 @@ namespace pot
 
         Routes::Put(router, "/plantInfo",
                     Routes::bind(&SmartPotEndpoint::putPlantType, this));
+
+        // The snapshot routes are on both ports, the parts larger than a
+        // request of our port go to the snapshot one.
+        for (Rest::Router *routes : {&router, &snapshotRouter})
+        {
+            Routes::Get(*routes, "/snapshot",
+                        Routes::bind(&SmartPotEndpoint::getSnapshot, this));
+
+            Routes::Put(*routes, "/snapshot",
+                        Routes::bind(&SmartPotEndpoint::putSnapshot, this));
+
+            Routes::Post(*routes, "/snapshot/uploads",
+                        Routes::bind(&SmartPotEndpoint::postSnapshotUpload, this));
+
+            Routes::Put(*routes, "/snapshot/uploads/:uploadId",
+                        Routes::bind(&SmartPotEndpoint::putSnapshotUpload, this));
+
+            Routes::Delete(*routes, "/snapshot/uploads/:uploadId",
+                        Routes::bind(&SmartPotEndpoint::deleteSnapshotUpload, this));
+        }
+
+        Routes::Get(router, "/schedules",
+                    Routes::bind(&SmartPotEndpoint::getSchedules, this));
+
+        Routes::Post(router, "/schedules",
+                    Routes::bind(&SmartPotEndpoint::postSchedule, this));
+
+        Routes::Delete(router, "/schedules/:scheduleId",
+                    Routes::bind(&SmartPotEndpoint::deleteSchedule, this));
+
+        Routes::Post(router, "/admin/reload",
+                    Routes::bind(&SmartPotEndpoint::postReload, this));
+
+        Routes::Get(router, "/admin/reload",
+                    Routes::bind(&SmartPotEndpoint::getReload, this));
+
+        Routes::Post(router, "/admin/trace",
+                    Routes::bind(&SmartPotEndpoint::postTrace, this));
+
+        Routes::Get(router, "/admin/trace/:traceId",
+                    Routes::bind(&SmartPotEndpoint::getTrace, this));
+
+        Routes::Get(router, "/admin/cluster",
+                    Routes::bind(&SmartPotEndpoint::getCluster, this));
+
+        Routes::Get(router, "/admin/memory",
+                    Routes::bind(&SmartPotEndpoint::getMemory, this));
+    }
+
+    ///
+    /// @brief Forwards the request to the instance owning pot @p potId,
+    /// unless it is this one or the request was already forwarded to it
+    /// (the instances then disagree on the owner during a rebalance, and
+    /// this one answers with what it has). The owner is asked from a
+    /// thread of the peer client, which sends its response back, so the
+    /// HTTP thread goes on with the next requests.
+    ///
+    /// @returns true if the request was forwarded, @p response is then
+    /// moved away.
+    ///
+    bool SmartPotEndpoint::forwardToOwner(int potId,
+                                          const Rest::Request &request,
+                                          Http::ResponseWriter &response)
+    {
+        shared_ptr<const Cluster> current = atomic_load(&cluster);
+        if (current->Owns(potId) || request.headers().tryGetRaw(PeerClient::forwardedHeader))
+            return false;
+
+        const string &owner = current->Owner(potId);
+        if (owner.empty())
+        {
+            response.send(Http::Code::Service_Unavailable, "The cluster has no instance to serve pot "
+                          + to_string(potId));
+            return true;
+        }
+
+        auto contentType = request.headers().tryGet<Http::Header::ContentType>();
+        auto writer = make_shared<Http::ResponseWriter>(move(response));
+        if (peers->SendAsync(owner, Http::methodString(request.method()),
+                             request.resource() + request.query().as_str(),
+                             contentType ? contentType->mime().toString() : string(),
+                             request.body(),
+            [writer](int failed, PeerClient::Response &answer, const string &error)
+            {
+                if (failed)
+                    writer->send(Http::Code::Bad_Gateway, error);
+                else if (answer.contentType.empty())
+                    writer->send(static_cast<Http::Code>(answer.code), answer.body);
+                else
+                    writer->send(static_cast<Http::Code>(answer.code), answer.body,
+                                 Http::Mime::MediaType::fromString(answer.contentType));
+            }))
+        {
+            writer->send(Http::Code::Service_Unavailable, "Too many requests are being forwarded");
+        }
+        return true;
+    }
+
+    ///
+    /// @brief Forwards a request of the default pot like forwardToOwner.
+    /// The handlers then read it with withDefaultPot, which answers 404 if
+    /// this instance does not have it either (it was forwarded here by an
+    /// instance which disagrees on its owner).
+    ///
+    /// @returns true if the request was forwarded.
+    ///
+    bool SmartPotEndpoint::forwardDefaultPot(const Rest::Request &request,
+                                             Http::ResponseWriter &response)
+    {
+        return forwardToOwner(defaultPotId, request, response);
+    }
+
+    ///
+    /// @brief Calls @p use with the default pot, under potLock. The pot is
+    /// looked up every time, a reload or a snapshot may hand it over or
+    /// replace it.
+    ///
+    /// @returns true if the pot is not here, the request is then answered
+    /// with a 404.
+    ///
+    bool SmartPotEndpoint::withDefaultPot(const function<void(SmartPot &)> &use,
+                                          Http::ResponseWriter &response)
+    {
+        {
+            Guard guard(potLock);
+            SmartPot *pot = fleet->Get(defaultPotId);
+            if (pot != nullptr)
+            {
+                use(*pot);
+                return false;
+            }
+        }
+        response.send(Http::Code::Not_Found, "Pot " + to_string(defaultPotId) + " was not found");
+        return true;
     }
 
     ///
@@ -180,9 +581,9 @@ namespace pot
     void SmartPotEndpoint::getSetting(const Rest::Request &request,
                                       Http::ResponseWriter response)
     {
-        // Lock the pot settings.
-        // TODO: REVISE THIS.
-        Guard guard(potLock);
+        // The routes without a pot id are those of the default pot.
+        if (forwardDefaultPot(request, response))
+            return;
 
         // Setup some headers for the response.
         using namespace Http;
@@ -195,8 +596,11 @@ namespace pot
 
         // Retrieve the setting value.
         string settingValue = "";
+        int missing = 0;
+        if (withDefaultPot([&](SmartPot &pot) { missing = pot.Get(settingName, settingValue); }, response))
+            return;
         // If it does NOT exist.
-        if (smartPot->Get(settingName, settingValue))
+        if (missing)
         {
             response.send(Http::Code::Not_Found, settingName + " was not found");
         }
@@ -217,9 +621,9 @@ namespace pot
     void SmartPotEndpoint::putSetting(const Rest::Request &request,
                                       Http::ResponseWriter response)
     {
-        // Lock the pot settings.
-        // TODO: REVISE THIS.
-        Guard guard(potLock);
+        // The routes without a pot id are those of the default pot.
+        if (forwardDefaultPot(request, response))
+            return;
 
         // Setup some headers for the response.
         using namespace Http;
@@ -232,9 +636,12 @@ namespace pot
 
         // Retrieve the setting value.
         string settingValue = request.param(":settingName").as<string>();
+        int missing = 0;
+        if (withDefaultPot([&](SmartPot &pot) { missing = pot.Get(settingName, settingValue); }, response))
+            return;
 
         // If it does NOT exist.
-        if (smartPot->Get(settingName, settingValue))
+        if (missing)
         {
             response.send(Http::Code::Not_Found, settingName + " was not found");
         }
@@ -264,34 +671,69 @@ namespace pot
         {
             response.send(Http::Code::Unprocessable_Entity,
                           "The schema is not a valid JSON. Impossible to parse.");
+            return;
+        }
+        if (document.HasMember("potId") && !document["potId"].IsInt())
+        {
+            response.send(Http::Code::Unprocessable_Entity, "potId field shall be an integer.");
+            return;
+        }
+        if (!document.HasMember("sensorType") || !document["sensorType"].IsNumber())
+        {
+            response.send(Http::Code::Unprocessable_Entity, "sensorType field shall be a number.");
+            return;
+        }
+        if (!document.HasMember("min") || !document["min"].IsNumber()
+            || !document.HasMember("max") || !document["max"].IsNumber())
+        {
+            response.send(Http::Code::Unprocessable_Entity, "min and max fields shall be numbers.");
+            return;
+        }
+        if (document.HasMember("nutrientType") && !document["nutrientType"].IsNull()
+            && !document["nutrientType"].IsString())
+        {
+            response.send(Http::Code::Unprocessable_Entity, "nutrientType field shall be a string or null.");
+            return;
         }
         
         string message = "";
 
+        // The pot id is optional, the default pot is used without it.
+        int potId = document.HasMember("potId") ? document["potId"].GetInt() : defaultPotId;
+        if (forwardToOwner(potId, request, response))
+            return;
+        if (fleet->Get(potId) == nullptr)
+        {
+            response.send(Http::Code::Not_Found, "Pot " + to_string(potId) + " was not found");
+            return;
+        }
+
         double sensorTypeID = document["sensorType"].GetDouble();
         double sensorMin = document["min"].GetDouble();
         double sensorMax = document["max"].GetDouble();
 
         // Valoarea o updatam in MQTT.
-        if (document["nutrientType"].IsNull())
+        string sensorName;
+        if (!document.HasMember("nutrientType") || document["nutrientType"].IsNull())
         {
-            Sensor aux = smartPot->GetSensor(sensorNameMap[sensorTypeID]);
-            aux.SetMinValue(sensorMin);
-            aux.SetMaxValue(sensorMax);
-
-            smartPot->Set(sensorNameMap[sensorTypeID], aux);
-            
-            Sensor aux2 = smartPot->GetSensor(sensorNameMap[sensorTypeID]);
+            shared_ptr<const PotConfig> current = atomic_load(&config);
+            auto sensorType = current->SensorTypes().find((int) sensorTypeID);
+            if (sensorType == current->SensorTypes().end())
+            {
+                response.send(Http::Code::Unprocessable_Entity,
+                              "Unknown sensorType " + to_string((int) sensorTypeID));
+                return;
+            }
+            sensorName = sensorType->second;
         }
         else
         {   
-            Sensor aux = smartPot->GetSensor(document["nutrientType"].GetString());
-            aux.SetMinValue(sensorMin);
-            aux.SetMaxValue(sensorMax);
-
-            smartPot->Set(document["nutrientType"].GetString(), aux);
-            
-            Sensor aux2 = smartPot->GetSensor(document["nutrientType"].GetString());
+            sensorName = document["nutrientType"].GetString();
+        }
+        if (fleet->SetThresholds(potId, sensorName, sensorMin, sensorMax))
+        {
+            response.send(Http::Code::Not_Found, sensorName + " was not found");
+            return;
         }
 
         response.send(Http::Code::Ok, message);
@@ -317,29 +759,28 @@ namespace pot
         {
             response.send(Http::Code::Unprocessable_Entity,
                           "The schema is not a valid JSON. Impossible to parse.");
+            return;
         }
 
         string message = "";
 
-        if(!document["species"].IsString())
-        {
-            response.send(Http::Code::Unprocessable_Entity, "species field shall be a string.");
-        }
-        if(!document["color"].IsString())
-        {
-            response.send(Http::Code::Unprocessable_Entity, "color field shall be a string.");
-        }
-        if(!document["type"].IsString())
+        for (const char *field : {"species", "color", "type", "suitableSoilType"})
         {
-            response.send(Http::Code::Unprocessable_Entity, "type field shall be a string.");
+            if (!document.HasMember(field) || !document[field].IsString())
+            {
+                response.send(Http::Code::Unprocessable_Entity, string(field) + " field shall be a string.");
+                return;
+            }
         }
-        if(!document["height"].IsNumber())
+        if (!document.HasMember("height") || !document["height"].IsNumber())
         {
             response.send(Http::Code::Unprocessable_Entity, "height field shall be a double.");
+            return;
         }
-        if(!document["suitableSoilType"].IsString())
+        if (document.HasMember("potId") && !document["potId"].IsInt())
         {
-            response.send(Http::Code::Unprocessable_Entity, "height field shall be a double.");
+            response.send(Http::Code::Unprocessable_Entity, "potId field shall be an integer.");
+            return;
         }
 
         string species = document["species"].GetString();
@@ -349,113 +790,1641 @@ namespace pot
         string suitableSoilType = document["suitableSoilType"].GetString();
 
         message += species + "  " + color + " " + " ";
-        
-        Plant p(species, color, height, type, suitableSoilType);
-        smartPot->SetPlant(p);
+
+        // The pot id is optional, the default pot is used without it.
+        int potId = document.HasMember("potId") ? document["potId"].GetInt() : defaultPotId;
+        if (forwardToOwner(potId, request, response))
+            return;
+
+        Plant p(move(species), move(color), height, move(type), move(suitableSoilType));
+        if (fleet->SetPlant(potId, move(p)))
+        {
+            response.send(Http::Code::Not_Found, "Pot " + to_string(potId) + " was not found");
+            return;
+        }
 
         response.send(Http::Code::Ok, message);
     }
 
+    // A sensor of GET /status?since=, with the version of its latest write.
+    static void writeStatusSensor(Writer<StringBuffer> &writer,
+                                  const ChangeLog::Entry &entry,
+                                  uint64_t version)
+    {
+        const Sensor &sensor = entry.second;
+        writer.Key(entry.first.c_str(), (SizeType) entry.first.size());
+        writer.StartObject();
+        writer.Key("value");
+        if (sensor.IsNumeric())
+            writer.Double(sensor.GetDoubleValue());
+        else
+            writer.String(sensor.GetStringValue().c_str(), (SizeType) sensor.GetStringValue().size());
+        writer.Key("min");      writer.Double(sensor.GetMinValue());
+        writer.Key("max");      writer.Double(sensor.GetMaxValue());
+        writer.Key("stale");    writer.Bool(sensor.IsStale());
+        writer.Key("lastSeen"); writer.Int64(sensor.GetLastSeen());
+        const AnomalyDetector &detector = sensor.GetDetector();
+        if (sensor.IsNumeric() && detector.Kinds() != AnomalyDetector::none)
+        {
+            writer.Key("anomaly"); writer.String(AnomalyDetector::Name(detector.Kinds()));
+            writer.Key("zScore");  writer.Double(detector.ZScore());
+            writer.Key("rate");    writer.Double(detector.RateOfChange());
+        }
+        if (version != 0)
+        {
+            writer.Key("version");
+            writer.Uint64(version);
+        }
+        writer.EndObject();
+    }
+
+    ///
+    /// @brief GET request function which returns the plant and sensors of
+    /// the default pot as text. With a ?since= version (0 for everything),
+    /// it returns in JSON the version of the ?pot= (the default pot
+    /// otherwise) and only the sensors and plant written after ?since=, or
+    /// everything with "full": true when the pot does not remember back to
+    /// that version.
+    ///
     void SmartPotEndpoint::getStatus(const Rest::Request &request,
                                      Http::ResponseWriter response)
     {
+        auto sinceParam = request.query().get("since");
+        if (sinceParam)
+        {
+            getStatusSince(request, strtoull(sinceParam->c_str(), nullptr, 10), response);
+            return;
+        }
+        if (forwardDefaultPot(request, response))
+            return;
+
         string status = "";
-        status += smartPot->DisplayPlantData()
-                + string("\n")
-                + smartPot->DisplayEnvironmentData();
+        {
+            TRACE_SPAN(wait, "status.lockWait");
+            Guard guard(potLock);
+            TRACE_END(wait);
+            const SmartPot *pot = fleet->Get(defaultPotId);
+            if (pot == nullptr)
+            {
+                response.send(Http::Code::Not_Found, "Pot " + to_string(defaultPotId) + " was not found");
+                return;
+            }
+            TRACE_SPAN(build, "status.build");
+            status += pot->DisplayPlantData()
+                    + string("\n")
+                    + pot->DisplayEnvironmentData();
+        }
 
+        TRACE_SPAN(write, "status.write");
         ofstream statusFile("../../status.txt");
         statusFile << status;
+        TRACE_END(write);
         
+        TRACE_SPAN(send, "status.send");
         response.send(Http::Code::Ok, status);
     }
 
+    void SmartPotEndpoint::getStatusSince(const Rest::Request &request,
+                                          uint64_t since,
+                                          Http::ResponseWriter &response)
+    {
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2")
+            .add<Header::ContentType>(MIME(Application, Json));
+
+        auto potParam = request.query().get("pot");
+        int potId = potParam ? atoi(potParam->c_str()) : defaultPotId;
+        if (forwardToOwner(potId, request, response))
+            return;
+
+        StringBuffer buffer;
+        Writer<StringBuffer> writer(buffer);
+        {
+            TRACE_SPAN(wait, "status.lockWait");
+            Guard guard(potLock);
+            TRACE_END(wait);
+            const SmartPot *pot = fleet->Get(potId);
+            if (pot == nullptr)
+            {
+                response.send(Http::Code::Not_Found, "Pot " + to_string(potId) + " was not found");
+                return;
+            }
+
+            TRACE_SPAN(json, "status.json");
+            // The latest write of every sensor changed, the ring holds a
+            // few changes so they are looked up in it.
+            const ChangeLog::Entry *changed[ChangeLog::capacity];
+            uint64_t versions[ChangeLog::capacity];
+            size_t changedCount = 0;
+            bool full = !pot->Changes().Since(since, [&](const ChangeLog::Entry &entry, uint64_t version)
+            {
+                if (find(changed, changed + changedCount, &entry) == changed + changedCount)
+                {
+                    changed[changedCount] = &entry;
+                    versions[changedCount++] = version;
+                }
+            });
+
+            writer.StartObject();
+            writer.Key("pot");      writer.Int(potId);
+            writer.Key("version");  writer.Uint64(pot->Version());
+            writer.Key("full");     writer.Bool(full);
+            if (pot->HasPlant() && (full || pot->PlantVersion() > since))
+            {
+                const Plant &plant = pot->GetPlant();
+                writer.Key("plant");
+                writer.StartObject();
+                writer.Key("species");          writer.String(plant.GetName().c_str());
+                writer.Key("color");            writer.String(plant.GetColor().c_str());
+                writer.Key("height");           writer.Double(plant.GetHeight());
+                writer.Key("type");             writer.String(plant.GetType().c_str());
+                writer.Key("suitableSoilType"); writer.String(plant.GetSoil().c_str());
+                writer.EndObject();
+            }
+            writer.Key("sensors");
+            writer.StartObject();
+            if (full)
+            {
+                for (auto it = pot->GetSensors().begin(); it != pot->GetSensors().end(); ++it)
+                {
+                    for (auto it2 = (it->second).begin(); it2 != (it->second).end(); ++it2)
+                        writeStatusSensor(writer, *it2, 0);
+                }
+            }
+            else
+            {
+                for (size_t i = 0; i < changedCount; ++i)
+                    writeStatusSensor(writer, *changed[i], versions[i]);
+            }
+            writer.EndObject();
+            writer.EndObject();
+        }
+
+        TRACE_SPAN(send, "status.send");
+        response.send(Http::Code::Ok, buffer.GetString());
+    }
+
     void SmartPotEndpoint::shovel(const Rest::Request &request,
                                       Http::ResponseWriter response)
     {
-        response.send(Http::Code::Ok, smartPot->Shovel());
+        if (forwardDefaultPot(request, response))
+            return;
+        string message;
+        // The scheduler thread marks the sensors stale meanwhile.
+        if (withDefaultPot([&message](SmartPot &pot) { message = pot.Shovel(); }, response))
+            return;
+        response.send(Http::Code::Ok, message);
     }
     
     void SmartPotEndpoint::soilStatus(const Rest::Request &request,
                                       Http::ResponseWriter response)
     {
-        response.send(Http::Code::Ok, smartPot->SoilStatus());
+        if (forwardDefaultPot(request, response))
+            return;
+        string message;
+        if (withDefaultPot([&message](SmartPot &pot) { message = pot.SoilStatus(); }, response))
+            return;
+        response.send(Http::Code::Ok, message);
     }
 
     void SmartPotEndpoint::irrigationSoil(const Rest::Request &request,
                                           Http::ResponseWriter response)
     {
-        response.send(Http::Code::Ok, smartPot->IrrigateSoil());
+        if (forwardDefaultPot(request, response))
+            return;
+        string message;
+        if (withDefaultPot([&message](SmartPot &pot) { message = pot.IrrigateSoil(); }, response))
+            return;
+        response.send(Http::Code::Ok, message);
     }
 
     void SmartPotEndpoint::injectMinerals(const Rest::Request &request,
                                           Http::ResponseWriter response)
     {
-        response.send(Http::Code::Ok, smartPot->NutrientsInjector());
+        if (forwardDefaultPot(request, response))
+            return;
+        string message;
+        if (withDefaultPot([&message](SmartPot &pot) { message = pot.NutrientsInjector(); }, response))
+            return;
+        response.send(Http::Code::Ok, message);
     }
 
     void SmartPotEndpoint::activateSolarLamp(const Rest::Request &request,
                                              Http::ResponseWriter response)
     {
-        response.send(Http::Code::Ok, smartPot->SolarLamp());
+        if (forwardDefaultPot(request, response))
+            return;
+        string message;
+        if (withDefaultPot([&message](SmartPot &pot) { message = pot.SolarLamp(); }, response))
+            return;
+        response.send(Http::Code::Ok, message);
     }
 
-    void SmartPotEndpoint::mosquittoOnMessage (struct mosquitto *mosq,
-                                                void *obj,
-                                                const struct mosquitto_message *msg)
-    {   
-        Document document;
-        if (document.Parse((char *) msg->payload).HasParseError() || document.IsObject() == false)
+    ///
+    /// @brief Writes one aggregate as a JSON object.
+    ///
+    static void writeAggregate(Writer<StringBuffer> &writer,
+                               const SensorAggregate &aggregate)
+    {
+        writer.StartObject();
+        writer.Key("count");        writer.Int64(aggregate.GetCount());
+        writer.Key("sum");          writer.Double(aggregate.GetSum());
+        writer.Key("mean");         writer.Double(aggregate.GetMean());
+        writer.Key("min");          writer.Double(aggregate.GetMin());
+        writer.Key("max");          writer.Double(aggregate.GetMax());
+        writer.Key("outOfRange");   writer.Int64(aggregate.GetOutOfRange());
+        writer.Key("p50");          writer.Double(aggregate.GetPercentile(0.5));
+        writer.Key("p90");          writer.Double(aggregate.GetPercentile(0.9));
+        writer.Key("p99");          writer.Double(aggregate.GetPercentile(0.99));
+        writer.EndObject();
+    }
+
+    ///
+    /// @brief GET request function which returns the fleet aggregates per
+    /// sensor kind and per plant type, optionally restricted with the
+    /// ?sensor= and ?plantType= query parameters.
+    ///
+    /// @returns A JSON object, built from the running aggregates so it does
+    /// not depend on the number of pots. The pots declared but not built
+    /// yet are counted in "pots" and "pending", and left out of the
+    /// aggregates until they are built.
+    ///
+    void SmartPotEndpoint::getFleetAggregates(const Rest::Request &request,
+                                              Http::ResponseWriter response)
+    {
+        Guard guard(potLock);
+
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2")
+            .add<Header::ContentType>(MIME(Application, Json));
+
+        auto sensorFilter = request.query().get("sensor");
+        auto plantTypeFilter = request.query().get("plantType");
+
+        const FleetAggregates &aggregates = fleet->Aggregates();
+
+        StringBuffer buffer;
+        Writer<StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("pots");
+        writer.Uint64(fleet->Size());
+        writer.Key("pending");
+        writer.Uint64(fleet->Pending());
+        writer.Key("staleSensors");
+        writer.Uint64(fleet->StaleCount());
+
+        writer.Key("sensors");
+        writer.StartObject();
+        for (auto it = aggregates.BySensor().begin(); it != aggregates.BySensor().end(); ++it)
         {
-            return ;
+            if (it->second.GetCount() == 0 || (sensorFilter && *sensorFilter != it->first))
+                continue;
+            writer.Key(it->first.c_str());
+            writeAggregate(writer, it->second);
         }
+        writer.EndObject();
 
-        string message = "";
+        writer.Key("plantTypes");
+        writer.StartObject();
+        for (auto it = aggregates.ByPlantType().begin(); it != aggregates.ByPlantType().end(); ++it)
+        {
+            if (plantTypeFilter && *plantTypeFilter != it->first)
+                continue;
+            writer.Key(it->first.c_str());
+            writer.StartObject();
+            for (auto it2 = it->second.begin(); it2 != it->second.end(); ++it2)
+            {
+                if (it2->second.GetCount() == 0 || (sensorFilter && *sensorFilter != it2->first))
+                    continue;
+                writer.Key(it2->first.c_str());
+                writeAggregate(writer, it2->second);
+            }
+            writer.EndObject();
+        }
+        writer.EndObject();
+        writer.EndObject();
 
-        double sensorTypeID = document["sensorType"].GetDouble();
+        response.send(Http::Code::Ok, buffer.GetString());
+    }
+
+    ///
+    /// @brief GET request function which lists every pot whose soil type
+    /// does not suit its plant, grouped by (suitable, actual) soil type and
+    /// optionally restricted with the ?suitableSoilType= query parameter.
+    ///
+    /// @returns A JSON object, read from the soil index so it costs as much
+    /// as the answer and not as the fleet. The pots not built yet, counted
+    /// in "pending", are not in the index.
+    ///
+    void SmartPotEndpoint::getIncompatibleSoil(const Rest::Request &request,
+                                               Http::ResponseWriter response)
+    {
+        Guard guard(potLock);
+
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2")
+            .add<Header::ContentType>(MIME(Application, Json));
 
-        string nutrientType = document["nutrientType"].IsNull() ? "" : document["nutrientType"].GetString();
+        auto suitableFilter = request.query().get("suitableSoilType");
 
-        
-        message += string("Senzorul ") + sensorNameMap[sensorTypeID] + " " +  nutrientType;
-        
-        if(document["value"].IsNumber())
+        const SoilIndex &soils = fleet->Soils();
+
+        StringBuffer buffer;
+        Writer<StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("count");
+        writer.Uint64(soils.IncompatibleCount());
+        writer.Key("pending");
+        writer.Uint64(fleet->Pending());
+
+        writer.Key("groups");
+        writer.StartArray();
+        auto it = suitableFilter ? soils.Incompatible().lower_bound(SoilIndex::SoilPair(*suitableFilter, ""))
+                                 : soils.Incompatible().begin();
+        for (; it != soils.Incompatible().end(); ++it)
         {
-            Sensor aux = smartPot->GetSensor(document["nutrientType"].IsNull() 
-                                            ? sensorNameMap[sensorTypeID] : nutrientType);
-            aux.SetValue(document["value"].GetDouble());
-            smartPot->Set(document["nutrientType"].IsNull() ? sensorNameMap[sensorTypeID] : nutrientType, aux);
+            if (suitableFilter && *suitableFilter != it->first.first)
+                break;
+            writer.StartObject();
+            writer.Key("suitableSoilType");
+            writer.String(it->first.first.c_str());
+            writer.Key("soilType");
+            writer.String(it->first.second.c_str());
+            writer.Key("pots");
+            writer.StartArray();
+            for (int potId : it->second)
+                writer.Int(potId);
+            writer.EndArray();
+            writer.EndObject();
+        }
+        writer.EndArray();
+        writer.EndObject();
+
+        response.send(Http::Code::Ok, buffer.GetString());
+    }
 
-            message += string(" ") + (document["nutrientType"].IsNull() ? "NULL" : nutrientType);
-            message += string(" ") + to_string(document["value"].GetDouble());
+    // Decodes the %XX escapes and the '+' of a query parameter.
+    static string decodeQueryParameter(const string &value)
+    {
+        string decoded;
+        decoded.reserve(value.size());
+        for (size_t i = 0; i < value.size(); ++i)
+        {
+            if (value[i] == '+')
+                decoded += ' ';
+            else if (value[i] == '%' && i + 2 < value.size() && isxdigit(value[i + 1]) && isxdigit(value[i + 2]))
+            {
+                decoded += (char) strtol(value.substr(i + 1, 2).c_str(), nullptr, 16);
+                i += 2;
+            }
+            else
+                decoded += value[i];
         }
-        else if(document["value"].IsString())
+        return decoded;
+    }
+
+    ///
+    /// @brief GET request function which lists the pots matching the
+    /// ?where= expression (see FleetQuery.hpp), at most ?limit= of them in
+    /// pot id order, with the number of matching pots. The pots not built
+    /// yet, counted in "pending", are not matched until they are built.
+    ///
+    void SmartPotEndpoint::getFleetQuery(const Rest::Request &request,
+                                         Http::ResponseWriter response)
+    {
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2")
+            .add<Header::ContentType>(MIME(Application, Json));
+
+        auto whereParam = request.query().get("where");
+        auto limitParam = request.query().get("limit");
+        if (!whereParam)
         {
-            Sensor aux = smartPot->GetSensor(document["nutrientType"].IsNull() 
-                                            ? sensorNameMap[sensorTypeID] : nutrientType);
-            aux.SetValue(document["value"].GetString());
-            smartPot->Set(document["nutrientType"].IsNull() ? sensorNameMap[sensorTypeID] : nutrientType, aux);
+            response.send(Http::Code::Unprocessable_Entity, "The where parameter is missing.");
+            return;
+        }
+        size_t limit = limitParam ? strtoul(limitParam->c_str(), nullptr, 10) : defaultQueryLimit;
+        limit = min(limit, maxPotsLimit);
 
-            message += string(" ") + (document["nutrientType"].IsNull() ? "NULL" : nutrientType);
-            message += string(" ") + document["value"].GetString();
+        // Compiled without the lock, and only once per text.
+        string error;
+        shared_ptr<const FleetQuery> query = queries.Get(decodeQueryParameter(*whereParam), error);
+        if (query == nullptr)
+        {
+            response.send(Http::Code::Unprocessable_Entity, "Invalid where expression: " + error);
+            return;
         }
 
-        mosquitto_publish(mosq, NULL, "test/response", 100, message.c_str(), 0, false);
+        vector<int> potIds;
+        size_t count, pending;
+        {
+            Guard guard(potLock);
+            // The query runs on the columns of the built pots only.
+            count = query->Run(fleet->Columns(), [&potIds](int potId) { potIds.push_back(potId); });
+            pending = fleet->Pending();
+        }
+        sort(potIds.begin(), potIds.end());
+        if (potIds.size() > limit)
+            potIds.resize(limit);
+
+        StringBuffer buffer;
+        Writer<StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("count");
+        writer.Uint64(count);
+        writer.Key("pending");
+        writer.Uint64(pending);
+        writer.Key("pots");
+        writer.StartArray();
+        for (int potId : potIds)
+            writer.Int(potId);
+        writer.EndArray();
+        writer.EndObject();
+
+        response.send(Http::Code::Ok, buffer.GetString());
+    }
+
+    ///
+    /// @brief GET request function which returns the readings of the
+    /// ?sensor= of the ?pot= (the default pot otherwise) taken between
+    /// ?from= and ?to= (seconds since the epoch, the whole history
+    /// otherwise): at most ?limit= samples, or with a ?step= (in seconds)
+    /// the count, min, max and mean of the readings of every step.
+    ///
+    void SmartPotEndpoint::getHistory(const Rest::Request &request,
+                                      Http::ResponseWriter response)
+    {
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2")
+            .add<Header::ContentType>(MIME(Application, Json));
+
+        auto potParam = request.query().get("pot");
+        auto sensorParam = request.query().get("sensor");
+        auto fromParam = request.query().get("from");
+        auto toParam = request.query().get("to");
+        auto stepParam = request.query().get("step");
+        auto limitParam = request.query().get("limit");
+        if (!sensorParam)
+        {
+            response.send(Http::Code::Unprocessable_Entity, "The sensor parameter is missing.");
+            return;
+        }
+        int potId = potParam ? atoi(potParam->c_str()) : defaultPotId;
+        if (forwardToOwner(potId, request, response))
+            return;
+        int64_t from = fromParam ? strtoll(fromParam->c_str(), nullptr, 10) : INT64_MIN;
+        int64_t to = toParam ? strtoll(toParam->c_str(), nullptr, 10) : INT64_MAX;
+        int64_t step = stepParam ? strtoll(stepParam->c_str(), nullptr, 10) : 0;
+        size_t limit = limitParam ? strtoul(limitParam->c_str(), nullptr, 10) : defaultHistoryLimit;
+        limit = min(limit, maxHistoryLimit);
+        if (stepParam && step <= 0)
+        {
+            response.send(Http::Code::Unprocessable_Entity, "step shall be a positive number of seconds.");
+            return;
+        }
+        if (stepParam && !fromParam)
+        {
+            response.send(Http::Code::Unprocessable_Entity, "A step needs a from parameter.");
+            return;
+        }
+
+        vector<SensorHistory::Sample> samples;
+        vector<SensorHistory::Bucket> buckets;
+        {
+            Guard guard(potLock);
+            if (fleet->Get(potId) == nullptr)
+            {
+                response.send(Http::Code::Not_Found, "Pot " + to_string(potId) + " was not found");
+                return;
+            }
+            if (step > 0)
+                fleet->History().Aggregate(potId, *sensorParam, from, to, step, buckets);
+            else
+                fleet->History().Range(potId, *sensorParam, from, to, limit, samples);
+        }
+
+        StringBuffer buffer;
+        Writer<StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("pot");
+        writer.Int(potId);
+        writer.Key("sensor");
+        writer.String(sensorParam->c_str());
+        if (step > 0)
+        {
+            writer.Key("buckets");
+            writer.StartArray();
+            for (const SensorHistory::Bucket &bucket : buckets)
+            {
+                writer.StartObject();
+                writer.Key("start"); writer.Int64(bucket.start);
+                writer.Key("count"); writer.Uint64(bucket.count);
+                writer.Key("min");   writer.Double(bucket.min);
+                writer.Key("max");   writer.Double(bucket.max);
+                writer.Key("mean");  writer.Double(bucket.sum / bucket.count);
+                writer.EndObject();
+            }
+            writer.EndArray();
+        }
+        else
+        {
+            // [time, value] pairs, in time order.
+            writer.Key("samples");
+            writer.StartArray();
+            for (const SensorHistory::Sample &sample : samples)
+            {
+                writer.StartArray();
+                writer.Int64(sample.time);
+                writer.Double(sample.value);
+                writer.EndArray();
+            }
+            writer.EndArray();
+        }
+        writer.EndObject();
+
+        response.send(Http::Code::Ok, buffer.GetString());
+    }
+
+    ///
+    /// @brief GET request function which lists a page of pots, from the
+    /// ?cursor= given by the previous page, at most ?limit= of them, with
+    /// only the ?fields= (sensor names and "plant") asked for. The page is
+    /// streamed in chunks, compressed with gzip or deflate if the
+    /// Accept-Encoding header allows it, and the lock is released between
+    /// the chunks.
+    ///
+    void SmartPotEndpoint::getPots(const Rest::Request &request,
+                                   Http::ResponseWriter response)
+    {
+        using namespace Http;
+
+        auto cursorParam = request.query().get("cursor");
+        auto limitParam = request.query().get("limit");
+        auto fieldsParam = request.query().get("fields");
+        int cursor = cursorParam ? atoi(cursorParam->c_str()) : 0;
+        size_t limit = limitParam ? strtoul(limitParam->c_str(), nullptr, 10) : defaultPotsLimit;
+        limit = min(limit, maxPotsLimit);
+
+        auto acceptEncoding = request.headers().tryGetRaw("Accept-Encoding");
+        ChunkCompressor::Encoding encoding = acceptEncoding
+            ? ChunkCompressor::Negotiate(acceptEncoding->value())
+            : ChunkCompressor::identity;
+
+        response.headers()
+            .add<Header::Server>("pistache/0.2")
+            .add<Header::ContentType>(MIME(Application, Json));
+        if (encoding != ChunkCompressor::identity)
+        {
+            response.headers().addRaw(Header::Raw("Content-Encoding", ChunkCompressor::Name(encoding)));
+        }
+        response.headers().addRaw(Header::Raw("Vary", "Accept-Encoding"));
+
+        PotListing listing(cursor, limit, fieldsParam ? *fieldsParam : string(), encoding);
+        auto stream = response.stream(Http::Code::Ok);
+        string chunk;
+        bool more = true;
+        while (more)
+        {
+            {
+                Guard guard(potLock);
+                more = listing.Next(*fleet, potsChunkPots, chunk);
+            }
+            stream.write(chunk.data(), chunk.size());
+            stream.flush();
+            chunk.clear();
+        }
+        stream.ends();
+    }
+
+    ///
+    /// @brief GET request function which returns the counters of the MQTT
+    /// ingest: the messages applied, the ones dropped because their pot was
+    /// over its rate, the ones coalesced under overload and, of those, the
+    /// ones replaced by a newer reading before being applied.
+    ///
+    void SmartPotEndpoint::getIngestStats(const Rest::Request &request,
+                                          Http::ResponseWriter response)
+    {
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2")
+            .add<Header::ContentType>(MIME(Application, Json));
+
+        StringBuffer buffer;
+        Writer<StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("accepted");     writer.Uint64(limiter->Accepted());
+        writer.Key("rateLimited");  writer.Uint64(limiter->Dropped());
+        writer.Key("coalesced");    writer.Uint64(limiter->Coalesced());
+        writer.Key("superseded");   writer.Uint64(ingest->Superseded());
+        writer.Key("pending");      writer.Uint64(ingest->Pending());
+        writer.EndObject();
+
+        response.send(Http::Code::Ok, buffer.GetString());
+    }
+
+    ///
+    /// @brief GET request function which streams a binary snapshot of every
+    /// pot (see Snapshot.hpp) with chunked transfer encoding. The snapshot is
+    /// encoded a few pots at a time, so it is never held in memory and the
+    /// updates are only blocked while a chunk is encoded.
+    ///
+    void SmartPotEndpoint::getSnapshot(const Rest::Request &request,
+                                       Http::ResponseWriter response)
+    {
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2")
+            .add<Header::ContentType>(MIME(Application, OctetStream));
+
+        auto stream = response.stream(Http::Code::Ok);
+
+        string chunk;
+        Snapshot::WriteHeader(chunk);
+        uint64_t potCount = 0;
+        int nextPotId = 0;
+        while (nextPotId >= 0)
+        {
+            {
+                Guard guard(potLock);
+                nextPotId = fleet->ForEachFrom(nextPotId, snapshotChunkPots,
+                    [&chunk, &potCount](int potId, const SmartPot &pot)
+                    {
+                        Snapshot::WritePot(chunk, potId, pot);
+                        potCount++;
+                    });
+            }
+            if (nextPotId < 0)
+            {
+                Snapshot::WriteEnd(chunk, potCount);
+            }
+
+            stream.write(chunk.data(), chunk.size());
+            stream.flush();
+            chunk.clear();
+        }
+        stream.ends();
+    }
+
+    // Seconds of the steady clock, for the snapshot uploads.
+    static int64_t steadySeconds()
+    {
+        return chrono::duration_cast<chrono::seconds>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    ///
+    /// @brief Adds the pots staged by @p upload, or replaces the pots with
+    /// the same id, or merges them with those for a hand over (see
+    /// Fleet::Merge). They are read back a chunk at a time, bound as the
+    /// pots built here without the lock, then put under it.
+    ///
+    /// @returns 0 on success, 1 if the staged pots could not be read (see
+    /// @p error), in which case the pots of the chunks before are loaded.
+    ///
+    int SmartPotEndpoint::loadPots(SnapshotUpload &upload,
+                                   size_t &loaded,
+                                   string &error)
+    {
+        shared_ptr<const PotConfig> current = atomic_load(&config);
+        vector<pair<int, SmartPot>> chunk;
+        auto put = [&]()
+            {
+                Guard guard(potLock);
+                for (pair<int, SmartPot> &pot : chunk)
+                {
+                    if (upload.Merging())
+                        fleet->Merge(pot.first, move(pot.second));
+                    else
+                        fleet->Put(pot.first, move(pot.second));
+                }
+                loaded += chunk.size();
+                chunk.clear();
+            };
+
+        loaded = 0;
+        int failed = upload.Load([&](int potId, SmartPot &&pot)
+            {
+                current->Rebind(potId, pot);
+                chunk.emplace_back(potId, move(pot));
+                if (chunk.size() == snapshotChunkPots)
+                    put();
+            });
+        put();
+        if (failed)
+            error = upload.Error();
+        return failed;
+    }
+
+    // Answers a part refused by @p upload: 413 if it is over the bytes
+    // staged, 422 if the snapshot is invalid, 500 if it cannot be staged.
+    static void refuseSnapshot(const SnapshotUpload &upload,
+                               Http::ResponseWriter &response)
+    {
+        response.send(upload.TooLarge() ? Http::Code::Payload_Too_Large
+                      : upload.Invalid() ? Http::Code::Unprocessable_Entity
+                      : Http::Code::Internal_Server_Error, upload.Error());
+    }
+
+    ///
+    /// @brief PUT request function which loads a binary snapshot made by
+    /// GET /snapshot, small enough for one request (bigger ones are
+    /// uploaded in parts, see postSnapshotUpload). Every pot of the
+    /// snapshot is added, or replaces the pot with the same id.
+    ///
+    /// @returns The number of pots loaded, 422 if the snapshot is invalid
+    /// or truncated, in which case no pot is loaded, or 500 if it could not
+    /// be staged.
+    ///
+    void SmartPotEndpoint::putSnapshot(const Rest::Request &request,
+                                       Http::ResponseWriter response)
+    {
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2")
+            .add<Header::ContentType>(MIME(Text, Plain));
+
+        // Decoded without the lock, the pots are only loaded once they all
+        // are.
+        const string &body = request.body();
+        SnapshotUpload upload(steadySeconds(), maxSnapshotUploadBytes);
+        if (upload.Open(stagingDirectory) || upload.Feed(body.data(), body.size(), steadySeconds()))
+        {
+            refuseSnapshot(upload, response);
+            return;
+        }
+        if (!upload.Done())
+        {
+            response.send(Http::Code::Unprocessable_Entity, "The snapshot is truncated.");
+            return;
+        }
+        size_t loaded;
+        string error;
+        if (loadPots(upload, loaded, error))
+        {
+            response.send(Http::Code::Internal_Server_Error, error);
+            return;
+        }
+        response.send(Http::Code::Ok, to_string(loaded) + " pots loaded");
+    }
+
+    ///
+    /// @brief POST request function which starts the upload of a snapshot
+    /// in parts, each one sent with PUT /snapshot/uploads/:uploadId. The
+    /// instances of a cluster hand their pots over with it, whoever owns
+    /// them, with ?merge=true: the sensors read here since are kept (see
+    /// Fleet::Merge).
+    ///
+    /// @returns 201 and the id of the upload, 503 if too many snapshots
+    /// are being uploaded, or 500 if its pots cannot be staged.
+    ///
+    void SmartPotEndpoint::postSnapshotUpload(const Rest::Request &request,
+                                              Http::ResponseWriter response)
+    {
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2")
+            .add<Header::ContentType>(MIME(Application, Json));
+
+        auto mergeParam = request.query().get("merge");
+        bool merging = mergeParam && *mergeParam == "true";
+
+        int64_t now = steadySeconds();
+        uint64_t id;
+        {
+            Guard guard(uploadLock);
+            // The uploads given up by their client make room.
+            for (auto it = uploads.begin(); it != uploads.end(); )
+            {
+                if (now - it->second.Touched() > snapshotUploadTimeoutSeconds)
+                    it = uploads.erase(it);
+                else
+                    ++it;
+            }
+            if (uploads.size() >= maxSnapshotUploads)
+            {
+                response.send(Http::Code::Service_Unavailable, "Too many snapshots are being uploaded");
+                return;
+            }
+            SnapshotUpload upload(now, maxSnapshotUploadBytes, merging);
+            if (upload.Open(stagingDirectory))
+            {
+                response.send(Http::Code::Internal_Server_Error, upload.Error());
+                return;
+            }
+            id = nextUploadId++;
+            uploads.emplace(id, move(upload));
+        }
+        response.send(Http::Code::Created, "{\"upload\":" + to_string(id) + "}");
+    }
+
+    ///
+    /// @brief PUT request function which adds the body, the next part of a
+    /// snapshot, to the upload :uploadId. The pots are decoded as the
+    /// parts come and staged on disk, they are only loaded once the last
+    /// part is there.
+    ///
+    /// @returns 202 with the number of pots received while the snapshot is
+    /// incomplete, 200 with the number of pots loaded after the last part,
+    /// 404 if there is no such upload, 413 if the upload or all of them
+    /// would stage too many bytes, 422 if the snapshot is invalid, or 500
+    /// if it cannot be staged. The upload is dropped on error and no pot is
+    /// loaded.
+    ///
+    void SmartPotEndpoint::putSnapshotUpload(const Rest::Request &request,
+                                             Http::ResponseWriter response)
+    {
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2")
+            .add<Header::ContentType>(MIME(Text, Plain));
+
+        string uploadId = request.param(":uploadId").as<string>();
+        const string &body = request.body();
+        map<uint64_t, SnapshotUpload>::node_type done;
+        {
+            Guard guard(uploadLock);
+            auto it = uploads.find(strtoull(uploadId.c_str(), nullptr, 10));
+            if (it == uploads.end())
+            {
+                response.send(Http::Code::Not_Found, "Upload " + uploadId + " was not found");
+                return;
+            }
+            uint64_t stagedBytes = body.size();
+            for (const auto &upload : uploads)
+                stagedBytes += upload.second.StagedBytes();
+            if (stagedBytes > maxSnapshotStagedBytes)
+            {
+                uploads.erase(it);
+                response.send(Http::Code::Payload_Too_Large,
+                              "The snapshots being uploaded are larger than "
+                              + to_string(maxSnapshotStagedBytes) + " bytes.");
+                return;
+            }
+            SnapshotUpload &upload = it->second;
+            if (upload.Feed(body.data(), body.size(), steadySeconds()))
+            {
+                refuseSnapshot(upload, response);
+                uploads.erase(it);
+                return;
+            }
+            if (!upload.Done())
+            {
+                response.send(Http::Code::Accepted, to_string(upload.Staged()) + " pots received");
+                return;
+            }
+            done = uploads.extract(it);
+        }
+        size_t loaded;
+        string error;
+        if (loadPots(done.mapped(), loaded, error))
+        {
+            response.send(Http::Code::Internal_Server_Error, error);
+            return;
+        }
+        response.send(Http::Code::Ok, to_string(loaded) + " pots loaded");
+    }
+
+    ///
+    /// @brief DELETE request function which gives up the upload
+    /// :uploadId, none of its pots is loaded.
+    ///
+    void SmartPotEndpoint::deleteSnapshotUpload(const Rest::Request &request,
+                                                Http::ResponseWriter response)
+    {
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2")
+            .add<Header::ContentType>(MIME(Text, Plain));
+
+        string uploadId = request.param(":uploadId").as<string>();
+        {
+            Guard guard(uploadLock);
+            if (uploads.erase(strtoull(uploadId.c_str(), nullptr, 10)) == 0)
+            {
+                response.send(Http::Code::Not_Found, "Upload " + uploadId + " was not found");
+                return;
+            }
+        }
+        response.send(Http::Code::Ok, "Upload " + uploadId + " deleted");
+    }
+
+    ///
+    /// @brief GET request function which lists the scheduled jobs, of the
+    /// pot given by ?potId= or of every pot, at most ?limit= of them.
+    ///
+    /// @returns A JSON array of jobs, in id order.
+    ///
+    void SmartPotEndpoint::getSchedules(const Rest::Request &request,
+                                        Http::ResponseWriter response)
+    {
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2")
+            .add<Header::ContentType>(MIME(Application, Json));
+
+        auto potIdFilter = request.query().get("potId");
+        auto limitParam = request.query().get("limit");
+        int potId = potIdFilter ? atoi(potIdFilter->c_str()) : -1;
+        // The jobs of a pot are kept by its owner, without a pot only those
+        // of this instance are listed.
+        if (potIdFilter && forwardToOwner(potId, request, response))
+            return;
+        size_t limit = limitParam ? strtoul(limitParam->c_str(), nullptr, 10) : defaultScheduleLimit;
+
+        vector<Scheduler::Job> jobs = scheduler->List(potId, limit);
+
+        StringBuffer buffer;
+        Writer<StringBuffer> writer(buffer);
+        writer.StartArray();
+        for (const Scheduler::Job &job : jobs)
+        {
+            writer.StartObject();
+            writer.Key("id");           writer.Uint64(job.id);
+            writer.Key("potId");        writer.Int(job.potId);
+            writer.Key("action");       writer.String(Scheduler::ActionName(job.action));
+            writer.Key("at");           writer.Int64(job.first);
+            writer.Key("every");        writer.Int64(job.period);
+            writer.Key("count");        writer.Uint(job.count);
+            writer.Key("runs");         writer.Uint(job.runs);
+            writer.Key("next");         writer.Int64(job.next);
+            writer.Key("lastResult");   writer.String(job.lastResult.c_str());
+            writer.EndObject();
+        }
+        writer.EndArray();
+
+        response.send(Http::Code::Ok, buffer.GetString());
+    }
+
+    ///
+    /// @brief POST request function which schedules an actuator job, e.g.
+    /// {"potId": 3, "action": "irrigateSoil", "at": 1700028000, "every": 86400}.
+    ///
+    /// @returns 201 and the id of the job, or 422 if the job is invalid.
+    ///
+    void SmartPotEndpoint::postSchedule(const Rest::Request &request,
+                                        Http::ResponseWriter response)
+    {
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2")
+            .add<Header::ContentType>(MIME(Application, Json));
+
+        Document document;
+        if (document.Parse(request.body().c_str()).HasParseError() || document.IsObject() == false)
+        {
+            response.send(Http::Code::Unprocessable_Entity,
+                          "The schema is not a valid JSON. Impossible to parse.");
+            return;
+        }
+
+        Scheduler::Job job;
+        job.potId = defaultPotId;
+        if (document.HasMember("potId"))
+        {
+            if (!document["potId"].IsInt())
+            {
+                response.send(Http::Code::Unprocessable_Entity, "potId field shall be an integer.");
+                return;
+            }
+            job.potId = document["potId"].GetInt();
+        }
+        if (forwardToOwner(job.potId, request, response))
+            return;
+        if (!document.HasMember("action") || !document["action"].IsString()
+            || (job.action = Scheduler::ActionFromName(document["action"].GetString())) == Scheduler::actionCount)
+        {
+            response.send(Http::Code::Unprocessable_Entity,
+                          "action field shall be irrigateSoil, injectMinerals, activateSolarLamp or shovel.");
+            return;
+        }
+        if (document.HasMember("at") && !document["at"].IsInt64())
+        {
+            response.send(Http::Code::Unprocessable_Entity, "at field shall be a time in seconds since the epoch.");
+            return;
+        }
+        if (document.HasMember("every") && (!document["every"].IsInt64() || document["every"].GetInt64() < 0))
+        {
+            response.send(Http::Code::Unprocessable_Entity, "every field shall be a positive number of seconds.");
+            return;
+        }
+        if (document.HasMember("count") && !document["count"].IsUint())
+        {
+            response.send(Http::Code::Unprocessable_Entity, "count field shall be a positive integer.");
+            return;
+        }
+        // Without a time the job runs right away.
+        job.first = document.HasMember("at") ? document["at"].GetInt64() : 0;
+        job.period = document.HasMember("every") ? document["every"].GetInt64() : 0;
+        job.count = document.HasMember("count") ? document["count"].GetUint() : 0;
+
+        uint64_t id = scheduler->Add(move(job));
+        if (id == 0)
+        {
+            response.send(Http::Code::Unprocessable_Entity, "Invalid job.");
+            return;
+        }
+        response.send(Http::Code::Created, "{\"id\":" + to_string(id) + "}");
+    }
+
+    ///
+    /// @brief DELETE request function which cancels the job :scheduleId.
+    ///
+    void SmartPotEndpoint::deleteSchedule(const Rest::Request &request,
+                                          Http::ResponseWriter response)
+    {
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2")
+            .add<Header::ContentType>(MIME(Text, Plain));
+
+        string scheduleId = request.param(":scheduleId").as<string>();
+        if (scheduler->Remove(strtoull(scheduleId.c_str(), nullptr, 10)))
+        {
+            response.send(Http::Code::Not_Found, "Schedule " + scheduleId + " was not found");
+            return;
+        }
+        response.send(Http::Code::Ok, "Schedule " + scheduleId + " deleted");
+    }
+
+    ///
+    /// @brief Reloads the pots configuration: the new one is loaded aside,
+    /// then published at once, so a request or a MQTT message sees either
+    /// the old or the new configuration and nothing waits for the load.
+    /// The pots already built then take their new plant and thresholds, a
+    /// chunk at a time, and the pots new to the configuration are declared.
+    /// Pots missing from the new configuration are kept.
+    ///
+    /// The cluster file is loaded again too: the pots this instance no
+    /// longer owns are handed over to their new owner, and those it now
+    /// owns are declared, their former owner sends them over.
+    ///
+    /// @returns 0 on success, 1 if the configuration or the cluster could
+    /// not be loaded, in which case the current ones stay, or if some pots
+    /// could not be handed over, in which case they are kept.
+    ///
+    int SmartPotEndpoint::reload(string &message)
+    {
+        int failed;
+        {
+            // Reloads run one at a time.
+            Guard reloading(reloadLock);
+            failed = applyReload(message);
+        }
+        Guard guard(reloadStatusLock);
+        reloadMessage = message;
+        reloadFailed = failed;
+        return failed;
+    }
+
+    ///
+    /// @brief Runs reload on a thread of its own, so the HTTP requests are
+    /// served meanwhile (a handover waits on the other instances).
+    ///
+    /// @returns false if the reload started before is still running.
+    ///
+    bool SmartPotEndpoint::reloadInBackground(void)
+    {
+        if (reloadRunning.exchange(true))
+            return false;
+        // The thread of the previous reload is done.
+        if (reloadThread.joinable())
+            reloadThread.join();
+        reloadThread = thread([this]()
+            {
+                string message;
+                reload(message);
+                std::cout << message << endl;
+                reloadRunning = false;
+            });
+        return true;
+    }
+
+    int SmartPotEndpoint::applyReload(string &message)
+    {
+        string error;
+        shared_ptr<const PotConfig> loaded = loadConfig(configPath, error);
+        if (loaded == nullptr)
+        {
+            message = "Could not load the pots configuration: " + error;
+            return 1;
+        }
+        shared_ptr<const Cluster> members = loadCluster(clusterPath, error);
+        if (members == nullptr)
+        {
+            message = "Could not load the cluster: " + error;
+            return 1;
+        }
+        atomic_store(&config, loaded);
+        ingest->SetSensorNames(sensorNamesOf(loaded));
+        // The requests and messages of the pots moving go to their new
+        // owner from now on.
+        atomic_store(&cluster, members);
+
+        size_t handedOff = 0;
+        int failed = handOff(*members, handedOff, error);
+
+        vector<int> potIds = loaded->PotIds();
+        size_t owned = 0;
+        size_t declared = 0;
+        for (size_t start = 0; start < potIds.size(); start += reloadChunkPots)
+        {
+            Guard guard(potLock);
+            size_t end = min(potIds.size(), start + reloadChunkPots);
+            for (size_t i = start; i < end; ++i)
+            {
+                if (!members->Owns(potIds[i]))
+                    continue;
+                owned++;
+                if (fleet->Declare(potIds[i]) == 0)
+                    declared++;
+                else if (!fleet->IsDeclared(potIds[i]))
+                    fleet->Reconfigure(potIds[i], loaded->Build(potIds[i]));
+            }
+        }
+        message = "Reloaded " + to_string(owned) + " pots, "
+                + to_string(declared) + " of them new";
+        if (members->IsClustered())
+            message += ", " + to_string(handedOff) + " handed over to other instances";
+        if (failed)
+            message += ", " + error;
+        return failed;
+    }
+
+    ///
+    /// @brief Sends the pots this instance does not own in @p current to
+    /// their owner, as PUT /snapshot requests of a few megabytes, and
+    /// removes them once their owner has them. The pots are encoded a
+    /// chunk at a time, as GET /snapshot does. The declared pots which
+    /// were never built are only removed, their owner builds them from
+    /// the same configuration.
+    ///
+    /// @returns 0 on success, 1 if an owner could not take its pots, which
+    /// are kept here (see @p error), the next reload tries again.
+    ///
+    int SmartPotEndpoint::handOff(const Cluster &current,
+                                  size_t &handedOff,
+                                  string &error)
+    {
+        if (!current.IsClustered())
+            return 0;
+
+        vector<int> potIds = atomic_load(&config)->PotIds();
+        for (size_t start = 0; start < potIds.size(); start += reloadChunkPots)
+        {
+            Guard guard(potLock);
+            size_t end = min(potIds.size(), start + reloadChunkPots);
+            for (size_t i = start; i < end; ++i)
+            {
+                if (fleet->IsDeclared(potIds[i]) && !current.Owns(potIds[i]))
+                    fleet->Remove(potIds[i]);
+            }
+        }
+
+        // The snapshot and the pots of every new owner, until sent.
+        struct Batch
+        {
+            string snapshot;
+            vector<int> potIds;
+            bool failed = false;
+        };
+        map<string, Batch> batches;
+        auto send = [&](const string &owner, Batch &batch)
+        {
+            Snapshot::WriteEnd(batch.snapshot, batch.potIds.size());
+            string reason;
+            if (sendSnapshot(owner, batch.snapshot, reason))
+            {
+                batch.failed = true;
+                error = "could not hand pots over to " + owner + ": " + reason;
+            }
+            else
+            {
+                Guard guard(potLock);
+                for (int potId : batch.potIds)
+                    fleet->Remove(potId);
+                handedOff += batch.potIds.size();
+            }
+            batch.snapshot.clear();
+            batch.potIds.clear();
+        };
+
+        int nextPotId = 0;
+        while (nextPotId >= 0)
+        {
+            {
+                Guard guard(potLock);
+                nextPotId = fleet->ForEachFrom(nextPotId, snapshotChunkPots,
+                    [&current, &batches](int potId, const SmartPot &pot)
+                    {
+                        if (current.Owns(potId) || current.Owner(potId).empty())
+                            return;
+                        Batch &batch = batches[current.Owner(potId)];
+                        if (batch.failed)
+                            return;
+                        if (batch.snapshot.empty())
+                            Snapshot::WriteHeader(batch.snapshot);
+                        Snapshot::WritePot(batch.snapshot, potId, pot);
+                        batch.potIds.push_back(potId);
+                    });
+            }
+            for (auto &entry : batches)
+            {
+                if (entry.second.snapshot.size() >= handOffBatchBytes)
+                    send(entry.first, entry.second);
+            }
+        }
+
+        int failed = 0;
+        for (auto &entry : batches)
+        {
+            if (!entry.second.potIds.empty())
+                send(entry.first, entry.second);
+            failed |= entry.second.failed ? 1 : 0;
+        }
+        return failed;
+    }
+
+    ///
+    /// @brief Uploads @p snapshot to the instance @p peer, in parts sent to
+    /// its snapshot port (see Cluster::SnapshotAddress), whose request size
+    /// limit fits them. The pots are only loaded by @p peer once it has
+    /// every part, and merged with the readings it got since it owns them.
+    ///
+    /// @returns 0 once @p peer loaded the pots, 1 otherwise (see @p error).
+    ///
+    int SmartPotEndpoint::sendSnapshot(const string &peer,
+                                       const string &snapshot,
+                                       string &error)
+    {
+        string address = Cluster::SnapshotAddress(peer);
+        PeerClient::Response answer;
+        if (peers->Send(address, "POST", "/snapshot/uploads?merge=true", "", "", answer, error))
+            return 1;
+        Document document;
+        if (answer.code != 201 || document.Parse(answer.body.c_str()).HasParseError()
+            || !document.IsObject() || !document.HasMember("upload") || !document["upload"].IsUint64())
+        {
+            error = answer.body;
+            return 1;
+        }
+        string resource = "/snapshot/uploads/" + to_string(document["upload"].GetUint64());
+
+        for (size_t offset = 0; offset < snapshot.size(); offset += snapshotPartBytes)
+        {
+            size_t size = min(snapshotPartBytes, snapshot.size() - offset);
+            bool last = offset + size == snapshot.size();
+            int failed = peers->Send(address, "PUT", resource, "application/octet-stream",
+                                     string_view(snapshot).substr(offset, size), answer, error);
+            if (!failed && answer.code != (last ? 200 : 202))
+            {
+                error = answer.body;
+                failed = 1;
+            }
+            if (failed)
+            {
+                // Nothing is loaded without the last part, the upload is
+                // given up.
+                string ignored;
+                peers->Send(address, "DELETE", resource, "", "", answer, ignored);
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    ///
+    /// @brief POST request function which reloads the pots configuration,
+    /// as SIGHUP does, in the background: GET /admin/reload tells how it
+    /// went.
+    ///
+    /// @returns 202 once the reload started, 409 if one is running.
+    ///
+    void SmartPotEndpoint::postReload(const Rest::Request &request,
+                                      Http::ResponseWriter response)
+    {
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2")
+            .add<Header::ContentType>(MIME(Text, Plain));
+
+        if (!reloadInBackground())
+        {
+            response.send(Http::Code::Conflict, "A reload is already running");
+            return;
+        }
+        response.send(Http::Code::Accepted, "Reloading");
+    }
+
+    ///
+    /// @brief GET request function which tells whether a reload is running
+    /// and how the latest one went.
+    ///
+    void SmartPotEndpoint::getReload(const Rest::Request &request,
+                                     Http::ResponseWriter response)
+    {
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2")
+            .add<Header::ContentType>(MIME(Application, Json));
+
+        StringBuffer buffer;
+        Writer<StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("running");  writer.Bool(reloadRunning);
+        {
+            Guard guard(reloadStatusLock);
+            writer.Key("failed");   writer.Bool(reloadFailed != 0);
+            writer.Key("message");  writer.String(reloadMessage.c_str());
+        }
+        writer.EndObject();
+
+        response.send(Http::Code::Ok, buffer.GetString());
+    }
+
+    ///
+    /// @brief Stops the trace capture once its seconds are over, called by
+    /// the scheduler tick and when the trace is collected.
+    ///
+    void SmartPotEndpoint::finishTrace(void)
+    {
+        Guard guard(traceLock);
+        if (traceRunning && chrono::steady_clock::now() >= traceEnd)
+        {
+            Trace::Stop(traceCapture);
+            traceRunning = false;
+        }
+    }
+
+    ///
+    /// @brief POST request function which starts recording the trace spans
+    /// of every thread for ?seconds= (1 by default, 10 at most), collected
+    /// afterwards with GET /admin/trace/:traceId.
+    ///
+    /// @returns 202 with the id of the trace, 409 if one is being captured.
+    ///
+    void SmartPotEndpoint::postTrace(const Rest::Request &request,
+                                     Http::ResponseWriter response)
+    {
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2");
+#ifdef SMARTPOT_TRACE
+        int seconds = defaultTraceSeconds;
+        auto secondsParam = request.query().get("seconds");
+        if (secondsParam)
+        {
+            char *end;
+            long value = strtol(secondsParam->c_str(), &end, 10);
+            if (*end != '\0' || end == secondsParam->c_str() || value < 1 || value > maxTraceSeconds)
+            {
+                response.send(Http::Code::Unprocessable_Entity,
+                              "seconds shall be between 1 and " + to_string(maxTraceSeconds));
+                return;
+            }
+            seconds = (int) value;
+        }
+
+        uint64_t id;
+        {
+            Guard guard(traceLock);
+            if (Trace::Start(traceCapture))
+            {
+                response.send(Http::Code::Conflict, "A trace is already being captured");
+                return;
+            }
+            traceRunning = true;
+            traceEnd = chrono::steady_clock::now() + chrono::seconds(seconds);
+            id = ++traceId;
+        }
+        response.headers().add<Header::ContentType>(MIME(Application, Json));
+        response.send(Http::Code::Accepted, "{\"trace\":" + to_string(id) + "}");
+#else
+        response.send(Http::Code::Not_Implemented, "The server was built without SMARTPOT_TRACE");
+#endif
+    }
+
+    ///
+    /// @brief GET request function which returns the trace :traceId as
+    /// Chrome trace events once captured. Only the latest trace is kept.
+    ///
+    /// @returns 202 while the trace is being captured, 404 for another
+    /// trace.
+    ///
+    void SmartPotEndpoint::getTrace(const Rest::Request &request,
+                                    Http::ResponseWriter response)
+    {
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2");
+#ifdef SMARTPOT_TRACE
+        uint64_t id = strtoull(request.param(":traceId").as<string>().c_str(), nullptr, 10);
+        finishTrace();
+
+        StringBuffer buffer;
+        Writer<StringBuffer> writer(buffer);
+        {
+            Guard guard(traceLock);
+            if (id == 0 || id != traceId)
+            {
+                response.send(Http::Code::Not_Found, "The trace was not found");
+                return;
+            }
+            if (traceRunning)
+            {
+                response.send(Http::Code::Accepted, "The trace is being captured");
+                return;
+            }
+
+            // Complete events ("X"), in microseconds from the start.
+            writer.StartObject();
+            writer.Key("traceEvents");
+            writer.StartArray();
+            for (const Trace::Event &event : traceCapture.events)
+            {
+                writer.StartObject();
+                writer.Key("name"); writer.String(event.name);
+                writer.Key("ph");   writer.String("X");
+                writer.Key("ts");   writer.Double(traceCapture.Microseconds(event.start));
+                writer.Key("dur");  writer.Double(traceCapture.Microseconds(event.end) - traceCapture.Microseconds(event.start));
+                writer.Key("pid");  writer.Int(1);
+                writer.Key("tid");  writer.Uint(event.thread);
+                writer.EndObject();
+            }
+            writer.EndArray();
+            writer.Key("displayTimeUnit"); writer.String("ns");
+            writer.EndObject();
+        }
+
+        response.headers().add<Header::ContentType>(MIME(Application, Json));
+        response.send(Http::Code::Ok, buffer.GetString());
+#else
+        response.send(Http::Code::Not_Implemented, "The server was built without SMARTPOT_TRACE");
+#endif
+    }
+
+    ///
+    /// @brief GET request function which returns this instance, the
+    /// instances of its cluster and the number of pots it serves, and with
+    /// a ?pot= the instance owning that pot.
+    ///
+    void SmartPotEndpoint::getCluster(const Rest::Request &request,
+                                      Http::ResponseWriter response)
+    {
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2")
+            .add<Header::ContentType>(MIME(Application, Json));
+
+        shared_ptr<const Cluster> current = atomic_load(&cluster);
+        size_t pots;
+        {
+            Guard guard(potLock);
+            pots = fleet->Size();
+        }
+
+        StringBuffer buffer;
+        Writer<StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("self");         writer.String(current->Self().c_str());
+        writer.Key("nodes");
+        writer.StartArray();
+        for (const string &node : current->Ring().Nodes())
+            writer.String(node.c_str());
+        writer.EndArray();
+        writer.Key("virtualNodes"); writer.Int(current->Ring().VirtualNodes());
+        writer.Key("pots");         writer.Uint64(pots);
+        auto potParam = request.query().get("pot");
+        if (potParam)
+        {
+            int potId = atoi(potParam->c_str());
+            writer.Key("pot");      writer.Int(potId);
+            writer.Key("owner");    writer.String(current->Owner(potId).c_str());
+        }
+        writer.EndObject();
+
+        response.send(Http::Code::Ok, buffer.GetString());
+    }
+
+    ///
+    /// @brief GET request function which tells how many pots are in memory
+    /// and in the cold store, how often the pots used were in memory and
+    /// how long reading the others back took.
+    ///
+    void SmartPotEndpoint::getMemory(const Rest::Request &request,
+                                     Http::ResponseWriter response)
+    {
+        using namespace Http;
+        response.headers()
+            .add<Header::Server>("pistache/0.2")
+            .add<Header::ContentType>(MIME(Application, Json));
+
+        StringBuffer buffer;
+        Writer<StringBuffer> writer(buffer);
+        {
+            Guard guard(potLock);
+            const Fleet::TierStats &stats = fleet->Tiering();
+            uint64_t uses = stats.hits + stats.faults;
+            writer.StartObject();
+            writer.Key("hotPots");       writer.Uint64(fleet->HotPots());
+            writer.Key("coldPots");      writer.Uint64(fleet->ColdPots());
+            writer.Key("declaredPots");  writer.Uint64(fleet->Pending());
+            writer.Key("hotBytes");      writer.Uint64(fleet->HotBytes());
+            writer.Key("budgetBytes");   writer.Uint64(fleet->GetMemoryBudget());
+            writer.Key("storeBytes");    writer.Uint64(fleet->Store().Size());
+            writer.Key("hits");          writer.Uint64(stats.hits);
+            writer.Key("faults");        writer.Uint64(stats.faults);
+            writer.Key("hitRate");       writer.Double(uses > 0 ? (double) stats.hits / uses : 1);
+            writer.Key("evictions");     writer.Uint64(stats.evictions);
+            writer.Key("faultMeanUs");
+            writer.Double(stats.faults > 0 ? (double) stats.faultNanoseconds / stats.faults / 1000 : 0);
+            writer.Key("faultMaxUs");    writer.Double((double) stats.maxFaultNanoseconds / 1000);
+        }
+        writer.Key("residentBytes"); writer.Uint64(residentBytes());
+        writer.EndObject();
+
+        response.send(Http::Code::Ok, buffer.GetString());
+    }
+
+    void SmartPotEndpoint::mosquittoOnMessage (struct mosquitto *mosq,
+                                                void *obj,
+                                                const struct mosquitto_message *msg)
+    {   
+        TRACE_SPAN(span, "mqtt.message");
+        if (capture.IsOpen())
+        {
+            int64_t time = chrono::duration_cast<chrono::nanoseconds>(
+                chrono::system_clock::now().time_since_epoch()).count();
+            capture.Write(msg->topic, (const char *) msg->payload, msg->payloadlen, time);
+        }
+
+        // Every instance of a cluster gets the messages of every pot, and
+        // only applies those of its own.
+        int potId = MqttIngest::PotIdFromTopic(msg->topic, defaultPotId);
+        if (potId >= 0 && !atomic_load(&cluster)->Owns(potId))
+            return;
+
+        int64_t now = chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+
+        // Only touched by the MQTT thread, reusing them saves allocations.
+        static MqttIngest::Reading reading;
+        static string message;
+        static vector<Fleet::Anomaly> anomalies;
+        if (ingest->Receive(msg->topic, (const char *) msg->payload, msg->payloadlen, now, defaultPotId,
+                            *limiter, potLock, reading, message, anomalies) != MqttIngest::applied)
+        {
+            return ;
+        }
+
+        TRACE_SPAN(publish, "mqtt.publish");
+        mosquitto_publish(mosq, NULL, "test/response", message.size(), message.c_str(), 0, false);
+        publishAnomalies(mosq, anomalies);
+    }
+
+    void SmartPotEndpoint::publishAnomalies (struct mosquitto *mosq,
+                                             const vector<Fleet::Anomaly> &anomalies)
+    {
+        for (const Fleet::Anomaly &anomaly : anomalies)
+        {
+            StringBuffer buffer;
+            Writer<StringBuffer> writer(buffer);
+            writer.StartObject();
+            writer.Key("sensor");  writer.String(anomaly.sensor.c_str(), (SizeType) anomaly.sensor.size());
+            writer.Key("anomaly"); writer.String(AnomalyDetector::Name(anomaly.kinds));
+            writer.Key("value");   writer.Double(anomaly.value);
+            writer.Key("mean");    writer.Double(anomaly.mean);
+            writer.Key("zScore");  writer.Double(anomaly.zScore);
+            writer.Key("rate");    writer.Double(anomaly.rate);
+            writer.EndObject();
+
+            string topic = "pots/" + to_string(anomaly.potId) + "/anomaly";
+            mosquitto_publish(mosq, NULL, topic.c_str(), buffer.GetSize(), buffer.GetString(), 0, false);
+        }
     }
     
     void SmartPotEndpoint::mosquittoOnConnect (struct mosquitto *mosq,
                                                void *obj,
                                                int rc)
     {
-	    std::cout << string("MQTT Client ID: ") + to_string(* (int *) obj) << endl;
+        // The client is created without user data.
+        if (obj != nullptr)
+	        std::cout << string("MQTT Client ID: ") + to_string(* (int *) obj) << endl;
 
         if(rc)
         {
             std::cout << string("Error with result code: ") +  to_string(rc) << endl;
         }
 
-        // Subscribe to our "endpoint" topics.
+        // Subscribe to our "endpoint" topics, "test" for the default pot
+        // and "pots/<potId>" for every pot of the fleet.
         mosquitto_subscribe(mosq, NULL, "test", 0);
+        mosquitto_subscribe(mosq, NULL, "pots/+", 0);
     }   
 
     // void SmartPotEndpoint::mosquittoOnSubscribe (struct mosquitto *mosq,
@@ -466,16 +2435,13 @@ namespace pot
     //     cout<<"Subscribed to topic: " <<endl;
     // }
 
-    map <int, string> SmartPotEndpoint::sensorNameMap = {
-            {1, "ground"},
-            {2, "temperature"},
-            {3, "luminosity"},
-            {4, "humidity"},
-            {5, "fertiliser"},
-            {6, "soilPh"},
-            {7, "soilHumidity"},
-            {8, "soilType"}
-    };
-
-    SmartPot*  SmartPotEndpoint::smartPot;
+    Fleet*  SmartPotEndpoint::fleet;
+    MqttIngest*  SmartPotEndpoint::ingest;
+    RateLimiter*  SmartPotEndpoint::limiter;
+    MqttCapture  SmartPotEndpoint::capture;
+    shared_ptr<const PotConfig>  SmartPotEndpoint::config;
+    shared_ptr<const Cluster>  SmartPotEndpoint::cluster;
+    PeerClient*  SmartPotEndpoint::peers;
+    QueryCache  SmartPotEndpoint::queries;
+    Lock  SmartPotEndpoint::potLock;
 }
\ No newline at end of file
@@ -0,0 +1 @@
+#include "Snapshot.hpp"
\ No newline at end of file
@@ -0,0 +1 @@
+#include "SoilIndex.hpp"
\ No newline at end of file
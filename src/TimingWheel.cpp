@@ -0,0 +1 @@
+#include "TimingWheel.hpp"
\ No newline at end of file
@@ -0,0 +1 @@
+#include "Trace.hpp"
\ No newline at end of file
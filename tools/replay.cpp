@@ -0,0 +1,287 @@
+///
+/// @file replay.cpp
+///
+/// @brief Feeds a MQTT capture (see MqttCapture.hpp, recorded with the
+/// fourth argument of the server) back into the ingest of a fleet, without
+/// a broker, at the speed of the capture, N times faster or as fast as
+/// possible.
+///
+/// The messages go through MqttIngest::Receive as in the server, and the
+/// fleet, the rate limiter and the ticks of the server (applying the
+/// readings kept under overload, the staleness) follow the times of the
+/// capture rather than the clock. Replaying a capture gives the same fleet
+/// whatever the speed: the checksum printed at the end only changes when
+/// the ingest does.
+///
+/// The latency of a message is counted from the time it is due, so it
+/// includes the wait for the previous messages (and the wake up of the
+/// replay below full speed), the service time from the time it is
+/// handled.
+///
+///     replay <capture> [--config <path>] [--speed <N> | --speed max]
+///
+#include "MqttCapture.hpp"
+#include "MqttIngest.hpp"
+#include "PotConfig.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace pot;
+
+namespace
+{
+    // The settings of SmartPotEndpoint.cpp.
+    const int defaultPotId = 0;
+    const int64_t staleSensorTtl = 600;
+    const double ingestPotRate = 10;
+    const double ingestPotBurst = 50;
+    const double ingestGlobalRate = 20000;
+    const double ingestGlobalBurst = 20000;
+    const size_t hydratePotsPerTick = 4096;
+
+    const int64_t nanosecondsPerSecond = 1000000000;
+
+    struct Options
+    {
+        string capturePath;
+        string configPath;
+        // 0 for as fast as possible.
+        double speed = 0;
+    };
+
+    int ParseOptions(int argc, char *argv[], Options &options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            if (strcmp(argv[i], "--config") == 0 && i + 1 < argc)
+            {
+                options.configPath = argv[++i];
+            }
+            else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc)
+            {
+                ++i;
+                if (strcmp(argv[i], "max") == 0)
+                {
+                    options.speed = 0;
+                    continue;
+                }
+                char *end;
+                options.speed = strtod(argv[i], &end);
+                if (*end != '\0' || !(options.speed > 0))
+                    return 1;
+            }
+            else if (argv[i][0] != '-' && options.capturePath.empty())
+            {
+                options.capturePath = argv[i];
+            }
+            else
+            {
+                return 1;
+            }
+        }
+        return options.capturePath.empty() ? 1 : 0;
+    }
+
+    uint64_t Fnv(uint64_t hash, const void *data, size_t size)
+    {
+        const unsigned char *bytes = (const unsigned char *) data;
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    uint64_t Fnv(uint64_t hash, const string &value)
+    {
+        // The length keeps "ab","c" apart from "a","bc".
+        uint64_t size = value.size();
+        hash = Fnv(hash, &size, sizeof(size));
+        return Fnv(hash, value.data(), value.size());
+    }
+
+    template<typename T>
+    uint64_t FnvValue(uint64_t hash, T value)
+    {
+        return Fnv(hash, &value, sizeof(value));
+    }
+
+    ///
+    /// @brief Hashes the plants and sensors of every pot in pot id order,
+    /// building the declared pots.
+    ///
+    uint64_t Checksum(Fleet &fleet)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        fleet.ForEachFrom(0, SIZE_MAX, [&hash](int potId, const SmartPot &pot)
+        {
+            hash = FnvValue(hash, potId);
+            hash = Fnv(hash, pot.GetPlant().GetName());
+            hash = Fnv(hash, pot.GetPlant().GetType());
+            for (auto it = pot.GetSensors().begin(); it != pot.GetSensors().end(); ++it)
+            {
+                for (auto it2 = (it->second).begin(); it2 != (it->second).end(); ++it2)
+                {
+                    const Sensor &sensor = it2->second;
+                    hash = Fnv(hash, it2->first);
+                    hash = FnvValue(hash, sensor.GetDoubleValue());
+                    hash = Fnv(hash, sensor.GetStringValue());
+                    hash = FnvValue(hash, sensor.GetMinValue());
+                    hash = FnvValue(hash, sensor.GetMaxValue());
+                    hash = FnvValue(hash, sensor.GetLastSeen());
+                    hash = FnvValue(hash, sensor.IsStale());
+                    hash = FnvValue(hash, sensor.GetDetector().Kinds());
+                }
+            }
+        });
+        return hash;
+    }
+
+    // The latency under which @p fraction of the messages were handled.
+    double Percentile(vector<int64_t> &latencies, double fraction)
+    {
+        if (latencies.empty())
+            return 0;
+        size_t index = min(latencies.size() - 1, (size_t) (fraction * (double) latencies.size()));
+        nth_element(latencies.begin(), latencies.begin() + index, latencies.end());
+        return (double) latencies[index] / 1000;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (ParseOptions(argc, argv, options))
+    {
+        std::cerr << "Usage: " << argv[0] << " <capture> [--config <path>] [--speed <N> | --speed max]" << std::endl;
+        return 1;
+    }
+
+    MqttCaptureReader reader;
+    if (reader.Load(options.capturePath))
+    {
+        std::cerr << reader.Error() << std::endl;
+        return 1;
+    }
+    MqttCaptureReader::Message message;
+    int next = reader.Next(message);
+    if (next <= 0)
+    {
+        std::cerr << (next < 0 ? reader.Error() : "The capture is empty") << std::endl;
+        return 1;
+    }
+    int64_t firstTime = message.time;
+
+    // The fleet of the server, with its clock at the start of the capture.
+    shared_ptr<PotConfig> config = make_shared<PotConfig>();
+    config->LoadJson(PotConfig::defaults);
+    if (!options.configPath.empty() && config->Load(options.configPath))
+    {
+        std::cerr << "Could not load the pots configuration: " << config->Error() << std::endl;
+        return 1;
+    }
+    int64_t second = firstTime / nanosecondsPerSecond;
+    Fleet fleet(second);
+    fleet.SetStaleTtl(staleSensorTtl);
+    fleet.SetHydrator([config](int potId) { return config->Build(potId); });
+    for (int potId : config->PotIds())
+        fleet.Declare(potId);
+    MqttIngest ingest(fleet, shared_ptr<const map<int, string>>(config, &config->SensorTypes()));
+    RateLimiter limiter(ingestPotRate, ingestPotBurst, ingestGlobalRate, ingestGlobalBurst);
+    mutex lock;
+
+    MqttIngest::Reading reading;
+    string reply;
+    vector<Fleet::Anomaly> anomalies;
+    uint64_t outcomes[MqttIngest::applied + 1] = {};
+    uint64_t anomalyCount = 0;
+    // From the time a message is due, and from the time it is handled.
+    vector<int64_t> latencies;
+    vector<int64_t> serviceTimes;
+
+    auto start = chrono::steady_clock::now();
+    do
+    {
+        // The messages are due at their time in the capture, over the
+        // speed, and take as long as they wait for the previous ones.
+        auto due = start;
+        if (options.speed > 0)
+        {
+            due += chrono::nanoseconds((int64_t) ((double) (message.time - firstTime) / options.speed));
+            this_thread::sleep_until(due);
+        }
+        else
+        {
+            due = chrono::steady_clock::now();
+        }
+
+        // The ticks of the server which came before the message.
+        int64_t messageSecond = message.time / nanosecondsPerSecond;
+        if (messageSecond > second)
+        {
+            lock_guard<mutex> guard(lock);
+            ingest.Flush();
+            fleet.ExpireStale(messageSecond);
+            fleet.HydrateSome(hydratePotsPerTick * (size_t) (messageSecond - second));
+            fleet.TakeAnomalies(anomalies);
+            anomalyCount += anomalies.size();
+            second = messageSecond;
+        }
+
+        auto handled = chrono::steady_clock::now();
+        MqttIngest::Outcome outcome = ingest.Receive(message.topic->c_str(), message.payload.data(),
+                                                     message.payload.size(), message.time, defaultPotId,
+                                                     limiter, lock, reading, reply, anomalies);
+        outcomes[outcome]++;
+        if (outcome == MqttIngest::applied)
+            anomalyCount += anomalies.size();
+        auto done = chrono::steady_clock::now();
+        latencies.push_back(chrono::duration_cast<chrono::nanoseconds>(done - due).count());
+        serviceTimes.push_back(chrono::duration_cast<chrono::nanoseconds>(done - handled).count());
+    }
+    while ((next = reader.Next(message)) > 0);
+
+    // The last tick applies what was kept under overload.
+    {
+        lock_guard<mutex> guard(lock);
+        ingest.Flush();
+        fleet.TakeAnomalies(anomalies);
+        anomalyCount += anomalies.size();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (next < 0)
+        std::cerr << "The capture is cut short: " << reader.Error() << std::endl;
+
+    size_t messages = latencies.size();
+    printf("messages      %zu over %.3f s of capture\n", messages,
+           (double) (message.time - firstTime) / nanosecondsPerSecond);
+    printf("applied       %llu, coalesced %llu, dropped %llu, invalid %llu, unknown pot %llu, ignored %llu\n",
+           (unsigned long long) outcomes[MqttIngest::applied],
+           (unsigned long long) outcomes[MqttIngest::coalesced],
+           (unsigned long long) outcomes[MqttIngest::dropped],
+           (unsigned long long) outcomes[MqttIngest::invalid],
+           (unsigned long long) outcomes[MqttIngest::unknownPot],
+           (unsigned long long) outcomes[MqttIngest::ignored]);
+    printf("anomalies     %llu\n", (unsigned long long) anomalyCount);
+    printf("replayed in   %.3f s, %.0f messages/s\n", seconds, (double) messages / seconds);
+    printf("latency (us)  p50 %.2f, p99 %.2f, p99.9 %.2f, max %.2f\n",
+           Percentile(latencies, 0.5), Percentile(latencies, 0.99),
+           Percentile(latencies, 0.999), Percentile(latencies, 1));
+    printf("service (us)  p50 %.2f, p99 %.2f, p99.9 %.2f, max %.2f\n",
+           Percentile(serviceTimes, 0.5), Percentile(serviceTimes, 0.99),
+           Percentile(serviceTimes, 0.999), Percentile(serviceTimes, 1));
+    printf("checksum      %016llx\n", (unsigned long long) Checksum(fleet));
+    return next < 0 ? 1 : 0;
+}